@@ -1,13 +1,49 @@
 ﻿using System;
 using System.Collections.Generic;
 using System.Linq;
+using System.Runtime.InteropServices;
 using Autodesk.DesignScript.Interfaces;
+using DynamoUtilities;
 
 namespace Dynamo.DSEngine
 {
-    public class RenderPackage: IRenderPackage, IDisposable
+    /// <summary>
+    /// Unmanaged view of a RenderPackage, this must be kept in sync with
+    /// "NativeRenderPackageData" in Bloodstone.Cpp's "Interfaces.h". All
+    /// the pointers refer to memory following this header in the same block.
+    /// </summary>
+    [StructLayout(LayoutKind.Sequential)]
+    internal struct NativeRenderPackageData
     {
+        public const uint PackageSignature = 0x4b505244; // "DRPK"
+
+        public uint Signature;
+        public uint StructSize;
+
+        public int PointVertexCount;
+        public IntPtr PointVertices;
+        public IntPtr PointColors;
+
+        public int LineStripVertexCount;
+        public int LineStripCount;
+        public IntPtr LineStripVertices;
+        public IntPtr LineStripColors;
+        public IntPtr LineStripVertexCounts;
+
+        public int TriangleVertexCount;
+        public IntPtr TriangleVertices;
+        public IntPtr TriangleNormals;
+        public IntPtr TriangleColors;
+    }
+
+    public class RenderPackage: IRenderPackage, INativeMemoryOwner, IDisposable
+    {
+        private readonly object syncRoot = new object();
         private IntPtr nativeRenderPackage;
+        private int nativeRenderPackageBytes;
+        private bool nativeRenderPackageDirty = true;
+        private bool disposed = false;
+        private int[] nativeRenderPackageCounts = new int[8];
 
         private bool disableClearData = false;
         private List<double> lineStripVertices = new List<double>();
@@ -28,49 +64,49 @@ public class RenderPackage: IRenderPackage, IDisposable
         public List<double> LineStripVertices
         {
             get { return lineStripVertices;}
-            set { lineStripVertices = value; }
+            set { lineStripVertices = value; nativeRenderPackageDirty = true; }
         }
 
         public List<double> PointVertices
         {
             get { return pointVertices; }
-            set { pointVertices = value; }
+            set { pointVertices = value; nativeRenderPackageDirty = true; }
         }
 
         public List<double> TriangleVertices
         {
             get { return triangleVertices; }
-            set { triangleVertices = value; }
+            set { triangleVertices = value; nativeRenderPackageDirty = true; }
         }
 
         public List<double> TriangleNormals
         {
             get { return triangleNormals; }
-            set { triangleNormals = value; }
+            set { triangleNormals = value; nativeRenderPackageDirty = true; }
         }
 
         public List<byte> LineStripVertexColors
         {
             get { return lineStripVertexColors; }
-            set { lineStripVertexColors = value; }
+            set { lineStripVertexColors = value; nativeRenderPackageDirty = true; }
         }
 
         public List<int> LineStripVertexCounts
         {
             get { return lineStripVertexCounts; }
-            set { lineStripVertexCounts = value; }
+            set { lineStripVertexCounts = value; nativeRenderPackageDirty = true; }
         }
 
         public List<byte> PointVertexColors
         {
             get { return pointVertexColors; }
-            set { pointVertexColors = value; }
+            set { pointVertexColors = value; nativeRenderPackageDirty = true; }
         }
 
         public List<byte> TriangleVertexColors
         {
             get { return triangleVertexColor; }
-            set { triangleVertexColor = value; }
+            set { triangleVertexColor = value; nativeRenderPackageDirty = true; }
         }
 
         /// <summary>
@@ -104,6 +140,8 @@ public void Clear()
             if (disableClearData)
                 return;
 
+            nativeRenderPackageDirty = true;
+
             lineStripVertices.Clear();
             lineStripVertexColors.Clear();
             lineStripVertexCounts.Clear();
@@ -116,16 +154,42 @@ public void Clear()
             ItemsCount = 0;
         }
 
+        /// <summary>
+        /// Lock held by readers of NativeRenderPackage (see INativeMemoryOwner).
+        /// </summary>
+        public object SyncRoot
+        {
+            get { return syncRoot; }
+        }
+
+        /// <summary>
+        /// A snapshot of this package in unmanaged memory (see the type
+        /// NativeRenderPackageData), so that native consumers like Bloodstone
+        /// can read contiguous arrays instead of indexing into the lists one
+        /// element at a time. The snapshot is only rebuilt when the package
+        /// content changes, and it stays valid until the next change. Readers
+        /// hold a lock on SyncRoot while they read from the snapshot, it is
+        /// neither rebuilt nor released in the meantime. A package that has
+        /// been disposed of has no snapshot (IntPtr.Zero).
+        /// </summary>
         public IntPtr NativeRenderPackage
         {
             get 
             {
-                return nativeRenderPackage;
+                lock (syncRoot)
+                {
+                    if (disposed)
+                        return IntPtr.Zero;
+
+                    UpdateNativeRenderPackage();
+                    return nativeRenderPackage;
+                }
             }
         }
 
         public void PushLineStripVertex(double x, double y, double z)
         {
+            nativeRenderPackageDirty = true;
             lineStripVertices.Add(x);
             lineStripVertices.Add(y);
             lineStripVertices.Add(z);
@@ -133,6 +197,7 @@ public void PushLineStripVertex(double x, double y, double z)
 
         public void PushLineStripVertexColor(byte red, byte green, byte blue, byte alpha)
         {
+            nativeRenderPackageDirty = true;
             lineStripVertexColors.Add(red);
             lineStripVertexColors.Add(green);
             lineStripVertexColors.Add(blue);
@@ -141,11 +206,13 @@ public void PushLineStripVertexColor(byte red, byte green, byte blue, byte alpha
 
         public void PushLineStripVertexCount(int n)
         {
+            nativeRenderPackageDirty = true;
             lineStripVertexCounts.Add(n);
         }
 
         public void PushPointVertex(double x, double y, double z)
         {
+            nativeRenderPackageDirty = true;
             pointVertices.Add(x);
             pointVertices.Add(y);
             pointVertices.Add(z);
@@ -153,6 +220,7 @@ public void PushPointVertex(double x, double y, double z)
 
         public void PushPointVertexColor(byte red, byte green, byte blue, byte alpha)
         {
+            nativeRenderPackageDirty = true;
             pointVertexColors.Add(red);
             pointVertexColors.Add(green);
             pointVertexColors.Add(blue);
@@ -161,6 +229,7 @@ public void PushPointVertexColor(byte red, byte green, byte blue, byte alpha)
 
         public void PushTriangleVertex(double x, double y, double z)
         {
+            nativeRenderPackageDirty = true;
             triangleVertices.Add(x);
             triangleVertices.Add(y);
             triangleVertices.Add(z);
@@ -168,6 +237,7 @@ public void PushTriangleVertex(double x, double y, double z)
 
         public void PushTriangleVertexColor(byte red, byte green, byte blue, byte alpha)
         {
+            nativeRenderPackageDirty = true;
             triangleVertexColor.Add(red);
             triangleVertexColor.Add(green);
             triangleVertexColor.Add(blue);
@@ -176,6 +246,7 @@ public void PushTriangleVertexColor(byte red, byte green, byte blue, byte alpha)
 
         public void PushTriangleVertexNormal(double x, double y, double z)
         {
+            nativeRenderPackageDirty = true;
             triangleNormals.Add(x);
             triangleNormals.Add(y);
             triangleNormals.Add(z);
@@ -236,11 +307,160 @@ public void PushTriangleVertexNormal(double x, double y, double z)
         public void Dispose()
         {
             //DesignScriptStudio.Renderer.RenderPackageUtils.DestroyNativeRenderPackage(nativeRenderPackage);
+            lock (syncRoot)
+            {
+                disposed = true;
+                ReleaseNativeRenderPackage();
+            }
+
+            GC.SuppressFinalize(this);
+        }
+
+        ~RenderPackage()
+        {
+            ReleaseNativeRenderPackage();
         }
 
         public bool IsNotEmpty()
         {
             return lineStripVertices.Any() || pointVertices.Any() || triangleVertices.Any();
         }
+
+        #region Native render package
+
+        private void UpdateNativeRenderPackage()
+        {
+            // The lists are publicly exposed and may be modified without going 
+            // through the "Push" methods, so their sizes are compared as well.
+            var counts = new[]
+            {
+                pointVertices.Count, pointVertexColors.Count,
+                lineStripVertices.Count, lineStripVertexColors.Count,
+                lineStripVertexCounts.Count, triangleVertices.Count,
+                triangleNormals.Count, triangleVertexColor.Count
+            };
+
+            if (!nativeRenderPackageDirty && nativeRenderPackage != IntPtr.Zero)
+            {
+                if (counts.SequenceEqual(nativeRenderPackageCounts))
+                    return; // Snapshot is still up-to-date.
+            }
+
+            int pointCount = pointVertices.Count / 3;
+            int lineStripCount = lineStripVertices.Count / 3;
+            int triangleCount = triangleVertices.Count / 3;
+            bool hasTriangleNormals = triangleNormals.Count == triangleCount * 3;
+
+            int headerBytes = Align(Marshal.SizeOf(typeof(NativeRenderPackageData)));
+            int totalBytes = headerBytes +
+                Align(pointCount * 3 * sizeof(float)) +
+                Align(pointCount * 4) +
+                Align(lineStripCount * 3 * sizeof(float)) +
+                Align(lineStripCount * 4) +
+                Align(lineStripVertexCounts.Count * sizeof(int)) +
+                Align(triangleCount * 3 * sizeof(float)) * 2 +
+                Align(triangleCount * 4);
+
+            if (totalBytes > nativeRenderPackageBytes)
+            {
+                // Snapshots of large packages run into megabytes, which the 
+                // garbage collector would otherwise not know this object holds.
+                ReleaseNativeRenderPackage();
+                nativeRenderPackage = Marshal.AllocHGlobal(totalBytes);
+                nativeRenderPackageBytes = totalBytes;
+                GC.AddMemoryPressure(totalBytes);
+            }
+
+            var offset = headerBytes;
+            var data = new NativeRenderPackageData
+            {
+                Signature = NativeRenderPackageData.PackageSignature,
+                StructSize = (uint)Marshal.SizeOf(typeof(NativeRenderPackageData)),
+                PointVertexCount = pointCount,
+                PointVertices = CopyVertices(pointVertices, pointCount, ref offset),
+                PointColors = CopyColors(pointVertexColors, pointCount, ref offset),
+                LineStripVertexCount = lineStripCount,
+                LineStripCount = lineStripVertexCounts.Count,
+                LineStripVertices = CopyVertices(lineStripVertices, lineStripCount, ref offset),
+                LineStripColors = CopyColors(lineStripVertexColors, lineStripCount, ref offset),
+                LineStripVertexCounts = CopyCounts(lineStripVertexCounts, ref offset),
+                TriangleVertexCount = triangleCount,
+                TriangleVertices = CopyVertices(triangleVertices, triangleCount, ref offset),
+                TriangleNormals = hasTriangleNormals ?
+                    CopyVertices(triangleNormals, triangleCount, ref offset) : IntPtr.Zero,
+                TriangleColors = CopyColors(triangleVertexColor, triangleCount, ref offset)
+            };
+
+            Marshal.StructureToPtr(data, nativeRenderPackage, false);
+            nativeRenderPackageCounts = counts;
+            nativeRenderPackageDirty = false;
+        }
+
+        // Elements are written straight into the unmanaged block, there is
+        // no intermediate managed array for them to be copied out of.
+        private unsafe IntPtr CopyVertices(List<double> source, int vertexCount, ref int offset)
+        {
+            if (vertexCount <= 0)
+                return IntPtr.Zero;
+
+            var destination = IntPtr.Add(nativeRenderPackage, offset);
+            var pFloats = (float*)destination.ToPointer();
+            var count = vertexCount * 3;
+            for (int i = 0; i < count; ++i)
+                pFloats[i] = (float)source[i];
+
+            offset += Align(count * sizeof(float));
+            return destination;
+        }
+
+        private unsafe IntPtr CopyColors(List<byte> source, int vertexCount, ref int offset)
+        {
+            // Incomplete colors are left out, native side defaults to white.
+            if (vertexCount <= 0 || source.Count != vertexCount * 4)
+                return IntPtr.Zero;
+
+            var destination = IntPtr.Add(nativeRenderPackage, offset);
+            var pBytes = (byte*)destination.ToPointer();
+            var count = source.Count;
+            for (int i = 0; i < count; ++i)
+                pBytes[i] = source[i];
+
+            offset += Align(count);
+            return destination;
+        }
+
+        private unsafe IntPtr CopyCounts(List<int> source, ref int offset)
+        {
+            if (source.Count <= 0)
+                return IntPtr.Zero;
+
+            var destination = IntPtr.Add(nativeRenderPackage, offset);
+            var pCounts = (int*)destination.ToPointer();
+            var count = source.Count;
+            for (int i = 0; i < count; ++i)
+                pCounts[i] = source[i];
+
+            offset += Align(count * sizeof(int));
+            return destination;
+        }
+
+        private void ReleaseNativeRenderPackage()
+        {
+            if (nativeRenderPackage == IntPtr.Zero)
+                return;
+
+            Marshal.FreeHGlobal(nativeRenderPackage);
+            GC.RemoveMemoryPressure(nativeRenderPackageBytes);
+            nativeRenderPackage = IntPtr.Zero;
+            nativeRenderPackageBytes = 0;
+            nativeRenderPackageDirty = true;
+        }
+
+        private static int Align(int bytes)
+        {
+            return (bytes + 15) & ~15; // Keep every array 16-byte aligned.
+        }
+
+        #endregion
     }
 }
@@ -1614,6 +1614,11 @@ public void ClearRenderPackages()
         {
             lock (RenderPackagesMutex)
             {
+                // Packages may hold snapshots in native memory, these are let
+                // go of here rather than whenever their finalizers get to run.
+                foreach (var package in RenderPackages.OfType<IDisposable>().Distinct())
+                    package.Dispose();
+
                 RenderPackages.Clear();
                 HasRenderPackages = false;
             }
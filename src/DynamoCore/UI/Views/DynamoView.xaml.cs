@@ -368,22 +368,31 @@ private void OnRequestUpdateBloodstoneVisual(object sender, UpdateBloodstoneVisu
             if (scene == null)
                 return;
 
-            scene.UpdateNodeGeometries(geometries);
+            // Geometries, modes and colors all make it into the same frame.
+            scene.BeginUpdate();
+            try
+            {
+                scene.UpdateNodeGeometries(geometries);
 
-            var renderModes = new Dictionary<string, RenderMode>();
-            var nodeColors = new Dictionary<string, Dynamo.Bloodstone.NodeColor>();
+                var renderModes = new Dictionary<string, RenderMode>();
+                var nodeColors = new Dictionary<string, Dynamo.Bloodstone.NodeColor>();
 
-            foreach (var node in dynamoViewModel.Model.Nodes)
-            {
-                var nodeId = node.GUID.ToString();
-                renderModes.Add(nodeId, node.RenderStyle);
+                foreach (var node in dynamoViewModel.Model.Nodes)
+                {
+                    var nodeId = node.GUID.ToString();
+                    renderModes.Add(nodeId, node.RenderStyle);
 
-                var c = node.NodeColor;
-                nodeColors.Add(nodeId, new NodeColor(c.R, c.G, c.B, c.A));
-            }
+                    var c = node.NodeColor;
+                    nodeColors.Add(nodeId, new NodeColor(c.R, c.G, c.B, c.A));
+                }
 
-            scene.SetNodeRenderMode(renderModes);
-            scene.SetNodeColor(nodeColors);
+                scene.SetNodeRenderMode(renderModes);
+                scene.SetNodeColor(nodeColors);
+            }
+            finally
+            {
+                scene.EndUpdate();
+            }
         }
 
         private void OnModelNodeDeleted(NodeModel node)
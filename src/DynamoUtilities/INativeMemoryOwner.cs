@@ -0,0 +1,13 @@
+﻿namespace DynamoUtilities
+{
+    /// <summary>
+    /// Implemented by objects that hand out unmanaged memory of their own
+    /// (e.g. the native snapshot of a render package). Readers hold a lock
+    /// on SyncRoot for as long as they read from that memory, which is
+    /// neither rebuilt nor released in the meantime.
+    /// </summary>
+    public interface INativeMemoryOwner
+    {
+        object SyncRoot { get; }
+    }
+}
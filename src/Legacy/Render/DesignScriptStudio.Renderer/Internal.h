@@ -248,6 +248,7 @@ namespace DesignScriptStudio { namespace Renderer {
         const std::vector<unsigned char>& GetTriangleColors(void) const;
 
     private:
+        void AlterBoundingBox(const std::vector<float>& vertices);
         void AlterBoundingBox(float x, float y, float z);
 
         PackageId mPackageId;
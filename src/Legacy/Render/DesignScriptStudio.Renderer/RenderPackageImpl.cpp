@@ -1,8 +1,10 @@
 
 #include "stdafx.h"
 #include "Internal.h"
+#include "..\..\..\Libraries\Bloodstone.Cpp\Kernels.h"
 
 using namespace DesignScriptStudio::Renderer;
+using namespace Dynamo::Bloodstone;
 
 RenderPackageImpl::RenderPackageImpl(int documentId, int packageId) : 
     mBoundingBoxComputed(false)
@@ -151,20 +153,9 @@ void RenderPackageImpl::ComputeBoundingBox(void)
     // Reset the bounding box.
     mBoundingBoxComputed = false;
 
-    const float* p = mPointVertices.data();
-    size_t floatCount = mPointVertices.size();
-    for (size_t index = 0; index < floatCount; index += 3)
-        AlterBoundingBox(p[index + 0], p[index + 1], p[index + 2]);
-
-    p = mLineStripVertices.data();
-    floatCount = mLineStripVertices.size();
-    for (size_t index = 0; index < floatCount; index += 3)
-        AlterBoundingBox(p[index + 0], p[index + 1], p[index + 2]);
-
-    p = mTriangleVertices.data();
-    floatCount = mTriangleVertices.size();
-    for (size_t index = 0; index < floatCount; index += 3)
-        AlterBoundingBox(p[index + 0], p[index + 1], p[index + 2]);
+    AlterBoundingBox(mPointVertices);
+    AlterBoundingBox(mLineStripVertices);
+    AlterBoundingBox(mTriangleVertices);
 
     if (false == mBoundingBoxComputed) {
         memset(&mBoundingBox[0], 0, sizeof(mBoundingBox));
@@ -231,6 +222,20 @@ const std::vector<unsigned char>& RenderPackageImpl::GetTriangleColors(void) con
     return mTriangleColors;
 }
 
+void RenderPackageImpl::AlterBoundingBox(const std::vector<float>& vertices)
+{
+    const size_t vertexCount = vertices.size() / 3;
+    if (vertexCount <= 0)
+        return;
+
+    // Corners of the whole stream count as two points, which is exactly
+    // what evaluating every vertex one at a time would have resulted in.
+    float minCorner[3], maxCorner[3];
+    GeometryKernels::EvaluateBounds(vertices.data(), vertexCount, minCorner, maxCorner);
+    AlterBoundingBox(minCorner[0], minCorner[1], minCorner[2]);
+    AlterBoundingBox(maxCorner[0], maxCorner[1], maxCorner[2]);
+}
+
 void RenderPackageImpl::AlterBoundingBox(float x, float y, float z)
 {
     if (false != mBoundingBoxComputed)
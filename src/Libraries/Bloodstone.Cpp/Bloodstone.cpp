@@ -4,10 +4,12 @@
 #include "stdafx.h"
 #include "Bloodstone.h"
 #include "Utilities.h"
+#include "Kernels.h"
 #include "NodeSceneData.h"
 #include "OpenGL Files\OpenInterfaces.h"
 #include "Resources\resource.h"
 
+#include <cstring>
 #include <msclr/marshal_cppstd.h>
 
 using namespace System;
@@ -20,31 +22,51 @@ using namespace DynamoUtilities;
 // Static helper methods (TODO: Move them into a utility class)
 // ================================================================================
 
-static float Normalize(unsigned char value)
+// Managed render packages hold double precision coordinates, these get
+// converted in bulk (see "GeometryKernels") rather than one at a time.
+// 
+static bool PushVertices(List<double>^ coordinates, GeometryData& data)
 {
-    const float inverse = 1.0f / 255.0f;
-    return ((float)(value * inverse));
+    auto elements = coordinates->ToArray();
+    const int vertexCount = elements->Length / 3;
+    if (vertexCount <= 0)
+        return false;
+
+    pin_ptr<double> pElements = &elements[0];
+    GeometryKernels::ConvertToFloats(pElements, data.ExtendVertices(vertexCount), vertexCount * 3);
+    return true;
 }
 
-bool GetPointGeometries(IRenderPackage^ rp, PointGeometryData& data)
+static void PushNormals(List<double>^ coordinates, TriangleGeometryData& data)
 {
-    if (rp == nullptr || (rp->PointVertices->Count <= 0))
-        return false;
+    auto elements = coordinates->ToArray();
+    const int vertexCount = elements->Length / 3;
+    if (vertexCount <= 0)
+        return;
 
-    auto pv = rp->PointVertices;
-    auto pc = rp->PointVertexColors;
-    auto count = rp->PointVertices->Count;
+    pin_ptr<double> pElements = &elements[0];
+    GeometryKernels::ConvertToFloats(pElements, data.ExtendNormals(vertexCount), vertexCount * 3);
+}
 
-    const float inv255 = 1.0f / 255.0f;
+static void PushColors(List<Byte>^ rgbaColors, GeometryData& data)
+{
+    auto elements = ((rgbaColors != nullptr) ? rgbaColors->ToArray() : nullptr);
+    if (elements == nullptr || elements->Length < 4)
+        return;
 
-    for (int p = 0, c = 0; p < count; p = p + 3, c = c + 4)
-    {
-        data.PushVertex((float) pv[p + 0], (float) pv[p + 1], (float) pv[p + 2]);
+    pin_ptr<Byte> pElements = &elements[0];
+    data.PushColors(pElements, elements->Length / 4);
+}
 
-        data.PushColor(Normalize(pc[c + 0]), Normalize(pc[c + 1]),
-            Normalize(pc[c + 2]), Normalize(pc[c + 3]));
-    }
+bool GetPointGeometries(IRenderPackage^ rp, PointGeometryData& data)
+{
+    if (rp == nullptr || (rp->PointVertices->Count <= 0))
+        return false;
 
+    if (!PushVertices(rp->PointVertices, data))
+        return false;
+
+    PushColors(rp->PointVertexColors, data);
     return true;
 }
 
@@ -53,20 +75,13 @@ bool GetLineStripGeometries(IRenderPackage^ rp, LineStripGeometryData& data)
     if (rp == nullptr || (rp->LineStripVertices->Count <= 0))
         return false;
 
-    auto lsv = rp->LineStripVertices;
-    auto lsc = rp->LineStripVertexColors;
-    auto count = rp->LineStripVertices->Count;
-
-    for (int p = 0, c = 0; p < count; p = p + 3, c = c + 4)
-    {
-        data.PushVertex((float) lsv[p + 0], (float) lsv[p + 1], (float) lsv[p + 2]);
+    if (!PushVertices(rp->LineStripVertices, data))
+        return false;
 
-        data.PushColor(Normalize(lsc[c + 0]), Normalize(lsc[c + 1]),
-            Normalize(lsc[c + 2]), Normalize(lsc[c + 3]));
-    }
+    PushColors(rp->LineStripVertexColors, data);
 
     auto lsvc = rp->LineStripVertexCounts;
-    count = rp->LineStripVertexCounts->Count;
+    auto count = rp->LineStripVertexCounts->Count;
     for (int index = 0; index < count; ++index)
         data.PushSegmentVertexCount(lsvc[index]);
 
@@ -77,24 +92,94 @@ bool GetTriangleGeometries(IRenderPackage^ rp, TriangleGeometryData& data)
 {
     if (rp == nullptr || (rp->TriangleVertices->Count <= 0))
         return false;
+    if (rp->TriangleNormals->Count != rp->TriangleVertices->Count)
+        return false; // Triangles cannot be shaded without normals.
 
-    auto tv = rp->TriangleVertices;
-    auto tn = rp->TriangleNormals;
-    auto tc = rp->TriangleVertexColors;
-    auto count = rp->TriangleVertices->Count;
+    if (!PushVertices(rp->TriangleVertices, data))
+        return false;
 
-    for (int p = 0, c = 0; p < count; p = p + 3, c = c + 4)
-    {
-        data.PushVertex((float) tv[p + 0], (float) tv[p + 1], (float) tv[p + 2]);
-        data.PushNormal((float) tn[p + 0], (float) tn[p + 1], (float) tn[p + 2]);
+    PushNormals(rp->TriangleNormals, data);
+    PushColors(rp->TriangleVertexColors, data);
+    return true;
+}
 
-        data.PushColor(Normalize(tc[c + 0]), Normalize(tc[c + 1]),
-            Normalize(tc[c + 2]), Normalize(tc[c + 3]));
+const NativeRenderPackageData* GetNativeRenderPackage(IRenderPackage^ rp)
+{
+    if (rp == nullptr)
+        return nullptr;
+
+    auto pointer = rp->NativeRenderPackage;
+    if (pointer == IntPtr::Zero)
+        return nullptr;
+
+    // Other 'IRenderPackage' implementations may hand out native objects of
+    // their own (e.g. the legacy renderer), only accept those we understand.
+    auto pPackage = ((const NativeRenderPackageData *) pointer.ToPointer());
+    if (pPackage->signature != NATIVE_RENDER_PACKAGE_SIGNATURE)
+        return nullptr;
+    if (pPackage->structSize != sizeof(NativeRenderPackageData))
+        return nullptr;
+
+    return pPackage;
+}
+
+// Native packages are only valid while locked (see "NodeGeometries"), so
+// every stream is copied into the geometry data rather than referred to.
+// 
+static void CopyVertices(const float* pCoordinates, int vertexCount, GeometryData& data)
+{
+    memcpy(data.ExtendVertices(vertexCount), pCoordinates, vertexCount * 3 * sizeof(float));
+}
+
+static void CopyColors(const unsigned char* pRgbaColors, int vertexCount, GeometryData& data)
+{
+    if (pRgbaColors != nullptr)
+        data.PushColors(pRgbaColors, vertexCount);
+}
+
+bool GetPointGeometries(const NativeRenderPackageData* pPackage, PointGeometryData& data)
+{
+    const int count = pPackage->pointVertexCount;
+    if (count <= 0 || (pPackage->pPointVertices == nullptr))
+        return false;
+
+    CopyVertices(pPackage->pPointVertices, count, data);
+    CopyColors(pPackage->pPointColors, count, data);
+    return true;
+}
+
+bool GetLineStripGeometries(const NativeRenderPackageData* pPackage, LineStripGeometryData& data)
+{
+    const int count = pPackage->lineStripVertexCount;
+    if (count <= 0 || (pPackage->pLineStripVertices == nullptr))
+        return false;
+
+    CopyVertices(pPackage->pLineStripVertices, count, data);
+    CopyColors(pPackage->pLineStripColors, count, data);
+
+    if (pPackage->pLineStripVertexCounts != nullptr) {
+        data.PushSegmentVertexCounts(pPackage->pLineStripVertexCounts,
+            pPackage->lineStripCount);
     }
 
     return true;
 }
 
+bool GetTriangleGeometries(const NativeRenderPackageData* pPackage, TriangleGeometryData& data)
+{
+    const int count = pPackage->triangleVertexCount;
+    if (count <= 0 || (pPackage->pTriangleVertices == nullptr))
+        return false;
+
+    if (pPackage->pTriangleNormals == nullptr)
+        return false; // Triangles cannot be shaded without normals.
+
+    CopyVertices(pPackage->pTriangleVertices, count, data);
+    memcpy(data.ExtendNormals(count), pPackage->pTriangleNormals, count * 3 * sizeof(float));
+    CopyColors(pPackage->pTriangleColors, count, data);
+    return true;
+}
+
 // ================================================================================
 // IGraphicsContext
 // ================================================================================
@@ -5,16 +5,33 @@
 #define BLOODSTONE_API __declspec(dllimport)
 #endif
 
+// Posted to the visualizer window by worker threads, which cannot touch
+// the window (or the visualizer) themselves. The thread that owns it then
+// requests a frame update as it handles the message.
+#define WM_BLOODSTONE_FRAME_UPDATE      (WM_APP + 1)
+
 namespace Gen = System::Collections::Generic;
 namespace Ds = Autodesk::DesignScript::Interfaces;
 
 namespace Dynamo { namespace Bloodstone {
 
+    class ICamera;
     class IGraphicsContext;
-    class IShaderProgram;
     class IVertexBuffer;
-    class GeometryData;
+    class INodeStateTable;
+    class PointGeometryData;
+    class LineStripGeometryData;
+    class TriangleGeometryData;
     class NodeSceneData;
+    template<typename NodeType> class NodeTable;
+    class NodeHierarchy;
+    struct CullingStatistics;
+    struct RenderStatistics;
+    class RenderQueue;
+    class ShaderVariants;
+    class SceneCommandQueue;
+    struct NodeKey;
+    struct NodeHandle;
     class BoundingBox;
     class BillboardTextGroup;
     ref class Scene;
@@ -108,17 +125,86 @@ namespace Dynamo { namespace Bloodstone {
         void SetNodeColor(NodeColors^ nodeColors);
         void SetNodeRenderMode(RenderModes^ renderModes);
 
+        // Changes made through the above methods are recorded and applied
+        // at the start of the next frame. Between "BeginUpdate" and the
+        // matching "EndUpdate" they are held back altogether, and the
+        // frame is requested only once the outermost "EndUpdate" is made.
+        void BeginUpdate(void);
+        void EndUpdate(void);
+
+        // Nodes tested, culled and drawn in the last frame rendered, and
+        // the draw calls and state changes it took to draw them (along
+        // with render package content and buffer heap relocation totals).
+        void GetCullingStatistics(CullingStatistics* pStatistics);
+        void GetRenderStatistics(RenderStatistics* pStatistics);
+
+        // Identifier of the node whose geometries are the nearest under a
+        // point of the viewport (in pixels from its top-left corner), or
+        // nullptr if there are none within a few pixels of it. The second
+        // method returns those of the nodes whose geometries lie entirely
+        // within a rectangle of the viewport. Changes not applied to the
+        // scene yet (see "BeginUpdate") are not taken into account.
+        System::String^ PickNode(int x, int y);
+        Strings^ PickNodes(int left, int top, int right, int bottom);
+
     private:
+        void RequestFrameUpdate(void);
+        void ApplyCommands(void);
+        void UpdateLevelsOfDetail(void);
+        void UpdateDynamicNodes(void);
+        void UpdateRenderList(void);
+        void UpdateHierarchy(void);
+        void CullRenderList(const ICamera* pCamera);
+        void LoadNodeGeometries(const std::vector<NodeKey>& nodeKeys,
+            Gen::List<System::String^>^ identifiers,
+            Gen::List<Ds::IRenderPackage^>^ renderPackages, BoundingBox& outerBoundingBox);
+        void AppendVertexBuffer(NodeSceneData* pNodeSceneData, const PointGeometryData& data);
+        void AppendVertexBuffer(NodeSceneData* pNodeSceneData, const LineStripGeometryData& data);
+        void AppendVertexBuffer(NodeSceneData* pNodeSceneData, const TriangleGeometryData& data);
+        void AppendVertexBuffer(NodeSceneData* pNodeSceneData, IVertexBuffer* pVertexBuffer);
         void RenderGeometries(const std::vector<NodeSceneData *>& geometries);
+        void WriteNodeState(const NodeSceneData* pNodeSceneData);
 
     private:
-        int mAlphaParamIndex;
-        int mColorParamIndex;
-        int mControlParamsIndex;
-        IShaderProgram* mpPhongShader;
+        ShaderVariants* mpPhongShaders; // Compiled as vertex buffers need them.
+        INodeStateTable* mpNodeStates; // Row of each node is its slot.
+        RenderQueue* mpRenderQueue; // Refilled for every frame.
         BillboardTextGroup* mpBillboardTextGroup;
 
         VisualizerWnd^ mVisualizer;
-        std::map<std::wstring, NodeSceneData*>* mpNodeSceneData;
+        NodeTable<NodeSceneData>* mpNodeTable; // Nodes and their geometries.
+
+        // Changes not yet applied, along with the packages they refer to.
+        bool mFrameUpdateRequested;
+        SceneCommandQueue* mpCommandQueue;
+        Gen::List<Ds::IRenderPackage^>^ mPendingPackages;
+        Gen::List<System::String^>^ mPendingIdentifiers; // Of each package.
+
+        // Identifier of the node in each slot, as it was first received.
+        Gen::List<System::String^>^ mNodeIdentifiers;
+
+        // Nodes in the order they are drawn, rebuilt only after nodes come
+        // and go, or change in a way that affects the order. Scene bounds
+        // grow along with geometries, and are evaluated from scratch (the
+        // next time they are asked for) once they may have shrunk.
+        bool mRenderListValid;
+        bool mSceneBoundsValid;
+        BoundingBox* mpSceneBounds;
+        std::vector<NodeSceneData *>* mpRenderList;
+        std::vector<int>* mpRenderListIndices; // Of the node in each slot.
+
+        // Of the nodes in the render list, only those in the view frustum
+        // are drawn. The hierarchy is built again when nodes come and go.
+        bool mHierarchyValid;
+        NodeHierarchy* mpHierarchy;
+        std::vector<int>* mpVisibleSlots;
+        std::vector<NodeSceneData *>* mpVisibleNodes;
+        std::vector<NodeHandle>* mpPendingDetailNodes; // Simplifying.
+        std::vector<NodeHandle>* mpDynamicNodes; // Streaming their geometries.
+
+        // Content of render packages received, and how much of it turned
+        // out to be unchanged (so neither converted nor uploaded again).
+        unsigned long long mReceivedPackageBytes;
+        unsigned long long mSkippedPackageBytes;
     };
 } }
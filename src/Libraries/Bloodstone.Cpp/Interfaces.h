@@ -7,6 +7,41 @@ namespace Dynamo { namespace Bloodstone {
     class IGraphicsContext; // Forward declaration.
     class BitmapData; // Forward declaration.
 
+    // "DRPK" in little-endian byte order.
+    #define NATIVE_RENDER_PACKAGE_SIGNATURE 0x4b505244
+
+    // This structure must be kept in sync with "NativeRenderPackageData"
+    // in "Dynamo.DSEngine.RenderPackage", which populates it in unmanaged
+    // memory and hands it out through "IRenderPackage.NativeRenderPackage".
+    // Color pointers are null when a package carries no (or incomplete)
+    // per-vertex colors, in which case vertices default to opaque white.
+    //
+    struct NativeRenderPackageData
+    {
+        unsigned int signature;
+        unsigned int structSize;
+
+        int pointVertexCount;
+        const float* pPointVertices;
+        const unsigned char* pPointColors;
+
+        int lineStripVertexCount;
+        int lineStripCount;
+        const float* pLineStripVertices;
+        const unsigned char* pLineStripColors;
+        const int* pLineStripVertexCounts;
+
+        int triangleVertexCount;
+        const float* pTriangleVertices;
+        const float* pTriangleNormals;
+        const unsigned char* pTriangleColors;
+    };
+
+    // Geometry data owns its vertex streams, which outlive the render
+    // package they are copied from (native packages are freed as soon as
+    // the node has new ones). Colors are kept as bytes and normalized only
+    // when the vertex buffer interleaves them into its final vertex format.
+    //
     class GeometryData
     {
     public:
@@ -19,7 +54,7 @@ namespace Dynamo { namespace Bloodstone {
             mCoordinates.push_back(z);
         }
 
-        void PushColor(float r, float g, float b, float a)
+        void PushColor(unsigned char r, unsigned char g, unsigned char b, unsigned char a)
         {
             mRgbaColors.push_back(r);
             mRgbaColors.push_back(g);
@@ -27,6 +62,21 @@ namespace Dynamo { namespace Bloodstone {
             mRgbaColors.push_back(a);
         }
 
+        // Grows the owned coordinates by "vertexCount" vertices and returns
+        // where they start, for bulk conversions to write into directly.
+        float* ExtendVertices(int vertexCount)
+        {
+            const auto offset = mCoordinates.size();
+            mCoordinates.resize(offset + vertexCount * 3);
+            return &mCoordinates[offset];
+        }
+
+        void PushColors(const unsigned char* pRgbaColors, int colorCount)
+        {
+            mRgbaColors.insert(mRgbaColors.end(),
+                pRgbaColors, pRgbaColors + colorCount * 4);
+        }
+
         int VertexCount(void) const
         {
             return ((int) mCoordinates.size()) / 3;
@@ -37,8 +87,19 @@ namespace Dynamo { namespace Bloodstone {
             return &mCoordinates[vertex * 3];
         }
 
-        const float* GetRgbaColors(int vertex) const
+        // Exchanges the coordinates with those of "coordinates", for what is
+        // kept of a geometry once it is uploaded (see "PickGeometry").
+        void SwapCoordinates(std::vector<float>& coordinates)
         {
+            mCoordinates.swap(coordinates);
+        }
+
+        // Returns nullptr if there is no color (vertices are then white).
+        const unsigned char* GetRgbaColors(int vertex) const
+        {
+            if (mRgbaColors.size() < ((std::size_t) VertexCount()) * 4)
+                return nullptr;
+
             return &mRgbaColors[vertex * 4];
         }
 
@@ -50,7 +111,7 @@ namespace Dynamo { namespace Bloodstone {
         }
 
         std::vector<float> mCoordinates;
-        std::vector<float> mRgbaColors;
+        std::vector<unsigned char> mRgbaColors;
     };
 
     class PointGeometryData : public GeometryData
@@ -75,6 +136,12 @@ namespace Dynamo { namespace Bloodstone {
             mSegmentVertexCount.push_back(segmentVertexCount);
         }
 
+        void PushSegmentVertexCounts(const int* pSegmentVertexCounts, int segmentCount)
+        {
+            mSegmentVertexCount.insert(mSegmentVertexCount.end(),
+                pSegmentVertexCounts, pSegmentVertexCounts + segmentCount);
+        }
+
         int GetSegmentCount(void) const
         {
             return ((int) mSegmentVertexCount.size());
@@ -85,16 +152,37 @@ namespace Dynamo { namespace Bloodstone {
             return &mSegmentVertexCount[0];
         }
 
+        void SwapSegmentVertexCounts(std::vector<int>& segmentVertexCounts)
+        {
+            mSegmentVertexCount.swap(segmentVertexCounts);
+        }
+
     private:
         std::vector<int> mSegmentVertexCount;
     };
 
+    // Consecutive triangles of an indexed mesh, bounded by a sphere. The
+    // normals of its triangles are all within "coneAngle" (in radians) of
+    // "coneAxis", an angle that is negative where the cluster cannot be
+    // told to face away from the viewer as a whole.
+    // 
+    struct MeshCluster
+    {
+        int firstIndex;
+        int indexCount;
+        float center[3];
+        float radius;
+        float coneAxis[3];
+        float coneAngle;
+    };
+
     class TriangleGeometryData : public GeometryData
     {
     public:
         TriangleGeometryData(int triangleCount) : 
             GeometryData(triangleCount * 3)
         {
+            mNormalCoords.reserve(triangleCount * 9);
         }
 
         void PushNormal(float x, float y, float z)
@@ -104,13 +192,62 @@ namespace Dynamo { namespace Bloodstone {
             mNormalCoords.push_back(z);
         }
 
+        float* ExtendNormals(int vertexCount)
+        {
+            const auto offset = mNormalCoords.size();
+            mNormalCoords.resize(offset + vertexCount * 3);
+            return &mNormalCoords[offset];
+        }
+
         const float* GetNormalCoords(int vertex) const
         {
             return &mNormalCoords[vertex * 3];
         }
 
+        // Triangles are indexed once any index is pushed (e.g. by the
+        // "MeshProcessor::Weld"), otherwise every three consecutive
+        // vertices make up a triangle.
+        // 
+        void PushIndex(unsigned int index)
+        {
+            mIndices.push_back(index);
+        }
+
+        int IndexCount(void) const
+        {
+            return ((int) mIndices.size());
+        }
+
+        const unsigned int* GetIndices(void) const
+        {
+            return (mIndices.empty() ? nullptr : &mIndices[0]);
+        }
+
+        void SwapIndices(std::vector<unsigned int>& indices)
+        {
+            mIndices.swap(indices);
+        }
+
+        // Clusters (if any) cover all indices, see "MeshProcessor::BuildClusters".
+        void SetClusters(const std::vector<MeshCluster>& clusters)
+        {
+            mClusters = clusters;
+        }
+
+        int ClusterCount(void) const
+        {
+            return ((int) mClusters.size());
+        }
+
+        const MeshCluster* GetClusters(void) const
+        {
+            return (mClusters.empty() ? nullptr : &mClusters[0]);
+        }
+
     private:
         std::vector<float> mNormalCoords;
+        std::vector<unsigned int> mIndices;
+        std::vector<MeshCluster> mClusters;
     };
 
     class ITrackBall
@@ -257,6 +394,78 @@ namespace Dynamo { namespace Bloodstone {
         bool mInitialized;
     };
 
+    // Six planes (a, b, c, d) bounding the view volume of a camera, each
+    // facing inwards, so that "ax + by + cz + d" is negative only for a
+    // point outside of it. A default one has nothing outside of it. Normals
+    // "(a, b, c)" are of unit length, so that spheres can be tested too.
+    // 
+    class Frustum
+    {
+    public:
+        enum class Containment
+        {
+            Outside, Intersecting, Inside
+        };
+
+        Frustum()
+        {
+            memset(&mPlanes[0], 0, sizeof(mPlanes));
+        }
+
+        void SetPlanes(const float* pPlanes)
+        {
+            memcpy(&mPlanes[0], pPlanes, sizeof(mPlanes));
+        }
+
+        Containment Classify(const float* pMin, const float* pMax) const
+        {
+            auto containment = Containment::Inside;
+            for (int plane = 0; plane < 6; ++plane)
+            {
+                // Corners of the box farthest along and against the normal.
+                const float* pPlane = &mPlanes[plane * 4];
+                float nearest = pPlane[3], farthest = pPlane[3];
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    const float low = pPlane[axis] * pMin[axis];
+                    const float high = pPlane[axis] * pMax[axis];
+                    nearest += ((low < high) ? low : high);
+                    farthest += ((low < high) ? high : low);
+                }
+
+                if (farthest < 0.0f)
+                    return Containment::Outside;
+                if (nearest < 0.0f)
+                    containment = Containment::Intersecting;
+            }
+
+            return containment;
+        }
+
+        bool IsOutside(const float* pCenter, float radius) const
+        {
+            for (int plane = 0; plane < 6; ++plane)
+            {
+                const float* pPlane = &mPlanes[plane * 4];
+                const float distance = (pPlane[0] * pCenter[0]) +
+                    (pPlane[1] * pCenter[1]) + (pPlane[2] * pCenter[2]) + pPlane[3];
+
+                if (distance < -radius)
+                    return true;
+            }
+
+            return false;
+        }
+
+        bool operator==(const Frustum& other) const
+        {
+            return memcmp(&mPlanes[0], &other.mPlanes[0], sizeof(mPlanes)) == 0;
+        }
+
+    private:
+        float mPlanes[24];
+    };
+
     struct CameraConfiguration
     {
         CameraConfiguration()
@@ -391,6 +600,25 @@ namespace Dynamo { namespace Bloodstone {
             return this->GetTrackBallCore();
         }
 
+        void GetFrustum(Frustum* pFrustum) const
+        {
+            this->GetFrustumCore(pFrustum);
+        }
+
+        // Ray through a point of the viewport (in pixels from its top-left
+        // corner), from where it meets the near plane along a direction of
+        // unit length, and the frustum through a rectangle of the viewport.
+        void GetPickingRay(float x, float y, float* pOrigin, float* pDirection) const
+        {
+            this->GetPickingRayCore(x, y, pOrigin, pDirection);
+        }
+
+        void GetPickingFrustum(float left, float top,
+            float right, float bottom, Frustum* pFrustum) const
+        {
+            this->GetPickingFrustumCore(left, top, right, bottom, pFrustum);
+        }
+
     protected:
         virtual void ConfigureCore(const CameraConfiguration* pConfiguration) = 0;
         virtual void BeginConfigureCore(const CameraConfiguration* pConfiguration) = 0;
@@ -399,6 +627,11 @@ namespace Dynamo { namespace Bloodstone {
         virtual bool IsInTransitionCore(void) const = 0;
         virtual void UpdateFrameCore(void) = 0;
         virtual ITrackBall* GetTrackBallCore() const = 0;
+        virtual void GetFrustumCore(Frustum* pFrustum) const = 0;
+        virtual void GetPickingRayCore(float x, float y,
+            float* pOrigin, float* pDirection) const = 0;
+        virtual void GetPickingFrustumCore(float left, float top,
+            float right, float bottom, Frustum* pFrustum) const = 0;
     };
 
     class IVertexShader
@@ -424,6 +657,18 @@ namespace Dynamo { namespace Bloodstone {
         MaxShaderName
     };
 
+    // Features a shader program is specialized for at compile time, each
+    // present one is defined (e.g. "#define LIT") ahead of the source of
+    // both its shaders. "Count" is the number of combinations.
+    // 
+    enum class ShaderFeatures
+    {
+        None        = 0x00000000,
+        Lit         = 0x00000001,   // Triangles, lit through their normals.
+        Quantized   = 0x00000002,   // See "IVertexBuffer::AttributeEncoding".
+        Count       = 0x00000004
+    };
+
     enum class TransMatrix
     {
         Model, View, Projection, Normal
@@ -471,6 +716,16 @@ namespace Dynamo { namespace Bloodstone {
             None, Point, LineStrip, Triangle
         };
 
+        // "Quantized" stores positions as 16-bit values relative to the
+        // bounding box of the buffer and normals as 2x16-bit octahedral
+        // encoded values. Positions are then accurate to half of the box
+        // extent divided by 65535 on each axis.
+        //
+        enum class AttributeEncoding
+        {
+            Full, Quantized
+        };
+
     public:
         virtual ~IVertexBuffer()
         {
@@ -481,11 +736,29 @@ namespace Dynamo { namespace Bloodstone {
             return this->GetPrimitiveTypeCore();
         }
 
-        void LoadData(const GeometryData& geometries)
+        // Features of the program the buffer is to be drawn with, known
+        // once its data is loaded.
+        ShaderFeatures GetShaderFeatures() const
+        {
+            return this->GetShaderFeaturesCore();
+        }
+
+        void LoadData(const PointGeometryData& geometries)
         {
             this->LoadDataCore(geometries);
         }
 
+        void LoadData(const LineStripGeometryData& geometries)
+        {
+            this->LoadDataCore(geometries);
+        }
+
+        void LoadData(const TriangleGeometryData& geometries,
+            AttributeEncoding encoding = AttributeEncoding::Full)
+        {
+            this->LoadDataCore(geometries, encoding);
+        }
+
         void GetBoundingBox(BoundingBox* pBoundingBox) const
         {
             this->GetBoundingBoxCore(pBoundingBox);
@@ -496,11 +769,33 @@ namespace Dynamo { namespace Bloodstone {
             this->BindToShaderProgramCore(pShaderProgram);
         }
 
+        // Dynamic buffers are meant for geometries that get replaced every
+        // so often (e.g. sensor input), their data is streamed rather than
+        // placed into static storage. Takes effect on the next "LoadData",
+        // except that data being streamed moves into static storage as soon
+        // as the buffer is no longer dynamic.
+        //
+        bool IsDynamic(void) const
+        {
+            return this->IsDynamicCore();
+        }
+
+        void SetDynamic(bool dynamic)
+        {
+            this->SetDynamicCore(dynamic);
+        }
+
     protected:
         virtual PrimitiveType GetPrimitiveTypeCore() const = 0;
-        virtual void LoadDataCore(const GeometryData& geometries) = 0;
+        virtual ShaderFeatures GetShaderFeaturesCore() const = 0;
+        virtual void LoadDataCore(const PointGeometryData& geometries) = 0;
+        virtual void LoadDataCore(const LineStripGeometryData& geometries) = 0;
+        virtual void LoadDataCore(const TriangleGeometryData& geometries,
+            AttributeEncoding encoding) = 0;
         virtual void GetBoundingBoxCore(BoundingBox* pBoundingBox) const = 0;
         virtual void BindToShaderProgramCore(IShaderProgram* pShaderProgram) = 0;
+        virtual bool IsDynamicCore(void) const = 0;
+        virtual void SetDynamicCore(bool dynamic) = 0;
     };
 
     struct BillboardVertex
@@ -598,6 +893,82 @@ namespace Dynamo { namespace Bloodstone {
         virtual void ActivateCore(void) const = 0;
     };
 
+    // Shader state of a node: the color that overrides those of vertices
+    // (with the selection color already applied), and flags telling
+    // whether it does, whether the node is selected and whether its
+    // triangles are shaded (in this order, the last value is unused).
+    // 
+    struct NodeState
+    {
+        float color[4];
+        float flags[4];
+    };
+
+    // Shader states of all nodes, kept in a table on the GPU that shaders
+    // look up through the row selected for each draw. Rows are only written
+    // when a node changes, and changed rows are uploaded on "Activate", so
+    // drawing a node takes selecting its row rather than setting each of
+    // its shader parameters all over again.
+    // 
+    // Every program drawing with the table gets bound to it while active,
+    // before its draws (rows are then selected in the last one bound).
+    // 
+    class INodeStateTable
+    {
+    public:
+        virtual ~INodeStateTable()
+        {
+        }
+
+        void SetRow(int row, const NodeState& state)
+        {
+            this->SetRowCore(row, state);
+        }
+
+        void BindToShaderProgram(IShaderProgram* pShaderProgram)
+        {
+            this->BindToShaderProgramCore(pShaderProgram);
+        }
+
+        void Activate(void)
+        {
+            this->ActivateCore();
+        }
+
+        void SelectRow(int row) const
+        {
+            this->SelectRowCore(row);
+        }
+
+    protected:
+        virtual void SetRowCore(int row, const NodeState& state) = 0;
+        virtual void BindToShaderProgramCore(IShaderProgram* pShaderProgram) = 0;
+        virtual void ActivateCore(void) = 0;
+        virtual void SelectRowCore(int row) const = 0;
+    };
+
+    // Vertex buffer to be drawn with the node state of a row (see
+    // "INodeStateTable"), ordered by its key (see "RenderQueue").
+    struct DrawItem
+    {
+        unsigned long long key;
+        IVertexBuffer* pVertexBuffer;
+        int stateRow;
+    };
+
+    struct RenderStatistics
+    {
+        int drawItems;      // Vertex buffers drawn through "RenderDrawItems".
+        int drawCalls;      // Draw calls made for them.
+        int stateChanges;   // Vertex arrays bound, programs and node state rows selected.
+        int filteredCalls;  // State changes dropped as they would not change anything.
+
+        // Totals since the scene was created rather than of the last frame.
+        int heapRelocations;                        // Buffer heaps moved to new storage.
+        unsigned long long receivedPackageBytes;    // Render package content received.
+        unsigned long long skippedPackageBytes;     // Of which found to be unchanged.
+    };
+
     class IGraphicsContext
     {
     public:
@@ -644,9 +1015,10 @@ namespace Dynamo { namespace Bloodstone {
             return this->CreateFragmentShaderCore(content);
         }
 
-        IShaderProgram* CreateShaderProgram(ShaderName shaderName) const
+        IShaderProgram* CreateShaderProgram(ShaderName shaderName,
+            ShaderFeatures features = ShaderFeatures::None) const
         {
-            return this->CreateShaderProgramCore(shaderName);
+            return this->CreateShaderProgramCore(shaderName, features);
         }
 
         IVertexBuffer* CreateVertexBuffer(void) const
@@ -664,6 +1036,11 @@ namespace Dynamo { namespace Bloodstone {
             return this->CreateTexture2dCore(pBitmapData);
         }
 
+        INodeStateTable* CreateNodeStateTable(void) const
+        {
+            return this->CreateNodeStateTableCore();
+        }
+
         void BeginRenderFrame(HDC deviceContext) const
         {
             this->BeginRenderFrameCore(deviceContext);
@@ -679,6 +1056,21 @@ namespace Dynamo { namespace Bloodstone {
             this->RenderVertexBufferCore(pVertexBuffer);
         }
 
+        // Draws "count" items in order, selecting the row of each in the
+        // node state table (only when it differs from that of the item
+        // before it). Buffers and table must be of this context.
+        void RenderDrawItems(const DrawItem* pDrawItems,
+            int count, const INodeStateTable* pNodeStates) const
+        {
+            this->RenderDrawItemsCore(pDrawItems, count, pNodeStates);
+        }
+
+        // Counts of what was drawn since "BeginRenderFrame".
+        void GetRenderStatistics(RenderStatistics* pStatistics) const
+        {
+            this->GetRenderStatisticsCore(pStatistics);
+        }
+
         bool EndRenderFrame(HDC deviceContext) const
         {
             return this->EndRenderFrameCore(deviceContext);
@@ -704,14 +1096,19 @@ namespace Dynamo { namespace Bloodstone {
             const std::string& content) const = 0;
         virtual IFragmentShader* CreateFragmentShaderCore(
             const std::string& content) const = 0;
-        virtual IShaderProgram* CreateShaderProgramCore(ShaderName shaderName) const = 0;
+        virtual IShaderProgram* CreateShaderProgramCore(ShaderName shaderName,
+            ShaderFeatures features) const = 0;
 
         virtual IVertexBuffer* CreateVertexBufferCore(void) const = 0;
         virtual IBillboardVertexBuffer* CreateBillboardVertexBufferCore(void) const = 0;
         virtual ITexture2d* CreateTexture2dCore(const BitmapData* pBitmapData) const = 0;
+        virtual INodeStateTable* CreateNodeStateTableCore(void) const = 0;
         virtual void BeginRenderFrameCore(HDC deviceContext) const = 0;
         virtual void ActivateShaderProgramCore(IShaderProgram* pShaderProgram) const = 0;
         virtual void RenderVertexBufferCore(IVertexBuffer* pVertexBuffer) const = 0;
+        virtual void RenderDrawItemsCore(const DrawItem* pDrawItems,
+            int count, const INodeStateTable* pNodeStates) const = 0;
+        virtual void GetRenderStatisticsCore(RenderStatistics* pStatistics) const = 0;
         virtual bool EndRenderFrameCore(HDC deviceContext) const = 0;
         virtual void EnableAlphaBlendCore(void) const = 0;
         virtual void ClearDepthBufferCore(void) const = 0;
@@ -0,0 +1,491 @@
+// Kernels.cpp : Compiled without precompiled headers and as native code,
+// see "GeometryKernels" in "Kernels.h" for details.
+//
+
+#include "Kernels.h"
+
+#include <intrin.h>
+#include <immintrin.h>
+
+using namespace Dynamo::Bloodstone;
+
+// Bits of interest in CPUID leaf 1 (ECX, EDX) and XCR0 respectively.
+#define CPUID_SSE2_BIT      (1 << 26)
+#define CPUID_OSXSAVE_BIT   (1 << 27)
+#define CPUID_AVX_BIT       (1 << 28)
+#define XCR0_XMM_YMM_STATE  0x06
+
+static int sSupportedInstructionSet = -1; // Not yet determined.
+static int sInstructionSet = -1; // Supported one, unless set otherwise.
+
+static InstructionSet DetectInstructionSet(void)
+{
+    int registers[4] = { 0 }; // EAX, EBX, ECX, EDX.
+    __cpuid(registers, 0);
+    if (registers[0] < 1)
+        return InstructionSet::Scalar;
+
+    __cpuid(registers, 1);
+    const int ecx = registers[2];
+    const int edx = registers[3];
+
+    if ((ecx & CPUID_AVX_BIT) && (ecx & CPUID_OSXSAVE_BIT))
+    {
+        const auto xcr0 = _xgetbv(0);
+        if ((xcr0 & XCR0_XMM_YMM_STATE) == XCR0_XMM_YMM_STATE)
+            return InstructionSet::Avx;
+    }
+
+    if (edx & CPUID_SSE2_BIT)
+        return InstructionSet::Sse2;
+
+    return InstructionSet::Scalar;
+}
+
+// ================================================================================
+// Double to float conversion
+// ================================================================================
+
+static void ConvertToFloatsScalar(const double* pSource, float* pTarget, std::size_t count)
+{
+    for (std::size_t index = 0; index < count; ++index)
+        pTarget[index] = ((float) pSource[index]);
+}
+
+static void ConvertToFloatsSse2(const double* pSource, float* pTarget, std::size_t count)
+{
+    // Both "cvtpd2ps" and a scalar cast round to nearest (the default
+    // MXCSR mode), so results do not depend on the path taken.
+    std::size_t index = 0;
+    for (; index + 4 <= count; index += 4)
+    {
+        const __m128 low = _mm_cvtpd_ps(_mm_loadu_pd(pSource + index));
+        const __m128 high = _mm_cvtpd_ps(_mm_loadu_pd(pSource + index + 2));
+        _mm_storeu_ps(pTarget + index, _mm_movelh_ps(low, high));
+    }
+
+    ConvertToFloatsScalar(pSource + index, pTarget + index, count - index);
+}
+
+static void ConvertToFloatsAvx(const double* pSource, float* pTarget, std::size_t count)
+{
+    std::size_t index = 0;
+    for (; index + 8 <= count; index += 8)
+    {
+        const __m128 low = _mm256_cvtpd_ps(_mm256_loadu_pd(pSource + index));
+        const __m128 high = _mm256_cvtpd_ps(_mm256_loadu_pd(pSource + index + 4));
+        _mm_storeu_ps(pTarget + index, low);
+        _mm_storeu_ps(pTarget + index + 4, high);
+    }
+
+    // Avoid the AVX to SSE transition penalty in the code that follows.
+    _mm256_zeroupper();
+    ConvertToFloatsScalar(pSource + index, pTarget + index, count - index);
+}
+
+// ================================================================================
+// Bounding box evaluation
+// ================================================================================
+
+// Operands are ordered so that a coordinate that is not a number leaves
+// the corner as it is, just like the comparisons of the scalar version
+// (and of "BoundingBox::EvaluatePoint") do. Vectors span several vertices
+// (x, y, z, x, ...), element "i" of all of them is on axis "i % 3".
+//
+static void EvaluateBoundsScalar(const float* pCoordinates,
+    std::size_t vertexCount, float* pMin, float* pMax)
+{
+    for (std::size_t vertex = 0; vertex < vertexCount; ++vertex, pCoordinates += 3)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const float value = pCoordinates[axis];
+            pMin[axis] = ((value < pMin[axis]) ? value : pMin[axis]);
+            pMax[axis] = ((value > pMax[axis]) ? value : pMax[axis]);
+        }
+    }
+}
+
+static void ReduceBounds(const float* pMinLanes, const float* pMaxLanes,
+    int laneCount, float* pMin, float* pMax)
+{
+    for (int lane = 0; lane < laneCount; ++lane)
+    {
+        const int axis = lane % 3;
+        pMin[axis] = ((pMinLanes[lane] < pMin[axis]) ? pMinLanes[lane] : pMin[axis]);
+        pMax[axis] = ((pMaxLanes[lane] > pMax[axis]) ? pMaxLanes[lane] : pMax[axis]);
+    }
+}
+
+static void EvaluateBoundsSse2(const float* pCoordinates,
+    std::size_t vertexCount, float* pMin, float* pMax)
+{
+    // Four vertices (12 floats) at a time, in three vectors.
+    float minLanes[12], maxLanes[12];
+    for (int lane = 0; lane < 12; ++lane) {
+        minLanes[lane] = pMin[lane % 3];
+        maxLanes[lane] = pMax[lane % 3];
+    }
+
+    __m128 min0 = _mm_loadu_ps(&minLanes[0]);
+    __m128 min1 = _mm_loadu_ps(&minLanes[4]);
+    __m128 min2 = _mm_loadu_ps(&minLanes[8]);
+    __m128 max0 = _mm_loadu_ps(&maxLanes[0]);
+    __m128 max1 = _mm_loadu_ps(&maxLanes[4]);
+    __m128 max2 = _mm_loadu_ps(&maxLanes[8]);
+
+    std::size_t vertex = 0;
+    for (; vertex + 4 <= vertexCount; vertex += 4, pCoordinates += 12)
+    {
+        const __m128 v0 = _mm_loadu_ps(pCoordinates + 0);
+        const __m128 v1 = _mm_loadu_ps(pCoordinates + 4);
+        const __m128 v2 = _mm_loadu_ps(pCoordinates + 8);
+        min0 = _mm_min_ps(v0, min0);
+        min1 = _mm_min_ps(v1, min1);
+        min2 = _mm_min_ps(v2, min2);
+        max0 = _mm_max_ps(v0, max0);
+        max1 = _mm_max_ps(v1, max1);
+        max2 = _mm_max_ps(v2, max2);
+    }
+
+    _mm_storeu_ps(&minLanes[0], min0);
+    _mm_storeu_ps(&minLanes[4], min1);
+    _mm_storeu_ps(&minLanes[8], min2);
+    _mm_storeu_ps(&maxLanes[0], max0);
+    _mm_storeu_ps(&maxLanes[4], max1);
+    _mm_storeu_ps(&maxLanes[8], max2);
+
+    ReduceBounds(&minLanes[0], &maxLanes[0], 12, pMin, pMax);
+    EvaluateBoundsScalar(pCoordinates, vertexCount - vertex, pMin, pMax);
+}
+
+static void EvaluateBoundsAvx(const float* pCoordinates,
+    std::size_t vertexCount, float* pMin, float* pMax)
+{
+    // Eight vertices (24 floats) at a time, in three vectors.
+    float minLanes[24], maxLanes[24];
+    for (int lane = 0; lane < 24; ++lane) {
+        minLanes[lane] = pMin[lane % 3];
+        maxLanes[lane] = pMax[lane % 3];
+    }
+
+    __m256 min0 = _mm256_loadu_ps(&minLanes[0]);
+    __m256 min1 = _mm256_loadu_ps(&minLanes[8]);
+    __m256 min2 = _mm256_loadu_ps(&minLanes[16]);
+    __m256 max0 = _mm256_loadu_ps(&maxLanes[0]);
+    __m256 max1 = _mm256_loadu_ps(&maxLanes[8]);
+    __m256 max2 = _mm256_loadu_ps(&maxLanes[16]);
+
+    std::size_t vertex = 0;
+    for (; vertex + 8 <= vertexCount; vertex += 8, pCoordinates += 24)
+    {
+        const __m256 v0 = _mm256_loadu_ps(pCoordinates + 0);
+        const __m256 v1 = _mm256_loadu_ps(pCoordinates + 8);
+        const __m256 v2 = _mm256_loadu_ps(pCoordinates + 16);
+        min0 = _mm256_min_ps(v0, min0);
+        min1 = _mm256_min_ps(v1, min1);
+        min2 = _mm256_min_ps(v2, min2);
+        max0 = _mm256_max_ps(v0, max0);
+        max1 = _mm256_max_ps(v1, max1);
+        max2 = _mm256_max_ps(v2, max2);
+    }
+
+    _mm256_storeu_ps(&minLanes[0], min0);
+    _mm256_storeu_ps(&minLanes[8], min1);
+    _mm256_storeu_ps(&minLanes[16], min2);
+    _mm256_storeu_ps(&maxLanes[0], max0);
+    _mm256_storeu_ps(&maxLanes[8], max1);
+    _mm256_storeu_ps(&maxLanes[16], max2);
+    _mm256_zeroupper();
+
+    ReduceBounds(&minLanes[0], &maxLanes[0], 24, pMin, pMax);
+    EvaluateBoundsScalar(pCoordinates, vertexCount - vertex, pMin, pMax);
+}
+
+// ================================================================================
+// Ray/triangle intersection
+// ================================================================================
+
+// Coordinate "axis" of vertex "vertex" of the triangle in lane "lane".
+#define BLOCK_COORDINATE(pBlock, vertex, axis, lane) \
+    ((pBlock)[(vertex) * 12 + (axis) * 4 + (lane)])
+
+// Both versions go through here for every hit (and for every edge case),
+// so that they accept the very same ones. Not a number fails every test.
+static bool AcceptTriangle(float u, float v, float w,
+    float az, float bz, float cz, float maxDistance, float* pDistance)
+{
+    const bool inside = (u >= 0.0f && v >= 0.0f && w >= 0.0f) ||
+        (u <= 0.0f && v <= 0.0f && w <= 0.0f);
+
+    float determinant = u + v + w;
+    if (!inside || determinant == 0.0f)
+        return false;
+
+    // Scaled hit distance, its sign flipped along with the determinant.
+    float scaled = (u * az) + (v * bz) + (w * cz);
+    if (determinant < 0.0f) {
+        scaled = -scaled;
+        determinant = -determinant;
+    }
+
+    if (!(scaled >= 0.0f && scaled < maxDistance * determinant))
+        return false;
+
+    (*pDistance) = scaled / determinant;
+    return true;
+}
+
+static bool IntersectTriangleScalar(const KernelRay& ray,
+    const float* pBlock, int lane, float maxDistance, float* pDistance)
+{
+    const int kx = ray.axes[0], ky = ray.axes[1], kz = ray.axes[2];
+
+    // Vertices relative to the origin, sheared and scaled so that the
+    // ray runs along the z axis (which only then gets scaled).
+    float x[3], y[3], z[3];
+    for (int vertex = 0; vertex < 3; ++vertex)
+    {
+        const float dx = BLOCK_COORDINATE(pBlock, vertex, kx, lane) - ray.origin[kx];
+        const float dy = BLOCK_COORDINATE(pBlock, vertex, ky, lane) - ray.origin[ky];
+        z[vertex] = BLOCK_COORDINATE(pBlock, vertex, kz, lane) - ray.origin[kz];
+        x[vertex] = dx - ray.shear[0] * z[vertex];
+        y[vertex] = dy - ray.shear[1] * z[vertex];
+    }
+
+    float u = (x[2] * y[1]) - (y[2] * x[1]);
+    float v = (x[0] * y[2]) - (y[0] * x[2]);
+    float w = (x[1] * y[0]) - (y[1] * x[0]);
+
+    // Edges through the ray (or nearly so) are decided in double precision,
+    // where the products above are exact, so the sign is never a guess.
+    if (u == 0.0f || v == 0.0f || w == 0.0f)
+    {
+        u = ((float) (((double) x[2]) * y[1] - ((double) y[2]) * x[1]));
+        v = ((float) (((double) x[0]) * y[2] - ((double) y[0]) * x[2]));
+        w = ((float) (((double) x[1]) * y[0] - ((double) y[1]) * x[0]));
+    }
+
+    return AcceptTriangle(u, v, w, ray.shear[2] * z[0],
+        ray.shear[2] * z[1], ray.shear[2] * z[2], maxDistance, pDistance);
+}
+
+static int IntersectTrianglesScalar(const KernelRay& ray,
+    const float* pBlocks, std::size_t blockCount, float* pDistance)
+{
+    int nearest = -1;
+    for (std::size_t block = 0; block < blockCount; ++block)
+    {
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            float distance = 0.0f;
+            if (IntersectTriangleScalar(ray, pBlocks + block * 36, lane, *pDistance, &distance)) {
+                (*pDistance) = distance;
+                nearest = ((int) (block * 4)) + lane;
+            }
+        }
+    }
+
+    return nearest;
+}
+
+static int IntersectTrianglesSse2(const KernelRay& ray,
+    const float* pBlocks, std::size_t blockCount, float* pDistance)
+{
+    const int kx = ray.axes[0], ky = ray.axes[1], kz = ray.axes[2];
+    const __m128 originX = _mm_set1_ps(ray.origin[kx]);
+    const __m128 originY = _mm_set1_ps(ray.origin[ky]);
+    const __m128 originZ = _mm_set1_ps(ray.origin[kz]);
+    const __m128 shearX = _mm_set1_ps(ray.shear[0]);
+    const __m128 shearY = _mm_set1_ps(ray.shear[1]);
+    const __m128 shearZ = _mm_set1_ps(ray.shear[2]);
+    const __m128 zero = _mm_setzero_ps();
+
+    int nearest = -1;
+    for (std::size_t block = 0; block < blockCount; ++block)
+    {
+        // Same operations in the same order as the scalar version, four
+        // triangles at a time, up to the signs of "u", "v" and "w".
+        const float* pBlock = pBlocks + block * 36;
+        __m128 x[3], y[3], z[3];
+        for (int vertex = 0; vertex < 3; ++vertex)
+        {
+            const __m128 dx = _mm_sub_ps(_mm_loadu_ps(pBlock + vertex * 12 + kx * 4), originX);
+            const __m128 dy = _mm_sub_ps(_mm_loadu_ps(pBlock + vertex * 12 + ky * 4), originY);
+            z[vertex] = _mm_sub_ps(_mm_loadu_ps(pBlock + vertex * 12 + kz * 4), originZ);
+            x[vertex] = _mm_sub_ps(dx, _mm_mul_ps(shearX, z[vertex]));
+            y[vertex] = _mm_sub_ps(dy, _mm_mul_ps(shearY, z[vertex]));
+        }
+
+        const __m128 u = _mm_sub_ps(_mm_mul_ps(x[2], y[1]), _mm_mul_ps(y[2], x[1]));
+        const __m128 v = _mm_sub_ps(_mm_mul_ps(x[0], y[2]), _mm_mul_ps(y[0], x[2]));
+        const __m128 w = _mm_sub_ps(_mm_mul_ps(x[1], y[0]), _mm_mul_ps(y[1], x[0]));
+
+        // Lanes on the inside of all three edges (or the outside of all of
+        // them, seen from the back), and those that need double precision.
+        const __m128 front = _mm_and_ps(_mm_and_ps(
+            _mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)), _mm_cmpge_ps(w, zero));
+        const __m128 back = _mm_and_ps(_mm_and_ps(
+            _mm_cmple_ps(u, zero), _mm_cmple_ps(v, zero)), _mm_cmple_ps(w, zero));
+        const __m128 exact = _mm_or_ps(_mm_or_ps(
+            _mm_cmpeq_ps(u, zero), _mm_cmpeq_ps(v, zero)), _mm_cmpeq_ps(w, zero));
+
+        const int exactLanes = _mm_movemask_ps(exact);
+        const int candidates = _mm_movemask_ps(_mm_or_ps(front, back)) | exactLanes;
+        if (candidates == 0)
+            continue;
+
+        float lanes[3][4];
+        _mm_storeu_ps(&lanes[0][0], u);
+        _mm_storeu_ps(&lanes[1][0], v);
+        _mm_storeu_ps(&lanes[2][0], w);
+
+        float depths[3][4];
+        _mm_storeu_ps(&depths[0][0], _mm_mul_ps(shearZ, z[0]));
+        _mm_storeu_ps(&depths[1][0], _mm_mul_ps(shearZ, z[1]));
+        _mm_storeu_ps(&depths[2][0], _mm_mul_ps(shearZ, z[2]));
+
+        for (int lane = 0; lane < 4; ++lane)
+        {
+            if ((candidates & (1 << lane)) == 0)
+                continue;
+
+            bool hit = false;
+            float distance = 0.0f;
+            if (exactLanes & (1 << lane))
+                hit = IntersectTriangleScalar(ray, pBlock, lane, *pDistance, &distance);
+            else {
+                hit = AcceptTriangle(lanes[0][lane], lanes[1][lane], lanes[2][lane],
+                    depths[0][lane], depths[1][lane], depths[2][lane], *pDistance, &distance);
+            }
+
+            if (hit) {
+                (*pDistance) = distance;
+                nearest = ((int) (block * 4)) + lane;
+            }
+        }
+    }
+
+    return nearest;
+}
+
+// ================================================================================
+// GeometryKernels
+// ================================================================================
+
+InstructionSet GeometryKernels::GetInstructionSet(void)
+{
+    // Racing threads would all arrive at the same value, no need to lock.
+    if (sInstructionSet < 0) {
+        sSupportedInstructionSet = ((int) DetectInstructionSet());
+        sInstructionSet = sSupportedInstructionSet;
+    }
+
+    return ((InstructionSet) sInstructionSet);
+}
+
+InstructionSet GeometryKernels::SetInstructionSet(InstructionSet instructionSet)
+{
+    GetInstructionSet(); // Detect the supported one if not done yet.
+
+    const int requested = ((int) instructionSet);
+    sInstructionSet = ((requested < sSupportedInstructionSet) ?
+        requested : sSupportedInstructionSet);
+
+    return ((InstructionSet) sInstructionSet);
+}
+
+void GeometryKernels::ConvertToFloats(const double* pSource,
+    float* pTarget, std::size_t count)
+{
+    switch (GetInstructionSet())
+    {
+    case InstructionSet::Avx:
+        ConvertToFloatsAvx(pSource, pTarget, count);
+        break;
+    case InstructionSet::Sse2:
+        ConvertToFloatsSse2(pSource, pTarget, count);
+        break;
+    default:
+        ConvertToFloatsScalar(pSource, pTarget, count);
+        break;
+    }
+}
+
+void GeometryKernels::EvaluateBounds(const float* pCoordinates,
+    std::size_t vertexCount, float* pMin, float* pMax)
+{
+    // Both corners start out at the first vertex, which only ever makes a
+    // difference if it is not a number (it then sticks, as it always has).
+    for (int axis = 0; axis < 3; ++axis)
+        pMin[axis] = pMax[axis] = pCoordinates[axis];
+
+    switch (GetInstructionSet())
+    {
+    case InstructionSet::Avx:
+        EvaluateBoundsAvx(pCoordinates, vertexCount, pMin, pMax);
+        break;
+    case InstructionSet::Sse2:
+        EvaluateBoundsSse2(pCoordinates, vertexCount, pMin, pMax);
+        break;
+    default:
+        EvaluateBoundsScalar(pCoordinates, vertexCount, pMin, pMax);
+        break;
+    }
+
+    // Which of -0.0 and 0.0 is kept depends on the order vertices are
+    // compared in (and so on the path taken), settle on the latter.
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (pMin[axis] == 0.0f)
+            pMin[axis] = 0.0f;
+        if (pMax[axis] == 0.0f)
+            pMax[axis] = 0.0f;
+    }
+}
+
+void GeometryKernels::PrepareRay(const float* pOrigin,
+    const float* pDirection, KernelRay* pRay)
+{
+    // Axis along which the direction is largest becomes "z", the other two
+    // follow in cyclic order (swapped when the direction points backwards
+    // along "z", so that the winding of the triangles is kept).
+    int kz = 0;
+    for (int axis = 1; axis < 3; ++axis) {
+        const float magnitude = ((pDirection[axis] < 0.0f) ? -pDirection[axis] : pDirection[axis]);
+        const float largest = ((pDirection[kz] < 0.0f) ? -pDirection[kz] : pDirection[kz]);
+        if (magnitude > largest)
+            kz = axis;
+    }
+
+    int kx = (kz + 1) % 3, ky = (kx + 1) % 3;
+    if (pDirection[kz] < 0.0f) {
+        const int swapped = kx;
+        kx = ky;
+        ky = swapped;
+    }
+
+    for (int axis = 0; axis < 3; ++axis)
+        pRay->origin[axis] = pOrigin[axis];
+
+    pRay->axes[0] = kx;
+    pRay->axes[1] = ky;
+    pRay->axes[2] = kz;
+    pRay->shear[0] = pDirection[kx] / pDirection[kz];
+    pRay->shear[1] = pDirection[ky] / pDirection[kz];
+    pRay->shear[2] = 1.0f / pDirection[kz];
+}
+
+int GeometryKernels::IntersectTriangles(const KernelRay& ray,
+    const float* pBlocks, std::size_t blockCount, float* pDistance)
+{
+    // Rays are cast one at a time, eight lanes would not pay for themselves.
+    switch (GetInstructionSet())
+    {
+    case InstructionSet::Avx:
+    case InstructionSet::Sse2:
+        return IntersectTrianglesSse2(ray, pBlocks, blockCount, pDistance);
+    default:
+        return IntersectTrianglesScalar(ray, pBlocks, blockCount, pDistance);
+    }
+}
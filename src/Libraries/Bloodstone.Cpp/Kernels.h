@@ -0,0 +1,72 @@
+#ifndef _BLOODSTONE_KERNELS_H_
+#define _BLOODSTONE_KERNELS_H_
+
+#include <cstddef>
+
+namespace Dynamo { namespace Bloodstone {
+
+    enum class InstructionSet
+    {
+        Scalar, Sse2, Avx
+    };
+
+    // Ray set up by "GeometryKernels::PrepareRay": its origin, the axes
+    // ordered so that the direction is largest along the last one, and the
+    // shear that takes the direction onto that axis.
+    struct KernelRay
+    {
+        float origin[3];
+        int axes[3];
+        float shear[3];
+    };
+
+    // Bulk loops over vertex streams, each with a scalar, an SSE2 and an
+    // AVX implementation picked (through CPUID) the first time any of them
+    // is called. All implementations produce results that are identical
+    // bit for bit (bounds at zero always come out as 0.0, never -0.0).
+    // This file is compiled natively (no /clr) and shared with the legacy
+    // renderer, so it depends on nothing else in this project.
+    //
+    class GeometryKernels
+    {
+    public:
+        // Widest instruction set that both the processor and the operating
+        // system support (AVX needs the latter to save the YMM registers).
+        static InstructionSet GetInstructionSet(void);
+
+        // Has the kernels take the paths of the given instruction set from
+        // now on, or of the widest supported one if that is not supported.
+        // It is meant for tests, which run each path on the same inputs.
+        //
+        static InstructionSet SetInstructionSet(InstructionSet instructionSet);
+
+        // Rounds each of "count" doubles to the nearest float.
+        static void ConvertToFloats(const double* pSource,
+            float* pTarget, std::size_t count);
+
+        // Minimum and maximum corners of "vertexCount" (x, y, z) triples,
+        // which must be at least one. Coordinates that are not a number
+        // are ignored, unless they belong to the very first vertex.
+        //
+        static void EvaluateBounds(const float* pCoordinates,
+            std::size_t vertexCount, float* pMin, float* pMax);
+
+        // Ray/triangle intersection that is watertight (Woop, Benthin and
+        // Wald, 2013), a ray through an edge or a vertex shared by several
+        // triangles never slips in between them. Triangles come in blocks
+        // of four, each of 36 floats: the x, y and z coordinates of the
+        // first vertex of all four triangles, then of the second and then
+        // of the third vertex (unused triangles have them not a number).
+        // Both sides of a triangle are hit. Returns the index (counted over
+        // all blocks) of the nearest triangle hit at a distance (in units
+        // of the direction) below "*pDistance", which is then updated, or
+        // -1 if there is none. The SSE2 version is used on AVX processors.
+        //
+        static void PrepareRay(const float* pOrigin,
+            const float* pDirection, KernelRay* pRay);
+        static int IntersectTriangles(const KernelRay& ray,
+            const float* pBlocks, std::size_t blockCount, float* pDistance);
+    };
+} }
+
+#endif
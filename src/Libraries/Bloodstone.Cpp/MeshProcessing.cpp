@@ -0,0 +1,893 @@
+
+#include "stdafx.h"
+#include "MeshProcessing.h"
+
+#include <cmath>
+#include <algorithm>
+#include <unordered_map>
+
+using namespace Dynamo::Bloodstone;
+
+// ================================================================================
+// Vertex welding
+// ================================================================================
+
+struct WeldKey
+{
+    long long position[3];
+    long long normal[3];
+    unsigned int rgba;
+
+    bool operator==(const WeldKey& other) const
+    {
+        return memcmp(this, &other, sizeof(WeldKey)) == 0;
+    }
+};
+
+struct WeldKeyHasher
+{
+    std::size_t operator()(const WeldKey& key) const
+    {
+        // FNV-1a over the bytes of the key.
+        auto pBytes = ((const unsigned char *) &key);
+        unsigned int hash = 2166136261u;
+        for (std::size_t i = 0; i < sizeof(WeldKey); ++i)
+            hash = (hash ^ pBytes[i]) * 16777619u;
+
+        return hash;
+    }
+};
+
+// Cells are 64-bit, a coordinate far from the origin divided by a small
+// epsilon does not fit 32 bits (30000 units at 1e-5 is already 3e9 cells).
+// Values beyond even these cells are further apart than any epsilon in
+// float, their bits stand for them instead (kept clear of the cells).
+// 
+#define WELD_CELL_LIMIT (1LL << 62)
+
+static long long ToWeldCell(float value, double inverseEpsilon)
+{
+    if (value == 0.0f)
+        return 0; // Treat "-0.0f" and "0.0f" the same.
+
+    const double cell = std::floor(value * inverseEpsilon);
+    if (inverseEpsilon > 0.0 && cell > -((double) WELD_CELL_LIMIT) &&
+        cell < ((double) WELD_CELL_LIMIT))
+    {
+        return ((long long) cell);
+    }
+
+    unsigned int bits = 0;
+    memcpy(&bits, &value, sizeof(bits));
+    const long long magnitude = ((long long) (bits & 0x7fffffff));
+    return ((value < 0.0f) ? (-WELD_CELL_LIMIT - magnitude) : (WELD_CELL_LIMIT + magnitude));
+}
+
+void MeshProcessor::Weld(const TriangleGeometryData& source, float epsilon,
+    float normalEpsilon, TriangleGeometryData& welded)
+{
+    const int vertexCount = source.VertexCount();
+    if (vertexCount <= 0)
+        return;
+
+    // An indexed source is welded through its indices, so the result
+    // still describes the very same triangles.
+    const int cornerCount = ((source.IndexCount() > 0) ? source.IndexCount() : vertexCount);
+    const unsigned int* pSourceIndices = source.GetIndices();
+
+    const bool hasColors = (source.GetRgbaColors(0) != nullptr);
+    const double inverseEpsilon = ((epsilon > 0.0f) ? (1.0 / epsilon) : 0.0);
+    const double inverseNormalEpsilon = ((normalEpsilon > 0.0f) ? (1.0 / normalEpsilon) : 0.0);
+
+    std::unordered_map<WeldKey, unsigned int, WeldKeyHasher> weldedVertices;
+    weldedVertices.reserve(vertexCount);
+
+    for (int corner = 0; corner < cornerCount; ++corner)
+    {
+        const int vertex = ((pSourceIndices != nullptr) ? ((int) pSourceIndices[corner]) : corner);
+        const float* pCoordinates = source.GetCoordinates(vertex);
+        const float* pNormalCoords = source.GetNormalCoords(vertex);
+        const unsigned char* pRgbaColors = (hasColors ? source.GetRgbaColors(vertex) : nullptr);
+
+        // Keys are hashed and compared as bytes, padding included.
+        WeldKey key;
+        memset(&key, 0, sizeof(key));
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            key.position[axis] = ToWeldCell(pCoordinates[axis], inverseEpsilon);
+            key.normal[axis] = ToWeldCell(pNormalCoords[axis], inverseNormalEpsilon);
+        }
+
+        key.rgba = 0xffffffff;
+        if (pRgbaColors != nullptr)
+            memcpy(&key.rgba, pRgbaColors, sizeof(key.rgba));
+
+        const auto nextIndex = ((unsigned int) weldedVertices.size());
+        auto inserted = weldedVertices.insert(std::make_pair(key, nextIndex));
+        if (inserted.second)
+        {
+            // First vertex of its cell, it represents all the others.
+            welded.PushVertex(pCoordinates[0], pCoordinates[1], pCoordinates[2]);
+            welded.PushNormal(pNormalCoords[0], pNormalCoords[1], pNormalCoords[2]);
+            if (pRgbaColors != nullptr) {
+                welded.PushColor(pRgbaColors[0], pRgbaColors[1],
+                    pRgbaColors[2], pRgbaColors[3]);
+            }
+        }
+
+        welded.PushIndex(inserted.first->second);
+    }
+}
+
+// ================================================================================
+// Vertex cache optimization
+// ================================================================================
+
+// Size of the least-recently-used cache modelled while optimizing, hardware
+// caches are typically smaller but the resulting order degrades gracefully.
+#define OPTIMIZER_CACHE_SIZE 32
+
+static float ForsythVertexScore(int cachePosition, int remainingTriangles)
+{
+    if (remainingTriangles <= 0)
+        return -1.0f; // No triangle needs this vertex anymore.
+
+    float score = 0.0f;
+    if (cachePosition >= 0)
+    {
+        // Vertices of the last triangle get a fixed score so that the next
+        // triangle does not simply reuse two of them in a thin strip.
+        if (cachePosition < 3)
+            score = 0.75f;
+        else
+        {
+            const float scaler = 1.0f / (OPTIMIZER_CACHE_SIZE - 3);
+            score = std::pow(1.0f - ((cachePosition - 3) * scaler), 1.5f);
+        }
+    }
+
+    // Vertices with few triangles left are finished off first.
+    return score + (2.0f / std::sqrt((float) remainingTriangles));
+}
+
+static void GetTriangleIndices(const TriangleGeometryData& mesh,
+    std::vector<unsigned int>& indices)
+{
+    if (mesh.IndexCount() > 0)
+    {
+        auto pIndices = mesh.GetIndices();
+        indices.assign(pIndices, pIndices + mesh.IndexCount());
+        return;
+    }
+
+    indices.resize(mesh.VertexCount());
+    for (int vertex = 0; vertex < mesh.VertexCount(); ++vertex)
+        indices[vertex] = ((unsigned int) vertex);
+}
+
+static void CompactVertices(const TriangleGeometryData& source,
+    const std::vector<unsigned int>& indices, TriangleGeometryData& output)
+{
+    // Vertices are written in the order they are first referenced by
+    // "indices", those not referenced at all are dropped.
+    const unsigned int unassigned = 0xffffffff;
+    std::vector<unsigned int> remap(source.VertexCount(), unassigned);
+    const bool hasColors = (source.GetRgbaColors(0) != nullptr);
+    unsigned int nextVertex = 0;
+
+    auto iterator = indices.begin();
+    for (; iterator != indices.end(); ++iterator)
+    {
+        const int vertex = ((int) *iterator);
+        if (remap[vertex] == unassigned)
+        {
+            remap[vertex] = nextVertex++;
+
+            const float* pCoordinates = source.GetCoordinates(vertex);
+            const float* pNormalCoords = source.GetNormalCoords(vertex);
+            output.PushVertex(pCoordinates[0], pCoordinates[1], pCoordinates[2]);
+            output.PushNormal(pNormalCoords[0], pNormalCoords[1], pNormalCoords[2]);
+
+            if (hasColors) {
+                const unsigned char* pRgbaColors = source.GetRgbaColors(vertex);
+                output.PushColor(pRgbaColors[0], pRgbaColors[1],
+                    pRgbaColors[2], pRgbaColors[3]);
+            }
+        }
+
+        output.PushIndex(remap[vertex]);
+    }
+}
+
+static void OptimizeTriangleOrder(const std::vector<unsigned int>& indices,
+    int vertexCount, std::vector<unsigned int>& output)
+{
+    const int triangleCount = ((int) indices.size()) / 3;
+
+    // Triangles that are yet to be emitted, listed per vertex.
+    std::vector<int> remaining(vertexCount, 0);
+    for (int index = 0; index < triangleCount * 3; ++index)
+        remaining[indices[index]]++;
+
+    std::vector<int> adjacencyOffsets(vertexCount + 1, 0);
+    for (int vertex = 0; vertex < vertexCount; ++vertex)
+        adjacencyOffsets[vertex + 1] = adjacencyOffsets[vertex] + remaining[vertex];
+
+    std::vector<int> adjacency(triangleCount * 3);
+    {
+        std::vector<int> cursors(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (int index = 0; index < triangleCount * 3; ++index)
+            adjacency[cursors[indices[index]]++] = index / 3;
+    }
+
+    std::vector<int> cachePositions(vertexCount, -1);
+    std::vector<float> vertexScores(vertexCount);
+    for (int vertex = 0; vertex < vertexCount; ++vertex)
+        vertexScores[vertex] = ForsythVertexScore(-1, remaining[vertex]);
+
+    std::vector<char> emitted(triangleCount, 0);
+
+    int cache[OPTIMIZER_CACHE_SIZE + 3];
+    int cacheCount = 0, bestTriangle = -1, nextTriangle = 0;
+
+    output.clear();
+    output.reserve(triangleCount * 3);
+
+    for (int count = 0; count < triangleCount; ++count)
+    {
+        if (bestTriangle < 0)
+        {
+            // Nothing in the cache is of use (e.g. a disconnected part of
+            // the mesh begins), carry on with the next pending triangle.
+            while (emitted[nextTriangle] != 0)
+                nextTriangle++;
+
+            bestTriangle = nextTriangle;
+        }
+
+        emitted[bestTriangle] = 1;
+
+        int newCache[OPTIMIZER_CACHE_SIZE + 3], newCacheCount = 0;
+        const unsigned int* pCorners = &indices[bestTriangle * 3];
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            const int vertex = ((int) pCorners[corner]);
+            output.push_back(pCorners[corner]);
+
+            // Drop the triangle from the pending list of its vertex.
+            int* pBegin = &adjacency[adjacencyOffsets[vertex]];
+            int* pLast = pBegin + (remaining[vertex] - 1);
+            for (int* pTriangle = pBegin; pTriangle <= pLast; ++pTriangle)
+            {
+                if (*pTriangle == bestTriangle) {
+                    std::swap(*pTriangle, *pLast);
+                    break;
+                }
+            }
+
+            remaining[vertex]--;
+
+            if (std::find(newCache, newCache + newCacheCount, vertex) == newCache + newCacheCount)
+                newCache[newCacheCount++] = vertex;
+        }
+
+        // Vertices of the emitted triangle move to the front of the cache.
+        const int triangleVertexCount = newCacheCount;
+        for (int entry = 0; entry < cacheCount; ++entry)
+        {
+            const int vertex = cache[entry];
+            auto pEnd = newCache + triangleVertexCount;
+            if (std::find(newCache, pEnd, vertex) == pEnd)
+                newCache[newCacheCount++] = vertex;
+        }
+
+        for (int entry = 0; entry < newCacheCount; ++entry)
+        {
+            const int vertex = newCache[entry];
+            cachePositions[vertex] = ((entry < OPTIMIZER_CACHE_SIZE) ? entry : -1);
+            vertexScores[vertex] = ForsythVertexScore(cachePositions[vertex], remaining[vertex]);
+        }
+
+        // Only triangles sharing a vertex with the cache (including those
+        // that were just evicted) changed their scores.
+        float bestScore = -1.0f;
+        bestTriangle = -1;
+
+        for (int entry = 0; entry < newCacheCount; ++entry)
+        {
+            const int vertex = newCache[entry];
+            const int* pTriangles = &adjacency[adjacencyOffsets[vertex]];
+            for (int i = 0; i < remaining[vertex]; ++i)
+            {
+                const int triangle = pTriangles[i];
+                const unsigned int* pOther = &indices[triangle * 3];
+                const float score = vertexScores[pOther[0]] +
+                    vertexScores[pOther[1]] + vertexScores[pOther[2]];
+
+                if (score > bestScore) {
+                    bestScore = score;
+                    bestTriangle = triangle;
+                }
+            }
+        }
+
+        cacheCount = ((newCacheCount < OPTIMIZER_CACHE_SIZE) ? newCacheCount : OPTIMIZER_CACHE_SIZE);
+        std::copy(newCache, newCache + cacheCount, cache);
+    }
+}
+
+void MeshProcessor::OptimizeVertexCache(const TriangleGeometryData& source,
+    TriangleGeometryData& optimized)
+{
+    const int vertexCount = source.VertexCount();
+    if (vertexCount <= 0)
+        return;
+
+    std::vector<unsigned int> indices, ordered;
+    GetTriangleIndices(source, indices);
+    OptimizeTriangleOrder(indices, vertexCount, ordered);
+
+    // Lay vertices out in the order they are first referenced, so that
+    // vertex fetches walk through memory (mostly) sequentially.
+    CompactVertices(source, ordered, optimized);
+}
+
+VertexCacheStatistics MeshProcessor::AnalyzeVertexCache(
+    const TriangleGeometryData& mesh, int cacheSize)
+{
+    VertexCacheStatistics statistics = { 0.0f, 0.0f };
+
+    std::vector<unsigned int> indices;
+    GetTriangleIndices(mesh, indices);
+    if (indices.empty() || cacheSize <= 0)
+        return statistics;
+
+    // Time stamp of each vertex entering the FIFO cache.
+    std::vector<int> cachedAt(mesh.VertexCount(), -1);
+    int misses = 0, uniqueVertices = 0;
+
+    auto iterator = indices.begin();
+    for (; iterator != indices.end(); ++iterator)
+    {
+        int& timestamp = cachedAt[*iterator];
+        if (timestamp < 0)
+            uniqueVertices++;
+
+        if (timestamp < 0 || (misses - timestamp) >= cacheSize)
+        {
+            timestamp = misses;
+            misses++;
+        }
+    }
+
+    statistics.acmr = ((float) misses) / (indices.size() / 3);
+    statistics.atvr = ((float) misses) / uniqueVertices;
+    return statistics;
+}
+
+// ================================================================================
+// Quadric error simplification
+// ================================================================================
+
+// Symmetric 4x4 matrix of the plane equations around a vertex, only the
+// upper triangle (a00 a01 a02 a03 a11 a12 a13 a22 a23 a33) is stored.
+struct Quadric
+{
+    double a[10];
+
+    void AddPlane(double x, double y, double z, double d, double weight)
+    {
+        a[0] += weight * x * x; a[1] += weight * x * y; a[2] += weight * x * z;
+        a[3] += weight * x * d; a[4] += weight * y * y; a[5] += weight * y * z;
+        a[6] += weight * y * d; a[7] += weight * z * z; a[8] += weight * z * d;
+        a[9] += weight * d * d;
+    }
+
+    void Add(const Quadric& other)
+    {
+        for (int i = 0; i < 10; ++i)
+            a[i] += other.a[i];
+    }
+
+    double Evaluate(const float* pPosition) const
+    {
+        const double x = pPosition[0], y = pPosition[1], z = pPosition[2];
+        return (a[0] * x * x) + (2.0 * a[1] * x * y) + (2.0 * a[2] * x * z) +
+            (2.0 * a[3] * x) + (a[4] * y * y) + (2.0 * a[5] * y * z) +
+            (2.0 * a[6] * y) + (a[7] * z * z) + (2.0 * a[8] * z) + a[9];
+    }
+};
+
+struct EdgeCollapse
+{
+    double cost;
+    unsigned int from, to;
+
+    bool operator<(const EdgeCollapse& other) const
+    {
+        return cost < other.cost;
+    }
+};
+
+static void TriangleNormal(const float* p0, const float* p1, const float* p2, float* pNormal)
+{
+    const float e0[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+    const float e1[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+    pNormal[0] = (e0[1] * e1[2]) - (e0[2] * e1[1]);
+    pNormal[1] = (e0[2] * e1[0]) - (e0[0] * e1[2]);
+    pNormal[2] = (e0[0] * e1[1]) - (e0[1] * e1[0]);
+}
+
+// Moving "from" onto "to" must not turn any of the remaining triangles
+// around "from" over, or collapse them into a zero area sliver.
+static bool IsCollapseValid(const TriangleGeometryData& mesh,
+    const std::vector<unsigned int>& indices, const int* pTriangles,
+    int triangleCount, unsigned int from, unsigned int to)
+{
+    for (int i = 0; i < triangleCount; ++i)
+    {
+        const unsigned int* pCorners = &indices[pTriangles[i] * 3];
+        if (pCorners[0] == to || pCorners[1] == to || pCorners[2] == to)
+            continue; // This triangle goes away with the collapse.
+
+        const float* p[3], *q[3];
+        for (int corner = 0; corner < 3; ++corner) {
+            p[corner] = mesh.GetCoordinates(pCorners[corner]);
+            q[corner] = ((pCorners[corner] == from) ? mesh.GetCoordinates(to) : p[corner]);
+        }
+
+        float before[3], after[3];
+        TriangleNormal(p[0], p[1], p[2], before);
+        TriangleNormal(q[0], q[1], q[2], after);
+
+        const float dot = (before[0] * after[0]) + (before[1] * after[1]) + (before[2] * after[2]);
+        if (dot <= 0.0f)
+            return false;
+    }
+
+    return true;
+}
+
+void MeshProcessor::Simplify(const TriangleGeometryData& source,
+    int targetTriangleCount, TriangleGeometryData& simplified)
+{
+    const int vertexCount = source.VertexCount();
+    if (vertexCount <= 0)
+        return;
+
+    std::vector<unsigned int> indices;
+    GetTriangleIndices(source, indices);
+
+    // Each vertex starts off with the (area weighted) planes around it.
+    std::vector<Quadric> quadrics(vertexCount);
+    memset(&quadrics[0], 0, quadrics.size() * sizeof(Quadric));
+
+    for (std::size_t index = 0; index + 2 < indices.size(); index += 3)
+    {
+        const float* p0 = source.GetCoordinates(indices[index + 0]);
+        float normal[3];
+        TriangleNormal(p0, source.GetCoordinates(indices[index + 1]),
+            source.GetCoordinates(indices[index + 2]), normal);
+
+        const double length = std::sqrt((double) (normal[0] * normal[0] +
+            normal[1] * normal[1] + normal[2] * normal[2]));
+        if (length <= 0.0)
+            continue;
+
+        const double x = normal[0] / length, y = normal[1] / length, z = normal[2] / length;
+        const double d = -((x * p0[0]) + (y * p0[1]) + (z * p0[2]));
+        for (int corner = 0; corner < 3; ++corner)
+            quadrics[indices[index + corner]].AddPlane(x, y, z, d, length * 0.5);
+    }
+
+    // An edge used by anything other than two triangles lies on an open
+    // boundary (or a seam where welding kept vertices apart), lock both
+    // of its vertices in place.
+    std::vector<char> locked(vertexCount, 0);
+    {
+        std::unordered_map<unsigned long long, int> edgeUses;
+        edgeUses.reserve(indices.size());
+        for (std::size_t index = 0; index + 2 < indices.size(); index += 3)
+        {
+            for (int edge = 0; edge < 3; ++edge)
+            {
+                unsigned long long v0 = indices[index + edge];
+                unsigned long long v1 = indices[index + ((edge + 1) % 3)];
+                if (v0 > v1)
+                    std::swap(v0, v1);
+
+                edgeUses[(v0 << 32) | v1]++;
+            }
+        }
+
+        auto iterator = edgeUses.begin();
+        for (; iterator != edgeUses.end(); ++iterator)
+        {
+            if (iterator->second != 2) {
+                locked[(unsigned int) (iterator->first >> 32)] = 1;
+                locked[(unsigned int) (iterator->first & 0xffffffff)] = 1;
+            }
+        }
+    }
+
+    std::vector<EdgeCollapse> collapses;
+    std::vector<int> adjacencyOffsets, adjacency;
+    std::vector<unsigned int> collapseTargets(vertexCount);
+    std::vector<char> touched(vertexCount);
+
+    int triangleCount = ((int) indices.size()) / 3;
+    while (triangleCount > targetTriangleCount)
+    {
+        // Candidate collapses of this pass, cheapest first.
+        collapses.clear();
+        for (std::size_t index = 0; index < indices.size(); index += 3)
+        {
+            for (int edge = 0; edge < 3; ++edge)
+            {
+                const unsigned int v0 = indices[index + edge];
+                const unsigned int v1 = indices[index + ((edge + 1) % 3)];
+
+                Quadric combined = quadrics[v0];
+                combined.Add(quadrics[v1]);
+
+                if (locked[v0] == 0) {
+                    EdgeCollapse collapse = { combined.Evaluate(source.GetCoordinates(v1)), v0, v1 };
+                    collapses.push_back(collapse);
+                }
+
+                if (locked[v1] == 0) {
+                    EdgeCollapse collapse = { combined.Evaluate(source.GetCoordinates(v0)), v1, v0 };
+                    collapses.push_back(collapse);
+                }
+            }
+        }
+
+        if (collapses.empty())
+            break;
+
+        std::sort(collapses.begin(), collapses.end());
+
+        // Triangles around each vertex, for validating collapses.
+        adjacencyOffsets.assign(vertexCount + 1, 0);
+        for (std::size_t index = 0; index < indices.size(); ++index)
+            adjacencyOffsets[indices[index] + 1]++;
+        for (int vertex = 0; vertex < vertexCount; ++vertex)
+            adjacencyOffsets[vertex + 1] += adjacencyOffsets[vertex];
+
+        adjacency.resize(indices.size());
+        {
+            std::vector<int> cursors(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for (std::size_t index = 0; index < indices.size(); ++index)
+                adjacency[cursors[indices[index]]++] = ((int) index) / 3;
+        }
+
+        for (int vertex = 0; vertex < vertexCount; ++vertex)
+            collapseTargets[vertex] = ((unsigned int) vertex);
+
+        // A vertex takes part in one collapse per pass, neighbours of a
+        // collapsed vertex are left alone so validation stays accurate.
+        std::fill(touched.begin(), touched.end(), 0);
+        int removedTriangles = 0, collapseCount = 0;
+        const int trianglesToRemove = triangleCount - targetTriangleCount;
+
+        auto iterator = collapses.begin();
+        for (; iterator != collapses.end(); ++iterator)
+        {
+            if (removedTriangles >= trianglesToRemove)
+                break;
+
+            const unsigned int from = iterator->from, to = iterator->to;
+            if (touched[from] != 0 || touched[to] != 0)
+                continue;
+
+            const int* pTriangles = &adjacency[adjacencyOffsets[from]];
+            const int count = adjacencyOffsets[from + 1] - adjacencyOffsets[from];
+            if (!IsCollapseValid(source, indices, pTriangles, count, from, to))
+                continue;
+
+            collapseTargets[from] = to;
+            quadrics[to].Add(quadrics[from]);
+            collapseCount++;
+
+            for (int i = 0; i < count; ++i)
+            {
+                const unsigned int* pCorners = &indices[pTriangles[i] * 3];
+                if (pCorners[0] == to || pCorners[1] == to || pCorners[2] == to)
+                    removedTriangles++;
+
+                touched[pCorners[0]] = touched[pCorners[1]] = touched[pCorners[2]] = 1;
+            }
+        }
+
+        if (collapseCount == 0)
+            break; // Nothing more can be collapsed.
+
+        // Apply the collapses, dropping triangles that degenerated.
+        std::size_t output = 0;
+        for (std::size_t index = 0; index < indices.size(); index += 3)
+        {
+            const unsigned int v0 = collapseTargets[indices[index + 0]];
+            const unsigned int v1 = collapseTargets[indices[index + 1]];
+            const unsigned int v2 = collapseTargets[indices[index + 2]];
+            if (v0 == v1 || v1 == v2 || v2 == v0)
+                continue;
+
+            indices[output++] = v0;
+            indices[output++] = v1;
+            indices[output++] = v2;
+        }
+
+        indices.resize(output);
+        triangleCount = ((int) indices.size()) / 3;
+    }
+
+    // Only vertices that are still referenced make it into the result.
+    CompactVertices(source, indices, simplified);
+}
+
+// ================================================================================
+// Mesh clustering
+// ================================================================================
+
+struct CentroidBelow
+{
+    const float* pCentroids;
+    int axis;
+    float median;
+
+    bool operator()(unsigned int triangle) const
+    {
+        return pCentroids[triangle * 3 + axis] < median;
+    }
+};
+
+// Halves the triangles from "begin" to "end" at the median of their
+// centroids along the longest axis, until no part has more than
+// "clusterSize" of them. The range of each part goes into "ranges".
+// 
+static void SplitTriangles(const std::vector<float>& centroids, int clusterSize,
+    std::vector<unsigned int>& triangles, int begin, int end, std::vector<int>& ranges)
+{
+    const int count = end - begin;
+    if (count <= clusterSize) {
+        ranges.push_back(begin);
+        ranges.push_back(end);
+        return;
+    }
+
+    float min[3], max[3];
+    const float* pCentroid = &centroids[triangles[begin] * 3];
+    for (int axis = 0; axis < 3; ++axis)
+        min[axis] = max[axis] = pCentroid[axis];
+
+    for (int index = begin + 1; index < end; ++index)
+    {
+        pCentroid = &centroids[triangles[index] * 3];
+        for (int axis = 0; axis < 3; ++axis) {
+            min[axis] = ((pCentroid[axis] < min[axis]) ? pCentroid[axis] : min[axis]);
+            max[axis] = ((pCentroid[axis] > max[axis]) ? pCentroid[axis] : max[axis]);
+        }
+    }
+
+    int axis = 0;
+    if (max[1] - min[1] > max[axis] - min[axis])
+        axis = 1;
+    if (max[2] - min[2] > max[axis] - min[axis])
+        axis = 2;
+
+    std::vector<float> values(count);
+    for (int index = 0; index < count; ++index)
+        values[index] = centroids[triangles[begin + index] * 3 + axis];
+
+    std::nth_element(values.begin(), values.begin() + count / 2, values.end());
+
+    // A stable partition keeps the order triangles were optimized into.
+    CentroidBelow below = { &centroids[0], axis, values[count / 2] };
+    auto middle = std::stable_partition(triangles.begin() + begin,
+        triangles.begin() + end, below);
+
+    int split = ((int) (middle - triangles.begin()));
+    if (split == begin || split == end)
+        split = begin + (count / 2); // Centroids coincide along the axis.
+
+    SplitTriangles(centroids, clusterSize, triangles, begin, split, ranges);
+    SplitTriangles(centroids, clusterSize, triangles, split, end, ranges);
+}
+
+// A mesh is closed if every edge is shared by exactly two triangles that
+// run along it in opposite directions (vertices are told apart by their
+// positions alone, so that seams in normals or colors do not count as
+// openings). "orientation" is then 1.0 for outward facing triangles.
+// 
+static bool IsClosedMesh(const TriangleGeometryData& mesh,
+    const std::vector<unsigned int>& indices, float& orientation)
+{
+    std::unordered_map<WeldKey, unsigned int, WeldKeyHasher> positionIds;
+    std::vector<unsigned int> vertexPositions(mesh.VertexCount());
+    for (int vertex = 0; vertex < mesh.VertexCount(); ++vertex)
+    {
+        WeldKey key = { 0 };
+        const float* pCoordinates = mesh.GetCoordinates(vertex);
+        for (int axis = 0; axis < 3; ++axis)
+            key.position[axis] = ToWeldCell(pCoordinates[axis], 0.0f);
+
+        auto inserted = positionIds.insert(std::make_pair(key,
+            ((unsigned int) positionIds.size())));
+        vertexPositions[vertex] = inserted.first->second;
+    }
+
+    double volume = 0.0;
+    std::vector<unsigned long long> edges;
+    edges.reserve(indices.size());
+
+    for (std::size_t index = 0; index < indices.size(); index += 3)
+    {
+        const unsigned int corners[3] = {
+            vertexPositions[indices[index + 0]],
+            vertexPositions[indices[index + 1]],
+            vertexPositions[indices[index + 2]]
+        };
+
+        if (corners[0] == corners[1] || corners[1] == corners[2] || corners[2] == corners[0])
+            continue; // Degenerate triangles do not close anything.
+
+        for (int corner = 0; corner < 3; ++corner) {
+            const unsigned long long from = corners[corner];
+            edges.push_back((from << 32) | corners[(corner + 1) % 3]);
+        }
+
+        // Signed volume of the tetrahedron with the origin (times six).
+        const float* p0 = mesh.GetCoordinates(indices[index + 0]);
+        const float* p1 = mesh.GetCoordinates(indices[index + 1]);
+        const float* p2 = mesh.GetCoordinates(indices[index + 2]);
+        volume += (p0[0] * ((double) p1[1] * p2[2] - (double) p1[2] * p2[1])) +
+            (p0[1] * ((double) p1[2] * p2[0] - (double) p1[0] * p2[2])) +
+            (p0[2] * ((double) p1[0] * p2[1] - (double) p1[1] * p2[0]));
+    }
+
+    if (edges.empty())
+        return false;
+
+    std::sort(edges.begin(), edges.end());
+    for (std::size_t edge = 0; edge < edges.size(); ++edge)
+    {
+        if (edge > 0 && edges[edge] == edges[edge - 1])
+            return false; // More than two triangles along the same edge.
+
+        const unsigned long long reversed = (edges[edge] >> 32) | (edges[edge] << 32);
+        if (!std::binary_search(edges.begin(), edges.end(), reversed))
+            return false;
+    }
+
+    orientation = ((volume < 0.0) ? -1.0f : 1.0f);
+    return true;
+}
+
+void MeshProcessor::BuildClusters(const TriangleGeometryData& source,
+    int clusterSize, TriangleGeometryData& clustered)
+{
+    const int vertexCount = source.VertexCount();
+    if (vertexCount <= 0)
+        return;
+
+    std::vector<unsigned int> indices;
+    GetTriangleIndices(source, indices);
+    const int triangleCount = ((int) indices.size()) / 3;
+
+    std::vector<float> centroids(triangleCount * 3);
+    std::vector<unsigned int> triangles(triangleCount);
+    for (int triangle = 0; triangle < triangleCount; ++triangle)
+    {
+        triangles[triangle] = ((unsigned int) triangle);
+        const float* p0 = source.GetCoordinates(indices[triangle * 3 + 0]);
+        const float* p1 = source.GetCoordinates(indices[triangle * 3 + 1]);
+        const float* p2 = source.GetCoordinates(indices[triangle * 3 + 2]);
+        for (int axis = 0; axis < 3; ++axis)
+            centroids[triangle * 3 + axis] = (p0[axis] + p1[axis] + p2[axis]) / 3.0f;
+    }
+
+    std::vector<int> ranges;
+    if (triangleCount > 0)
+        SplitTriangles(centroids, clusterSize, triangles, 0, triangleCount, ranges);
+
+    std::vector<unsigned int> ordered;
+    ordered.reserve(indices.size());
+    for (int triangle = 0; triangle < triangleCount; ++triangle) {
+        const unsigned int first = triangles[triangle] * 3;
+        ordered.insert(ordered.end(), &indices[first], &indices[first] + 3);
+    }
+
+    // Each cluster reads vertices that are next to one another.
+    CompactVertices(source, ordered, clustered);
+    indices.assign(clustered.GetIndices(), clustered.GetIndices() + clustered.IndexCount());
+
+    float orientation = 1.0f;
+    const bool closed = IsClosedMesh(clustered, indices, orientation);
+
+    std::vector<MeshCluster> clusters(ranges.size() / 2);
+    for (std::size_t cluster = 0; cluster < clusters.size(); ++cluster)
+    {
+        MeshCluster& current = clusters[cluster];
+        current.firstIndex = ranges[cluster * 2 + 0] * 3;
+        current.indexCount = ranges[cluster * 2 + 1] * 3 - current.firstIndex;
+
+        const unsigned int* pIndices = &indices[current.firstIndex];
+        float min[3], max[3];
+        const float* pFirst = clustered.GetCoordinates(pIndices[0]);
+        for (int axis = 0; axis < 3; ++axis)
+            min[axis] = max[axis] = pFirst[axis];
+
+        for (int index = 1; index < current.indexCount; ++index)
+        {
+            const float* pCoordinates = clustered.GetCoordinates(pIndices[index]);
+            for (int axis = 0; axis < 3; ++axis) {
+                min[axis] = ((pCoordinates[axis] < min[axis]) ? pCoordinates[axis] : min[axis]);
+                max[axis] = ((pCoordinates[axis] > max[axis]) ? pCoordinates[axis] : max[axis]);
+            }
+        }
+
+        float squaredRadius = 0.0f;
+        for (int axis = 0; axis < 3; ++axis)
+            current.center[axis] = (min[axis] + max[axis]) * 0.5f;
+
+        for (int index = 0; index < current.indexCount; ++index)
+        {
+            const float* pCoordinates = clustered.GetCoordinates(pIndices[index]);
+            const float dx = pCoordinates[0] - current.center[0];
+            const float dy = pCoordinates[1] - current.center[1];
+            const float dz = pCoordinates[2] - current.center[2];
+            const float squared = (dx * dx) + (dy * dy) + (dz * dz);
+            squaredRadius = ((squared > squaredRadius) ? squared : squaredRadius);
+        }
+
+        current.radius = std::sqrt(squaredRadius);
+        current.coneAxis[0] = current.coneAxis[1] = current.coneAxis[2] = 0.0f;
+        current.coneAngle = -1.0f;
+        if (closed == false)
+            continue;
+
+        // Cone around the average facing of the triangles, it has to be
+        // narrower than a hemisphere to ever face away as a whole.
+        std::vector<float> normals;
+        normals.reserve(current.indexCount);
+        float axis[3] = { 0.0f, 0.0f, 0.0f };
+        for (int index = 0; index < current.indexCount; index += 3)
+        {
+            float normal[3];
+            TriangleNormal(clustered.GetCoordinates(pIndices[index + 0]),
+                clustered.GetCoordinates(pIndices[index + 1]),
+                clustered.GetCoordinates(pIndices[index + 2]), &normal[0]);
+
+            const float length = std::sqrt((normal[0] * normal[0]) +
+                (normal[1] * normal[1]) + (normal[2] * normal[2]));
+            if (length <= 0.0f)
+                continue; // Degenerate triangles are never seen.
+
+            for (int component = 0; component < 3; ++component) {
+                normals.push_back(normal[component] * orientation / length);
+                axis[component] += normals.back();
+            }
+        }
+
+        const float length = std::sqrt((axis[0] * axis[0]) + (axis[1] * axis[1]) + (axis[2] * axis[2]));
+        if (normals.empty() || length <= 0.0f)
+            continue;
+
+        float minimumDot = 1.0f;
+        for (std::size_t normal = 0; normal < normals.size(); normal += 3) {
+            const float dot = ((normals[normal + 0] * axis[0]) +
+                (normals[normal + 1] * axis[1]) + (normals[normal + 2] * axis[2])) / length;
+            minimumDot = ((dot < minimumDot) ? dot : minimumDot);
+        }
+
+        if (minimumDot > 0.0f)
+        {
+            current.coneAxis[0] = axis[0] / length;
+            current.coneAxis[1] = axis[1] / length;
+            current.coneAxis[2] = axis[2] / length;
+            current.coneAngle = std::acos((minimumDot < 1.0f) ? minimumDot : 1.0f);
+        }
+    }
+
+    clustered.SetClusters(clusters);
+}
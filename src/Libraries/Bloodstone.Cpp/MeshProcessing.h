@@ -0,0 +1,62 @@
+
+#ifndef _BLOODSTONE_MESHPROCESSING_H_
+#define _BLOODSTONE_MESHPROCESSING_H_
+
+#include "Interfaces.h"
+
+namespace Dynamo { namespace Bloodstone {
+
+    struct VertexCacheStatistics
+    {
+        // Average cache miss ratio: vertex shader invocations per triangle,
+        // 3.0 for an unindexed mesh and approaching 0.5 for large grids.
+        float acmr;
+
+        // Average transform to vertex ratio: vertex shader invocations per
+        // unique vertex, where 1.0 is the best possible value.
+        float atvr;
+    };
+
+    class MeshProcessor
+    {
+    public:
+        // Merges vertices whose positions fall into the same "epsilon" sized
+        // cell, whose normals fall into the same "normalEpsilon" sized cell
+        // and whose colors are identical, producing an indexed mesh in
+        // "welded". An epsilon of zero (or less) merges only coordinates
+        // that are bitwise identical.
+        // 
+        static void Weld(const TriangleGeometryData& source, float epsilon,
+            float normalEpsilon, TriangleGeometryData& welded);
+
+        // Reorders triangles of an indexed mesh for the post-transform
+        // vertex cache (Tom Forsyth's linear-speed algorithm), then lays
+        // the vertices out in the order they are first referenced.
+        // 
+        static void OptimizeVertexCache(const TriangleGeometryData& source,
+            TriangleGeometryData& optimized);
+
+        // Splits an indexed mesh into clusters of at most "clusterSize"
+        // triangles by halving it along its longest axis, keeping triangles
+        // in their current (cache optimized) order within each cluster.
+        // Normal cones are only given where the mesh is closed, open ones
+        // are drawn from both sides and never face away from the viewer.
+        // 
+        static void BuildClusters(const TriangleGeometryData& source,
+            int clusterSize, TriangleGeometryData& clustered);
+
+        // Collapses edges of an indexed mesh in the order of their quadric
+        // error until at most "targetTriangleCount" triangles remain (or no
+        // further edge can be collapsed). Vertices on open boundaries and
+        // attribute seams are never moved, so outlines are kept intact.
+        // 
+        static void Simplify(const TriangleGeometryData& source,
+            int targetTriangleCount, TriangleGeometryData& simplified);
+
+        // Simulates a FIFO post-transform cache of "cacheSize" entries.
+        static VertexCacheStatistics AnalyzeVertexCache(
+            const TriangleGeometryData& mesh, int cacheSize);
+    };
+} }
+
+#endif
@@ -0,0 +1,324 @@
+// NodeHierarchy.cpp : Compiled into the native tests as well, see
+// "NodeHierarchy" in "NodeHierarchy.h".
+//
+
+#include "stdafx.h"
+#include "NodeHierarchy.h"
+
+#include <cstring>
+#include <algorithm>
+
+using namespace Dynamo::Bloodstone;
+
+// Nodes are binned along one axis when the hierarchy is built, branches
+// with no more than "NODE_HIERARCHY_LEAF_SIZE" nodes are not split further.
+#define NODE_HIERARCHY_BIN_COUNT        12
+#define NODE_HIERARCHY_LEAF_SIZE        4
+
+static float GetHalfSurfaceArea(const float* pMin, const float* pMax)
+{
+    const float dx = pMax[0] - pMin[0];
+    const float dy = pMax[1] - pMin[1];
+    const float dz = pMax[2] - pMin[2];
+    return (dx * dy) + (dy * dz) + (dz * dx);
+}
+
+static void MergeBounds(float* pMin, float* pMax, const float* pOtherMin, const float* pOtherMax)
+{
+    for (int axis = 0; axis < 3; ++axis) {
+        pMin[axis] = ((pOtherMin[axis] < pMin[axis]) ? pOtherMin[axis] : pMin[axis]);
+        pMax[axis] = ((pOtherMax[axis] > pMax[axis]) ? pOtherMax[axis] : pMax[axis]);
+    }
+}
+
+static int GetBin(float center, float minimum, float extent)
+{
+    // Centers that are not a number end up in the first bin.
+    const int bin = ((int) (((center - minimum) / extent) * NODE_HIERARCHY_BIN_COUNT));
+    return ((bin < 0) ? 0 : ((bin < NODE_HIERARCHY_BIN_COUNT) ? bin : NODE_HIERARCHY_BIN_COUNT - 1));
+}
+
+NodeHierarchy::NodeHierarchy(void)
+{
+    mStatistics.nodesTested = 0;
+    mStatistics.nodesCulled = 0;
+    mStatistics.nodesDrawn = 0;
+}
+
+void NodeHierarchy::Build(const std::vector<NodeBounds>& nodes, int slotCount)
+{
+    mBranches.clear();
+    mEntrySlots.clear();
+    mEntryBounds.clear();
+    mLeafOfSlot.assign(slotCount, -1);
+
+    if (nodes.empty())
+        return;
+
+    const int entryCount = ((int) nodes.size());
+    std::vector<BuildEntry> entries(entryCount);
+    for (int index = 0; index < entryCount; ++index)
+    {
+        BuildEntry& entry = entries[index];
+        entry.bounds = nodes[index];
+        for (int axis = 0; axis < 3; ++axis)
+            entry.center[axis] = (entry.bounds.min[axis] + entry.bounds.max[axis]) * 0.5f;
+    }
+
+    mEntrySlots.resize(entryCount);
+    mEntryBounds.resize(entryCount * 6);
+    mBranches.reserve(entryCount * 2);
+
+    Branch root;
+    root.parent = -1;
+    mBranches.push_back(root);
+    BuildBranch(0, entries, 0, entryCount);
+}
+
+void NodeHierarchy::BuildBranch(int branch,
+    std::vector<BuildEntry>& entries, int begin, int end)
+{
+    // Bounds of the nodes, and of their centers (which are binned).
+    float centerMin[3], centerMax[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        mBranches[branch].min[axis] = entries[begin].bounds.min[axis];
+        mBranches[branch].max[axis] = entries[begin].bounds.max[axis];
+        centerMin[axis] = centerMax[axis] = entries[begin].center[axis];
+    }
+
+    for (int index = begin + 1; index < end; ++index) {
+        const BuildEntry& entry = entries[index];
+        MergeBounds(mBranches[branch].min, mBranches[branch].max,
+            entry.bounds.min, entry.bounds.max);
+        MergeBounds(centerMin, centerMax, entry.center, entry.center);
+    }
+
+    mBranches[branch].child = -1;
+    mBranches[branch].first = begin;
+    mBranches[branch].count = end - begin;
+
+    if (end - begin <= NODE_HIERARCHY_LEAF_SIZE)
+    {
+        for (int index = begin; index < end; ++index)
+        {
+            const BuildEntry& entry = entries[index];
+            mEntrySlots[index] = entry.bounds.slot;
+            mLeafOfSlot[entry.bounds.slot] = branch;
+            for (int axis = 0; axis < 3; ++axis) {
+                mEntryBounds[index * 6 + axis] = entry.bounds.min[axis];
+                mEntryBounds[index * 6 + axis + 3] = entry.bounds.max[axis];
+            }
+        }
+
+        return;
+    }
+
+    int axis = 0;
+    for (int other = 1; other < 3; ++other) {
+        if (centerMax[other] - centerMin[other] > centerMax[axis] - centerMin[axis])
+            axis = other;
+    }
+
+    int middle = begin + ((end - begin) / 2);
+    const float extent = centerMax[axis] - centerMin[axis];
+    if (extent > 0.0f)
+    {
+        // Center at "centerMax" lands in the last bin, that at "centerMin"
+        // in the first one, so there is always a split with nodes on both
+        // sides (otherwise the centers coincide, and are split in half).
+        // 
+        int binCounts[NODE_HIERARCHY_BIN_COUNT] = { 0 };
+        float binBounds[NODE_HIERARCHY_BIN_COUNT][6];
+
+        for (int index = begin; index < end; ++index)
+        {
+            const BuildEntry& entry = entries[index];
+            const int bin = GetBin(entry.center[axis], centerMin[axis], extent);
+            float* pBounds = &binBounds[bin][0];
+            if (binCounts[bin]++ == 0) {
+                memcpy(pBounds, entry.bounds.min, sizeof(entry.bounds.min));
+                memcpy(pBounds + 3, entry.bounds.max, sizeof(entry.bounds.max));
+            }
+            else
+                MergeBounds(pBounds, pBounds + 3, entry.bounds.min, entry.bounds.max);
+        }
+
+        // Cost of splitting after each bin, the area of both sides weighed
+        // by the number of nodes on them. Left side is swept first.
+        float costs[NODE_HIERARCHY_BIN_COUNT - 1];
+        float sideBounds[6];
+        int sideCount = 0;
+        for (int bin = 0; bin < NODE_HIERARCHY_BIN_COUNT - 1; ++bin)
+        {
+            if (binCounts[bin] > 0) {
+                if (sideCount == 0)
+                    memcpy(&sideBounds[0], &binBounds[bin][0], sizeof(sideBounds));
+                else
+                    MergeBounds(&sideBounds[0], &sideBounds[3], &binBounds[bin][0], &binBounds[bin][3]);
+                sideCount += binCounts[bin];
+            }
+
+            costs[bin] = ((sideCount > 0) ?
+                GetHalfSurfaceArea(&sideBounds[0], &sideBounds[3]) * sideCount : -1.0f);
+        }
+
+        sideCount = 0;
+        for (int bin = NODE_HIERARCHY_BIN_COUNT - 1; bin > 0; --bin)
+        {
+            if (binCounts[bin] > 0) {
+                if (sideCount == 0)
+                    memcpy(&sideBounds[0], &binBounds[bin][0], sizeof(sideBounds));
+                else
+                    MergeBounds(&sideBounds[0], &sideBounds[3], &binBounds[bin][0], &binBounds[bin][3]);
+                sideCount += binCounts[bin];
+            }
+
+            if (sideCount == 0 || costs[bin - 1] < 0.0f)
+                costs[bin - 1] = -1.0f; // Either side would be empty.
+            else
+                costs[bin - 1] += GetHalfSurfaceArea(&sideBounds[0], &sideBounds[3]) * sideCount;
+        }
+
+        int split = -1;
+        for (int bin = 0; bin < NODE_HIERARCHY_BIN_COUNT - 1; ++bin) {
+            if (costs[bin] >= 0.0f && (split < 0 || costs[bin] < costs[split]))
+                split = bin;
+        }
+
+        // Nodes in bins up to (and including) "split" go to the left.
+        int left = begin, right = end - 1;
+        while (left <= right)
+        {
+            if (GetBin(entries[left].center[axis], centerMin[axis], extent) <= split)
+                left++;
+            else
+                std::swap(entries[left], entries[right--]);
+        }
+
+        middle = left;
+    }
+
+    const int child = ((int) mBranches.size());
+    mBranches[branch].child = child;
+
+    Branch children[2];
+    children[0].parent = children[1].parent = branch;
+    mBranches.push_back(children[0]);
+    mBranches.push_back(children[1]);
+
+    BuildBranch(child, entries, begin, middle);
+    BuildBranch(child + 1, entries, middle, end);
+}
+
+void NodeHierarchy::Refit(int slot, const float* pMin, const float* pMax)
+{
+    if (slot >= ((int) mLeafOfSlot.size()) || mLeafOfSlot[slot] < 0)
+        return; // The node came after the hierarchy was built.
+
+    const int leaf = mLeafOfSlot[slot];
+    const Branch& branch = mBranches[leaf];
+    for (int index = branch.first; index < branch.first + branch.count; ++index)
+    {
+        if (mEntrySlots[index] == slot) {
+            float* pBounds = &mEntryBounds[index * 6];
+            memcpy(pBounds, pMin, sizeof(float) * 3);
+            memcpy(pBounds + 3, pMax, sizeof(float) * 3);
+        }
+    }
+
+    // Branches above only ever get their bounds from their children.
+    for (int current = leaf; current >= 0; current = mBranches[current].parent)
+        EvaluateBranch(current);
+}
+
+void NodeHierarchy::EvaluateBranch(int branch)
+{
+    Branch& current = mBranches[branch];
+    if (current.child >= 0)
+    {
+        const Branch& left = mBranches[current.child];
+        const Branch& right = mBranches[current.child + 1];
+        memcpy(current.min, left.min, sizeof(current.min));
+        memcpy(current.max, left.max, sizeof(current.max));
+        MergeBounds(current.min, current.max, right.min, right.max);
+        return;
+    }
+
+    const float* pBounds = &mEntryBounds[current.first * 6];
+    memcpy(current.min, pBounds, sizeof(current.min));
+    memcpy(current.max, pBounds + 3, sizeof(current.max));
+    for (int index = 1; index < current.count; ++index) {
+        pBounds = pBounds + 6;
+        MergeBounds(current.min, current.max, pBounds, pBounds + 3);
+    }
+}
+
+void NodeHierarchy::Cull(const Frustum& frustum, std::vector<int>& visibleSlots) const
+{
+    Collect(frustum, false, visibleSlots, mStatistics);
+}
+
+void NodeHierarchy::Query(const Frustum& frustum, bool contained, std::vector<int>& slots) const
+{
+    CullingStatistics statistics; // Of no interest here.
+    Collect(frustum, contained, slots, statistics);
+}
+
+void NodeHierarchy::Collect(const Frustum& frustum, bool contained,
+    std::vector<int>& slots, CullingStatistics& statistics) const
+{
+    slots.clear();
+    statistics.nodesTested = 0;
+    statistics.nodesCulled = 0;
+    statistics.nodesDrawn = 0;
+
+    if (mBranches.empty())
+        return;
+
+    mTraversal.clear();
+    mTraversal.push_back(0);
+    while (!mTraversal.empty())
+    {
+        const Branch& branch = mBranches[mTraversal.back()];
+        mTraversal.pop_back();
+
+        const int end = branch.first + branch.count;
+        switch (frustum.Classify(branch.min, branch.max))
+        {
+        case Frustum::Containment::Outside:
+            statistics.nodesCulled += branch.count;
+            break;
+
+        case Frustum::Containment::Inside:
+            slots.insert(slots.end(),
+                mEntrySlots.begin() + branch.first, mEntrySlots.begin() + end);
+            break;
+
+        default:
+            if (branch.child >= 0) {
+                mTraversal.push_back(branch.child + 1);
+                mTraversal.push_back(branch.child);
+                break;
+            }
+
+            for (int index = branch.first; index < end; ++index)
+            {
+                const float* pBounds = &mEntryBounds[index * 6];
+                statistics.nodesTested++;
+                const auto containment = frustum.Classify(pBounds, pBounds + 3);
+                if (containment == Frustum::Containment::Outside)
+                    statistics.nodesCulled++;
+                else if (containment == Frustum::Containment::Inside || !contained)
+                    slots.push_back(mEntrySlots[index]);
+            }
+            break;
+        }
+    }
+
+    statistics.nodesDrawn = ((int) slots.size());
+}
+
+void NodeHierarchy::GetCullingStatistics(CullingStatistics* pStatistics) const
+{
+    (*pStatistics) = mStatistics;
+}
@@ -0,0 +1,82 @@
+#ifndef _NODEHIERARCHY_H_
+#define _NODEHIERARCHY_H_
+
+#include "Interfaces.h"
+
+namespace Dynamo { namespace Bloodstone {
+
+    struct CullingStatistics
+    {
+        int nodesTested;    // Nodes whose own bounds were tested against the frustum.
+        int nodesCulled;    // Nodes outside the frustum, on their own or with a branch.
+        int nodesDrawn;     // Nodes left to be drawn.
+    };
+
+    // Bounds of a node, in the slot it has in the "NodeTable".
+    struct NodeBounds
+    {
+        int slot;
+        float min[3];
+        float max[3];
+    };
+
+    // Bounding volume hierarchy over the bounds of every node of a
+    // "NodeTable", built top-down by binning node centers along the widest
+    // axis and splitting where the surface area heuristic is lowest. Nodes
+    // coming or going require it to be built again, a node with replaced
+    // geometries only has the branches above it refitted. It is given the
+    // bounds rather than the nodes, and so depends on nothing but
+    // "Interfaces.h" (the native tests build it on its own).
+    // 
+    class NodeHierarchy
+    {
+    public:
+        NodeHierarchy(void);
+
+        // Slots of "nodes" are all below "slotCount", each listed once.
+        void Build(const std::vector<NodeBounds>& nodes, int slotCount);
+        void Refit(int slot, const float* pMin, const float* pMax);
+
+        // Slots of nodes (partly) inside the frustum, in no particular order.
+        void Cull(const Frustum& frustum, std::vector<int>& visibleSlots) const;
+        void GetCullingStatistics(CullingStatistics* pStatistics) const;
+
+        // Same as "Cull" (only nodes entirely inside the frustum if "contained"
+        // is set), without touching the statistics of the last frame drawn.
+        void Query(const Frustum& frustum, bool contained, std::vector<int>& slots) const;
+
+    private:
+        // Nodes of a branch are those of "mEntrySlots" in the range from
+        // "first" to "first + count", its children (if any) are "child"
+        // and "child + 1". Children always cover adjacent ranges.
+        struct Branch
+        {
+            float min[3];
+            float max[3];
+            int parent;
+            int child;
+            int first;
+            int count;
+        };
+
+        struct BuildEntry
+        {
+            NodeBounds bounds;
+            float center[3];
+        };
+
+        void BuildBranch(int branch, std::vector<BuildEntry>& entries, int begin, int end);
+        void EvaluateBranch(int branch);
+        void Collect(const Frustum& frustum, bool contained,
+            std::vector<int>& slots, CullingStatistics& statistics) const;
+
+        std::vector<Branch> mBranches;
+        std::vector<int> mEntrySlots;
+        std::vector<float> mEntryBounds; // Minimum and maximum corner of each entry.
+        std::vector<int> mLeafOfSlot; // Branch holding the node of each slot, or -1.
+        mutable std::vector<int> mTraversal;
+        mutable CullingStatistics mStatistics;
+    };
+} }
+
+#endif
@@ -2,13 +2,184 @@
 #include "stdafx.h"
 #include "Bloodstone.h"
 #include "NodeSceneData.h"
+#include "MeshProcessing.h"
+#include "Picking.h"
+#include "RenderQueue.h"
+#include "ShaderVariants.h"
+
+#include <algorithm>
 
 using namespace Dynamo::Bloodstone;
 
-NodeSceneData::NodeSceneData(const std::wstring& nodeId) :
+// Simplified levels are built until a level would have fewer triangles
+// than this, each having a quarter of the triangles of the level above.
+#define MAX_SIMPLIFIED_LEVELS           3
+#define MIN_SIMPLIFIED_TRIANGLE_COUNT   1000
+
+// ================================================================================
+// SimplificationJob
+// ================================================================================
+
+namespace Dynamo { namespace Bloodstone {
+
+    // Shared between "NodeSceneData" and a worker thread, whichever lets
+    // go of it last deletes it. The source geometry is copied, so the job
+    // does not depend on anything owned by the render thread.
+    // 
+    class SimplificationJob
+    {
+    public:
+        SimplificationJob(const IVertexBuffer* pVertexBuffer,
+            const TriangleGeometryData& source, IVertexBuffer::AttributeEncoding encoding) : 
+            mReferenceCount(1),
+            mCancelled(0),
+            mCompleted(0),
+            mpVertexBuffer(pVertexBuffer),
+            mEncoding(encoding),
+            mSource(source)
+        {
+        }
+
+        ~SimplificationJob(void)
+        {
+            auto iterator = mLevels.begin();
+            for (; iterator != mLevels.end(); ++iterator)
+                delete *iterator;
+        }
+
+        void AddRef(void)
+        {
+            InterlockedIncrement(&mReferenceCount);
+        }
+
+        void Release(void)
+        {
+            if (InterlockedDecrement(&mReferenceCount) == 0)
+                delete this;
+        }
+
+        void Cancel(void)
+        {
+            InterlockedExchange(&mCancelled, 1);
+        }
+
+        bool IsCompleted(void) const
+        {
+            return (mCompleted != 0);
+        }
+
+        const IVertexBuffer* GetVertexBuffer(void) const
+        {
+            return this->mpVertexBuffer;
+        }
+
+        IVertexBuffer::AttributeEncoding GetEncoding(void) const
+        {
+            return this->mEncoding;
+        }
+
+        const std::vector<TriangleGeometryData *>& GetLevels(void) const
+        {
+            return this->mLevels;
+        }
+
+        // Called on the worker thread.
+        void Run(void)
+        {
+            const TriangleGeometryData* pPrevious = &mSource;
+            int triangleCount = mSource.IndexCount() / 3;
+
+            for (int level = 0; level < MAX_SIMPLIFIED_LEVELS; ++level)
+            {
+                const int targetTriangleCount = triangleCount / 4;
+                if (mCancelled != 0 || targetTriangleCount < MIN_SIMPLIFIED_TRIANGLE_COUNT)
+                    break;
+
+                TriangleGeometryData simplified(0);
+                MeshProcessor::Simplify(*pPrevious, targetTriangleCount, simplified);
+
+                // Locked boundaries can keep the simplifier from getting
+                // anywhere near its target, a level like that is no use.
+                const int simplifiedCount = simplified.IndexCount() / 3;
+                if (simplifiedCount > ((triangleCount * 3) / 4))
+                    break;
+
+                auto pLevel = new TriangleGeometryData(0);
+                MeshProcessor::OptimizeVertexCache(simplified, *pLevel);
+                mLevels.push_back(pLevel);
+
+                pPrevious = pLevel;
+                triangleCount = simplifiedCount;
+            }
+
+            InterlockedExchange(&mCompleted, 1);
+        }
+
+    private:
+        volatile long mReferenceCount;
+        volatile long mCancelled;
+        volatile long mCompleted;
+        const IVertexBuffer* mpVertexBuffer;
+        IVertexBuffer::AttributeEncoding mEncoding;
+        TriangleGeometryData mSource;
+        std::vector<TriangleGeometryData *> mLevels;
+    };
+
+    ref class SimplificationWorker
+    {
+    public:
+        // Called on the thread that owns the visualizer window.
+        static void Queue(SimplificationJob* pJob)
+        {
+            HWND hWndVisualizer = nullptr;
+            auto visualizer = VisualizerWnd::CurrentInstance();
+            if (visualizer != nullptr)
+                hWndVisualizer = visualizer->GetWindowHandle();
+
+            pJob->AddRef(); // Released once the worker is done with it.
+            auto worker = gcnew SimplificationWorker(pJob, hWndVisualizer);
+            System::Threading::ThreadPool::QueueUserWorkItem(
+                gcnew System::Threading::WaitCallback(worker, &SimplificationWorker::Run));
+        }
+
+    private:
+        SimplificationWorker(SimplificationJob* pJob, HWND hWndVisualizer) :
+            mpJob(pJob),
+            mhWndVisualizer(hWndVisualizer)
+        {
+        }
+
+        void Run(System::Object^ state)
+        {
+            mpJob->Run();
+            const bool completed = mpJob->IsCompleted();
+            mpJob->Release();
+
+            // Have the new levels picked up by the next frame. The visualizer
+            // may be destroyed meanwhile, so only its window is posted to (a
+            // window that is gone fails the post, which is then ignored).
+            if (completed && mhWndVisualizer != nullptr)
+                ::PostMessage(mhWndVisualizer, WM_BLOODSTONE_FRAME_UPDATE, 0, 0);
+        }
+
+        SimplificationJob* mpJob;
+        HWND mhWndVisualizer;
+    };
+} }
+
+// ================================================================================
+// NodeSceneData
+// ================================================================================
+
+NodeSceneData::NodeSceneData(const NodeKey& nodeKey) :
     mRenderMode(RenderMode::Shaded),
-    mNodeId(nodeId),
-    mNodeSelected(false)
+    mNodeKey(nodeKey),
+    mNodeSelected(false),
+    mDynamic(false),
+    mStateRow(-1),
+    mContentHash(0),
+    mUpdateTime(0),
+    mpPickGeometry(nullptr)
 {
     mNodeRgbaColor[0] = mNodeRgbaColor[1] = 0.0f;
     mNodeRgbaColor[2] = mNodeRgbaColor[3] = 0.0f;
@@ -19,9 +190,9 @@ NodeSceneData::~NodeSceneData(void)
     ClearVertexBuffers();
 }
 
-const std::wstring NodeSceneData::GetNodeId(void) const
+const NodeKey& NodeSceneData::GetNodeKey(void) const
 {
-    return this->mNodeId;
+    return this->mNodeKey;
 }
 
 void NodeSceneData::GetBoundingBox(BoundingBox* pBoundingBox) const
@@ -29,6 +200,29 @@ void NodeSceneData::GetBoundingBox(BoundingBox* pBoundingBox) const
     (*pBoundingBox) = mBoundingBox;
 }
 
+void NodeSceneData::GetState(NodeState* pState) const
+{
+    for (int index = 0; index < 4; ++index) {
+        pState->color[index] = mNodeRgbaColor[index];
+        pState->flags[index] = 0.0f;
+    }
+
+    // Use the node color if one is specified.
+    if (mNodeRgbaColor[3] > 0.01f)
+        pState->flags[0] = 1.0f; // Override color.
+
+    if (mNodeSelected) {
+        pState->color[0] = 154.0f / 255.0f;
+        pState->color[1] = 206.0f / 255.0f;
+        pState->color[2] = 235.0f / 255.0f;
+        pState->flags[0] = 1.0f; // Override color.
+        pState->flags[1] = 1.0f;
+    }
+
+    if (mRenderMode == RenderMode::Shaded)
+        pState->flags[2] = 1.0f; // Triangles are shaded.
+}
+
 bool NodeSceneData::GetSelected(void) const
 {
     return this->mNodeSelected;
@@ -65,16 +259,96 @@ void NodeSceneData::SetRenderMode(RenderMode renderMode)
     this->mRenderMode = renderMode;
 }
 
+unsigned long long NodeSceneData::GetContentHash(void) const
+{
+    return this->mContentHash;
+}
+
+void NodeSceneData::SetContentHash(unsigned long long contentHash)
+{
+    this->mContentHash = contentHash;
+}
+
+unsigned long long NodeSceneData::GetUpdateTime(void) const
+{
+    return this->mUpdateTime;
+}
+
+void NodeSceneData::SetUpdateTime(unsigned long long updateTime)
+{
+    this->mUpdateTime = updateTime;
+}
+
+bool NodeSceneData::IsDynamic(void) const
+{
+    return this->mDynamic;
+}
+
+void NodeSceneData::SetDynamic(bool dynamic)
+{
+    // Vertex buffers already loaded move out of the streaming buffer once
+    // the node is no longer dynamic (see "IVertexBuffer::SetDynamic").
+    this->mDynamic = dynamic;
+
+    auto iterator = mVertexBuffers.begin();
+    for (; iterator != mVertexBuffers.end(); ++iterator)
+        (*iterator)->SetDynamic(dynamic);
+}
+
+bool NodeSceneData::IsTranslucent(void) const
+{
+    // Only an overriding color (see "GetState") can be.
+    const float alpha = mNodeRgbaColor[3];
+    return alpha > 0.01f && alpha < 1.0f;
+}
+
+bool NodeSceneData::HasPendingLevelsOfDetail(void) const
+{
+    return !mSimplificationJobs.empty();
+}
+
+int NodeSceneData::GetStateRow(void) const
+{
+    return this->mStateRow;
+}
+
+void NodeSceneData::SetStateRow(int stateRow)
+{
+    this->mStateRow = stateRow;
+}
+
 void NodeSceneData::ClearVertexBuffers(void)
 {
+    auto jobIterator = mSimplificationJobs.begin();
+    for (; jobIterator != mSimplificationJobs.end(); ++jobIterator) {
+        (*jobIterator)->Cancel();
+        (*jobIterator)->Release();
+    }
+
+    auto levelIterator = mSimplifiedBuffers.begin();
+    for (; levelIterator != mSimplifiedBuffers.end(); ++levelIterator) {
+        auto level = levelIterator->begin();
+        for (; level != levelIterator->end(); ++level)
+            delete *level;
+    }
+
     auto iterator = mVertexBuffers.begin();
     for (; iterator != mVertexBuffers.end(); ++iterator) {
         auto pVertexBuffer = *iterator;
         delete pVertexBuffer;
     }
 
+    if (mpPickGeometry != nullptr) {
+        mpPickGeometry->Cancel();
+        mpPickGeometry->Release();
+        mpPickGeometry = nullptr;
+    }
+
+    mSimplificationJobs.clear();
+    mSimplifiedBuffers.clear();
     mVertexBuffers.clear();
     mBoundingBox.Invalidate();
+    mContentHash = 0;
 }
 
 void NodeSceneData::AppendVertexBuffer(IVertexBuffer* pVertexBuffer)
@@ -91,31 +365,101 @@ void NodeSceneData::AppendVertexBuffer(IVertexBuffer* pVertexBuffer)
 #endif
 
     mVertexBuffers.push_back(pVertexBuffer);
+    mSimplifiedBuffers.push_back(std::vector<IVertexBuffer *>());
 
     BoundingBox boundingBox;
     pVertexBuffer->GetBoundingBox(&boundingBox);
     this->mBoundingBox.EvaluateBox(boundingBox);
 }
 
-void NodeSceneData::Render(IGraphicsContext* pGraphicsContext, Dimensionality dimensionality) const
+void NodeSceneData::SetPickGeometry(PickGeometry* pPickGeometry)
 {
-    auto iterator = mVertexBuffers.begin();
-    for (; iterator != mVertexBuffers.end(); ++iterator)
+    pPickGeometry->AddRef();
+    if (mpPickGeometry != nullptr) {
+        mpPickGeometry->Cancel();
+        mpPickGeometry->Release();
+    }
+
+    mpPickGeometry = pPickGeometry;
+}
+
+bool NodeSceneData::Pick(const PickRay& ray, float* pDistance) const
+{
+    if (mpPickGeometry == nullptr)
+        return false;
+
+    return mpPickGeometry->Intersect(ray, pDistance);
+}
+
+void NodeSceneData::BuildLevelsOfDetail(const IVertexBuffer* pVertexBuffer,
+    const TriangleGeometryData& data, IVertexBuffer::AttributeEncoding encoding)
+{
+    auto pJob = new SimplificationJob(pVertexBuffer, data, encoding);
+    mSimplificationJobs.push_back(pJob);
+    SimplificationWorker::Queue(pJob);
+}
+
+bool NodeSceneData::UpdateLevelsOfDetail(IGraphicsContext* pGraphicsContext,
+    ShaderVariants* pShaderVariants)
+{
+    bool updated = false;
+
+    auto iterator = mSimplificationJobs.begin();
+    while (iterator != mSimplificationJobs.end())
     {
-        auto pVertexBuffer = *iterator;
-        switch (pVertexBuffer->GetPrimitiveType())
+        auto pJob = *iterator;
+        if (pJob->IsCompleted() == false) {
+            ++iterator;
+            continue;
+        }
+
+        auto found = std::find(mVertexBuffers.begin(),
+            mVertexBuffers.end(), pJob->GetVertexBuffer());
+
+        if (found != mVertexBuffers.end())
+        {
+            // Vertex buffers can only be created on the render thread.
+            auto& simplified = mSimplifiedBuffers[found - mVertexBuffers.begin()];
+            auto level = pJob->GetLevels().begin();
+            for (; level != pJob->GetLevels().end(); ++level)
+            {
+                auto pVertexBuffer = pGraphicsContext->CreateVertexBuffer();
+                pVertexBuffer->LoadData(**level, pJob->GetEncoding());
+                auto pShaderProgram = pShaderVariants->GetProgram(pVertexBuffer->GetShaderFeatures());
+                pVertexBuffer->BindToShaderProgram(pShaderProgram);
+                simplified.push_back(pVertexBuffer);
+                updated = true;
+            }
+        }
+
+        pJob->Release();
+        iterator = mSimplificationJobs.erase(iterator);
+    }
+
+    return updated;
+}
+
+void NodeSceneData::Enqueue(RenderQueue* pRenderQueue, float distance, int levelOfDetail) const
+{
+    const bool translucent = IsTranslucent();
+    for (std::size_t index = 0; index < mVertexBuffers.size(); ++index)
+    {
+        // Level 0 is the buffer itself, then its simplified versions
+        // for as many levels as there are.
+        auto pVertexBuffer = mVertexBuffers[index];
+        const auto& simplified = mSimplifiedBuffers[index];
+        if (levelOfDetail > 0 && !simplified.empty())
         {
-        case IVertexBuffer::PrimitiveType::Point:
-        case IVertexBuffer::PrimitiveType::LineStrip:
-            if (dimensionality == Dimensionality::High)
-                return;
-            break;
-        case IVertexBuffer::PrimitiveType::Triangle:
-            if (dimensionality == Dimensionality::Low)
-                return;
-            break;
-        }
-
-        pGraphicsContext->RenderVertexBuffer(pVertexBuffer);
+            auto level = ((std::size_t) levelOfDetail);
+            if (level > simplified.size())
+                level = simplified.size();
+
+            pVertexBuffer = simplified[level - 1];
+        }
+
+        const auto features = pVertexBuffer->GetShaderFeatures();
+        const auto primitiveType = pVertexBuffer->GetPrimitiveType();
+        const auto key = RenderQueue::MakeKey(translucent, features, primitiveType, distance);
+        pRenderQueue->Add(key, pVertexBuffer, mStateRow);
     }
 }
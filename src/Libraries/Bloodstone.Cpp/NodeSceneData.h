@@ -3,10 +3,17 @@
 #define _NODESCENEDATA_H_
 
 #include "Interfaces.h"
+#include "NodeHierarchy.h"
+#include "NodeTable.h"
 
 namespace Dynamo { namespace Bloodstone {
 
     class IGraphicsContext;
+    class SimplificationJob;
+    class PickGeometry;
+    class RenderQueue;
+    class ShaderVariants;
+    struct PickRay;
 
     enum class Dimensionality
     {
@@ -16,12 +23,13 @@ namespace Dynamo { namespace Bloodstone {
     class NodeSceneData
     {
     public:
-        NodeSceneData(const std::wstring& nodeId);
+        NodeSceneData(const NodeKey& nodeKey);
         ~NodeSceneData(void);
 
         // Read-only property accessor methods.
-        const std::wstring GetNodeId(void) const;
+        const NodeKey& GetNodeKey(void) const;
         void GetBoundingBox(BoundingBox* pBoundingBox) const;
+        void GetState(NodeState* pState) const;
 
         // Read-write properties accessor methods.
         bool GetSelected(void) const;
@@ -30,19 +38,49 @@ namespace Dynamo { namespace Bloodstone {
         void SetColor(float red, float green, float blue, float alpha);
         RenderMode GetRenderMode(void) const;
         void SetRenderMode(RenderMode renderMode);
+        unsigned long long GetContentHash(void) const;
+        void SetContentHash(unsigned long long contentHash);
+        unsigned long long GetUpdateTime(void) const;
+        void SetUpdateTime(unsigned long long updateTime);
+        bool IsDynamic(void) const;
+        void SetDynamic(bool dynamic);
+        bool IsTranslucent(void) const;
+        bool HasPendingLevelsOfDetail(void) const;
+
+        // Row of the node in the node state table, assigned by the scene.
+        int GetStateRow(void) const;
+        void SetStateRow(int stateRow);
 
         // Generic class operational methods.
         void ClearVertexBuffers(void);
         void AppendVertexBuffer(IVertexBuffer* pVertexBuffer);
-        void Render(IGraphicsContext* pGraphicsContext, Dimensionality dimensionality) const;
+        void BuildLevelsOfDetail(const IVertexBuffer* pVertexBuffer,
+            const TriangleGeometryData& data, IVertexBuffer::AttributeEncoding encoding);
+        bool UpdateLevelsOfDetail(IGraphicsContext* pGraphicsContext, ShaderVariants* pShaderVariants);
+        void Enqueue(RenderQueue* pRenderQueue, float distance, int levelOfDetail) const;
+
+        // Geometries are picked through their own copy of the positions,
+        // which goes away along with the vertex buffers.
+        void SetPickGeometry(PickGeometry* pPickGeometry);
+        bool Pick(const PickRay& ray, float* pDistance) const;
 
     private:
         bool mNodeSelected;
+        bool mDynamic; // Geometries get replaced in quick succession.
+        int mStateRow;
         float mNodeRgbaColor[4];
         RenderMode mRenderMode;
         BoundingBox mBoundingBox;
-        std::wstring mNodeId;
+        unsigned long long mContentHash; // Of the render package last loaded.
+        unsigned long long mUpdateTime; // Tick count of the last content change.
+        NodeKey mNodeKey;
         std::vector<IVertexBuffer *> mVertexBuffers;
+
+        // Simplified versions of each entry in "mVertexBuffers" (if any),
+        // ordered from the most to the least detailed one.
+        std::vector<std::vector<IVertexBuffer *>> mSimplifiedBuffers;
+        std::vector<SimplificationJob *> mSimplificationJobs;
+        PickGeometry* mpPickGeometry;
     };
 } }
 
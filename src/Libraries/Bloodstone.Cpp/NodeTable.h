@@ -0,0 +1,276 @@
+#ifndef _NODETABLE_H_
+#define _NODETABLE_H_
+
+#include <vector>
+
+// Initial bucket count of a node table (a power of two).
+#define NODE_TABLE_MINIMUM_BUCKETS      64
+
+namespace Dynamo { namespace Bloodstone {
+
+    // Node identifiers (GUIDs) parsed into 128 bits once, on the way in.
+    struct NodeKey
+    {
+        unsigned long long high;
+        unsigned long long low;
+
+        bool operator==(const NodeKey& other) const
+        {
+            return high == other.high && low == other.low;
+        }
+    };
+
+    struct NodeKeyHasher
+    {
+        std::size_t operator()(const NodeKey& key) const
+        {
+            // Both halves are mostly random already (apart from the version
+            // and variant bits of a GUID), a multiplicative mix is plenty.
+            const unsigned long long mixed = (key.high ^ (key.low * 0x9e3779b97f4a7c15ULL));
+            return ((std::size_t) ((mixed * 0xbf58476d1ce4e5b9ULL) >> 32));
+        }
+    };
+
+    // Refers to a slot of "NodeTable". A slot moves on to its next
+    // generation whenever its node is removed, so that handles to the
+    // removed node resolve to nothing rather than to whatever moves in.
+    struct NodeHandle
+    {
+        int slot;
+        unsigned int generation;
+    };
+
+    // Owns every node of a scene, in slots that are reused as nodes come
+    // and go (so iterating over them stays dense). Keys are mapped to slots
+    // through an open-addressing (linear probing) table that is never more
+    // than half full, removal shifts entries back so that no tombstones are
+    // left behind. Nodes are made from their key, and give it back through
+    // "GetNodeKey" (the scene has a "NodeSceneData" in each, the native
+    // tests have nodes of their own).
+    //
+    template<typename NodeType>
+    class NodeTable
+    {
+    public:
+        NodeTable(void);
+        ~NodeTable(void);
+
+        // Slots are iterated over from zero to "GetSlotCount" (exclusive),
+        // "GetNode" returns nullptr for those not currently in use.
+        int GetSlotCount(void) const;
+        int GetNodeCount(void) const;
+        NodeType* GetNode(int slot) const;
+        NodeType* GetNode(const NodeHandle& handle) const;
+
+        // "Find" returns a handle to no node ("IsValid" is false) when the
+        // key is not found, "Insert" returns that of the existing node.
+        bool IsValid(const NodeHandle& handle) const;
+        NodeHandle Find(const NodeKey& key) const;
+        NodeHandle Insert(const NodeKey& key);
+        void Remove(const NodeHandle& handle);
+        void Clear(void);
+
+    private:
+        struct NodeSlot
+        {
+            NodeType* pNode;
+            unsigned int generation;
+        };
+
+        NodeTable(const NodeTable& other);
+        NodeTable& operator=(const NodeTable& other);
+
+        int FindBucket(const NodeKey& key) const;
+        void Rehash(std::size_t bucketCount);
+
+        int mNodeCount;
+        std::vector<NodeSlot> mSlots;
+        std::vector<int> mFreeSlots;
+        std::vector<int> mBuckets; // Slot of each bucket, -1 if empty.
+    };
+
+    template<typename NodeType>
+    NodeTable<NodeType>::NodeTable(void) : mNodeCount(0)
+    {
+        mBuckets.assign(NODE_TABLE_MINIMUM_BUCKETS, -1);
+    }
+
+    template<typename NodeType>
+    NodeTable<NodeType>::~NodeTable(void)
+    {
+        Clear();
+    }
+
+    template<typename NodeType>
+    int NodeTable<NodeType>::GetSlotCount(void) const
+    {
+        return ((int) mSlots.size());
+    }
+
+    template<typename NodeType>
+    int NodeTable<NodeType>::GetNodeCount(void) const
+    {
+        return this->mNodeCount;
+    }
+
+    template<typename NodeType>
+    NodeType* NodeTable<NodeType>::GetNode(int slot) const
+    {
+        return mSlots[slot].pNode;
+    }
+
+    template<typename NodeType>
+    NodeType* NodeTable<NodeType>::GetNode(const NodeHandle& handle) const
+    {
+        return (IsValid(handle) ? mSlots[handle.slot].pNode : nullptr);
+    }
+
+    template<typename NodeType>
+    bool NodeTable<NodeType>::IsValid(const NodeHandle& handle) const
+    {
+        if (handle.slot < 0 || handle.slot >= ((int) mSlots.size()))
+            return false;
+
+        const NodeSlot& slot = mSlots[handle.slot];
+        return slot.pNode != nullptr && slot.generation == handle.generation;
+    }
+
+    template<typename NodeType>
+    NodeHandle NodeTable<NodeType>::Find(const NodeKey& key) const
+    {
+        NodeHandle handle = { -1, 0 };
+
+        const int bucket = FindBucket(key);
+        if (mBuckets[bucket] >= 0) {
+            handle.slot = mBuckets[bucket];
+            handle.generation = mSlots[handle.slot].generation;
+        }
+
+        return handle;
+    }
+
+    template<typename NodeType>
+    NodeHandle NodeTable<NodeType>::Insert(const NodeKey& key)
+    {
+        NodeHandle handle = Find(key);
+        if (handle.slot >= 0)
+            return handle;
+
+        if ((mNodeCount + 1) * 2 > ((int) mBuckets.size()))
+            Rehash(mBuckets.size() * 2);
+
+        if (mFreeSlots.empty())
+        {
+            NodeSlot slot = { nullptr, 0 };
+            mSlots.push_back(slot);
+            handle.slot = ((int) mSlots.size()) - 1;
+        }
+        else
+        {
+            // Reuse the most recently freed slot, it is likely still cached.
+            handle.slot = mFreeSlots.back();
+            mFreeSlots.pop_back();
+        }
+
+        NodeSlot& slot = mSlots[handle.slot];
+        slot.pNode = new NodeType(key);
+        handle.generation = slot.generation;
+
+        mBuckets[FindBucket(key)] = handle.slot;
+        mNodeCount++;
+        return handle;
+    }
+
+    template<typename NodeType>
+    void NodeTable<NodeType>::Remove(const NodeHandle& handle)
+    {
+        if (IsValid(handle) == false)
+            return;
+
+        NodeSlot& slot = mSlots[handle.slot];
+        const std::size_t mask = mBuckets.size() - 1;
+        std::size_t bucket = FindBucket(slot.pNode->GetNodeKey());
+
+        // Shift entries that follow back into the hole, as long as doing so
+        // does not move any of them ahead of the bucket its key hashes to.
+        std::size_t next = bucket;
+        for (;;)
+        {
+            next = (next + 1) & mask;
+            if (mBuckets[next] < 0)
+                break;
+
+            const auto& key = mSlots[mBuckets[next]].pNode->GetNodeKey();
+            const std::size_t home = NodeKeyHasher()(key) & mask;
+            const bool movable = ((bucket <= next) ?
+                (home <= bucket || home > next) : (home <= bucket && home > next));
+
+            if (movable) {
+                mBuckets[bucket] = mBuckets[next];
+                bucket = next;
+            }
+        }
+
+        mBuckets[bucket] = -1;
+
+        delete slot.pNode;
+        slot.pNode = nullptr;
+        slot.generation++;
+        mFreeSlots.push_back(handle.slot);
+        mNodeCount--;
+    }
+
+    template<typename NodeType>
+    void NodeTable<NodeType>::Clear(void)
+    {
+        // Slots are kept (and move on to their next generation), so that
+        // handles given out before do not refer to nodes inserted later.
+        mFreeSlots.clear();
+        for (int index = ((int) mSlots.size()) - 1; index >= 0; --index)
+        {
+            NodeSlot& slot = mSlots[index];
+            if (slot.pNode != nullptr) {
+                delete slot.pNode;
+                slot.pNode = nullptr;
+                slot.generation++;
+            }
+
+            mFreeSlots.push_back(index);
+        }
+
+        mNodeCount = 0;
+        mBuckets.assign(NODE_TABLE_MINIMUM_BUCKETS, -1);
+    }
+
+    template<typename NodeType>
+    int NodeTable<NodeType>::FindBucket(const NodeKey& key) const
+    {
+        // Returns the bucket holding the key, or the empty one it belongs in.
+        const std::size_t mask = mBuckets.size() - 1;
+        std::size_t bucket = NodeKeyHasher()(key) & mask;
+        while (mBuckets[bucket] >= 0)
+        {
+            if (mSlots[mBuckets[bucket]].pNode->GetNodeKey() == key)
+                break;
+
+            bucket = (bucket + 1) & mask;
+        }
+
+        return ((int) bucket);
+    }
+
+    template<typename NodeType>
+    void NodeTable<NodeType>::Rehash(std::size_t bucketCount)
+    {
+        mBuckets.assign(bucketCount, -1);
+        for (int index = 0; index < ((int) mSlots.size()); ++index)
+        {
+            if (mSlots[index].pNode != nullptr) {
+                const auto& key = mSlots[index].pNode->GetNodeKey();
+                mBuckets[FindBucket(key)] = index;
+            }
+        }
+    }
+} }
+
+#endif
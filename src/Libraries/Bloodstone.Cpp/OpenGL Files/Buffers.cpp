@@ -1,68 +1,826 @@
 
 #include "stdafx.h"
 #include "OpenInterfaces.h"
+#include "Kernels.h"
+#include "Quantization.h"
+
+#include <cmath>
+#include <cassert>
+#include <algorithm>
 
 using namespace System;
 using namespace Dynamo::Bloodstone;
 using namespace Dynamo::Bloodstone::OpenGL;
 
-// Convert float count to offset.
-#define FC2O(x) ((const void *)(x * sizeof(float)))
+// Convert float count to offset (from a given base offset in bytes).
+#define FC2O(b, x) ((const void *)((b) + (x) * sizeof(float)))
+
+// Clusters whose bounding spheres are this much larger (relative to their
+// distance from the camera) are never found to face away from it.
+#define CLUSTER_MAX_SINE_OF_SPREAD  0.99f
+
+// Initial capacities of shared heaps, in vertices and 4-byte index units.
+#define SHARED_HEAP_VERTEX_COUNT    (64 * 1024)
+#define SHARED_HEAP_INDEX_UNITS     (256 * 1024)
+
+// Rather than growing, a shared heap that fails an allocation gets its
+// allocations packed together when at least this fraction would be left
+// free (that is, free space is there but it is too fragmented).
+#define HEAP_COMPACTION_THRESHOLD   0.25f
+
+// Initial size of the streaming buffer, and how long the writer waits on
+// a frame fence at a time (in nanoseconds).
+#define STREAMING_BUFFER_SIZE       (4 * 1024 * 1024)
+#define STREAMING_WAIT_TIMEOUT      1000000000
 
 // ================================================================================
-// VertexBuffer
+// BufferHeap
 // ================================================================================
 
-VertexBuffer::VertexBuffer() :
-    mVertexCount(0),
-    mVertexArrayId(0),
-    mVertexBufferId(0),
-    mPrimitiveType(Dynamo::Bloodstone::IVertexBuffer::PrimitiveType::None)
+BufferHeap::BufferHeap(const GraphicsContext* pGraphicsContext,
+    int unitSize, int minimumCapacity) :
+    mUnitSize(unitSize),
+    mMinimumCapacity(minimumCapacity),
+    mCapacity(0),
+    mUsedUnits(0),
+    mBufferId(0),
+    mpGraphicsContext(pGraphicsContext)
 {
 }
 
-VertexBuffer::~VertexBuffer()
+BufferHeap::~BufferHeap(void)
+{
+    if (mBufferId != 0) {
+        mpGraphicsContext->DeleteBuffer(mBufferId);
+        mBufferId = 0;
+    }
+}
+
+GLuint BufferHeap::GetBufferId(void) const
+{
+    return this->mBufferId;
+}
+
+int BufferHeap::GetCapacity(void) const
+{
+    return this->mCapacity;
+}
+
+std::size_t BufferHeap::GetCapacityBytes(void) const
+{
+    return ((std::size_t) mCapacity) * mUnitSize;
+}
+
+int BufferHeap::GetOffset(int allocation) const
+{
+    return mAllocations[allocation].offset;
+}
+
+int BufferHeap::Allocate(int units)
+{
+    int offset = FindFreeBlock(units);
+    if (offset < 0)
+    {
+        // Shared heaps have their allocations packed together if there is
+        // enough free space that is just too scattered, and double in size
+        // otherwise. Private heaps take the next power of two, so that they
+        // fall into a bucket of the pool once released.
+        const int required = mUsedUnits + units;
+        int capacity = 1;
+        while (capacity < required)
+            capacity = capacity * 2;
+
+        if (mMinimumCapacity > 0)
+        {
+            const float headroom = ((float) (mCapacity - required));
+            if (mCapacity > 0 && headroom >= mCapacity * HEAP_COMPACTION_THRESHOLD)
+                capacity = mCapacity;
+            else
+            {
+                capacity = ((mCapacity * 2 > mMinimumCapacity) ? mCapacity * 2 : mMinimumCapacity);
+                capacity = ((capacity > required) ? capacity : required);
+            }
+        }
+
+        Relocate(capacity);
+        offset = FindFreeBlock(units);
+    }
+
+    Allocation allocation = { offset, units };
+    mUsedUnits = mUsedUnits + units;
+
+    if (mFreeAllocations.empty()) {
+        mAllocations.push_back(allocation);
+        return ((int) mAllocations.size() - 1);
+    }
+
+    const int handle = mFreeAllocations.back();
+    mFreeAllocations.pop_back();
+    mAllocations[handle] = allocation;
+    return handle;
+}
+
+void BufferHeap::Free(int allocation)
 {
-    if (mVertexBufferId != 0) {
-        GL::glDeleteBuffers(1, &mVertexBufferId);
-        mVertexBufferId = 0;
+    int offset = mAllocations[allocation].offset;
+    int units = mAllocations[allocation].units;
+    mAllocations[allocation].units = 0;
+    mFreeAllocations.push_back(allocation);
+    mUsedUnits = mUsedUnits - units;
+
+    // Merge with the free blocks right after and right before it.
+    auto next = mFreeBlocks.find(offset + units);
+    if (next != mFreeBlocks.end()) {
+        units = units + next->second;
+        mFreeBlocks.erase(next);
+    }
+
+    auto previous = mFreeBlocks.lower_bound(offset);
+    if (previous != mFreeBlocks.begin())
+    {
+        --previous;
+        if (previous->first + previous->second == offset) {
+            offset = previous->first;
+            units = units + previous->second;
+            mFreeBlocks.erase(previous);
+        }
     }
 
+    mFreeBlocks[offset] = units;
+
+    // Give memory back once a shared heap is mostly empty.
+    if (mMinimumCapacity > 0 && mCapacity > mMinimumCapacity && mUsedUnits < mCapacity / 4)
+        Relocate((mCapacity / 2 > mMinimumCapacity) ? mCapacity / 2 : mMinimumCapacity);
+}
+
+void BufferHeap::Orphan(void)
+{
+    // Storage of an empty heap is specified anew, draw calls still in
+    // flight keep reading the old one and the update does not wait.
+    if (mBufferId == 0 || mUsedUnits > 0)
+        return;
+
+    mpGraphicsContext->BindBuffer(BufferTarget::Array, mBufferId);
+    GL::glBufferData(GL_ARRAY_BUFFER, GetCapacityBytes(), nullptr, GL_STATIC_DRAW);
+}
+
+void* BufferHeap::Map(int allocation)
+{
+    if (GL::glMapBufferRange == nullptr)
+        return nullptr;
+
+    // Only the allocation itself is invalidated, other parts of a shared
+    // heap may still be used by draw calls that are in flight.
+    const auto& entry = mAllocations[allocation];
+    const GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+
+    mpGraphicsContext->BindBuffer(BufferTarget::Array, mBufferId);
+    return GL::glMapBufferRange(GL_ARRAY_BUFFER,
+        ((GLintptr) entry.offset) * mUnitSize, ((GLsizeiptr) entry.units) * mUnitSize, access);
+}
+
+bool BufferHeap::Unmap(void)
+{
+    // Content of a mapped buffer can be lost (e.g. display mode change).
+    mpGraphicsContext->BindBuffer(BufferTarget::Array, mBufferId);
+    return (GL::glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE);
+}
+
+void BufferHeap::Write(int allocation, const void* pData, std::size_t bytes)
+{
+    const auto offset = ((GLintptr) mAllocations[allocation].offset) * mUnitSize;
+
+    // Heaps are always bound to the array buffer target for updates, so
+    // that index data never gets bound to a vertex array by accident.
+    mpGraphicsContext->BindBuffer(BufferTarget::Array, mBufferId);
+    GL::glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, pData);
+}
+
+int BufferHeap::FindFreeBlock(int units)
+{
+    auto iterator = mFreeBlocks.begin();
+    for (; iterator != mFreeBlocks.end(); ++iterator)
+    {
+        if (iterator->second < units)
+            continue;
+
+        const int offset = iterator->first;
+        const int remaining = iterator->second - units;
+        mFreeBlocks.erase(iterator);
+        if (remaining > 0)
+            mFreeBlocks[offset + units] = remaining;
+
+        return offset;
+    }
+
+    return -1; // None of the free blocks is large enough.
+}
+
+void BufferHeap::Relocate(int capacity)
+{
+    // Empty heaps keep their buffer object, only its storage is replaced.
+    GLuint bufferId = mBufferId;
+    if (bufferId == 0 || mUsedUnits > 0)
+        GL::glGenBuffers(1, &bufferId);
+
+    mpGraphicsContext->BindBuffer(BufferTarget::Array, bufferId);
+    GL::glBufferData(GL_ARRAY_BUFFER, ((GLsizeiptr) capacity) * mUnitSize,
+        nullptr, GL_STATIC_DRAW);
+
+    std::vector<int> live;
+    for (int handle = 0; handle < ((int) mAllocations.size()); ++handle) {
+        if (mAllocations[handle].units > 0)
+            live.push_back(handle);
+    }
+
+    // Private heaps are emptied before they are reallocated, it is only
+    // shared ones (OpenGL 3.2 and above) that ever move their content.
+    assert(live.empty() || GL::glCopyBufferSubData != nullptr);
+
+    std::sort(live.begin(), live.end(), [this](int first, int second) {
+        return mAllocations[first].offset < mAllocations[second].offset;
+    });
+
+    // Allocations are packed to the front of the new storage in their
+    // current order, those that are adjacent get copied over together.
+    if (!live.empty())
+        mpGraphicsContext->BindBuffer(BufferTarget::CopyRead, mBufferId);
+
+    int packed = 0;
+    std::size_t run = 0;
+    while (run < live.size())
+    {
+        const int source = mAllocations[live[run]].offset;
+        int units = 0;
+
+        for (; run < live.size(); ++run)
+        {
+            auto& allocation = mAllocations[live[run]];
+            if (allocation.offset != source + units)
+                break;
+
+            allocation.offset = packed + units;
+            units = units + allocation.units;
+        }
+
+        GL::glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_ARRAY_BUFFER,
+            ((GLintptr) source) * mUnitSize, ((GLintptr) packed) * mUnitSize,
+            ((GLsizeiptr) units) * mUnitSize);
+
+        packed = packed + units;
+    }
+
+    if (mBufferId != 0 && mBufferId != bufferId)
+        mpGraphicsContext->DeleteBuffer(mBufferId);
+
+    mBufferId = bufferId;
+    mCapacity = capacity;
+    mFreeBlocks.clear();
+    if (packed < capacity)
+        mFreeBlocks[packed] = capacity - packed;
+
+    mpGraphicsContext->CountHeapRelocation();
+}
+
+// ================================================================================
+// VertexArena
+// ================================================================================
+
+static int GetVertexSize(VertexFormat format)
+{
+    switch (format)
+    {
+    case VertexFormat::Point:
+        return ((int) sizeof(PointVertexData));
+    case VertexFormat::Triangle:
+        return ((int) sizeof(TriangleVertexData));
+    }
+
+    return ((int) sizeof(QuantizedTriangleVertexData));
+}
+
+// Attributes the shader compiler optimized away have no location (-1),
+// which is not a valid index for either of the calls.
+// 
+static void SpecifyVertexAttribute(GLint location, GLint size, GLenum type,
+    GLboolean normalized, GLsizei stride, const void* pOffset)
+{
+    if (location < 0)
+        return;
+
+    GL::glEnableVertexAttribArray(location);
+    GL::glVertexAttribPointer(location, size, type, normalized, stride, pOffset);
+}
+
+// Attribute pointers of the given vertex format, with vertices starting
+// "baseOffset" bytes into the buffer currently bound to GL_ARRAY_BUFFER.
+// 
+static void SpecifyVertexAttributes(VertexFormat format,
+    const ShaderProgram* pShaderProgram, std::size_t baseOffset)
+{
+    const auto locPosition = pShaderProgram->GetAttributeLocation("inPosition");
+    const auto locNormal = pShaderProgram->GetAttributeLocation("inNormal");
+    const auto locColor = pShaderProgram->GetAttributeLocation("inColor");
+
+    switch (format)
+    {
+    case VertexFormat::Point:
+        {
+            // Normal is left disabled, unlit primitives do not make use of it.
+            auto stride = ((int) sizeof(PointVertexData));
+            SpecifyVertexAttribute(locPosition, 3, GL_FLOAT, GL_FALSE, stride, FC2O(baseOffset, 0));
+            SpecifyVertexAttribute(locColor,    4, GL_UNSIGNED_BYTE, GL_TRUE, stride, FC2O(baseOffset, 3));
+            break;
+        }
+    case VertexFormat::QuantizedTriangle:
+        {
+            // Both are normalized to [0, 1] and [-1, 1] respectively, the
+            // shader takes care of scaling positions back to world space.
+            // Attribute offsets here are still multiples of 4 bytes.
+            auto stride = ((int) sizeof(QuantizedTriangleVertexData));
+            SpecifyVertexAttribute(locPosition, 3, GL_UNSIGNED_SHORT, GL_TRUE, stride, FC2O(baseOffset, 0));
+            SpecifyVertexAttribute(locNormal,   2, GL_SHORT, GL_TRUE, stride, FC2O(baseOffset, 2));
+            SpecifyVertexAttribute(locColor,    4, GL_UNSIGNED_BYTE, GL_TRUE, stride, FC2O(baseOffset, 3));
+            break;
+        }
+    case VertexFormat::Triangle:
+        {
+            auto stride = ((int) sizeof(TriangleVertexData));
+            SpecifyVertexAttribute(locPosition, 3, GL_FLOAT, GL_FALSE, stride, FC2O(baseOffset, 0));
+            SpecifyVertexAttribute(locNormal,   3, GL_FLOAT, GL_FALSE, stride, FC2O(baseOffset, 3));
+            SpecifyVertexAttribute(locColor,    4, GL_UNSIGNED_BYTE, GL_TRUE, stride, FC2O(baseOffset, 6));
+            break;
+        }
+    }
+
+}
+
+VertexArena::VertexArena(const GraphicsContext* pGraphicsContext,
+    VertexFormat format, bool shared) :
+    mShared(shared),
+    mFormat(format),
+    mVertexArrayId(0),
+    mVertexHeap(pGraphicsContext, GetVertexSize(format), (shared ? SHARED_HEAP_VERTEX_COUNT : 0)),
+    mIndexHeap(pGraphicsContext, ((int) sizeof(unsigned int)), (shared ? SHARED_HEAP_INDEX_UNITS : 0)),
+    mpShaderProgram(nullptr),
+    mpGraphicsContext(pGraphicsContext)
+{
+    GL::glGenVertexArrays(1, &mVertexArrayId);
+}
+
+VertexArena::~VertexArena(void)
+{
     if (mVertexArrayId != 0) {
-        GL::glDeleteVertexArrays(1, &mVertexArrayId);
+        mpGraphicsContext->DeleteVertexArray(mVertexArrayId);
         mVertexArrayId = 0;
     }
 }
 
-void VertexBuffer::Render(void) const
+bool VertexArena::IsShared(void) const
 {
-    if (mVertexCount <= 0) // Nothing to render.
+    return this->mShared;
+}
+
+VertexFormat VertexArena::GetFormat(void) const
+{
+    return this->mFormat;
+}
+
+int VertexArena::GetVertexCapacity(void) const
+{
+    return mVertexHeap.GetCapacity();
+}
+
+std::size_t VertexArena::GetCapacityBytes(void) const
+{
+    return mVertexHeap.GetCapacityBytes() + mIndexHeap.GetCapacityBytes();
+}
+
+void VertexArena::Bind(void) const
+{
+    mpGraphicsContext->BindVertexArray(mVertexArrayId);
+}
+
+void VertexArena::Orphan(void)
+{
+    mVertexHeap.Orphan();
+    mIndexHeap.Orphan();
+}
+
+void VertexArena::BindToShaderProgram(const IShaderProgram* pShaderProgram)
+{
+    auto pProgram = dynamic_cast<const ShaderProgram *>(pShaderProgram);
+    if (mpShaderProgram != pProgram) {
+        mpShaderProgram = pProgram;
+        RestoreBindings();
+    }
+}
+
+int VertexArena::AllocateVertices(int vertexCount)
+{
+    const auto bufferId = mVertexHeap.GetBufferId();
+    const int allocation = mVertexHeap.Allocate(vertexCount);
+    if (mVertexHeap.GetBufferId() != bufferId)
+        RestoreBindings();
+
+    return allocation;
+}
+
+int VertexArena::AllocateIndices(std::size_t bytes)
+{
+    const auto units = ((bytes + sizeof(unsigned int) - 1) / sizeof(unsigned int));
+    const auto bufferId = mIndexHeap.GetBufferId();
+    const int allocation = mIndexHeap.Allocate(((int) units));
+    if (mIndexHeap.GetBufferId() != bufferId)
+        RestoreBindings();
+
+    return allocation;
+}
+
+void VertexArena::FreeVertices(int allocation)
+{
+    const auto bufferId = mVertexHeap.GetBufferId();
+    mVertexHeap.Free(allocation);
+    if (mVertexHeap.GetBufferId() != bufferId)
+        RestoreBindings();
+}
+
+void VertexArena::FreeIndices(int allocation)
+{
+    const auto bufferId = mIndexHeap.GetBufferId();
+    mIndexHeap.Free(allocation);
+    if (mIndexHeap.GetBufferId() != bufferId)
+        RestoreBindings();
+}
+
+GLint VertexArena::GetBaseVertex(int allocation) const
+{
+    return mVertexHeap.GetOffset(allocation);
+}
+
+const void* VertexArena::GetIndexOffset(int allocation) const
+{
+    const auto offset = ((std::size_t) mIndexHeap.GetOffset(allocation));
+    return ((const void *) (offset * sizeof(unsigned int)));
+}
+
+BufferHeap* VertexArena::GetVertexHeap(void)
+{
+    return &mVertexHeap;
+}
+
+BufferHeap* VertexArena::GetIndexHeap(void)
+{
+    return &mIndexHeap;
+}
+
+void VertexArena::RestoreBindings(void)
+{
+    // Both the element array binding and vertex attribute pointers are
+    // captured by the vertex array, along with the buffers they refer to.
+    // They are specified again whenever a heap moves to a new buffer.
+    Bind();
+
+    if (mIndexHeap.GetBufferId() != 0)
+        GL::glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIndexHeap.GetBufferId());
+
+    if (mVertexHeap.GetBufferId() == 0 || mpShaderProgram == nullptr)
         return;
 
-    GL::glBindVertexArray(mVertexArrayId);
+    mpGraphicsContext->BindBuffer(BufferTarget::Array, mVertexHeap.GetBufferId());
+    SpecifyVertexAttributes(mFormat, mpShaderProgram, 0);
+}
+
+// ================================================================================
+// StreamingBuffer
+// ================================================================================
+
+StreamingBuffer::StreamingBuffer(const GraphicsContext* pGraphicsContext) :
+    mFenced(pGraphicsContext->IsVersionSupported(3, 2) && GL::glFenceSync != nullptr),
+    mInFrame(false),
+    mBufferId(0),
+    mCapacity(0),
+    mHead(0),
+    mFrameStart(0),
+    mStorageLap(0),
+    mResidentFrom(0),
+    mpGraphicsContext(pGraphicsContext)
+{
+    Reallocate(STREAMING_BUFFER_SIZE);
+}
+
+StreamingBuffer::~StreamingBuffer(void)
+{
+    auto iterator = mFrameFences.begin();
+    for (; iterator != mFrameFences.end(); ++iterator)
+        GL::glDeleteSync(iterator->sync);
+
+    if (mBufferId != 0) {
+        mpGraphicsContext->DeleteBuffer(mBufferId);
+        mBufferId = 0;
+    }
+}
+
+GLuint StreamingBuffer::GetBufferId(void) const
+{
+    return this->mBufferId;
+}
+
+bool StreamingBuffer::IsResident(const StreamRegion& region) const
+{
+    if (region.bufferId == 0 || region.bufferId != mBufferId)
+        return false; // Never written, or written before a reallocation.
+
+    if (region.position < mResidentFrom)
+        return false;
+
+    // Fenced writes only wait for frames that started within half a lap
+    // of what they overwrite, older regions must not be read any more.
+    if (mFenced)
+        return (mHead - region.position) < (mCapacity / 2);
+
+    return true;
+}
+
+StreamRegion StreamingBuffer::Write(const void* pData, std::size_t bytes)
+{
+    // Regions are kept 4-byte aligned. Anything larger than a quarter of
+    // the ring would have it wrap around (and wait) far too often.
+    const std::size_t aligned = ((bytes + 3) / 4) * 4;
+    if (aligned > mCapacity / 4)
+    {
+        std::size_t capacity = mCapacity * 2;
+        while (capacity < aligned * 4)
+            capacity = capacity * 2;
+
+        Reallocate(capacity);
+    }
+
+    // Regions never straddle the end of the buffer.
+    unsigned long long position = mHead;
+    std::size_t offset = ((std::size_t) (position % mCapacity));
+    if (offset + aligned > mCapacity) {
+        position = position + (mCapacity - offset);
+        offset = 0;
+    }
+
+    const unsigned long long end = position + aligned;
+
+    if (mFenced)
+    {
+        // Frame being recorded may read anything written since it began,
+        // it cannot be waited on so the ring has to grow instead.
+        if (mInFrame && end > mFrameStart + mCapacity / 2) {
+            Reallocate(mCapacity * 2);
+            return Write(pData, bytes);
+        }
+
+        if (end > mCapacity / 2)
+            WaitForFrames(end - mCapacity / 2);
+    }
+    else if (position / mCapacity != mStorageLap)
+    {
+        // Each lap writes into fresh storage, everything from the previous
+        // lap is gone and unsynchronized writes never hit anything in use.
+        mpGraphicsContext->BindBuffer(BufferTarget::Array, mBufferId);
+        GL::glBufferData(GL_ARRAY_BUFFER, mCapacity, nullptr, GL_STREAM_DRAW);
+        mStorageLap = position / mCapacity;
+        mResidentFrom = mStorageLap * mCapacity;
+    }
+
+    mpGraphicsContext->BindBuffer(BufferTarget::Array, mBufferId);
+
+    bool written = false;
+    if (GL::glMapBufferRange != nullptr)
+    {
+        const GLbitfield access = GL_MAP_WRITE_BIT |
+            GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+
+        auto pMapped = GL::glMapBufferRange(GL_ARRAY_BUFFER, offset, bytes, access);
+        if (pMapped != nullptr) {
+            memcpy(pMapped, pData, bytes);
+            written = (GL::glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE);
+        }
+    }
+
+    if (written == false)
+        GL::glBufferSubData(GL_ARRAY_BUFFER, offset, bytes, pData);
+
+    mHead = end;
+    StreamRegion region = { mBufferId, offset, position };
+    return region;
+}
+
+void StreamingBuffer::BeginFrame(void)
+{
+    mInFrame = true;
+    mFrameStart = mHead;
+}
+
+void StreamingBuffer::EndFrame(void)
+{
+    mInFrame = false;
+    if (mFenced == false)
+        return;
+
+    // Frames that began at the same position are waited on together, so
+    // the latest of them is all that needs a fence.
+    if (!mFrameFences.empty() && mFrameFences.back().start == mFrameStart) {
+        GL::glDeleteSync(mFrameFences.back().sync);
+        mFrameFences.pop_back();
+    }
+
+    FrameFence fence = { GL::glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), mFrameStart };
+    mFrameFences.push_back(fence);
+
+    // Let go of fences of frames that have completed by now.
+    while (mFrameFences.size() > 1)
+    {
+        const auto status = GL::glClientWaitSync(mFrameFences.front().sync, 0, 0);
+        if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+            break;
+
+        GL::glDeleteSync(mFrameFences.front().sync);
+        mFrameFences.erase(mFrameFences.begin());
+    }
+}
+
+void StreamingBuffer::Reallocate(std::size_t capacity)
+{
+    // Storage of the previous buffer lives on for as long as commands in
+    // flight refer to it, regions in it are no longer resident though.
+    if (mBufferId != 0)
+        mpGraphicsContext->DeleteBuffer(mBufferId);
+
+    auto iterator = mFrameFences.begin();
+    for (; iterator != mFrameFences.end(); ++iterator)
+        GL::glDeleteSync(iterator->sync);
+
+    mFrameFences.clear();
+
+    GL::glGenBuffers(1, &mBufferId);
+    mpGraphicsContext->BindBuffer(BufferTarget::Array, mBufferId);
+    GL::glBufferData(GL_ARRAY_BUFFER, capacity, nullptr, GL_STREAM_DRAW);
+
+    mCapacity = capacity;
+    mFrameStart = mHead;
+    mStorageLap = mHead / mCapacity;
+    mResidentFrom = mHead;
+}
+
+void StreamingBuffer::WaitForFrames(unsigned long long position)
+{
+    // Fences are in the order frames were rendered, so waiting stops at
+    // the first frame that began at or beyond the given position.
+    while (!mFrameFences.empty() && mFrameFences.front().start < position)
+    {
+        auto sync = mFrameFences.front().sync;
+        auto status = GL::glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, STREAMING_WAIT_TIMEOUT);
+        while (status == GL_TIMEOUT_EXPIRED)
+            status = GL::glClientWaitSync(sync, 0, STREAMING_WAIT_TIMEOUT);
+
+        GL::glDeleteSync(sync);
+        mFrameFences.erase(mFrameFences.begin());
+    }
+}
+
+// ================================================================================
+// VertexBuffer
+// ================================================================================
+
+// Buffers with vertex arenas of their own always start at vertex zero, it
+// is only those in shared arenas (OpenGL 3.2 and above) that need a base.
+// 
+static void DrawElements(GLenum mode, GLsizei count, GLenum type,
+    const void* pIndexOffset, GLint baseVertex)
+{
+    if (baseVertex != 0)
+        GL::glDrawElementsBaseVertex(mode, count, type, pIndexOffset, baseVertex);
+    else
+        GL::glDrawElements(mode, count, type, pIndexOffset);
+}
+
+VertexBuffer::VertexBuffer(const GraphicsContext* pGraphicsContext) :
+    mVertexCount(0),
+    mIndexCount(0),
+    mIndexType(GL_UNSIGNED_SHORT),
+    mDequantScaleIndex(-1),
+    mDequantOffsetIndex(-1),
+    mpShaderProgram(nullptr),
+    mpGraphicsContext(pGraphicsContext),
+    mpVertexArena(nullptr),
+    mVertexAllocation(-1),
+    mIndexAllocation(-1),
+    mDynamic(false),
+    mStreamed(false),
+    mVertexFormat(VertexFormat::Point),
+    mStreamVertexArrayId(0),
+    mStreamIndexOffset(0),
+    mPrimitiveType(Dynamo::Bloodstone::IVertexBuffer::PrimitiveType::None),
+    mAttributeEncoding(Dynamo::Bloodstone::IVertexBuffer::AttributeEncoding::Full),
+    mClusterRunsValid(false),
+    mClusterRunsTranslucent(false)
+{
+    mDequantScale[0] = mDequantScale[1] = mDequantScale[2] = 1.0f;
+    mDequantScale[3] = 0.0f;
+    mDequantOffset[0] = mDequantOffset[1] = mDequantOffset[2] = 0.0f;
+    mDequantOffset[3] = 0.0f;
+
+    StreamRegion region = { 0, 0, 0 };
+    mStreamRegion = region;
+}
+
+VertexBuffer::~VertexBuffer()
+{
+    ReleaseStorage();
+
+    if (mStreamVertexArrayId != 0) {
+        mpGraphicsContext->DeleteVertexArray(mStreamVertexArrayId);
+        mStreamVertexArrayId = 0;
+    }
+}
+
+int VertexBuffer::Render(bool translucent) const
+{
+    if (mVertexCount <= 0) // Nothing to render.
+        return 0;
+
+    // Only programs specialized for quantized vertices dequantize them.
+    if (mpShaderProgram != nullptr && mDequantScaleIndex >= 0) {
+        mpShaderProgram->SetParameter(mDequantScaleIndex, &mDequantScale[0], 4);
+        mpShaderProgram->SetParameter(mDequantOffsetIndex, &mDequantOffset[0], 4);
+    }
+
+    int drawCalls = 1;
+    GLint baseVertex = 0;
+    const void* pIndexOffset = nullptr;
+
+    if (mStreamed)
+    {
+        // Attribute pointers of the vertex array already start at the
+        // streamed region, indices follow right after the vertices.
+        EnsureStreamed();
+        pIndexOffset = ((const void *) (mStreamRegion.offset + mStreamIndexOffset));
+    }
+    else
+    {
+        mpVertexArena->Bind();
+        baseVertex = mpVertexArena->GetBaseVertex(mVertexAllocation);
+        if (mIndexCount > 0)
+            pIndexOffset = mpVertexArena->GetIndexOffset(mIndexAllocation);
+    }
 
     switch (mPrimitiveType)
     {
     case Dynamo::Bloodstone::IVertexBuffer::PrimitiveType::Point:
-        GL::glDrawArrays(GL_POINTS, 0, mVertexCount);
+        GL::glDrawArrays(GL_POINTS, baseVertex, mVertexCount);
         break;
     case Dynamo::Bloodstone::IVertexBuffer::PrimitiveType::LineStrip:
+        if (mIndexCount > 0)
+        {
+            // Strips are separated by restart indices (OpenGL 3.1 and up),
+            // which are compared against before the base vertex is added.
+            // Restart is left enabled for the line strips drawn next (see
+            // "RenderQueue"), it is indexed triangles that disable it again.
+            const GLuint restartIndex = ((mIndexType == GL_UNSIGNED_SHORT) ? 0xffff : 0xffffffff);
+            mpGraphicsContext->SetCapability(Capability::PrimitiveRestart, true);
+            mpGraphicsContext->SetPrimitiveRestartIndex(restartIndex);
+            DrawElements(GL_LINE_STRIP, mIndexCount, mIndexType, pIndexOffset, baseVertex);
+        }
+        else if (GL::glMultiDrawArrays != nullptr && !mSegmentVertexCount.empty())
         {
-            auto vc = mSegmentVertexCount.begin();
-            for (int start = 0; vc != mSegmentVertexCount.end(); ++vc)
+            // Only buffers in arenas of their own come without restart
+            // indices, the first vertex of each strip is right as it is.
+            GL::glMultiDrawArrays(GL_LINE_STRIP, &mSegmentFirstVertex[0],
+                &mSegmentVertexCount[0], ((GLsizei) mSegmentVertexCount.size()));
+        }
+        else
+        {
+            drawCalls = 0;
+            for (std::size_t segment = 0; segment < mSegmentVertexCount.size(); ++segment)
             {
-                int vertexCount = *vc;
-                if (vertexCount > 0) {
-                    GL::glDrawArrays(GL_LINE_STRIP, start, vertexCount);
-                    start = start + vertexCount;
+                if (mSegmentVertexCount[segment] > 0) {
+                    GL::glDrawArrays(GL_LINE_STRIP, mSegmentFirstVertex[segment],
+                        mSegmentVertexCount[segment]);
+                    drawCalls++;
                 }
             }
-            break;
         }
+        break;
     case Dynamo::Bloodstone::IVertexBuffer::PrimitiveType::Triangle:
-        GL::glDrawArrays(GL_TRIANGLES, 0, mVertexCount);
+        if (mIndexCount > 0)
+            mpGraphicsContext->SetCapability(Capability::PrimitiveRestart, false);
+
+        if (mIndexCount > 0 && !mClusters.empty())
+            drawCalls = DrawClusters(pIndexOffset, baseVertex, translucent);
+        else if (mIndexCount > 0)
+            DrawElements(GL_TRIANGLES, mIndexCount, mIndexType, pIndexOffset, baseVertex);
+        else
+            GL::glDrawArrays(GL_TRIANGLES, baseVertex, mVertexCount);
         break;
     }
+
+    return drawCalls;
 }
 
 IVertexBuffer::PrimitiveType VertexBuffer::GetPrimitiveTypeCore() const
@@ -70,59 +828,116 @@ IVertexBuffer::PrimitiveType VertexBuffer::GetPrimitiveTypeCore() const
     return this->mPrimitiveType;
 }
 
-void VertexBuffer::LoadDataCore(const GeometryData& geometries)
+ShaderFeatures VertexBuffer::GetShaderFeaturesCore() const
 {
-    EnsureVertexBufferCreation();
+    // Points and lines are never lit, they do not even carry normals.
+    int features = ((int) ShaderFeatures::None);
+    if (mPrimitiveType == Dynamo::Bloodstone::IVertexBuffer::PrimitiveType::Triangle)
+        features = features | ((int) ShaderFeatures::Lit);
+    if (mAttributeEncoding == Dynamo::Bloodstone::IVertexBuffer::AttributeEncoding::Quantized)
+        features = features | ((int) ShaderFeatures::Quantized);
 
-    const GeometryData* p = &geometries;
-    auto pgd = dynamic_cast<const PointGeometryData *>(p);
-    auto lgd = dynamic_cast<const LineStripGeometryData *>(p);
-    auto tgd = dynamic_cast<const TriangleGeometryData *>(p);
+    return ((ShaderFeatures) features);
+}
 
-    if (pgd != nullptr)
-        mPrimitiveType = Dynamo::Bloodstone::IVertexBuffer::PrimitiveType::Point;
-    else if (lgd != nullptr)
-        mPrimitiveType = Dynamo::Bloodstone::IVertexBuffer::PrimitiveType::LineStrip;
-    else if (tgd != nullptr)
-        mPrimitiveType = Dynamo::Bloodstone::IVertexBuffer::PrimitiveType::Triangle;
- 
-    mVertexCount = geometries.VertexCount();
-    std::vector<VertexData> data(mVertexCount);
-    for (int vertex = 0; vertex < mVertexCount; ++vertex)
+void VertexBuffer::LoadDataCore(const PointGeometryData& geometries)
+{
+    mPrimitiveType = Dynamo::Bloodstone::IVertexBuffer::PrimitiveType::Point;
+    mAttributeEncoding = Dynamo::Bloodstone::IVertexBuffer::AttributeEncoding::Full;
+    mIndexCount = 0;
+    mClusters.clear();
+    mSegmentVertexCount.clear();
+    mSegmentFirstVertex.clear();
+    LoadDataInternal<PointVertexData>(geometries, VertexFormat::Point);
+}
+
+void VertexBuffer::LoadDataCore(const LineStripGeometryData& geometries)
+{
+    mPrimitiveType = Dynamo::Bloodstone::IVertexBuffer::PrimitiveType::LineStrip;
+    mAttributeEncoding = Dynamo::Bloodstone::IVertexBuffer::AttributeEncoding::Full;
+    mIndexCount = 0;
+    mClusters.clear();
+
+    mSegmentVertexCount.clear();
+    mSegmentFirstVertex.clear();
+    auto segments = geometries.GetSegmentCount();
+    if (segments > 0)
     {
-        auto pCoordinates = geometries.GetCoordinates(vertex);
-        auto pRgbaColors = geometries.GetRgbaColors(vertex);
+        // First vertex of each strip, so that all of them can be drawn
+        // with a single "glMultiDrawArrays" call.
+        auto svc = geometries.GetSegmentVertexCounts();
+        mSegmentVertexCount.assign(svc, svc + segments);
+        mSegmentFirstVertex.resize(segments);
 
-        data[vertex].x = pCoordinates[0];
-        data[vertex].y = pCoordinates[1];
-        data[vertex].z = pCoordinates[2];
-        data[vertex].r = pRgbaColors[0];
-        data[vertex].g = pRgbaColors[1];
-        data[vertex].b = pRgbaColors[2];
-        data[vertex].a = pRgbaColors[3];
+        GLint first = 0;
+        for (int segment = 0; segment < segments; ++segment) {
+            mSegmentFirstVertex[segment] = first;
+            first = first + mSegmentVertexCount[segment];
+        }
     }
 
-    if (tgd != nullptr)
+    LoadDataInternal<LineStripVertexData>(geometries, VertexFormat::Point);
+
+    // Where primitive restart is available all strips go into one index
+    // buffer, each terminated by a restart index (which "LoadIndices"
+    // narrows down to 16 bits along with the rest of indices).
+    if (mVertexCount > 0 && segments > 0 &&
+        mpGraphicsContext->IsVersionSupported(3, 1))
     {
-        // We have normal values when we deal with triangles.
-        const float* pNormalCoords = tgd->GetNormalCoords(0);
-        for (int vertex = 0; vertex < mVertexCount; ++vertex)
+        std::vector<unsigned int> indices;
+        indices.reserve(mVertexCount + segments);
+
+        for (int segment = 0; segment < segments; ++segment)
         {
-            data[vertex].nx = pNormalCoords[0];
-            data[vertex].ny = pNormalCoords[1];
-            data[vertex].nz = pNormalCoords[2];
-            pNormalCoords = pNormalCoords + 3;
+            const unsigned int first = mSegmentFirstVertex[segment];
+            const unsigned int count = mSegmentVertexCount[segment];
+            for (unsigned int vertex = first; vertex < first + count; ++vertex)
+                indices.push_back(vertex);
+
+            indices.push_back(0xffffffff);
         }
+
+        LoadIndices(&indices[0], ((int) indices.size()));
     }
-    else if (lgd != nullptr)
-    {
-        auto segments = lgd->GetSegmentCount();
-        auto svc = lgd->GetSegmentVertexCounts();
-        for (int segment = 0; segment < segments; ++segment)
-            mSegmentVertexCount.push_back(svc[segment]);
+}
+
+void VertexBuffer::LoadDataCore(const TriangleGeometryData& geometries,
+    AttributeEncoding encoding)
+{
+    mPrimitiveType = Dynamo::Bloodstone::IVertexBuffer::PrimitiveType::Triangle;
+    mAttributeEncoding = encoding;
+    mSegmentVertexCount.clear();
+    mSegmentFirstVertex.clear();
+
+    if (encoding == Dynamo::Bloodstone::IVertexBuffer::AttributeEncoding::Quantized)
+        LoadDataInternal<QuantizedTriangleVertexData>(geometries, VertexFormat::QuantizedTriangle);
+    else
+        LoadDataInternal<TriangleVertexData>(geometries, VertexFormat::Triangle);
+
+    LoadIndices(geometries.GetIndices(), geometries.IndexCount());
+
+    mClusters.clear();
+    mClusterRunsValid = false;
+    if (mIndexCount > 0 && geometries.ClusterCount() > 0) {
+        auto pClusters = geometries.GetClusters();
+        mClusters.assign(pClusters, pClusters + geometries.ClusterCount());
     }
 
-    LoadDataInternal(data);
+    // Vertex colors that blend make the mesh translucent whatever the node
+    // it is drawn for, none of its clusters can be left out facing away.
+    const unsigned char* pRgbaColors = nullptr;
+    if (!mClusters.empty())
+        pRgbaColors = geometries.GetRgbaColors(0);
+
+    const int vertexCount = ((pRgbaColors != nullptr) ? geometries.VertexCount() : 0);
+    for (int vertex = 0; vertex < vertexCount; ++vertex)
+    {
+        if (pRgbaColors[vertex * 4 + 3] < 255) {
+            for (std::size_t cluster = 0; cluster < mClusters.size(); ++cluster)
+                mClusters[cluster].coneAngle = -1.0f;
+            break;
+        }
+    }
 }
 
 void VertexBuffer::GetBoundingBoxCore(BoundingBox* pBoundingBox) const
@@ -132,59 +947,451 @@ void VertexBuffer::GetBoundingBoxCore(BoundingBox* pBoundingBox) const
 
 void VertexBuffer::BindToShaderProgramCore(IShaderProgram* pShaderProgram)
 {
-    EnsureVertexBufferCreation();
+    mpShaderProgram = pShaderProgram;
+    mDequantScaleIndex = pShaderProgram->GetShaderParameterIndex("dequantScale");
+    mDequantOffsetIndex = pShaderProgram->GetShaderParameterIndex("dequantOffset");
 
-    GL::glBindVertexArray(mVertexArrayId);
-    GL::glBindBuffer(GL_ARRAY_BUFFER, mVertexBufferId);
+    // Vertex attributes are a property of the arena, which is only known
+    // once data is loaded (binding may well happen before that).
+    if (mpVertexArena != nullptr)
+        mpVertexArena->BindToShaderProgram(pShaderProgram);
 
-    GL::glEnableVertexAttribArray(0);   // Position
-    GL::glEnableVertexAttribArray(1);   // Normal
-    GL::glEnableVertexAttribArray(2);   // Color
+    // Streamed data has its attribute pointers specified on the next write.
+    mStreamRegion.bufferId = 0;
+}
 
-    const auto pProgram = dynamic_cast<ShaderProgram *>(pShaderProgram);
-    const auto locPosition = pProgram->GetAttributeLocation("inPosition");
-    const auto locNormal = pProgram->GetAttributeLocation("inNormal");
-    const auto locColor = pProgram->GetAttributeLocation("inColor");
+bool VertexBuffer::IsDynamicCore(void) const
+{
+    return this->mDynamic;
+}
 
-    auto stride = ((int) sizeof(VertexData));
-    GL::glVertexAttribPointer(locPosition, 3, GL_FLOAT, GL_FALSE, stride, FC2O(0));
-    GL::glVertexAttribPointer(locNormal,   3, GL_FLOAT, GL_FALSE, stride, FC2O(3));
-    GL::glVertexAttribPointer(locColor,    4, GL_FLOAT, GL_FALSE, stride, FC2O(6));
+void VertexBuffer::SetDynamicCore(bool dynamic)
+{
+    // Takes effect from the next "LoadData" call onwards, data that is
+    // already in an arena stays there. Streamed data still has its copy
+    // on this side, which can move into an arena right away.
+    mDynamic = dynamic;
+    if (mDynamic == false && mStreamed)
+        MoveStreamedData();
+}
 
-    GL::glBindBuffer(GL_ARRAY_BUFFER, 0);
-    GL::glBindVertexArray(0);
+void VertexBuffer::ReleaseStorage(void)
+{
+    if (mpVertexArena != nullptr)
+    {
+        if (mIndexAllocation >= 0)
+            mpVertexArena->FreeIndices(mIndexAllocation);
+        if (mVertexAllocation >= 0)
+            mpVertexArena->FreeVertices(mVertexAllocation);
+
+        mpGraphicsContext->ReleaseVertexArena(mpVertexArena);
+    }
+
+    mVertexCount = mIndexCount = 0;
+    mVertexAllocation = mIndexAllocation = -1;
+    mpVertexArena = nullptr;
+
+    mStreamed = false;
+    mStreamData.clear();
+    mStreamIndexOffset = 0;
+    mStreamRegion.bufferId = 0;
 }
 
-void VertexBuffer::EnsureVertexBufferCreation(void)
+void VertexBuffer::MoveStreamedData(void)
 {
-    if (mVertexArrayId == 0)
-        GL::glGenVertexArrays(1, &mVertexArrayId);
+    // Vertices and indices are already interleaved and narrowed down, they
+    // are written into the arena the same way "LoadData" would have.
+    mpVertexArena = mpGraphicsContext->AcquireVertexArena(mVertexFormat, mVertexCount);
+    if (mpShaderProgram != nullptr)
+        mpVertexArena->BindToShaderProgram(mpShaderProgram);
+
+    const auto vertexBytes = mVertexCount * GetVertexSize(mVertexFormat);
+    mVertexAllocation = mpVertexArena->AllocateVertices(mVertexCount);
+    mpVertexArena->GetVertexHeap()->Write(mVertexAllocation, &mStreamData[0], vertexBytes);
 
-    if (mVertexBufferId == 0)
-        GL::glGenBuffers(1, &mVertexBufferId);
+    if (mIndexCount > 0)
+    {
+        const auto indexBytes = mStreamData.size() - mStreamIndexOffset;
+        mIndexAllocation = mpVertexArena->AllocateIndices(indexBytes);
+        mpVertexArena->GetIndexHeap()->Write(mIndexAllocation,
+            &mStreamData[mStreamIndexOffset], indexBytes);
+    }
+
+    mStreamed = false;
+    std::vector<unsigned char>().swap(mStreamData);
+    mStreamIndexOffset = 0;
+    mStreamRegion.bufferId = 0;
 }
 
-void VertexBuffer::LoadDataInternal(const std::vector<VertexData>& vertices)
+void VertexBuffer::EnsureStreamed(void) const
 {
-    const auto bytes = vertices.size() * sizeof(VertexData);
+    auto pStreamingBuffer = mpGraphicsContext->GetStreamingBuffer();
+    if (mStreamVertexArrayId != 0 && pStreamingBuffer->IsResident(mStreamRegion)) {
+        mpGraphicsContext->BindVertexArray(mStreamVertexArrayId);
+        return;
+    }
+
+    mStreamRegion = pStreamingBuffer->Write(&mStreamData[0], mStreamData.size());
+
+    if (mStreamVertexArrayId == 0)
+        GL::glGenVertexArrays(1, &mStreamVertexArrayId);
+
+    // Region moves with every write, and attribute pointers with it.
+    mpGraphicsContext->BindVertexArray(mStreamVertexArrayId);
+    const auto bufferId = pStreamingBuffer->GetBufferId();
+
+    auto pProgram = dynamic_cast<const ShaderProgram *>(mpShaderProgram);
+    if (pProgram != nullptr) {
+        mpGraphicsContext->BindBuffer(BufferTarget::Array, bufferId);
+        SpecifyVertexAttributes(mVertexFormat, pProgram, mStreamRegion.offset);
+    }
+
+    if (mIndexCount > 0)
+        GL::glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bufferId);
+}
+
+void VertexBuffer::UpdateClusterRuns(bool translucent) const
+{
+    Frustum frustum;
+    CameraConfiguration configuration;
+    auto pCamera = mpGraphicsContext->GetDefaultCamera();
+    pCamera->GetFrustum(&frustum);
+    pCamera->GetConfiguration(&configuration);
+
+    const float* pEye = &configuration.cameraPosition[0];
+    if (mClusterRunsValid && mClusterRunsTranslucent == translucent && mClusterFrustum == frustum &&
+        memcmp(&mClusterEyePosition[0], pEye, sizeof(mClusterEyePosition)) == 0)
+        return; // The camera has not moved.
+
+    mClusterRunsValid = true;
+    mClusterRunsTranslucent = translucent;
+    mClusterFrustum = frustum;
+    memcpy(&mClusterEyePosition[0], pEye, sizeof(mClusterEyePosition));
+    mRunFirstIndices.clear();
+    mRunIndexCounts.clear();
+
+    // Triangles are drawn from both sides, so from within the bounding box
+    // of a closed mesh those facing away may well be the ones to be seen.
+    // Through a translucent mesh they are seen from anywhere.
+    float min[3], max[3];
+    mBoundingBox.Get(&min[0], &max[0]);
+    const bool outside = (pEye[0] < min[0] || pEye[0] > max[0] ||
+        pEye[1] < min[1] || pEye[1] > max[1] || pEye[2] < min[2] || pEye[2] > max[2]);
+    const bool cullBackFaces = (outside && !translucent);
+
+    auto iterator = mClusters.begin();
+    for (; iterator != mClusters.end(); ++iterator)
+    {
+        const MeshCluster& cluster = *iterator;
+        if (frustum.IsOutside(&cluster.center[0], cluster.radius))
+            continue;
+
+        if (cullBackFaces && cluster.coneAngle >= 0.0f)
+        {
+            // Facing away if the angle between the direction to the cluster
+            // and any of its triangle normals is below 90 degrees. That is
+            // at most the angle to the cone axis, plus the cone angle, plus
+            // the angle the bounding sphere spans as seen from the camera.
+            // 
+            const float dx = cluster.center[0] - pEye[0];
+            const float dy = cluster.center[1] - pEye[1];
+            const float dz = cluster.center[2] - pEye[2];
+            const float distance = std::sqrt((dx * dx) + (dy * dy) + (dz * dz));
+            const float sine = cluster.radius / distance;
 
-    std::size_t count = vertices.size();
-    if (count <= 0)
+            if (distance > 0.0f && sine < CLUSTER_MAX_SINE_OF_SPREAD)
+            {
+                const float* pAxis = &cluster.coneAxis[0];
+                float cosine = ((dx * pAxis[0]) + (dy * pAxis[1]) + (dz * pAxis[2])) / distance;
+                cosine = ((cosine < -1.0f) ? -1.0f : ((cosine > 1.0f) ? 1.0f : cosine));
+
+                const float angle = std::acos(cosine) + cluster.coneAngle + std::asin(sine);
+                if (angle < 1.5707963f)
+                    continue;
+            }
+        }
+
+        // Clusters are laid out one after another, so neighbours merge.
+        if (!mRunFirstIndices.empty() &&
+            mRunFirstIndices.back() + mRunIndexCounts.back() == cluster.firstIndex)
+        {
+            mRunIndexCounts.back() += cluster.indexCount;
+            continue;
+        }
+
+        mRunFirstIndices.push_back(cluster.firstIndex);
+        mRunIndexCounts.push_back(cluster.indexCount);
+    }
+}
+
+int VertexBuffer::DrawClusters(const void* pIndexOffset, GLint baseVertex, bool translucent) const
+{
+    UpdateClusterRuns(translucent);
+
+    const GLsizei runCount = ((GLsizei) mRunIndexCounts.size());
+    if (runCount <= 0)
+        return 0; // Every cluster is out of sight.
+
+    // Offsets move with the streamed region, so they are not kept.
+    const std::size_t indexSize = ((mIndexType == GL_UNSIGNED_SHORT) ?
+        sizeof(unsigned short) : sizeof(unsigned int));
+
+    mRunIndexOffsets.resize(runCount);
+    for (GLsizei run = 0; run < runCount; ++run) {
+        mRunIndexOffsets[run] = ((const unsigned char *) pIndexOffset) +
+            (mRunFirstIndices[run] * indexSize);
+    }
+
+    if (runCount == 1)
+    {
+        DrawElements(GL_TRIANGLES, mRunIndexCounts[0], mIndexType,
+            mRunIndexOffsets[0], baseVertex);
+        return 1;
+    }
+    else if (baseVertex != 0 && GL::glMultiDrawElementsBaseVertex != nullptr)
+    {
+        mRunBaseVertices.assign(runCount, baseVertex);
+        GL::glMultiDrawElementsBaseVertex(GL_TRIANGLES, &mRunIndexCounts[0],
+            mIndexType, &mRunIndexOffsets[0], runCount, &mRunBaseVertices[0]);
+        return 1;
+    }
+    else if (baseVertex == 0 && GL::glMultiDrawElements != nullptr)
+    {
+        GL::glMultiDrawElements(GL_TRIANGLES, &mRunIndexCounts[0],
+            mIndexType, &mRunIndexOffsets[0], runCount);
+        return 1;
+    }
+
+    for (GLsizei run = 0; run < runCount; ++run) {
+        DrawElements(GL_TRIANGLES, mRunIndexCounts[run], mIndexType,
+            mRunIndexOffsets[run], baseVertex);
+    }
+
+    return runCount;
+}
+
+template<typename VertexType, typename GeometryType>
+void VertexBuffer::LoadDataInternal(const GeometryType& geometries, VertexFormat format)
+{
+    ReleaseStorage();
+
+    mVertexCount = geometries.VertexCount();
+    if (mVertexCount <= 0) {
         mBoundingBox.Reset(0.0f, 0.0f, 0.0f);
+        return;
+    }
+
+    const auto bytes = mVertexCount * sizeof(VertexType);
+
+    // Vertices are in world space unless they get quantized.
+    mDequantScale[0] = mDequantScale[1] = mDequantScale[2] = 1.0f;
+    mDequantScale[3] = 0.0f;
+    mDequantOffset[0] = mDequantOffset[1] = mDequantOffset[2] = 0.0f;
+
+    mVertexFormat = format;
+    mStreamed = mDynamic;
+
+    if (mStreamed)
+    {
+        // Dynamic data stays on this side, the streaming buffer only ever
+        // holds it for a while. Indices (if any) go after the vertices.
+        mStreamData.resize(bytes);
+        InterleaveVertices(geometries, ((VertexType *) &mStreamData[0]));
+        mStreamIndexOffset = ((bytes + 3) / 4) * 4;
+        return;
+    }
+
+    mpVertexArena = mpGraphicsContext->AcquireVertexArena(format, mVertexCount);
+    if (mpShaderProgram != nullptr)
+        mpVertexArena->BindToShaderProgram(mpShaderProgram);
+
+    mVertexAllocation = mpVertexArena->AllocateVertices(mVertexCount);
+    auto pVertexHeap = mpVertexArena->GetVertexHeap();
+
+    // Interleave straight into the buffer storage if it can be mapped
+    // (OpenGL 3.0 and above), this saves an intermediate vertex copy.
+    bool uploaded = false;
+    auto pMapped = pVertexHeap->Map(mVertexAllocation);
+    if (pMapped != nullptr) {
+        InterleaveVertices(geometries, ((VertexType *) pMapped));
+        uploaded = pVertexHeap->Unmap();
+    }
+
+    if (uploaded == false)
+    {
+        auto pStaging = mpGraphicsContext->GetStagingBuffer(bytes);
+        InterleaveVertices(geometries, ((VertexType *) pStaging));
+        pVertexHeap->Write(mVertexAllocation, pStaging, bytes);
+    }
+}
+
+void VertexBuffer::LoadIndices(const unsigned int* pIndices, int indexCount)
+{
+    mIndexCount = ((mVertexCount > 0) ? indexCount : 0);
+    if (mIndexCount <= 0)
+        return;
+
+    std::size_t bytes = 0;
+    const void* pIndexData = pIndices;
+
+    if (mVertexCount < 65536)
+    {
+        // Every index fits into 16 bits (with "0xffff" left for restart
+        // index), halve the size of index buffer.
+        mIndexType = GL_UNSIGNED_SHORT;
+        bytes = mIndexCount * sizeof(unsigned short);
+        auto pShortIndices = ((unsigned short *) mpGraphicsContext->GetStagingBuffer(bytes));
+        for (int index = 0; index < mIndexCount; ++index)
+            pShortIndices[index] = ((unsigned short) pIndices[index]);
+
+        pIndexData = pShortIndices;
+    }
     else
     {
-        const VertexData* p = &vertices[0];
-        mBoundingBox.Reset(p[0].x, p[0].y, p[0].z);
-        for (std::size_t index = 0; index < count; ++index)
-            mBoundingBox.EvaluatePoint(p[index].x, p[index].y, p[index].z);
+        mIndexType = GL_UNSIGNED_INT;
+        bytes = mIndexCount * sizeof(unsigned int);
+    }
+
+    if (mStreamed) {
+        mStreamData.resize(mStreamIndexOffset + bytes);
+        memcpy(&mStreamData[mStreamIndexOffset], pIndexData, bytes);
+        return;
+    }
+
+    // Indices stay relative to the first vertex of this buffer, shared
+    // arenas add that in as the base vertex of draw calls.
+    mIndexAllocation = mpVertexArena->AllocateIndices(bytes);
+    mpVertexArena->GetIndexHeap()->Write(mIndexAllocation, pIndexData, bytes);
+}
+
+// Bounding box of the source coordinates, evaluated in a vectorized pass
+// ahead of interleaving (which then only copies attributes over).
+// 
+static void EvaluateBoundingBox(const float* pCoordinates,
+    int vertexCount, BoundingBox* pBoundingBox)
+{
+    float min[3], max[3];
+    GeometryKernels::EvaluateBounds(pCoordinates, vertexCount, &min[0], &max[0]);
+    pBoundingBox->Reset(min[0], min[1], min[2]);
+    pBoundingBox->EvaluatePoint(max[0], max[1], max[2]);
+}
+
+// The following "InterleaveVertices" overloads are the only pass over the
+// source data besides the bounding box: attributes are interleaved into
+// their final layout. The destination may be write-combined memory, so it
+// is written sequentially and never read back.
+// 
+void VertexBuffer::InterleaveVertices(const GeometryData& geometries,
+    PointVertexData* pVertices)
+{
+    const float* pCoordinates = geometries.GetCoordinates(0);
+    const unsigned char* pRgbaColors = geometries.GetRgbaColors(0);
+
+    EvaluateBoundingBox(pCoordinates, mVertexCount, &mBoundingBox);
+
+    for (int vertex = 0; vertex < mVertexCount; ++vertex)
+    {
+        PointVertexData& data = pVertices[vertex];
+        data.x = pCoordinates[0];
+        data.y = pCoordinates[1];
+        data.z = pCoordinates[2];
+        pCoordinates = pCoordinates + 3;
+
+        if (pRgbaColors != nullptr) {
+            data.r = pRgbaColors[0];
+            data.g = pRgbaColors[1];
+            data.b = pRgbaColors[2];
+            data.a = pRgbaColors[3];
+            pRgbaColors = pRgbaColors + 4;
+        } else {
+            data.r = data.g = data.b = data.a = 255;
+        }
     }
+}
 
-    GL::glBindVertexArray(mVertexArrayId);
-    GL::glBindBuffer(GL_ARRAY_BUFFER, mVertexBufferId);
-    GL::glBufferData(GL_ARRAY_BUFFER, bytes, &vertices[0], GL_STATIC_DRAW);
+void VertexBuffer::InterleaveVertices(const TriangleGeometryData& geometries,
+    TriangleVertexData* pVertices)
+{
+    const float* pCoordinates = geometries.GetCoordinates(0);
+    const float* pNormalCoords = geometries.GetNormalCoords(0);
+    const unsigned char* pRgbaColors = geometries.GetRgbaColors(0);
+
+    EvaluateBoundingBox(pCoordinates, mVertexCount, &mBoundingBox);
+
+    for (int vertex = 0; vertex < mVertexCount; ++vertex)
+    {
+        TriangleVertexData& data = pVertices[vertex];
+        data.x = pCoordinates[0];
+        data.y = pCoordinates[1];
+        data.z = pCoordinates[2];
+        pCoordinates = pCoordinates + 3;
+
+        data.nx = pNormalCoords[0];
+        data.ny = pNormalCoords[1];
+        data.nz = pNormalCoords[2];
+        pNormalCoords = pNormalCoords + 3;
 
-    GL::glBindBuffer(GL_ARRAY_BUFFER, 0);
-    GL::glBindVertexArray(0);
+        if (pRgbaColors != nullptr) {
+            data.r = pRgbaColors[0];
+            data.g = pRgbaColors[1];
+            data.b = pRgbaColors[2];
+            data.a = pRgbaColors[3];
+            pRgbaColors = pRgbaColors + 4;
+        } else {
+            data.r = data.g = data.b = data.a = 255;
+        }
+    }
+}
+
+void VertexBuffer::InterleaveVertices(const TriangleGeometryData& geometries,
+    QuantizedTriangleVertexData* pVertices)
+{
+    // Positions are quantized against the bounding box, so it has to be
+    // known before anything can be written out.
+    // 
+    const float* pCoordinates = geometries.GetCoordinates(0);
+    EvaluateBoundingBox(pCoordinates, mVertexCount, &mBoundingBox);
+
+    float min[3], max[3];
+    mBoundingBox.Get(&min[0], &max[0]);
+    const PositionQuantizer quantizer(&min[0], &max[0]);
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        mDequantScale[axis] = quantizer.GetScale()[axis];
+        mDequantOffset[axis] = quantizer.GetOffset()[axis];
+    }
+
+    mDequantScale[3] = 1.0f; // Normals are octahedral encoded.
+
+    const float* pNormalCoords = geometries.GetNormalCoords(0);
+    const unsigned char* pRgbaColors = geometries.GetRgbaColors(0);
+
+    for (int vertex = 0; vertex < mVertexCount; ++vertex)
+    {
+        unsigned short position[3];
+        quantizer.Quantize(pCoordinates, &position[0]);
+        pCoordinates = pCoordinates + 3;
+
+        QuantizedTriangleVertexData& data = pVertices[vertex];
+        data.x = position[0];
+        data.y = position[1];
+        data.z = position[2];
+        data.w = 0;
+
+        OctahedralNormal::Encode(pNormalCoords, &data.nu, &data.nv);
+        pNormalCoords = pNormalCoords + 3;
+
+        if (pRgbaColors != nullptr) {
+            data.r = pRgbaColors[0];
+            data.g = pRgbaColors[1];
+            data.b = pRgbaColors[2];
+            data.a = pRgbaColors[3];
+            pRgbaColors = pRgbaColors + 4;
+        } else {
+            data.r = data.g = data.b = data.a = 255;
+        }
+    }
 }
 
 // ================================================================================
@@ -195,19 +1402,18 @@ BillboardVertexBuffer::BillboardVertexBuffer(const IGraphicsContext* pGraphicsCo
     IBillboardVertexBuffer(pGraphicsContext),
     mVertexCount(0),
     mVertexArrayId(0),
-    mVertexBufferId(0)
+    mpGraphicsContext(dynamic_cast<const GraphicsContext *>(pGraphicsContext))
 {
+    mAttributeLocations[0] = mAttributeLocations[1] = mAttributeLocations[2] = -1;
+
+    StreamRegion region = { 0, 0, 0 };
+    mStreamRegion = region;
 }
 
 BillboardVertexBuffer::~BillboardVertexBuffer(void)
 {
-    if (mVertexBufferId != 0) {
-        GL::glDeleteBuffers(1, &mVertexBufferId);
-        mVertexBufferId = 0;
-    }
-
     if (mVertexArrayId != 0) {
-        GL::glDeleteVertexArrays(1, &mVertexArrayId);
+        mpGraphicsContext->DeleteVertexArray(mVertexArrayId);
         mVertexArrayId = 0;
     }
 }
@@ -217,10 +1423,12 @@ void BillboardVertexBuffer::RenderCore(void) const
     if (mVertexCount <= 0) // Nothing to render.
         return;
 
-    GL::glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-    GL::glBindVertexArray(mVertexArrayId);
+    EnsureStreamed();
+
+    // Everything else is drawn filled, so the mode is put back right after.
+    mpGraphicsContext->SetPolygonMode(GL_LINE);
     GL::glDrawArrays(GL_TRIANGLES, 0, mVertexCount);
-    GL::glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    mpGraphicsContext->SetPolygonMode(GL_FILL);
 }
 
 void BillboardVertexBuffer::UpdateCore(const std::vector<BillboardVertex>& vertices)
@@ -228,49 +1436,43 @@ void BillboardVertexBuffer::UpdateCore(const std::vector<BillboardVertex>& verti
     if (vertices.size() <= 0)
         return;
 
+    // Vertices are written into the streaming buffer on the next render,
+    // billboards get updated far more often than they get drawn.
     mVertexCount = ((int) vertices.size());
-    EnsureVertexBufferCreation();
-
-    GL::glBindVertexArray(mVertexArrayId);
-    GL::glBindBuffer(GL_ARRAY_BUFFER, mVertexBufferId);
-
-    const auto bytes = vertices.size() * sizeof(BillboardVertex);
-    GL::glBufferData(GL_ARRAY_BUFFER, bytes, &vertices[0], GL_DYNAMIC_DRAW);
-
-    GL::glBindBuffer(GL_ARRAY_BUFFER, 0);
-    GL::glBindVertexArray(0);
+    mVertices = vertices;
+    mStreamRegion.bufferId = 0;
 }
 
 void BillboardVertexBuffer::BindToShaderProgramCore(IShaderProgram* pShaderProgram)
 {
-    EnsureVertexBufferCreation();
-
-    GL::glBindVertexArray(mVertexArrayId);
-    GL::glBindBuffer(GL_ARRAY_BUFFER, mVertexBufferId);
-
-    GL::glEnableVertexAttribArray(0);   // Position
-    GL::glEnableVertexAttribArray(1);   // Color
-    GL::glEnableVertexAttribArray(2);   // Texture coordinates
-
     const auto pProgram = dynamic_cast<ShaderProgram *>(pShaderProgram);
-    const auto locPosition = pProgram->GetAttributeLocation("inPosition");
-    const auto locTexCoords = pProgram->GetAttributeLocation("inTextCoords");
-    const auto locColor = pProgram->GetAttributeLocation("inColor");
-
-    auto stride = ((int) sizeof(BillboardVertex));
-    GL::glVertexAttribPointer(locPosition,  3, GL_FLOAT, GL_FALSE, stride, FC2O(0));
-    GL::glVertexAttribPointer(locTexCoords, 4, GL_FLOAT, GL_FALSE, stride, FC2O(3));
-    GL::glVertexAttribPointer(locColor,     4, GL_FLOAT, GL_FALSE, stride, FC2O(7));
-
-    GL::glBindBuffer(GL_ARRAY_BUFFER, 0);
-    GL::glBindVertexArray(0);
+    mAttributeLocations[0] = pProgram->GetAttributeLocation("inPosition");
+    mAttributeLocations[1] = pProgram->GetAttributeLocation("inTextCoords");
+    mAttributeLocations[2] = pProgram->GetAttributeLocation("inColor");
+    mStreamRegion.bufferId = 0;
 }
 
-void BillboardVertexBuffer::EnsureVertexBufferCreation(void)
+void BillboardVertexBuffer::EnsureStreamed(void) const
 {
+    auto pStreamingBuffer = mpGraphicsContext->GetStreamingBuffer();
+    if (mVertexArrayId != 0 && pStreamingBuffer->IsResident(mStreamRegion)) {
+        mpGraphicsContext->BindVertexArray(mVertexArrayId);
+        return;
+    }
+
+    const auto bytes = mVertices.size() * sizeof(BillboardVertex);
+    mStreamRegion = pStreamingBuffer->Write(&mVertices[0], bytes);
+
     if (mVertexArrayId == 0)
         GL::glGenVertexArrays(1, &mVertexArrayId);
 
-    if (mVertexBufferId == 0)
-        GL::glGenBuffers(1, &mVertexBufferId);
+    mpGraphicsContext->BindVertexArray(mVertexArrayId);
+    mpGraphicsContext->BindBuffer(BufferTarget::Array, pStreamingBuffer->GetBufferId());
+
+    // Position, texture coordinates and color.
+    const auto base = mStreamRegion.offset;
+    auto stride = ((int) sizeof(BillboardVertex));
+    SpecifyVertexAttribute(mAttributeLocations[0], 3, GL_FLOAT, GL_FALSE, stride, FC2O(base, 0));
+    SpecifyVertexAttribute(mAttributeLocations[1], 4, GL_FLOAT, GL_FALSE, stride, FC2O(base, 3));
+    SpecifyVertexAttribute(mAttributeLocations[2], 4, GL_FLOAT, GL_FALSE, stride, FC2O(base, 7));
 }
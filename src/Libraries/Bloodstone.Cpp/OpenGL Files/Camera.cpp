@@ -185,7 +185,33 @@ void TrackBall::UpdateCameraInternal(void)
 // Camera
 // ================================================================================
 
+static void ExtractFrustum(const glm::mat4& clip, Frustum* pFrustum)
+{
+    // Planes come straight out of the rows of the combined matrix (glm
+    // matrices are indexed by column first), in the order left, right,
+    // bottom, top, near and far.
+    // 
+    float planes[24];
+    for (int plane = 0; plane < 6; ++plane)
+    {
+        const int row = plane / 2;
+        const float sign = (((plane % 2) == 0) ? 1.0f : -1.0f);
+        for (int column = 0; column < 4; ++column)
+            planes[plane * 4 + column] = clip[column][3] + sign * clip[column][row];
+
+        float* pPlane = &planes[plane * 4];
+        const float length = glm::length(glm::vec3(pPlane[0], pPlane[1], pPlane[2]));
+        for (int column = 0; column < 4 && length > 0.0f; ++column)
+            pPlane[column] = pPlane[column] / length;
+    }
+
+    pFrustum->SetPlanes(&planes[0]);
+}
+
 Camera::Camera(GraphicsContext* pGraphicsContext) :
+    mRevision(0),
+    mBufferRevision(0),
+    mUniformBufferId(0),
     mpTrackBall(nullptr),
     mpInterpolator(nullptr),
     mpGraphicsContext(pGraphicsContext)
@@ -195,6 +221,14 @@ Camera::Camera(GraphicsContext* pGraphicsContext) :
     mpTrackBall = new TrackBall(this);
 }
 
+Camera::~Camera(void)
+{
+    if (mUniformBufferId != 0) {
+        mpGraphicsContext->DeleteBuffer(mUniformBufferId);
+        mUniformBufferId = 0;
+    }
+}
+
 void Camera::GetMatrices(glm::mat4& model, glm::mat4& view, glm::mat4& proj) const
 {
     model = this->mModelMatrix;
@@ -207,6 +241,39 @@ GraphicsContext* Camera::GetGraphicsContext(void) const
     return this->mpGraphicsContext;
 }
 
+const CameraBlockData& Camera::GetBlockData(void) const
+{
+    return this->mBlockData;
+}
+
+unsigned int Camera::GetRevision(void) const
+{
+    return this->mRevision;
+}
+
+void Camera::UpdateUniformBuffer(void) const
+{
+    // Uniform buffers are there from OpenGL 3.1 (or its extension) on.
+    if (mBufferRevision == mRevision || GL::glBindBufferBase == nullptr)
+        return;
+
+    if (mUniformBufferId == 0)
+    {
+        // Bound to its binding point for good, nothing else uses it.
+        GL::glGenBuffers(1, &mUniformBufferId);
+        mpGraphicsContext->BindBuffer(BufferTarget::Uniform, mUniformBufferId);
+        GL::glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlockData), &mBlockData, GL_DYNAMIC_DRAW);
+        GL::glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BLOCK_BINDING, mUniformBufferId);
+    }
+    else
+    {
+        mpGraphicsContext->BindBuffer(BufferTarget::Uniform, mUniformBufferId);
+        GL::glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraBlockData), &mBlockData);
+    }
+
+    mBufferRevision = mRevision;
+}
+
 void Camera::ConfigureCore(const CameraConfiguration* pConfiguration)
 {
     FinalizeCurrentTransition();
@@ -265,6 +332,55 @@ ITrackBall* Camera::GetTrackBallCore() const
     return (const_cast<Camera *>(this))->mpTrackBall;
 }
 
+void Camera::GetFrustumCore(Frustum* pFrustum) const
+{
+    (*pFrustum) = this->mFrustum;
+}
+
+void Camera::GetPickingRayCore(float x, float y, float* pOrigin, float* pDirection) const
+{
+    // Point on the near plane, in normalized device coordinates (whose y
+    // axis points up, unlike that of the viewport), taken back to world
+    // space. Direction is that from the eye, which is exact to begin with.
+    const float w = ((float) mConfiguration.viewportWidth);
+    const float h = ((float) mConfiguration.viewportHeight);
+    const glm::vec4 device(((x / w) * 2.0f) - 1.0f, 1.0f - ((y / h) * 2.0f), -1.0f, 1.0f);
+
+    const glm::mat4 inverse = glm::inverse(mProjMatrix * mViewMatrix * mModelMatrix);
+    const glm::vec4 point = inverse * device;
+    const glm::vec3 origin(point.x / point.w, point.y / point.w, point.z / point.w);
+
+    const glm::vec3 eye(
+        mConfiguration.cameraPosition[0],
+        mConfiguration.cameraPosition[1],
+        mConfiguration.cameraPosition[2]);
+
+    const glm::vec3 direction = glm::normalize(origin - eye);
+    for (int axis = 0; axis < 3; ++axis) {
+        pOrigin[axis] = origin[axis];
+        pDirection[axis] = direction[axis];
+    }
+}
+
+void Camera::GetPickingFrustumCore(float left, float top,
+    float right, float bottom, Frustum* pFrustum) const
+{
+    // Scales and shifts the rectangle (in normalized device coordinates)
+    // onto the whole of the clip volume, as "gluPickMatrix" would.
+    const float w = ((float) mConfiguration.viewportWidth);
+    const float h = ((float) mConfiguration.viewportHeight);
+    const float x0 = ((left / w) * 2.0f) - 1.0f, x1 = ((right / w) * 2.0f) - 1.0f;
+    const float y0 = 1.0f - ((bottom / h) * 2.0f), y1 = 1.0f - ((top / h) * 2.0f);
+
+    glm::mat4 pick(1.0f);
+    pick[0][0] = 2.0f / (x1 - x0);
+    pick[1][1] = 2.0f / (y1 - y0);
+    pick[3][0] = -(x1 + x0) / (x1 - x0);
+    pick[3][1] = -(y1 + y0) / (y1 - y0);
+
+    ExtractFrustum(pick * mProjMatrix * mViewMatrix * mModelMatrix, pFrustum);
+}
+
 void Camera::InitializeTransition(const CameraConfiguration* pConfiguration)
 {
     FinalizeCurrentTransition(); // Cancel transition if there's any.
@@ -298,6 +414,12 @@ void Camera::FinalizeCurrentTransition(void)
 
 void Camera::ConfigureInternal(const CameraConfiguration* pConfiguration)
 {
+    // Nothing to evaluate (or upload later) if nothing changed.
+    if (mRevision != 0 && memcmp(pConfiguration,
+        &mConfiguration, sizeof(CameraConfiguration)) == 0) {
+        return;
+    }
+
     glm::vec3 cameraPosition(
         pConfiguration->cameraPosition[0],
         pConfiguration->cameraPosition[1],
@@ -323,5 +445,18 @@ void Camera::ConfigureInternal(const CameraConfiguration* pConfiguration)
         pConfiguration->nearClippingPlane,
         pConfiguration->farClippingPlane);
 
+    const glm::mat4 clip = mProjMatrix * mViewMatrix * mModelMatrix;
+    ExtractFrustum(clip, &this->mFrustum);
     this->mConfiguration = *pConfiguration;
+
+    mBlockData.model = mModelMatrix;
+    mBlockData.view = mViewMatrix;
+    mBlockData.proj = mProjMatrix;
+    mBlockData.viewProj = mProjMatrix * mViewMatrix;
+    mBlockData.normalMatrix = glm::transpose(glm::inverse(mViewMatrix * mModelMatrix));
+    mBlockData.viewportSize = glm::vec4(w, h, 0.0f, 0.0f);
+    mBlockData.eyePosition = glm::vec4(cameraPosition, 1.0f);
+
+    // Zero is left to mean "never configured".
+    mRevision = ((mRevision + 1 != 0) ? mRevision + 1 : 1);
 }
@@ -1,11 +1,18 @@
 
 #include "stdafx.h"
 #include "OpenInterfaces.h"
+#include "RenderQueue.h"
+
+#include <cstring>
 
 using namespace System;
 using namespace Dynamo::Bloodstone;
 using namespace Dynamo::Bloodstone::OpenGL;
 
+// Released private vertex arenas are deleted rather than pooled once the
+// pool holds this many bytes of buffer storage.
+#define VERTEX_ARENA_POOL_HIGH_WATER (32 * 1024 * 1024)
+
 // Legacy OpenGL APIs.
 INITGLPROC(PFNGLBINDTEXTUREPROC,                 glBindTexture);
 INITGLPROC(PFNGLCLEARPROC,                       glClear);
@@ -13,6 +20,7 @@ INITGLPROC(PFNGLCLEARCOLORPROC,                  glClearColor);
 INITGLPROC(PFNGLDELETETEXTURESPROC,              glDeleteTextures);
 INITGLPROC(PFNGLDISABLEPROC,                     glDisable);
 INITGLPROC(PFNGLDRAWARRAYSPROC,                  glDrawArrays);
+INITGLPROC(PFNGLDRAWELEMENTSPROC,                glDrawElements);
 INITGLPROC(PFNGLENABLEPROC,                      glEnable);
 INITGLPROC(PFNGLGENTEXTURESPROC,                 glGenTextures);
 INITGLPROC(PFNGLGETINTEGERVPROC,                 glGetIntegerv);
@@ -22,6 +30,7 @@ INITGLPROC(PFNGLPOLYGONMODEPROC,                 glPolygonMode);
 INITGLPROC(PFNGLTEXIMAGE2DPROC,                  glTexImage2D);
 INITGLPROC(PFNGLTEXPARAMETERFPROC,               glTexParameterf);
 INITGLPROC(PFNGLTEXPARAMETERIPROC,               glTexParameteri);
+INITGLPROC(PFNGLTEXSUBIMAGE2DPROC,               glTexSubImage2D);
 INITGLPROC(PFNGLVIEWPORTPROC,                    glViewport);
 
 // Modern OpenGL APIs.
@@ -29,20 +38,27 @@ INITGLPROC(PFNGLACTIVETEXTUREPROC,               glActiveTexture);
 INITGLPROC(PFNGLATTACHSHADERPROC,                glAttachShader);
 INITGLPROC(PFNGLBINDATTRIBLOCATIONPROC,          glBindAttribLocation);
 INITGLPROC(PFNGLBINDBUFFERPROC,                  glBindBuffer);
+INITGLPROC(PFNGLBINDBUFFERBASEPROC,              glBindBufferBase);
 INITGLPROC(PFNGLBINDVERTEXARRAYPROC,             glBindVertexArray);
 INITGLPROC(PFNGLBLENDEQUATIONSEPARATEPROC,       glBlendEquationSeparate);
 INITGLPROC(PFNGLBLENDFUNCSEPARATEPROC,           glBlendFuncSeparate);
 INITGLPROC(PFNGLBUFFERDATAPROC,                  glBufferData);
+INITGLPROC(PFNGLBUFFERSUBDATAPROC,               glBufferSubData);
+INITGLPROC(PFNGLCLIENTWAITSYNCPROC,              glClientWaitSync);
 INITGLPROC(PFNGLCOMPILESHADERPROC,               glCompileShader);
+INITGLPROC(PFNGLCOPYBUFFERSUBDATAPROC,           glCopyBufferSubData);
 INITGLPROC(PFNGLCREATEPROGRAMPROC,               glCreateProgram);
 INITGLPROC(PFNGLCREATESHADERPROC,                glCreateShader);
 INITGLPROC(PFNGLDELETEBUFFERSPROC,               glDeleteBuffers);
 INITGLPROC(PFNGLDELETEPROGRAMPROC,               glDeleteProgram);
 INITGLPROC(PFNGLDELETESHADERPROC,                glDeleteShader);
+INITGLPROC(PFNGLDELETESYNCPROC,                  glDeleteSync);
 INITGLPROC(PFNGLDELETEVERTEXARRAYSPROC,          glDeleteVertexArrays);
 INITGLPROC(PFNGLDETACHSHADERPROC,                glDetachShader);
 INITGLPROC(PFNGLDISABLEVERTEXATTRIBARRAYPROC,    glDisableVertexAttribArray);
+INITGLPROC(PFNGLDRAWELEMENTSBASEVERTEXPROC,      glDrawElementsBaseVertex);
 INITGLPROC(PFNGLENABLEVERTEXATTRIBARRAYPROC,     glEnableVertexAttribArray);
+INITGLPROC(PFNGLFENCESYNCPROC,                   glFenceSync);
 INITGLPROC(PFNGLGENBUFFERSPROC,                  glGenBuffers);
 INITGLPROC(PFNGLGENVERTEXARRAYSPROC,             glGenVertexArrays);
 INITGLPROC(PFNGLGETATTRIBLOCATIONPROC,           glGetAttribLocation);
@@ -50,8 +66,14 @@ INITGLPROC(PFNGLGETPROGRAMINFOLOGPROC,           glGetProgramInfoLog);
 INITGLPROC(PFNGLGETPROGRAMIVPROC,                glGetProgramiv);
 INITGLPROC(PFNGLGETSHADERINFOLOGPROC,            glGetShaderInfoLog);
 INITGLPROC(PFNGLGETSHADERIVPROC,                 glGetShaderiv);
+INITGLPROC(PFNGLGETUNIFORMBLOCKINDEXPROC,        glGetUniformBlockIndex);
 INITGLPROC(PFNGLGETUNIFORMLOCATIONPROC,          glGetUniformLocation);
 INITGLPROC(PFNGLLINKPROGRAMPROC,                 glLinkProgram);
+INITGLPROC(PFNGLMAPBUFFERRANGEPROC,              glMapBufferRange);
+INITGLPROC(PFNGLMULTIDRAWARRAYSPROC,             glMultiDrawArrays);
+INITGLPROC(PFNGLMULTIDRAWELEMENTSPROC,           glMultiDrawElements);
+INITGLPROC(PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC, glMultiDrawElementsBaseVertex);
+INITGLPROC(PFNGLPRIMITIVERESTARTINDEXPROC,       glPrimitiveRestartIndex);
 INITGLPROC(PFNGLSHADERSOURCEPROC,                glShaderSource);
 INITGLPROC(PFNGLUNIFORM1FPROC,                   glUniform1f);
 INITGLPROC(PFNGLUNIFORM1IPROC,                   glUniform1i);
@@ -61,7 +83,9 @@ INITGLPROC(PFNGLUNIFORM3FPROC,                   glUniform3f);
 INITGLPROC(PFNGLUNIFORM3IPROC,                   glUniform3i);
 INITGLPROC(PFNGLUNIFORM4FPROC,                   glUniform4f);
 INITGLPROC(PFNGLUNIFORM4IPROC,                   glUniform4i);
+INITGLPROC(PFNGLUNIFORMBLOCKBINDINGPROC,         glUniformBlockBinding);
 INITGLPROC(PFNGLUNIFORMMATRIX4FVPROC,            glUniformMatrix4fv);
+INITGLPROC(PFNGLUNMAPBUFFERPROC,                 glUnmapBuffer);
 INITGLPROC(PFNGLUSEPROGRAMPROC,                  glUseProgram);
 INITGLPROC(PFNGLVERTEXATTRIBPOINTERPROC,         glVertexAttribPointer);
 INITGLPROC(PFNWGLCHOOSEPIXELFORMATARBPROC,       wglChoosePixelFormatARB);
@@ -72,8 +96,308 @@ GraphicsContext::GraphicsContext() :
     mMinorVersion(0),
     mRenderWindow(nullptr),
     mhRenderContext(nullptr),
-    mpDefaultCamera(nullptr)
+    mpDefaultCamera(nullptr),
+    mNodeStateStorage(NodeStateStorage::Count),
+    mPooledArenaBytes(0),
+    mpStreamingBuffer(nullptr)
+{
+    for (int format = 0; format < ((int) VertexFormat::Count); ++format)
+        mpVertexArenas[format] = nullptr;
+
+    mArenaStatistics.arenasCreated = 0;
+    mArenaStatistics.arenasRecycled = 0;
+    mArenaStatistics.arenasDiscarded = 0;
+    mArenaStatistics.sharedAllocations = 0;
+    mArenaStatistics.heapRelocations = 0;
+
+    mRenderStatistics.drawItems = 0;
+    mRenderStatistics.drawCalls = 0;
+    mRenderStatistics.stateChanges = 0;
+    mRenderStatistics.filteredCalls = 0;
+    mRenderStatistics.heapRelocations = 0;
+    mRenderStatistics.receivedPackageBytes = 0;
+    mRenderStatistics.skippedPackageBytes = 0;
+
+    ResetStateCache();
+}
+
+bool GraphicsContext::IsVersionSupported(int major, int minor) const
+{
+    if (mMajorVersion != major)
+        return mMajorVersion > major;
+
+    return mMinorVersion >= minor;
+}
+
+void* GraphicsContext::GetStagingBuffer(std::size_t bytes) const
+{
+    if (mStagingBuffer.size() < bytes)
+        mStagingBuffer.resize(bytes);
+
+    return &mStagingBuffer[0];
+}
+
+StreamingBuffer* GraphicsContext::GetStreamingBuffer(void) const
+{
+    // Only created once there is something dynamic to be drawn.
+    if (mpStreamingBuffer == nullptr) {
+        mpStreamingBuffer = new StreamingBuffer(this);
+        mpStreamingBuffer->BeginFrame();
+    }
+
+    return mpStreamingBuffer;
+}
+
+VertexArena* GraphicsContext::AcquireVertexArena(VertexFormat format, int vertexCount) const
+{
+    auto pVertexArena = GetSharedVertexArena(format);
+    if (pVertexArena != nullptr) {
+        mArenaStatistics.sharedAllocations++;
+        return pVertexArena;
+    }
+
+    // Private arenas come in capacities of powers of two, any one in the
+    // bucket that fits the vertex count (or the one above) will do.
+    int bucket = 0;
+    while (bucket < VERTEX_ARENA_POOL_BUCKETS - 1 && (1 << bucket) < vertexCount)
+        bucket++;
+
+    const int lastBucket = ((bucket + 1 < VERTEX_ARENA_POOL_BUCKETS) ? bucket + 1 : bucket);
+    for (; bucket <= lastBucket; ++bucket)
+    {
+        auto& pooled = mPooledArenas[((int) format)][bucket];
+        if (pooled.empty())
+            continue;
+
+        pVertexArena = pooled.back();
+        pooled.pop_back();
+        mPooledArenaBytes = mPooledArenaBytes - pVertexArena->GetCapacityBytes();
+        mArenaStatistics.arenasRecycled++;
+
+        pVertexArena->Orphan(); // Do not wait for frames still using it.
+        return pVertexArena;
+    }
+
+    mArenaStatistics.arenasCreated++;
+    return new VertexArena(this, format, false);
+}
+
+void GraphicsContext::ReleaseVertexArena(VertexArena* pVertexArena) const
+{
+    if (pVertexArena->IsShared())
+        return; // Owned by the context itself.
+
+    const auto bytes = pVertexArena->GetCapacityBytes();
+    if (mPooledArenaBytes + bytes > VERTEX_ARENA_POOL_HIGH_WATER) {
+        mArenaStatistics.arenasDiscarded++;
+        delete pVertexArena;
+        return;
+    }
+
+    int bucket = 0;
+    const auto capacity = pVertexArena->GetVertexCapacity();
+    while (bucket < VERTEX_ARENA_POOL_BUCKETS - 1 && (1 << bucket) < capacity)
+        bucket++;
+
+    mPooledArenas[((int) pVertexArena->GetFormat())][bucket].push_back(pVertexArena);
+    mPooledArenaBytes = mPooledArenaBytes + bytes;
+}
+
+void GraphicsContext::GetVertexArenaStatistics(VertexArenaStatistics* pStatistics) const
+{
+    (*pStatistics) = mArenaStatistics;
+}
+
+void GraphicsContext::CountHeapRelocation(void) const
+{
+    mArenaStatistics.heapRelocations++;
+}
+
+VertexArena* GraphicsContext::GetSharedVertexArena(VertexFormat format) const
+{
+    // Drawing out of shared storage takes base vertex draw calls (OpenGL
+    // 3.2) and moving allocations around takes buffer copies (OpenGL 3.1).
+    if (IsVersionSupported(3, 2) == false)
+        return nullptr;
+
+    auto& pVertexArena = mpVertexArenas[((int) format)];
+    if (pVertexArena == nullptr)
+        pVertexArena = new VertexArena(this, format, true);
+
+    return pVertexArena;
+}
+
+void GraphicsContext::BindVertexArray(GLuint vertexArrayId) const
+{
+    if (mBoundVertexArray == vertexArrayId) {
+        mRenderStatistics.filteredCalls++;
+        return;
+    }
+
+    GL::glBindVertexArray(vertexArrayId);
+    mBoundVertexArray = vertexArrayId;
+    mRenderStatistics.stateChanges++;
+}
+
+void GraphicsContext::DeleteVertexArray(GLuint vertexArrayId) const
+{
+    // Deleting a bound vertex array reverts the binding to zero.
+    if (mBoundVertexArray == vertexArrayId)
+        mBoundVertexArray = 0;
+
+    GL::glDeleteVertexArrays(1, &vertexArrayId);
+}
+
+void GraphicsContext::BindBuffer(BufferTarget target, GLuint bufferId) const
+{
+    static const GLenum targets[] =
+    {
+        GL_ARRAY_BUFFER, GL_COPY_READ_BUFFER, GL_UNIFORM_BUFFER
+    };
+
+    GLuint& boundBuffer = mBoundBuffers[((int) target)];
+    if (boundBuffer == bufferId) {
+        mRenderStatistics.filteredCalls++;
+        return;
+    }
+
+    GL::glBindBuffer(targets[((int) target)], bufferId);
+    boundBuffer = bufferId;
+}
+
+void GraphicsContext::DeleteBuffer(GLuint bufferId) const
+{
+    // Deleting a bound buffer reverts its bindings to zero.
+    for (int target = 0; target < ((int) BufferTarget::Count); ++target) {
+        if (mBoundBuffers[target] == bufferId)
+            mBoundBuffers[target] = 0;
+    }
+
+    GL::glDeleteBuffers(1, &bufferId);
+}
+
+void GraphicsContext::UseProgram(GLuint programId) const
+{
+    if (mCurrentProgram == programId) {
+        mRenderStatistics.filteredCalls++;
+        return;
+    }
+
+    GL::glUseProgram(programId);
+    mCurrentProgram = programId;
+    mRenderStatistics.stateChanges++;
+}
+
+void GraphicsContext::DeleteProgram(GLuint programId) const
+{
+    // Program in use would only be flagged for deletion, and be deleted
+    // whenever another one happens to take its place.
+    if (mCurrentProgram == programId) {
+        GL::glUseProgram(0);
+        mCurrentProgram = 0;
+    }
+
+    GL::glDeleteProgram(programId);
+}
+
+void GraphicsContext::SetCapability(Capability capability, bool enabled) const
+{
+    static const GLenum capabilities[] =
+    {
+        GL_BLEND, GL_DEPTH_TEST, GL_PRIMITIVE_RESTART
+    };
+
+    bool& current = mCapabilities[((int) capability)];
+    if (current == enabled) {
+        mRenderStatistics.filteredCalls++;
+        return;
+    }
+
+    if (enabled)
+        GL::glEnable(capabilities[((int) capability)]);
+    else
+        GL::glDisable(capabilities[((int) capability)]);
+
+    current = enabled;
+}
+
+void GraphicsContext::SetBlendEquation(GLenum modeRgb, GLenum modeAlpha) const
 {
+    if (mBlendEquation[0] == modeRgb && mBlendEquation[1] == modeAlpha) {
+        mRenderStatistics.filteredCalls++;
+        return;
+    }
+
+    GL::glBlendEquationSeparate(modeRgb, modeAlpha);
+    mBlendEquation[0] = modeRgb;
+    mBlendEquation[1] = modeAlpha;
+}
+
+void GraphicsContext::SetBlendFunction(GLenum srcRgb, GLenum dstRgb,
+    GLenum srcAlpha, GLenum dstAlpha) const
+{
+    if (mBlendFunction[0] == srcRgb && mBlendFunction[1] == dstRgb &&
+        mBlendFunction[2] == srcAlpha && mBlendFunction[3] == dstAlpha)
+    {
+        mRenderStatistics.filteredCalls++;
+        return;
+    }
+
+    GL::glBlendFuncSeparate(srcRgb, dstRgb, srcAlpha, dstAlpha);
+    mBlendFunction[0] = srcRgb;
+    mBlendFunction[1] = dstRgb;
+    mBlendFunction[2] = srcAlpha;
+    mBlendFunction[3] = dstAlpha;
+}
+
+void GraphicsContext::SetPolygonMode(GLenum mode) const
+{
+    if (mPolygonMode == mode) {
+        mRenderStatistics.filteredCalls++;
+        return;
+    }
+
+    GL::glPolygonMode(GL_FRONT_AND_BACK, mode);
+    mPolygonMode = mode;
+}
+
+void GraphicsContext::SetPrimitiveRestartIndex(GLuint restartIndex) const
+{
+    if (mPrimitiveRestartIndex == restartIndex) {
+        mRenderStatistics.filteredCalls++;
+        return;
+    }
+
+    GL::glPrimitiveRestartIndex(restartIndex);
+    mPrimitiveRestartIndex = restartIndex;
+}
+
+NodeStateStorage GraphicsContext::GetNodeStateStorage(void) const
+{
+    if (mNodeStateStorage != NodeStateStorage::Count)
+        return mNodeStateStorage;
+
+    // Node states are read in vertex shaders, which some implementations
+    // give no texture units to at all.
+    GLint vertexTextureUnits = 0;
+    GL::glGetIntegerv(GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS, &vertexTextureUnits);
+    if (vertexTextureUnits <= 0) {
+        mNodeStateStorage = NodeStateStorage::Uniforms;
+        return mNodeStateStorage;
+    }
+
+    // Float textures are core from OpenGL 3.0, the extension string is
+    // only there to be looked at in contexts older than that.
+    bool floatTextures = IsVersionSupported(3, 0);
+    if (floatTextures == false) {
+        auto pExtensions = ((const char *) GL::glGetString(GL_EXTENSIONS));
+        floatTextures = (pExtensions != nullptr &&
+            strstr(pExtensions, "GL_ARB_texture_float") != nullptr);
+    }
+
+    mNodeStateStorage = (floatTextures ?
+        NodeStateStorage::FloatTexture : NodeStateStorage::ByteTexture);
+    return mNodeStateStorage;
 }
 
 bool GraphicsContext::InitializeCore(HWND hWndOwner)
@@ -103,6 +427,7 @@ bool GraphicsContext::InitializeCore(HWND hWndOwner)
 
     mhRenderContext = GL::wglCreateContextAttribsARB(hDeviceContext, 0, attributes);
     wglMakeCurrent(hDeviceContext, mhRenderContext);
+    ResetStateCache(); // States of the new context are all at defaults.
 
     ::ReleaseDC(hWndOwner, hDeviceContext); // Done with device context.
     mRenderWindow = hWndOwner;
@@ -111,7 +436,7 @@ bool GraphicsContext::InitializeCore(HWND hWndOwner)
     mpDefaultCamera = new Camera(this);
 
     // Default states of our renderer.
-    GL::glEnable(GL_DEPTH_TEST);
+    SetCapability(Capability::DepthTest, true);
     GL::glPointSize(4.0f);
     return true;
 }
@@ -121,6 +446,25 @@ void GraphicsContext::UninitializeCore(void)
     if (mhRenderContext == nullptr)
         return;
 
+    // Vertex buffers are all gone by now, release the storage they shared.
+    for (int format = 0; format < ((int) VertexFormat::Count); ++format) {
+        delete mpVertexArenas[format];
+        mpVertexArenas[format] = nullptr;
+    }
+
+    ClearVertexArenaPool();
+
+    if (mpStreamingBuffer != nullptr) {
+        delete mpStreamingBuffer;
+        mpStreamingBuffer = nullptr;
+    }
+
+    // Camera owns a uniform buffer, let go of it while the context is there.
+    if (mpDefaultCamera != nullptr) {
+        delete mpDefaultCamera;
+        mpDefaultCamera = nullptr;
+    }
+
     HDC hDeviceContext = ::GetDC(mRenderWindow);
     ::wglMakeCurrent(hDeviceContext, nullptr);
     ::ReleaseDC(mRenderWindow, hDeviceContext); // Done with device context.
@@ -129,10 +473,7 @@ void GraphicsContext::UninitializeCore(void)
     ::wglDeleteContext(mhRenderContext);
     mhRenderContext = nullptr;
 
-    if (mpDefaultCamera != nullptr) {
-        delete mpDefaultCamera;
-        mpDefaultCamera = nullptr;
-    }
+    std::vector<unsigned char>().swap(mStagingBuffer);
 }
 
 ICamera* GraphicsContext::GetDefaultCameraCore(void) const
@@ -166,7 +507,40 @@ IFragmentShader* GraphicsContext::CreateFragmentShaderCore(const std::string& co
     return pFragmentShader;
 }
 
-IShaderProgram* GraphicsContext::CreateShaderProgramCore(ShaderName shaderName) const
+// Each feature the program is specialized for is defined right after the
+// "#version" directive (which has to come first), and the line numbers of
+// what follows are then put back to those of the source itself.
+// 
+static void DefineShaderFeatures(std::string& content,
+    ShaderFeatures features, NodeStateStorage nodeStateStorage)
+{
+    static const char* names[] = { "LIT", "QUANTIZED" }; // In order of their bits.
+
+    std::string defines;
+    for (int bit = 0; bit < _countof(names); ++bit) {
+        if ((((int) features) & (1 << bit)) != 0)
+            defines = defines + "#define " + names[bit] + "\n";
+    }
+
+    // Node states are then set as uniforms instead of read from a texture.
+    if (nodeStateStorage == NodeStateStorage::Uniforms)
+        defines = defines + "#define NODE_STATE_UNIFORMS\n";
+
+    if (defines.empty())
+        return;
+
+    std::size_t position = 0;
+    if (content.compare(0, 8, "#version") == 0) {
+        position = content.find('\n');
+        position = ((position == std::string::npos) ? content.size() : position + 1);
+    }
+
+    defines = defines + ((position == 0) ? "#line 1\n" : "#line 2\n");
+    content.insert(position, defines);
+}
+
+IShaderProgram* GraphicsContext::CreateShaderProgramCore(ShaderName shaderName,
+    ShaderFeatures features) const
 {
     GetResourceIdentifiersParam params;
     params.openGlVersion = GetOpenGLVersion(mMajorVersion, mMinorVersion);
@@ -176,16 +550,19 @@ IShaderProgram* GraphicsContext::CreateShaderProgramCore(ShaderName shaderName)
     std::string vs, fs;
     Utils::LoadShaderResource(params.vertexShaderId, vs);
     Utils::LoadShaderResource(params.fragmentShaderId, fs);
+    const NodeStateStorage nodeStateStorage = GetNodeStateStorage();
+    DefineShaderFeatures(vs, features, nodeStateStorage);
+    DefineShaderFeatures(fs, features, nodeStateStorage);
 
     // Create shaders and their program.
     auto pvs = dynamic_cast<VertexShader *>(this->CreateVertexShader(vs));
     auto pfs = dynamic_cast<FragmentShader *>(this->CreateFragmentShader(fs));
-    return new ShaderProgram(pvs, pfs);
+    return new ShaderProgram(this, pvs, pfs);
 }
 
 IVertexBuffer* GraphicsContext::CreateVertexBufferCore(void) const
 {
-    return new VertexBuffer();
+    return new VertexBuffer(this);
 }
 
 IBillboardVertexBuffer* GraphicsContext::CreateBillboardVertexBufferCore(void) const
@@ -198,6 +575,11 @@ ITexture2d* GraphicsContext::CreateTexture2dCore(const BitmapData* pBitmapData)
     return nullptr;
 }
 
+INodeStateTable* GraphicsContext::CreateNodeStateTableCore(void) const
+{
+    return new NodeStateTable(this);
+}
+
 void GraphicsContext::BeginRenderFrameCore(HDC deviceContext) const
 {
     RECT rcClient;
@@ -210,6 +592,14 @@ void GraphicsContext::BeginRenderFrameCore(HDC deviceContext) const
     // If the camera is animating, this is the right time to update it.
     if (mpDefaultCamera->IsInTransition())
         mpDefaultCamera->UpdateFrame();
+
+    if (mpStreamingBuffer != nullptr)
+        mpStreamingBuffer->BeginFrame();
+
+    mRenderStatistics.drawItems = 0;
+    mRenderStatistics.drawCalls = 0;
+    mRenderStatistics.stateChanges = 0;
+    mRenderStatistics.filteredCalls = 0;
 }
 
 void GraphicsContext::ActivateShaderProgramCore(IShaderProgram* pShaderProgram) const
@@ -225,20 +615,57 @@ void GraphicsContext::RenderVertexBufferCore(IVertexBuffer* pVertexBuffer) const
 {
     auto pBuffer = dynamic_cast<VertexBuffer *>(pVertexBuffer);
     if (pBuffer != nullptr)
-        pBuffer->Render();
+        mRenderStatistics.drawCalls += pBuffer->Render(false);
+}
+
+void GraphicsContext::RenderDrawItemsCore(const DrawItem* pDrawItems,
+    int count, const INodeStateTable* pNodeStates) const
+{
+    // Vertex buffers and node state tables are only ever created by this
+    // class, which is what lets them be drawn without a cast being checked
+    // (or a virtual call made) for every item.
+    auto pTable = static_cast<const NodeStateTable *>(pNodeStates);
+
+    int stateRow = -1;
+    for (int index = 0; index < count; ++index)
+    {
+        const DrawItem& drawItem = pDrawItems[index];
+        if (drawItem.stateRow != stateRow) {
+            stateRow = drawItem.stateRow;
+            pTable->Select(stateRow);
+            mRenderStatistics.stateChanges++;
+        }
+
+        auto pBuffer = static_cast<const VertexBuffer *>(drawItem.pVertexBuffer);
+        mRenderStatistics.drawCalls += pBuffer->Render(RenderQueue::IsTranslucent(drawItem.key));
+    }
+
+    mRenderStatistics.drawItems += count;
+}
+
+void GraphicsContext::GetRenderStatisticsCore(RenderStatistics* pStatistics) const
+{
+    (*pStatistics) = mRenderStatistics;
+    pStatistics->heapRelocations = mArenaStatistics.heapRelocations;
 }
 
 bool GraphicsContext::EndRenderFrameCore(HDC deviceContext) const
 {
+    // Fence the frame before it is presented, everything streamed since
+    // "BeginRenderFrameCore" may be overwritten once the fence signals.
+    if (mpStreamingBuffer != nullptr)
+        mpStreamingBuffer->EndFrame();
+
     ::SwapBuffers(deviceContext);
     return mpDefaultCamera->IsInTransition(); // Request frame update if needed.
 }
 
 void GraphicsContext::EnableAlphaBlendCore(void) const
 {
-    GL::glEnable(GL_BLEND);
-    GL::glBlendEquationSeparate(GL_FUNC_ADD, GL_FUNC_ADD);
-    GL::glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
+    // Called for every frame, only the first of which changes anything.
+    SetCapability(Capability::Blend, true);
+    SetBlendEquation(GL_FUNC_ADD, GL_FUNC_ADD);
+    SetBlendFunction(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ZERO);
 }
 
 void GraphicsContext::ClearDepthBufferCore(void) const
@@ -246,6 +673,42 @@ void GraphicsContext::ClearDepthBufferCore(void) const
     GL::glClear(GL_DEPTH_BUFFER_BIT);
 }
 
+void GraphicsContext::ClearVertexArenaPool(void)
+{
+    for (int format = 0; format < ((int) VertexFormat::Count); ++format)
+    {
+        for (int bucket = 0; bucket < VERTEX_ARENA_POOL_BUCKETS; ++bucket)
+        {
+            auto& pooled = mPooledArenas[format][bucket];
+            auto iterator = pooled.begin();
+            for (; iterator != pooled.end(); ++iterator)
+                delete *iterator;
+
+            pooled.clear();
+        }
+    }
+
+    mPooledArenaBytes = 0;
+}
+
+void GraphicsContext::ResetStateCache(void) const
+{
+    // Initial states of an OpenGL context.
+    mBoundVertexArray = 0;
+    mCurrentProgram = 0;
+
+    for (int target = 0; target < ((int) BufferTarget::Count); ++target)
+        mBoundBuffers[target] = 0;
+    for (int capability = 0; capability < ((int) Capability::Count); ++capability)
+        mCapabilities[capability] = false;
+
+    mBlendEquation[0] = mBlendEquation[1] = GL_FUNC_ADD;
+    mBlendFunction[0] = mBlendFunction[2] = GL_ONE;
+    mBlendFunction[1] = mBlendFunction[3] = GL_ZERO;
+    mPolygonMode = GL_FILL;
+    mPrimitiveRestartIndex = 0;
+}
+
 bool GraphicsContext::InitializeWithDummyContext(HWND hWndOwner)
 {
     wchar_t wndClassName[128] = { 0 };
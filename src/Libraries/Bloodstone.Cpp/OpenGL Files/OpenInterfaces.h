@@ -50,6 +50,7 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
             GETGLPROC(PFNGLDELETETEXTURESPROC,              glDeleteTextures);
             GETGLPROC(PFNGLDISABLEPROC,                     glDisable);
             GETGLPROC(PFNGLDRAWARRAYSPROC,                  glDrawArrays);
+            GETGLPROC(PFNGLDRAWELEMENTSPROC,                glDrawElements);
             GETGLPROC(PFNGLENABLEPROC,                      glEnable);
             GETGLPROC(PFNGLGENTEXTURESPROC,                 glGenTextures);
             GETGLPROC(PFNGLGETINTEGERVPROC,                 glGetIntegerv);
@@ -59,6 +60,7 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
             GETGLPROC(PFNGLTEXIMAGE2DPROC,                  glTexImage2D);
             GETGLPROC(PFNGLTEXPARAMETERFPROC,               glTexParameterf);
             GETGLPROC(PFNGLTEXPARAMETERIPROC,               glTexParameteri);
+            GETGLPROC(PFNGLTEXSUBIMAGE2DPROC,               glTexSubImage2D);
             GETGLPROC(PFNGLVIEWPORTPROC,                    glViewport);
 
             // Modern OpenGL APIs.
@@ -66,20 +68,27 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
             GETGLPROC(PFNGLATTACHSHADERPROC,                glAttachShader);
             GETGLPROC(PFNGLBINDATTRIBLOCATIONPROC,          glBindAttribLocation);
             GETGLPROC(PFNGLBINDBUFFERPROC,                  glBindBuffer);
+            GETGLPROC(PFNGLBINDBUFFERBASEPROC,              glBindBufferBase);
             GETGLPROC(PFNGLBINDVERTEXARRAYPROC,             glBindVertexArray);
             GETGLPROC(PFNGLBLENDEQUATIONSEPARATEPROC,       glBlendEquationSeparate);
             GETGLPROC(PFNGLBLENDFUNCSEPARATEPROC,           glBlendFuncSeparate);
             GETGLPROC(PFNGLBUFFERDATAPROC,                  glBufferData);
+            GETGLPROC(PFNGLBUFFERSUBDATAPROC,               glBufferSubData);
+            GETGLPROC(PFNGLCLIENTWAITSYNCPROC,              glClientWaitSync);
             GETGLPROC(PFNGLCOMPILESHADERPROC,               glCompileShader);
+            GETGLPROC(PFNGLCOPYBUFFERSUBDATAPROC,           glCopyBufferSubData);
             GETGLPROC(PFNGLCREATEPROGRAMPROC,               glCreateProgram);
             GETGLPROC(PFNGLCREATESHADERPROC,                glCreateShader);
             GETGLPROC(PFNGLDELETEBUFFERSPROC,               glDeleteBuffers);
             GETGLPROC(PFNGLDELETEPROGRAMPROC,               glDeleteProgram);
             GETGLPROC(PFNGLDELETESHADERPROC,                glDeleteShader);
+            GETGLPROC(PFNGLDELETESYNCPROC,                  glDeleteSync);
             GETGLPROC(PFNGLDELETEVERTEXARRAYSPROC,          glDeleteVertexArrays);
             GETGLPROC(PFNGLDETACHSHADERPROC,                glDetachShader);
             GETGLPROC(PFNGLDISABLEVERTEXATTRIBARRAYPROC,    glDisableVertexAttribArray);
+            GETGLPROC(PFNGLDRAWELEMENTSBASEVERTEXPROC,      glDrawElementsBaseVertex);
             GETGLPROC(PFNGLENABLEVERTEXATTRIBARRAYPROC,     glEnableVertexAttribArray);
+            GETGLPROC(PFNGLFENCESYNCPROC,                   glFenceSync);
             GETGLPROC(PFNGLGENBUFFERSPROC,                  glGenBuffers);
             GETGLPROC(PFNGLGENVERTEXARRAYSPROC,             glGenVertexArrays);
             GETGLPROC(PFNGLGETATTRIBLOCATIONPROC,           glGetAttribLocation);
@@ -87,8 +96,14 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
             GETGLPROC(PFNGLGETPROGRAMIVPROC,                glGetProgramiv);
             GETGLPROC(PFNGLGETSHADERINFOLOGPROC,            glGetShaderInfoLog);
             GETGLPROC(PFNGLGETSHADERIVPROC,                 glGetShaderiv);
+            GETGLPROC(PFNGLGETUNIFORMBLOCKINDEXPROC,        glGetUniformBlockIndex);
             GETGLPROC(PFNGLGETUNIFORMLOCATIONPROC,          glGetUniformLocation);
             GETGLPROC(PFNGLLINKPROGRAMPROC,                 glLinkProgram);
+            GETGLPROC(PFNGLMAPBUFFERRANGEPROC,              glMapBufferRange);
+            GETGLPROC(PFNGLMULTIDRAWARRAYSPROC,             glMultiDrawArrays);
+            GETGLPROC(PFNGLMULTIDRAWELEMENTSPROC,           glMultiDrawElements);
+            GETGLPROC(PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC, glMultiDrawElementsBaseVertex);
+            GETGLPROC(PFNGLPRIMITIVERESTARTINDEXPROC,       glPrimitiveRestartIndex);
             GETGLPROC(PFNGLSHADERSOURCEPROC,                glShaderSource);
             GETGLPROC(PFNGLUNIFORM1FPROC,                   glUniform1f);
             GETGLPROC(PFNGLUNIFORM1IPROC,                   glUniform1i);
@@ -98,7 +113,9 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
             GETGLPROC(PFNGLUNIFORM3IPROC,                   glUniform3i);
             GETGLPROC(PFNGLUNIFORM4FPROC,                   glUniform4f);
             GETGLPROC(PFNGLUNIFORM4IPROC,                   glUniform4i);
+            GETGLPROC(PFNGLUNIFORMBLOCKBINDINGPROC,         glUniformBlockBinding);
             GETGLPROC(PFNGLUNIFORMMATRIX4FVPROC,            glUniformMatrix4fv);
+            GETGLPROC(PFNGLUNMAPBUFFERPROC,                 glUnmapBuffer);
             GETGLPROC(PFNGLUSEPROGRAMPROC,                  glUseProgram);
             GETGLPROC(PFNGLVERTEXATTRIBPOINTERPROC,         glVertexAttribPointer);
             GETGLPROC(PFNWGLCHOOSEPIXELFORMATARBPROC,       wglChoosePixelFormatARB);
@@ -110,6 +127,7 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
             GETLEGACYPROC(glDeleteTextures);
             GETLEGACYPROC(glDisable);
             GETLEGACYPROC(glDrawArrays);
+            GETLEGACYPROC(glDrawElements);
             GETLEGACYPROC(glEnable);
             GETLEGACYPROC(glGenTextures);
             GETLEGACYPROC(glGetIntegerv);
@@ -119,6 +137,7 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
             GETLEGACYPROC(glTexImage2D);
             GETLEGACYPROC(glTexParameterf);
             GETLEGACYPROC(glTexParameteri);
+            GETLEGACYPROC(glTexSubImage2D);
             GETLEGACYPROC(glViewport);
 
             auto pMessageData = message.c_str();
@@ -137,6 +156,7 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
         DEFGLPROC(PFNGLDELETETEXTURESPROC,              glDeleteTextures);
         DEFGLPROC(PFNGLDISABLEPROC,                     glDisable);
         DEFGLPROC(PFNGLDRAWARRAYSPROC,                  glDrawArrays);
+        DEFGLPROC(PFNGLDRAWELEMENTSPROC,                glDrawElements);
         DEFGLPROC(PFNGLENABLEPROC,                      glEnable);
         DEFGLPROC(PFNGLGENTEXTURESPROC,                 glGenTextures);
         DEFGLPROC(PFNGLGETINTEGERVPROC,                 glGetIntegerv);
@@ -146,6 +166,7 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
         DEFGLPROC(PFNGLTEXIMAGE2DPROC,                  glTexImage2D);
         DEFGLPROC(PFNGLTEXPARAMETERFPROC,               glTexParameterf);
         DEFGLPROC(PFNGLTEXPARAMETERIPROC,               glTexParameteri);
+        DEFGLPROC(PFNGLTEXSUBIMAGE2DPROC,               glTexSubImage2D);
         DEFGLPROC(PFNGLVIEWPORTPROC,                    glViewport);
 
         // Modern OpenGL APIs.
@@ -153,20 +174,27 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
         DEFGLPROC(PFNGLATTACHSHADERPROC,                glAttachShader);
         DEFGLPROC(PFNGLBINDATTRIBLOCATIONPROC,          glBindAttribLocation);
         DEFGLPROC(PFNGLBINDBUFFERPROC,                  glBindBuffer);
+        DEFGLPROC(PFNGLBINDBUFFERBASEPROC,              glBindBufferBase);
         DEFGLPROC(PFNGLBINDVERTEXARRAYPROC,             glBindVertexArray);
         DEFGLPROC(PFNGLBLENDEQUATIONSEPARATEPROC,       glBlendEquationSeparate);
         DEFGLPROC(PFNGLBLENDFUNCSEPARATEPROC,           glBlendFuncSeparate);
         DEFGLPROC(PFNGLBUFFERDATAPROC,                  glBufferData);
+        DEFGLPROC(PFNGLBUFFERSUBDATAPROC,               glBufferSubData);
+        DEFGLPROC(PFNGLCLIENTWAITSYNCPROC,              glClientWaitSync);
         DEFGLPROC(PFNGLCOMPILESHADERPROC,               glCompileShader);
+        DEFGLPROC(PFNGLCOPYBUFFERSUBDATAPROC,           glCopyBufferSubData);
         DEFGLPROC(PFNGLCREATEPROGRAMPROC,               glCreateProgram);
         DEFGLPROC(PFNGLCREATESHADERPROC,                glCreateShader);
         DEFGLPROC(PFNGLDELETEBUFFERSPROC,               glDeleteBuffers);
         DEFGLPROC(PFNGLDELETEPROGRAMPROC,               glDeleteProgram);
         DEFGLPROC(PFNGLDELETESHADERPROC,                glDeleteShader);
+        DEFGLPROC(PFNGLDELETESYNCPROC,                  glDeleteSync);
         DEFGLPROC(PFNGLDELETEVERTEXARRAYSPROC,          glDeleteVertexArrays);
         DEFGLPROC(PFNGLDETACHSHADERPROC,                glDetachShader);
         DEFGLPROC(PFNGLDISABLEVERTEXATTRIBARRAYPROC,    glDisableVertexAttribArray);
+        DEFGLPROC(PFNGLDRAWELEMENTSBASEVERTEXPROC,      glDrawElementsBaseVertex);
         DEFGLPROC(PFNGLENABLEVERTEXATTRIBARRAYPROC,     glEnableVertexAttribArray);
+        DEFGLPROC(PFNGLFENCESYNCPROC,                   glFenceSync);
         DEFGLPROC(PFNGLGENBUFFERSPROC,                  glGenBuffers);
         DEFGLPROC(PFNGLGENVERTEXARRAYSPROC,             glGenVertexArrays);
         DEFGLPROC(PFNGLGETATTRIBLOCATIONPROC,           glGetAttribLocation);
@@ -174,8 +202,14 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
         DEFGLPROC(PFNGLGETPROGRAMIVPROC,                glGetProgramiv);
         DEFGLPROC(PFNGLGETSHADERINFOLOGPROC,            glGetShaderInfoLog);
         DEFGLPROC(PFNGLGETSHADERIVPROC,                 glGetShaderiv);
+        DEFGLPROC(PFNGLGETUNIFORMBLOCKINDEXPROC,        glGetUniformBlockIndex);
         DEFGLPROC(PFNGLGETUNIFORMLOCATIONPROC,          glGetUniformLocation);
         DEFGLPROC(PFNGLLINKPROGRAMPROC,                 glLinkProgram);
+        DEFGLPROC(PFNGLMAPBUFFERRANGEPROC,              glMapBufferRange);
+        DEFGLPROC(PFNGLMULTIDRAWARRAYSPROC,             glMultiDrawArrays);
+        DEFGLPROC(PFNGLMULTIDRAWELEMENTSPROC,           glMultiDrawElements);
+        DEFGLPROC(PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC, glMultiDrawElementsBaseVertex);
+        DEFGLPROC(PFNGLPRIMITIVERESTARTINDEXPROC,       glPrimitiveRestartIndex);
         DEFGLPROC(PFNGLSHADERSOURCEPROC,                glShaderSource);
         DEFGLPROC(PFNGLUNIFORM1FPROC,                   glUniform1f);
         DEFGLPROC(PFNGLUNIFORM1IPROC,                   glUniform1i);
@@ -185,7 +219,9 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
         DEFGLPROC(PFNGLUNIFORM3IPROC,                   glUniform3i);
         DEFGLPROC(PFNGLUNIFORM4FPROC,                   glUniform4f);
         DEFGLPROC(PFNGLUNIFORM4IPROC,                   glUniform4i);
+        DEFGLPROC(PFNGLUNIFORMBLOCKBINDINGPROC,         glUniformBlockBinding);
         DEFGLPROC(PFNGLUNIFORMMATRIX4FVPROC,            glUniformMatrix4fv);
+        DEFGLPROC(PFNGLUNMAPBUFFERPROC,                 glUnmapBuffer);
         DEFGLPROC(PFNGLUSEPROGRAMPROC,                  glUseProgram);
         DEFGLPROC(PFNGLVERTEXATTRIBPOINTERPROC,         glVertexAttribPointer);
         DEFGLPROC(PFNWGLCHOOSEPIXELFORMATARBPROC,       wglChoosePixelFormatARB);
@@ -193,11 +229,76 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
     };
 
     class Camera; // Forward declaration.
+    class VertexArena; // Forward declaration.
+    class StreamingBuffer; // Forward declaration.
+
+    // Layouts of vertex data, one shared "VertexArena" exists for each.
+    enum class VertexFormat
+    {
+        Point, Triangle, QuantizedTriangle, Count
+    };
+
+    // Buffer binding points whose bindings "GraphicsContext" keeps track
+    // of. The element array binding is not one of them, it is part of the
+    // state of whichever vertex array is bound at the time.
+    enum class BufferTarget
+    {
+        Array, CopyRead, Uniform, Count
+    };
+
+    // Capabilities enabled and disabled through "GraphicsContext".
+    enum class Capability
+    {
+        Blend, DepthTest, PrimitiveRestart, Count
+    };
+
+    // Where node state tables keep their rows, depending on what the
+    // context supports: a float texture, a texture of bytes (every value
+    // of a row being between zero and one) without float textures, or
+    // uniforms set for every row selected when vertex shaders cannot read
+    // textures at all.
+    enum class NodeStateStorage
+    {
+        FloatTexture, ByteTexture, Uniforms, Count
+    };
+
+    // Private vertex arenas are capacities of a power of two, those that are
+    // released go into the bucket of their capacity (in vertices) for reuse.
+    #define VERTEX_ARENA_POOL_BUCKETS 32
+
+    struct VertexArenaStatistics
+    {
+        int arenasCreated;      // Private arenas created, with new buffer objects.
+        int arenasRecycled;     // Private arenas taken from the pool instead.
+        int arenasDiscarded;    // Released while the pool was at its limit.
+        int sharedAllocations;  // Loads into shared arenas, no buffer objects created.
+        int heapRelocations;    // Buffer heaps of any arena moved to new storage.
+    };
 
     class GraphicsContext : public Dynamo::Bloodstone::IGraphicsContext
     {
     public:
         GraphicsContext();
+        void* GetStagingBuffer(std::size_t bytes) const;
+        bool IsVersionSupported(int major, int minor) const;
+        VertexArena* AcquireVertexArena(VertexFormat format, int vertexCount) const;
+        void ReleaseVertexArena(VertexArena* pVertexArena) const;
+        void GetVertexArenaStatistics(VertexArenaStatistics* pStatistics) const;
+        void CountHeapRelocation(void) const;
+        StreamingBuffer* GetStreamingBuffer(void) const;
+        void BindVertexArray(GLuint vertexArrayId) const;
+        void DeleteVertexArray(GLuint vertexArrayId) const;
+        void BindBuffer(BufferTarget target, GLuint bufferId) const;
+        void DeleteBuffer(GLuint bufferId) const;
+        void UseProgram(GLuint programId) const;
+        void DeleteProgram(GLuint programId) const;
+        void SetCapability(Capability capability, bool enabled) const;
+        void SetBlendEquation(GLenum modeRgb, GLenum modeAlpha) const;
+        void SetBlendFunction(GLenum srcRgb, GLenum dstRgb,
+            GLenum srcAlpha, GLenum dstAlpha) const;
+        void SetPolygonMode(GLenum mode) const;
+        void SetPrimitiveRestartIndex(GLuint restartIndex) const;
+        NodeStateStorage GetNodeStateStorage(void) const;
 
     protected:
         virtual bool InitializeCore(HWND hWndOwner);
@@ -208,13 +309,18 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
             const std::string& content) const;
         virtual IFragmentShader* CreateFragmentShaderCore(
             const std::string& content) const;
-        virtual IShaderProgram* CreateShaderProgramCore(ShaderName shaderName) const;
+        virtual IShaderProgram* CreateShaderProgramCore(ShaderName shaderName,
+            ShaderFeatures features) const;
         virtual IVertexBuffer* CreateVertexBufferCore(void) const;
         virtual IBillboardVertexBuffer* CreateBillboardVertexBufferCore(void) const;
         virtual ITexture2d* CreateTexture2dCore(const BitmapData* pBitmapData) const;
+        virtual INodeStateTable* CreateNodeStateTableCore(void) const;
         virtual void BeginRenderFrameCore(HDC deviceContext) const;
         virtual void ActivateShaderProgramCore(IShaderProgram* pShaderProgram) const;
         virtual void RenderVertexBufferCore(IVertexBuffer* pVertexBuffer) const;
+        virtual void RenderDrawItemsCore(const DrawItem* pDrawItems,
+            int count, const INodeStateTable* pNodeStates) const;
+        virtual void GetRenderStatisticsCore(RenderStatistics* pStatistics) const;
         virtual bool EndRenderFrameCore(HDC deviceContext) const;
         virtual void EnableAlphaBlendCore(void) const;
         virtual void ClearDepthBufferCore(void) const;
@@ -223,12 +329,44 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
         bool InitializeWithDummyContext(HWND hWndOwner);
         bool SelectBestPixelFormat(HDC hDeviceContext) const;
         bool GetDeviceAttributes(int hardwareLevel, int* pAttributes) const;
+        VertexArena* GetSharedVertexArena(VertexFormat format) const;
+        void ClearVertexArenaPool(void);
+        void ResetStateCache(void) const;
 
         int mMajorVersion;
         int mMinorVersion;
         HWND mRenderWindow;
         HGLRC mhRenderContext;
         Camera* mpDefaultCamera;
+
+        // Shared by all vertex buffers when mapping is not available.
+        mutable std::vector<unsigned char> mStagingBuffer;
+
+        // States as they were last set through this context, so that calls
+        // which would not change any of them never reach the driver (those
+        // are counted as "filteredCalls" of the frame). Everything here has
+        // to go through the context for this to hold.
+        mutable GLuint mBoundVertexArray;
+        mutable GLuint mCurrentProgram;
+        mutable GLuint mBoundBuffers[((int) BufferTarget::Count)];
+        mutable bool mCapabilities[((int) Capability::Count)];
+        mutable GLenum mBlendEquation[2];   // RGB, alpha.
+        mutable GLenum mBlendFunction[4];   // Source and destination RGB, then alpha.
+        mutable GLenum mPolygonMode;
+        mutable GLuint mPrimitiveRestartIndex;
+
+        // Queried the first time a node state table or program needs it.
+        mutable NodeStateStorage mNodeStateStorage;
+
+        mutable VertexArena* mpVertexArenas[((int) VertexFormat::Count)];
+
+        // Private arenas released by vertex buffers, waiting to be reused.
+        mutable std::size_t mPooledArenaBytes;
+        mutable std::vector<VertexArena *> mPooledArenas
+            [((int) VertexFormat::Count)][VERTEX_ARENA_POOL_BUCKETS];
+        mutable VertexArenaStatistics mArenaStatistics;
+        mutable StreamingBuffer* mpStreamingBuffer;
+        mutable RenderStatistics mRenderStatistics; // Of the current frame.
     };
 
     class TrackBall : public Dynamo::Bloodstone::ITrackBall
@@ -268,13 +406,42 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
         glm::vec3 mRotateStart, mRotateEnd;
     };
 
+    // Binding point of the uniform buffer of the default camera, which all
+    // shader programs declaring a "CameraBlock" get their block bound to.
+    #define CAMERA_BLOCK_BINDING 0
+
+    // Values of the camera shared by all shader programs, laid out as the
+    // "CameraBlock" uniform block of shaders (following std140 rules, with
+    // every member a multiple of 16 bytes in size).
+    // 
+    struct CameraBlockData
+    {
+        glm::mat4 model;
+        glm::mat4 view;
+        glm::mat4 proj;
+        glm::mat4 viewProj;
+        glm::mat4 normalMatrix; // Transposed inverse of "view * model".
+        glm::vec4 viewportSize; // Width and height in pixels, zeros.
+        glm::vec4 eyePosition;  // Position in world space, one.
+    };
+
     class Camera : public Dynamo::Bloodstone::ICamera
     {
     public:
         Camera(GraphicsContext* pGraphicsContext);
+        ~Camera(void);
         void GetMatrices(glm::mat4& model, glm::mat4& view, glm::mat4& proj) const;
         GraphicsContext* GetGraphicsContext(void) const;
 
+        // Block data is evaluated whenever the configuration changes, which
+        // also bumps the revision. Its uniform buffer (bound to the point
+        // "CAMERA_BLOCK_BINDING") is only written the first time it is
+        // asked to be up to date after that. Uniform buffers take OpenGL
+        // 3.1 (or "ARB_uniform_buffer_object"), this does nothing without.
+        const CameraBlockData& GetBlockData(void) const;
+        unsigned int GetRevision(void) const;
+        void UpdateUniformBuffer(void) const;
+
     protected:
         virtual void ConfigureCore(const CameraConfiguration* pConfiguration);
         virtual void BeginConfigureCore(const CameraConfiguration* pConfiguration);
@@ -283,6 +450,11 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
         virtual bool IsInTransitionCore(void) const;
         virtual void UpdateFrameCore(void);
         virtual Dynamo::Bloodstone::ITrackBall* GetTrackBallCore() const;
+        virtual void GetFrustumCore(Frustum* pFrustum) const;
+        virtual void GetPickingRayCore(float x, float y,
+            float* pOrigin, float* pDirection) const;
+        virtual void GetPickingFrustumCore(float left, float top,
+            float right, float bottom, Frustum* pFrustum) const;
 
     private:
         void InitializeTransition(const CameraConfiguration* pConfiguration);
@@ -292,6 +464,11 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
         glm::mat4 mModelMatrix;
         glm::mat4 mViewMatrix;
         glm::mat4 mProjMatrix;
+        Frustum mFrustum; // Of the above matrices.
+        CameraBlockData mBlockData;
+        unsigned int mRevision; // Zero until first configured.
+        mutable unsigned int mBufferRevision; // Revision last uploaded.
+        mutable GLuint mUniformBufferId;
         TrackBall* mpTrackBall;
         Interpolator* mpInterpolator;
         CameraConfiguration mBeginConfigValue;
@@ -338,7 +515,8 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
     class ShaderProgram : public Dynamo::Bloodstone::IShaderProgram
     {
     public:
-        ShaderProgram(VertexShader* pVertexShader, FragmentShader* pFragmentShader);
+        ShaderProgram(const GraphicsContext* pGraphicsContext,
+            VertexShader* pVertexShader, FragmentShader* pFragmentShader);
         ~ShaderProgram(void);
         void Activate(void) const;
         int GetAttributeLocation(const std::string& name) const;
@@ -355,48 +533,263 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
         GLint mViewMatrixUniform;
         GLint mProjMatrixUniform;
         GLint mNormMatrixUniform;
+
+        // Programs with a "CameraBlock" take their matrices from the uniform
+        // buffer of the camera, the others have them set as uniforms (again
+        // only after the camera changes).
+        bool mUsesCameraBlock;
+        mutable const Camera* mpAppliedCamera;
+        mutable unsigned int mAppliedRevision;
         VertexShader* mpVertexShader;
         FragmentShader* mpFragmentShader;
+        const GraphicsContext* mpGraphicsContext;
+    };
+
+    // Points and line strips are not lit, so they do not carry normals.
+    // Colors are stored as normalized bytes for all primitive types.
+    struct PointVertexData
+    {
+        float x, y, z;
+        unsigned char r, g, b, a;
     };
 
-    struct VertexData
+    typedef PointVertexData LineStripVertexData;
+
+    struct TriangleVertexData
     {
         float x, y, z;
         float nx, ny, nz;
-        float r, g, b, a;
+        unsigned char r, g, b, a;
+    };
 
-        VertexData() :
-            x(0.0f), y(0.0f), z(0.0f),
-            nx(1.0f), ny(1.0f), nz(1.0f),
-            r(1.0f), g(1.0f), b(1.0f), a(1.0f)
+    // Positions are normalized against the bounding box of the buffer,
+    // "w" is unused and only keeps the following attributes 4-byte aligned.
+    struct QuantizedTriangleVertexData
+    {
+        unsigned short x, y, z, w;
+        short nu, nv;
+        unsigned char r, g, b, a;
+    };
+
+    // A single buffer object sub-allocated in fixed size units (a vertex,
+    // or 4 bytes of indices). Allocations are referred to by handles rather
+    // than offsets, so that they can be moved around when the storage gets
+    // compacted or reallocated.
+    // 
+    class BufferHeap
+    {
+    public:
+        BufferHeap(const GraphicsContext* pGraphicsContext,
+            int unitSize, int minimumCapacity);
+        ~BufferHeap(void);
+
+        GLuint GetBufferId(void) const;
+        int GetCapacity(void) const;
+        std::size_t GetCapacityBytes(void) const;
+        int GetOffset(int allocation) const;
+        int Allocate(int units);
+        void Free(int allocation);
+        void Orphan(void);
+        void* Map(int allocation);
+        bool Unmap(void);
+        void Write(int allocation, const void* pData, std::size_t bytes);
+
+    private:
+        struct Allocation
         {
-        }
+            int offset, units;
+        };
+
+        int FindFreeBlock(int units);
+        void Relocate(int capacity);
+
+        int mUnitSize;
+        int mMinimumCapacity;
+        int mCapacity;
+        int mUsedUnits;
+        GLuint mBufferId;
+        std::map<int, int> mFreeBlocks; // Offset to unit count.
+        std::vector<Allocation> mAllocations;
+        std::vector<int> mFreeAllocations;
+        const GraphicsContext* mpGraphicsContext;
+    };
+
+    // Vertex array of a given format along with the vertex and index heaps
+    // it sources from. Shared arenas hold geometries of every node in the
+    // scene, which are then drawn with base vertex and index offsets.
+    // 
+    class VertexArena
+    {
+    public:
+        VertexArena(const GraphicsContext* pGraphicsContext,
+            VertexFormat format, bool shared);
+        ~VertexArena(void);
+
+        bool IsShared(void) const;
+        VertexFormat GetFormat(void) const;
+        int GetVertexCapacity(void) const;
+        std::size_t GetCapacityBytes(void) const;
+        void Bind(void) const;
+        void Orphan(void);
+        void BindToShaderProgram(const IShaderProgram* pShaderProgram);
+        int AllocateVertices(int vertexCount);
+        int AllocateIndices(std::size_t bytes);
+        void FreeVertices(int allocation);
+        void FreeIndices(int allocation);
+        GLint GetBaseVertex(int allocation) const;
+        const void* GetIndexOffset(int allocation) const;
+        BufferHeap* GetVertexHeap(void);
+        BufferHeap* GetIndexHeap(void);
+
+    private:
+        void RestoreBindings(void);
+
+        bool mShared;
+        VertexFormat mFormat;
+        GLuint mVertexArrayId;
+        BufferHeap mVertexHeap;
+        BufferHeap mIndexHeap;
+        const ShaderProgram* mpShaderProgram;
+        const GraphicsContext* mpGraphicsContext;
+    };
+
+    // A region written into the streaming buffer, positions keep counting
+    // up across wrap-arounds so that their age can be told.
+    struct StreamRegion
+    {
+        GLuint bufferId;
+        std::size_t offset;
+        unsigned long long position;
+    };
+
+    // Ring buffer for data that gets replaced every so often. Writes go
+    // into the buffer unsynchronized, each frame is fenced and the writer
+    // only waits on frames that may still read what it overwrites. Where
+    // fences are not available (before OpenGL 3.2) the buffer is orphaned
+    // every time it wraps around instead.
+    // 
+    // Regions stay resident for at least half a lap, past that the writer
+    // of a region has to check "IsResident" and write it again if needed.
+    // 
+    class StreamingBuffer
+    {
+    public:
+        StreamingBuffer(const GraphicsContext* pGraphicsContext);
+        ~StreamingBuffer(void);
+
+        GLuint GetBufferId(void) const;
+        bool IsResident(const StreamRegion& region) const;
+        StreamRegion Write(const void* pData, std::size_t bytes);
+        void BeginFrame(void);
+        void EndFrame(void);
+
+    private:
+        struct FrameFence
+        {
+            GLsync sync;
+            unsigned long long start;
+        };
+
+        void Reallocate(std::size_t capacity);
+        void WaitForFrames(unsigned long long position);
+
+        bool mFenced;
+        bool mInFrame;
+        GLuint mBufferId;
+        std::size_t mCapacity;
+        unsigned long long mHead;
+        unsigned long long mFrameStart;
+        unsigned long long mStorageLap;
+        unsigned long long mResidentFrom;
+        std::vector<FrameFence> mFrameFences;
+        const GraphicsContext* mpGraphicsContext;
     };
 
     class VertexBuffer : public Dynamo::Bloodstone::IVertexBuffer
     {
     public:
-        VertexBuffer(void);
+        VertexBuffer(const GraphicsContext* pGraphicsContext);
         ~VertexBuffer(void);
-        void Render(void) const;
+        // Returns the number of draw calls made. Translucent buffers have
+        // all of their clusters drawn, back faces included (see below).
+        int Render(bool translucent) const;
 
     protected:
         virtual PrimitiveType GetPrimitiveTypeCore() const;
-        virtual void LoadDataCore(const GeometryData& geometries);
+        virtual ShaderFeatures GetShaderFeaturesCore() const;
+        virtual void LoadDataCore(const PointGeometryData& geometries);
+        virtual void LoadDataCore(const LineStripGeometryData& geometries);
+        virtual void LoadDataCore(const TriangleGeometryData& geometries,
+            AttributeEncoding encoding);
         virtual void GetBoundingBoxCore(BoundingBox* pBoundingBox) const;
         virtual void BindToShaderProgramCore(IShaderProgram* pShaderProgram);
+        virtual bool IsDynamicCore(void) const;
+        virtual void SetDynamicCore(bool dynamic);
 
     private:
-        void EnsureVertexBufferCreation(void);
-        void LoadDataInternal(const std::vector<VertexData>& vertices);
+        void ReleaseStorage(void);
+        void EnsureStreamed(void) const;
+        void MoveStreamedData(void);
+        void UpdateClusterRuns(bool translucent) const;
+        int DrawClusters(const void* pIndexOffset, GLint baseVertex, bool translucent) const;
+        template<typename VertexType, typename GeometryType>
+        void LoadDataInternal(const GeometryType& geometries, VertexFormat format);
+        void LoadIndices(const unsigned int* pIndices, int indexCount);
+        void InterleaveVertices(const GeometryData& geometries,
+            PointVertexData* pVertices);
+        void InterleaveVertices(const TriangleGeometryData& geometries,
+            TriangleVertexData* pVertices);
+        void InterleaveVertices(const TriangleGeometryData& geometries,
+            QuantizedTriangleVertexData* pVertices);
 
         int mVertexCount;
-        std::vector<int> mSegmentVertexCount;
+        int mIndexCount;
+        GLenum mIndexType;
+        int mDequantScaleIndex;
+        int mDequantOffsetIndex;
+        float mDequantScale[4];
+        float mDequantOffset[4];
+        const IShaderProgram* mpShaderProgram;
+        std::vector<GLsizei> mSegmentVertexCount;
+        std::vector<GLint> mSegmentFirstVertex;
+        const GraphicsContext* mpGraphicsContext;
 
-        GLuint mVertexArrayId;
-        GLuint mVertexBufferId;
+        // Shared arena of the context, or a private one where the context
+        // cannot draw out of shared storage (see "AcquireVertexArena").
+        VertexArena* mpVertexArena;
+        int mVertexAllocation;
+        int mIndexAllocation;
+
+        // Dynamic buffers keep their (interleaved) vertices and indices,
+        // to be streamed again whenever their region is no longer resident.
+        // Whether the data loaded is streamed is decided by "LoadData", it
+        // is not until then that a change of "mDynamic" applies to it.
+        bool mDynamic;
+        bool mStreamed;
+        VertexFormat mVertexFormat;
+        mutable GLuint mStreamVertexArrayId;
+        std::size_t mStreamIndexOffset;
+        std::vector<unsigned char> mStreamData;
+        mutable StreamRegion mStreamRegion;
         BoundingBox mBoundingBox;
         PrimitiveType mPrimitiveType;
+        AttributeEncoding mAttributeEncoding;
+
+        // Clusters of a large triangle mesh, those that are visible are
+        // merged into runs of consecutive indices. Runs are worked out
+        // again only when the camera has moved since they last were (or
+        // the buffer became translucent, or opaque). Clusters facing away
+        // are only left out of opaque ones, the back of a translucent mesh
+        // shows through its front.
+        std::vector<MeshCluster> mClusters;
+        mutable bool mClusterRunsValid;
+        mutable bool mClusterRunsTranslucent;
+        mutable Frustum mClusterFrustum;
+        mutable float mClusterEyePosition[3];
+        mutable std::vector<int> mRunFirstIndices;
+        mutable std::vector<GLsizei> mRunIndexCounts;
+        mutable std::vector<const void *> mRunIndexOffsets;
+        mutable std::vector<GLint> mRunBaseVertices;
     };
 
     class BillboardVertexBuffer : public Dynamo::Bloodstone::IBillboardVertexBuffer
@@ -411,11 +804,14 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
         virtual void BindToShaderProgramCore(IShaderProgram* pShaderProgram);
 
     private:
-        void EnsureVertexBufferCreation(void);
+        void EnsureStreamed(void) const;
 
         int mVertexCount;
-        GLuint mVertexArrayId;
-        GLuint mVertexBufferId;
+        mutable GLuint mVertexArrayId;
+        GLint mAttributeLocations[3];
+        std::vector<BillboardVertex> mVertices;
+        mutable StreamRegion mStreamRegion;
+        const GraphicsContext* mpGraphicsContext;
     };
 
     class Texture2d : public Dynamo::Bloodstone::ITexture2d
@@ -436,6 +832,55 @@ namespace Dynamo { namespace Bloodstone { namespace OpenGL {
         GLint mTexAttribLoc;
     };
 
+    // Rows are laid out a fixed number to each line of a float texture (two
+    // texels per row), which gets twice as many lines every time it runs
+    // out of them. Only the lines with changed rows are
+    // uploaded again, from the copy kept here. Where the context does not
+    // allow for that texture (see "NodeStateStorage"), rows are packed into
+    // bytes or set as uniforms of the program for every row selected.
+    // 
+    class NodeStateTable : public Dynamo::Bloodstone::INodeStateTable
+    {
+    public:
+        NodeStateTable(const IGraphicsContext* pGraphicsContext);
+        ~NodeStateTable(void);
+        void Select(int row) const;
+
+    protected:
+        virtual void SetRowCore(int row, const NodeState& state);
+        virtual void BindToShaderProgramCore(IShaderProgram* pShaderProgram);
+        virtual void ActivateCore(void);
+        virtual void SelectRowCore(int row) const;
+
+    private:
+        // Uniforms of a program bound to the table, which keep the values
+        // given to them (those of a texture with "textureLines" lines).
+        struct ProgramBinding
+        {
+            const IShaderProgram* pShaderProgram;
+            GLint tableUniform;
+            GLint tableSizeUniform;
+            GLint rowUniform;
+            GLint colorUniform;
+            GLint flagsUniform;
+            int textureLines;
+        };
+
+        const void* GetTexels(int firstRow, int rowCount, GLenum& type) const;
+
+        const GraphicsContext* mpGraphicsContext;
+        const NodeStateStorage mStorage;
+        GLuint mTextureId;
+        GLint mRowUniform; // Of the program bound last.
+        GLint mColorUniform;
+        GLint mFlagsUniform;
+        int mTextureLines;
+        int mChangedBegin; // Range of rows changed since the last upload.
+        int mChangedEnd;
+        std::vector<NodeState> mRows;
+        std::vector<ProgramBinding> mBindings;
+    };
+
 } } }
 
 #endif
@@ -76,15 +76,19 @@ GLuint FragmentShader::CreateShaderIdCore(void) const
 // ShaderProgram
 // ================================================================================
 
-ShaderProgram::ShaderProgram(
+ShaderProgram::ShaderProgram(const GraphicsContext* pGraphicsContext,
     VertexShader* pVertexShader, FragmentShader* pFragmentShader) : 
     mProgramId(0),
     mModelMatrixUniform(0),
     mViewMatrixUniform(0),
     mProjMatrixUniform(0),
     mNormMatrixUniform(0),
+    mUsesCameraBlock(false),
+    mpAppliedCamera(nullptr),
+    mAppliedRevision(0),
     mpVertexShader(pVertexShader),
-    mpFragmentShader(pFragmentShader)
+    mpFragmentShader(pFragmentShader),
+    mpGraphicsContext(pGraphicsContext)
 {
     mProgramId = GL::glCreateProgram();
     GL::glAttachShader(mProgramId, mpVertexShader->GetShaderId());
@@ -96,6 +100,16 @@ ShaderProgram::ShaderProgram(
 
     char buffer[2048] = { 0 };
     GL::glGetProgramInfoLog(mProgramId, sizeof(buffer), nullptr, buffer);
+
+    // Shaders only declare the block where uniform buffers are supported.
+    if (GL::glGetUniformBlockIndex != nullptr && GL::glUniformBlockBinding != nullptr)
+    {
+        GLuint blockIndex = GL::glGetUniformBlockIndex(mProgramId, "CameraBlock");
+        if (blockIndex != GL_INVALID_INDEX) {
+            GL::glUniformBlockBinding(mProgramId, blockIndex, CAMERA_BLOCK_BINDING);
+            mUsesCameraBlock = true;
+        }
+    }
 }
 
 ShaderProgram::~ShaderProgram(void)
@@ -113,14 +127,14 @@ ShaderProgram::~ShaderProgram(void)
     }
 
     if (mProgramId != 0) {
-        GL::glDeleteProgram(mProgramId);
+        mpGraphicsContext->DeleteProgram(mProgramId);
         mProgramId = 0;
     }
 }
 
 void ShaderProgram::Activate(void) const
 {
-    GL::glUseProgram(mProgramId);
+    mpGraphicsContext->UseProgram(mProgramId);
 }
 
 int ShaderProgram::GetAttributeLocation(const std::string& name) const
@@ -174,14 +188,23 @@ void ShaderProgram::ApplyTransformationCore(const ICamera* pCamera) const
     if (pCameraInternal == nullptr)
         return;
 
-    glm::mat4 model, view, proj;
-    pCameraInternal->GetMatrices(model, view, proj);
+    if (mUsesCameraBlock) {
+        pCameraInternal->UpdateUniformBuffer();
+        return;
+    }
+
+    // Uniforms stay with the program, they are only set again once the
+    // camera has changed (or it is another camera altogether).
+    const auto revision = pCameraInternal->GetRevision();
+    if (mpAppliedCamera == pCameraInternal && mAppliedRevision == revision)
+        return;
 
-    GL::glUniformMatrix4fv(mModelMatrixUniform, 1, GL_FALSE, glm::value_ptr(model));
-    GL::glUniformMatrix4fv(mViewMatrixUniform, 1, GL_FALSE, glm::value_ptr(view));
-    GL::glUniformMatrix4fv(mProjMatrixUniform, 1, GL_FALSE, glm::value_ptr(proj));
+    const CameraBlockData& data = pCameraInternal->GetBlockData();
+    GL::glUniformMatrix4fv(mModelMatrixUniform, 1, GL_FALSE, glm::value_ptr(data.model));
+    GL::glUniformMatrix4fv(mViewMatrixUniform, 1, GL_FALSE, glm::value_ptr(data.view));
+    GL::glUniformMatrix4fv(mProjMatrixUniform, 1, GL_FALSE, glm::value_ptr(data.proj));
+    GL::glUniformMatrix4fv(mNormMatrixUniform, 1, GL_FALSE, glm::value_ptr(data.normalMatrix));
 
-    glm::mat4 modelView(view * model);
-    glm::mat4 normal = glm::transpose(glm::inverse(modelView));
-    GL::glUniformMatrix4fv(mNormMatrixUniform, 1, GL_FALSE, glm::value_ptr(normal));
+    mpAppliedCamera = pCameraInternal;
+    mAppliedRevision = revision;
 }
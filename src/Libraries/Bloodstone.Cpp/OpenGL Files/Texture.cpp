@@ -6,6 +6,15 @@
 using namespace Dynamo::Bloodstone;
 using namespace Dynamo::Bloodstone::OpenGL;
 
+// Rows of the node state table in each line of its texture, and texels
+// in each row (the override color, then the flags).
+#define NODE_STATE_ROWS_PER_LINE    128
+#define NODE_STATE_TEXELS_PER_ROW   2
+
+// Texture unit the node state table is bound to, unit 0 being left to
+// the textures of billboard text.
+#define NODE_STATE_TEXTURE_UNIT     1
+
 Texture2d::Texture2d(const IGraphicsContext* pGraphicsContext) : 
     mTextureId(0),
     mTexAttribLoc(-1)
@@ -53,3 +62,177 @@ void Texture2d::ActivateCore(void) const
     GL::glBindTexture(GL_TEXTURE_2D, mTextureId);
     GL::glUniform1i(mTexAttribLoc, 0); // Bound to GL_TEXTURE0.
 }
+
+NodeStateTable::NodeStateTable(const IGraphicsContext* pGraphicsContext) :
+    mpGraphicsContext(dynamic_cast<const GraphicsContext *>(pGraphicsContext)),
+    mStorage(mpGraphicsContext->GetNodeStateStorage()),
+    mTextureId(0),
+    mRowUniform(-1),
+    mColorUniform(-1),
+    mFlagsUniform(-1),
+    mTextureLines(0),
+    mChangedBegin(0),
+    mChangedEnd(0)
+{
+}
+
+NodeStateTable::~NodeStateTable(void)
+{
+    if (mTextureId != 0) {
+        GL::glDeleteTextures(1, &mTextureId);
+        mTextureId = 0;
+    }
+}
+
+void NodeStateTable::SetRowCore(int row, const NodeState& state)
+{
+    if (((int) mRows.size()) <= row)
+        mRows.resize(row + 1);
+
+    mRows[row] = state;
+    if (mChangedBegin == mChangedEnd) {
+        mChangedBegin = row;
+        mChangedEnd = row + 1;
+    }
+    else {
+        mChangedBegin = ((row < mChangedBegin) ? row : mChangedBegin);
+        mChangedEnd = ((row >= mChangedEnd) ? row + 1 : mChangedEnd);
+    }
+}
+
+void NodeStateTable::BindToShaderProgramCore(IShaderProgram* pShaderProgram)
+{
+    // Uniforms are looked up the first time a program is bound, and only
+    // set again after the texture has grown since they last were.
+    std::size_t index = 0;
+    while (index < mBindings.size() && mBindings[index].pShaderProgram != pShaderProgram)
+        index++;
+
+    if (index == mBindings.size())
+    {
+        ProgramBinding binding;
+        binding.pShaderProgram = pShaderProgram;
+        binding.tableUniform = pShaderProgram->GetShaderParameterIndex("nodeStates");
+        binding.tableSizeUniform = pShaderProgram->GetShaderParameterIndex("nodeStatesSize");
+        binding.rowUniform = pShaderProgram->GetShaderParameterIndex("nodeIndex");
+        binding.colorUniform = pShaderProgram->GetShaderParameterIndex("nodeStateColor");
+        binding.flagsUniform = pShaderProgram->GetShaderParameterIndex("nodeStateFlags");
+        binding.textureLines = -1;
+        mBindings.push_back(binding);
+    }
+
+    ProgramBinding& binding = mBindings[index];
+    mColorUniform = binding.colorUniform;
+    mFlagsUniform = binding.flagsUniform;
+    if (mStorage == NodeStateStorage::Uniforms)
+        return; // No texture, rows are set as they get selected.
+
+    if (binding.textureLines != mTextureLines)
+    {
+        const int width = NODE_STATE_ROWS_PER_LINE * NODE_STATE_TEXELS_PER_ROW;
+        GL::glUniform1i(binding.tableUniform, NODE_STATE_TEXTURE_UNIT);
+        GL::glUniform2f(binding.tableSizeUniform, ((float) width), ((float) mTextureLines));
+        binding.textureLines = mTextureLines;
+    }
+
+    mRowUniform = binding.rowUniform;
+}
+
+void NodeStateTable::ActivateCore(void)
+{
+    if (mStorage == NodeStateStorage::Uniforms) {
+        mChangedBegin = mChangedEnd = 0;
+        return;
+    }
+
+    GL::glActiveTexture(GL_TEXTURE0 + NODE_STATE_TEXTURE_UNIT);
+
+    if (mTextureId == 0) {
+        GL::glGenTextures(1, &mTextureId);
+        GL::glBindTexture(GL_TEXTURE_2D, mTextureId);
+        GL::glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        GL::glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+    else
+        GL::glBindTexture(GL_TEXTURE_2D, mTextureId);
+
+    const int width = NODE_STATE_ROWS_PER_LINE * NODE_STATE_TEXELS_PER_ROW;
+    const int lines = ((int) mRows.size() + NODE_STATE_ROWS_PER_LINE - 1) / NODE_STATE_ROWS_PER_LINE;
+
+    if (lines > mTextureLines)
+    {
+        // Grown texture is uploaded as a whole, rows past the last one
+        // written are there only for the last line to be complete.
+        int textureLines = ((mTextureLines > 0) ? mTextureLines : 1);
+        while (textureLines < lines)
+            textureLines = textureLines * 2;
+
+        mRows.resize(textureLines * NODE_STATE_ROWS_PER_LINE);
+
+        GLenum type = GL_FLOAT;
+        const void* pTexels = GetTexels(0, ((int) mRows.size()), type);
+        const GLint format = ((type == GL_FLOAT) ? GL_RGBA32F : GL_RGBA8);
+        GL::glTexImage2D(GL_TEXTURE_2D, 0, format, width,
+            textureLines, 0, GL_RGBA, type, pTexels);
+
+        mTextureLines = textureLines;
+    }
+    else if (mChangedBegin < mChangedEnd)
+    {
+        // Every line from that of the first changed row to that of the last.
+        const int firstLine = mChangedBegin / NODE_STATE_ROWS_PER_LINE;
+        const int lastLine = (mChangedEnd - 1) / NODE_STATE_ROWS_PER_LINE;
+        const int lineCount = lastLine - firstLine + 1;
+
+        GLenum type = GL_FLOAT;
+        const void* pTexels = GetTexels(firstLine * NODE_STATE_ROWS_PER_LINE,
+            lineCount * NODE_STATE_ROWS_PER_LINE, type);
+        GL::glTexSubImage2D(GL_TEXTURE_2D, 0, 0, firstLine, width, lineCount,
+            GL_RGBA, type, pTexels);
+    }
+
+    mChangedBegin = mChangedEnd = 0;
+    GL::glActiveTexture(GL_TEXTURE0);
+}
+
+void NodeStateTable::Select(int row) const
+{
+    if (mStorage != NodeStateStorage::Uniforms) {
+        GL::glUniform1f(mRowUniform, ((float) row));
+        return;
+    }
+
+    const NodeState& state = mRows[row];
+    GL::glUniform4f(mColorUniform, state.color[0],
+        state.color[1], state.color[2], state.color[3]);
+    GL::glUniform4f(mFlagsUniform, state.flags[0],
+        state.flags[1], state.flags[2], state.flags[3]);
+}
+
+void NodeStateTable::SelectRowCore(int row) const
+{
+    Select(row);
+}
+
+// Rows as they are uploaded, either as they are kept or (without float
+// textures) with every value turned into a byte, in the staging buffer.
+// 
+const void* NodeStateTable::GetTexels(int firstRow, int rowCount, GLenum& type) const
+{
+    if (mStorage == NodeStateStorage::FloatTexture) {
+        type = GL_FLOAT;
+        return &mRows[firstRow];
+    }
+
+    const int valueCount = rowCount * NODE_STATE_TEXELS_PER_ROW * 4;
+    auto pTexels = ((unsigned char *) mpGraphicsContext->GetStagingBuffer(valueCount));
+    auto pValues = ((const float *) &mRows[firstRow]);
+    for (int index = 0; index < valueCount; ++index) {
+        const float value = ((pValues[index] < 0.0f) ? 0.0f :
+            ((pValues[index] > 1.0f) ? 1.0f : pValues[index]));
+        pTexels[index] = ((unsigned char) (value * 255.0f + 0.5f));
+    }
+
+    type = GL_UNSIGNED_BYTE;
+    return pTexels;
+}
@@ -0,0 +1,518 @@
+#include "stdafx.h"
+#include "Picking.h"
+#include "Kernels.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <limits>
+
+using namespace Dynamo::Bloodstone;
+
+// Nodes with fewer triangles than this are always tested one block after
+// another, a hierarchy would not make picking them any faster.
+#define PICK_HIERARCHY_TRIANGLE_COUNT   256
+
+// Deepest a hierarchy can get (branches are split in half, or nearly so,
+// which is far from reaching this even with billions of triangles).
+#define PICK_TRAVERSAL_DEPTH            64
+
+// Blocks gathered at a time, for triangles tested without a hierarchy.
+#define PICK_BATCH_BLOCK_COUNT          16
+
+// States of the hierarchy of a "PickGeometry".
+#define PICK_HIERARCHY_NOT_BUILT        0
+#define PICK_HIERARCHY_QUEUED           1
+#define PICK_HIERARCHY_BUILT            2
+
+// ================================================================================
+// PickGeometryWorker
+// ================================================================================
+
+namespace Dynamo { namespace Bloodstone {
+
+    ref class PickGeometryWorker
+    {
+    public:
+        static void Queue(PickGeometry* pPickGeometry)
+        {
+            pPickGeometry->AddRef(); // Released once the worker is done with it.
+            auto worker = gcnew PickGeometryWorker(pPickGeometry);
+            System::Threading::ThreadPool::QueueUserWorkItem(
+                gcnew System::Threading::WaitCallback(worker, &PickGeometryWorker::Run));
+        }
+
+    private:
+        PickGeometryWorker(PickGeometry* pPickGeometry) : mpPickGeometry(pPickGeometry)
+        {
+        }
+
+        void Run(System::Object^ state)
+        {
+            // Picks that come after this are the ones that get faster, there
+            // is nothing to be drawn again (unlike with simplified levels).
+            mpPickGeometry->BuildHierarchy();
+            mpPickGeometry->Release();
+        }
+
+        PickGeometry* mpPickGeometry;
+    };
+} }
+
+// ================================================================================
+// PickGeometry
+// ================================================================================
+
+struct CenterBelow
+{
+    const float* pCenters;
+    int axis;
+
+    bool operator()(int first, int second) const
+    {
+        return pCenters[first * 3 + axis] < pCenters[second * 3 + axis];
+    }
+};
+
+static bool IntersectBox(const PickRay& ray, const float* pInverseDirection,
+    const float* pMin, const float* pMax, float maxDistance, float* pEntry)
+{
+    // Slabs that cannot be told apart (a direction of zero along an axis
+    // with the origin on a face) come out as not a number, and are ignored.
+    float entry = 0.0f, exit = maxDistance;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const float toMin = (pMin[axis] - ray.origin[axis]) * pInverseDirection[axis];
+        const float toMax = (pMax[axis] - ray.origin[axis]) * pInverseDirection[axis];
+        const float low = ((toMin < toMax) ? toMin : toMax);
+        const float high = ((toMin < toMax) ? toMax : toMin);
+        entry = ((low > entry) ? low : entry);
+        exit = ((high < exit) ? high : exit);
+    }
+
+    (*pEntry) = entry;
+    return entry <= exit;
+}
+
+static float GetDistanceSquared(const float* pFirst, const float* pSecond)
+{
+    const float dx = pFirst[0] - pSecond[0];
+    const float dy = pFirst[1] - pSecond[1];
+    const float dz = pFirst[2] - pSecond[2];
+    return (dx * dx) + (dy * dy) + (dz * dz);
+}
+
+static bool IntersectSegment(const PickRay& ray, const float* pStart, float* pDistance)
+{
+    // Closest points of the ray (at "along") and of the segment (at
+    // "across" between its end points), with the direction of unit
+    // length. Parallel ones are measured from the first end point.
+    const float* pDirection = &ray.direction[0];
+    const float* pEnd = pStart + 3;
+
+    float edge[3], offset[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        edge[axis] = pEnd[axis] - pStart[axis];
+        offset[axis] = ray.origin[axis] - pStart[axis];
+    }
+
+    const float b = (pDirection[0] * edge[0]) + (pDirection[1] * edge[1]) + (pDirection[2] * edge[2]);
+    const float c = (edge[0] * edge[0]) + (edge[1] * edge[1]) + (edge[2] * edge[2]);
+    const float d = (pDirection[0] * offset[0]) + (pDirection[1] * offset[1]) + (pDirection[2] * offset[2]);
+    const float e = (edge[0] * offset[0]) + (edge[1] * offset[1]) + (edge[2] * offset[2]);
+
+    const float denominator = c - (b * b);
+    float across = ((denominator > c * 1.0e-6f) ? ((e - (b * d)) / denominator) : 0.0f);
+    across = ((across < 0.0f) ? 0.0f : ((across > 1.0f) ? 1.0f : across));
+
+    float along = (across * b) - d;
+    if (along < 0.0f) {
+        along = 0.0f;
+        across = ((c > 0.0f) ? (e / c) : 0.0f);
+        across = ((across < 0.0f) ? 0.0f : ((across > 1.0f) ? 1.0f : across));
+    }
+
+    if (along >= *pDistance)
+        return false;
+
+    float onRay[3], onSegment[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        onRay[axis] = ray.origin[axis] + (pDirection[axis] * along);
+        onSegment[axis] = pStart[axis] + (edge[axis] * across);
+    }
+
+    const float tolerance = ray.spread * along;
+    if (GetDistanceSquared(onRay, onSegment) > tolerance * tolerance)
+        return false;
+
+    (*pDistance) = along;
+    return true;
+}
+
+PickGeometry::PickGeometry(PointGeometryData* pPoints,
+    LineStripGeometryData* pLineStrips, TriangleGeometryData* pTriangles) :
+    mReferenceCount(1),
+    mCancelled(0),
+    mBuildState(PICK_HIERARCHY_NOT_BUILT)
+{
+    if (pPoints != nullptr)
+        pPoints->SwapCoordinates(mPoints);
+
+    if (pLineStrips != nullptr) {
+        pLineStrips->SwapCoordinates(mLineVertices);
+        pLineStrips->SwapSegmentVertexCounts(mLineVertexCounts);
+    }
+
+    if (pTriangles != nullptr)
+    {
+        pTriangles->SwapCoordinates(mVertices);
+        pTriangles->SwapIndices(mIndices);
+
+        if (mIndices.empty()) {
+            const std::size_t vertexCount = mVertices.size() / 3;
+            mIndices.resize(vertexCount - (vertexCount % 3));
+            for (std::size_t index = 0; index < mIndices.size(); ++index)
+                mIndices[index] = ((unsigned int) index);
+        }
+    }
+}
+
+PickGeometry::~PickGeometry(void)
+{
+}
+
+void PickGeometry::AddRef(void)
+{
+    InterlockedIncrement(&mReferenceCount);
+}
+
+void PickGeometry::Release(void)
+{
+    if (InterlockedDecrement(&mReferenceCount) == 0)
+        delete this;
+}
+
+void PickGeometry::Cancel(void)
+{
+    InterlockedExchange(&mCancelled, 1);
+}
+
+bool PickGeometry::Intersect(const PickRay& ray, float* pDistance)
+{
+    bool hit = IntersectPoints(ray, pDistance);
+    if (IntersectLines(ray, pDistance))
+        hit = true;
+
+    if (mBuildState == PICK_HIERARCHY_BUILT)
+    {
+        // The worker is done with the triangles as they came in.
+        if (!mIndices.empty()) {
+            std::vector<float>().swap(mVertices);
+            std::vector<unsigned int>().swap(mIndices);
+        }
+
+        if (IntersectHierarchy(ray, pDistance))
+            hit = true;
+
+        return hit;
+    }
+
+    const int triangleCount = ((int) mIndices.size()) / 3;
+    if (triangleCount >= PICK_HIERARCHY_TRIANGLE_COUNT && InterlockedCompareExchange(
+        &mBuildState, PICK_HIERARCHY_QUEUED, PICK_HIERARCHY_NOT_BUILT) == PICK_HIERARCHY_NOT_BUILT)
+        PickGeometryWorker::Queue(this);
+
+    if (IntersectTriangles(ray, pDistance))
+        hit = true;
+
+    return hit;
+}
+
+void PickGeometry::BuildHierarchy(void)
+{
+    // Triangles are split by their centers (sums of their vertices, that
+    // is, which order the same way), those not a number going first.
+    const int triangleCount = ((int) mIndices.size()) / 3;
+    std::vector<float> centers(triangleCount * 3, 0.0f);
+    std::vector<int> triangles(triangleCount);
+
+    for (int triangle = 0; triangle < triangleCount; ++triangle)
+    {
+        triangles[triangle] = triangle;
+        for (int vertex = 0; vertex < 3; ++vertex)
+        {
+            const float* pVertex = &mVertices[mIndices[triangle * 3 + vertex] * 3];
+            for (int axis = 0; axis < 3; ++axis)
+                centers[triangle * 3 + axis] += pVertex[axis];
+        }
+
+        for (int axis = 0; axis < 3; ++axis) {
+            const float center = centers[triangle * 3 + axis];
+            if (center != center)
+                centers[triangle * 3 + axis] = -FLT_MAX;
+        }
+    }
+
+    if (triangleCount > 0)
+    {
+        mBranches.reserve(((triangleCount / 4) + 1) * 2);
+        mBlocks.reserve(((triangleCount / 4) + 1) * 36);
+
+        Branch root;
+        mBranches.push_back(root);
+        BuildBranch(0, triangles, centers, 0, triangleCount);
+    }
+
+    InterlockedExchange(&mBuildState, PICK_HIERARCHY_BUILT);
+}
+
+void PickGeometry::BuildBranch(int branch, std::vector<int>& triangles,
+    const std::vector<float>& centers, int begin, int end)
+{
+    // Nobody is going to pick this node any more, leave it half built.
+    if (mCancelled != 0)
+        return;
+
+    const int count = end - begin;
+    if (count <= 4)
+    {
+        const int block = ((int) mBlocks.size()) / 36;
+        mBlocks.resize(mBlocks.size() + 36);
+        GatherBlock(&triangles[begin], count, &mBlocks[block * 36]);
+
+        Branch& leaf = mBranches[branch];
+        leaf.child = -1;
+        leaf.block = block;
+
+        const float* pFirst = &mVertices[mIndices[triangles[begin] * 3] * 3];
+        memcpy(leaf.min, pFirst, sizeof(leaf.min));
+        memcpy(leaf.max, pFirst, sizeof(leaf.max));
+        for (int index = begin; index < end; ++index)
+        {
+            for (int vertex = 0; vertex < 3; ++vertex)
+            {
+                const float* pVertex = &mVertices[mIndices[triangles[index] * 3 + vertex] * 3];
+                for (int axis = 0; axis < 3; ++axis) {
+                    leaf.min[axis] = ((pVertex[axis] < leaf.min[axis]) ? pVertex[axis] : leaf.min[axis]);
+                    leaf.max[axis] = ((pVertex[axis] > leaf.max[axis]) ? pVertex[axis] : leaf.max[axis]);
+                }
+            }
+        }
+
+        return;
+    }
+
+    float centerMin[3], centerMax[3];
+    for (int axis = 0; axis < 3; ++axis)
+        centerMin[axis] = centerMax[axis] = centers[triangles[begin] * 3 + axis];
+
+    for (int index = begin + 1; index < end; ++index)
+    {
+        const float* pCenter = &centers[triangles[index] * 3];
+        for (int axis = 0; axis < 3; ++axis) {
+            centerMin[axis] = ((pCenter[axis] < centerMin[axis]) ? pCenter[axis] : centerMin[axis]);
+            centerMax[axis] = ((pCenter[axis] > centerMax[axis]) ? pCenter[axis] : centerMax[axis]);
+        }
+    }
+
+    int axis = 0;
+    for (int other = 1; other < 3; ++other) {
+        if (centerMax[other] - centerMin[other] > centerMax[axis] - centerMin[axis])
+            axis = other;
+    }
+
+    // Split at the median along the widest axis, rounded up to a multiple
+    // of four triangles so that the blocks of the leaves below are full.
+    const int half = (((count / 2) + 3) / 4) * 4;
+    const int middle = begin + ((half < count) ? half : count / 2);
+
+    CenterBelow centerBelow = { &centers[0], axis };
+    std::nth_element(triangles.begin() + begin,
+        triangles.begin() + middle, triangles.begin() + end, centerBelow);
+
+    const int child = ((int) mBranches.size());
+    mBranches[branch].child = child;
+    mBranches[branch].block = -1;
+
+    Branch children[2];
+    mBranches.push_back(children[0]);
+    mBranches.push_back(children[1]);
+
+    BuildBranch(child, triangles, centers, begin, middle);
+    BuildBranch(child + 1, triangles, centers, middle, end);
+
+    Branch& current = mBranches[branch];
+    const Branch& left = mBranches[child];
+    const Branch& right = mBranches[child + 1];
+    for (int index = 0; index < 3; ++index) {
+        current.min[index] = ((right.min[index] < left.min[index]) ? right.min[index] : left.min[index]);
+        current.max[index] = ((right.max[index] > left.max[index]) ? right.max[index] : left.max[index]);
+    }
+}
+
+void PickGeometry::GatherBlock(const int* pTriangles, int count, float* pBlock) const
+{
+    // Lanes without a triangle are not a number, and never hit.
+    for (int index = 0; index < 36; ++index)
+        pBlock[index] = std::numeric_limits<float>::quiet_NaN();
+
+    for (int lane = 0; lane < count; ++lane)
+    {
+        for (int vertex = 0; vertex < 3; ++vertex)
+        {
+            const float* pVertex = &mVertices[mIndices[pTriangles[lane] * 3 + vertex] * 3];
+            for (int axis = 0; axis < 3; ++axis)
+                pBlock[vertex * 12 + axis * 4 + lane] = pVertex[axis];
+        }
+    }
+}
+
+bool PickGeometry::IntersectTriangles(const PickRay& ray, float* pDistance) const
+{
+    KernelRay kernelRay;
+    GeometryKernels::PrepareRay(ray.origin, ray.direction, &kernelRay);
+
+    float blocks[PICK_BATCH_BLOCK_COUNT * 36];
+    int triangles[PICK_BATCH_BLOCK_COUNT * 4];
+
+    bool hit = false;
+    const int triangleCount = ((int) mIndices.size()) / 3;
+    for (int first = 0; first < triangleCount; first += PICK_BATCH_BLOCK_COUNT * 4)
+    {
+        const int remaining = triangleCount - first;
+        const int count = ((remaining < PICK_BATCH_BLOCK_COUNT * 4) ?
+            remaining : PICK_BATCH_BLOCK_COUNT * 4);
+
+        for (int index = 0; index < count; ++index)
+            triangles[index] = first + index;
+
+        const int blockCount = (count + 3) / 4;
+        for (int block = 0; block < blockCount; ++block) {
+            const int lanes = count - (block * 4);
+            GatherBlock(&triangles[block * 4], ((lanes < 4) ? lanes : 4), &blocks[block * 36]);
+        }
+
+        if (GeometryKernels::IntersectTriangles(kernelRay, &blocks[0], blockCount, pDistance) >= 0)
+            hit = true;
+    }
+
+    return hit;
+}
+
+bool PickGeometry::IntersectHierarchy(const PickRay& ray, float* pDistance) const
+{
+    if (mBranches.empty())
+        return false;
+
+    KernelRay kernelRay;
+    GeometryKernels::PrepareRay(ray.origin, ray.direction, &kernelRay);
+
+    float inverseDirection[3];
+    for (int axis = 0; axis < 3; ++axis)
+        inverseDirection[axis] = 1.0f / ray.direction[axis];
+
+    // Branches waiting to be visited, along with where the ray enters
+    // them. Those entered no nearer than a hit found since are skipped.
+    int branches[PICK_TRAVERSAL_DEPTH];
+    float entries[PICK_TRAVERSAL_DEPTH];
+    int depth = 0;
+
+    const Branch& root = mBranches[0];
+    if (IntersectBox(ray, inverseDirection, root.min, root.max, *pDistance, &entries[0]))
+        branches[depth++] = 0;
+
+    bool hit = false;
+    while (depth > 0)
+    {
+        depth--;
+        if (entries[depth] > *pDistance)
+            continue;
+
+        const Branch& branch = mBranches[branches[depth]];
+        if (branch.child < 0)
+        {
+            const float* pBlock = &mBlocks[branch.block * 36];
+            if (GeometryKernels::IntersectTriangles(kernelRay, pBlock, 1, pDistance) >= 0)
+                hit = true;
+
+            continue;
+        }
+
+        // The nearer child goes on top, to be visited first.
+        float leftEntry = 0.0f, rightEntry = 0.0f;
+        const Branch& left = mBranches[branch.child];
+        const Branch& right = mBranches[branch.child + 1];
+        const bool leftHit = IntersectBox(ray, inverseDirection, left.min, left.max, *pDistance, &leftEntry);
+        const bool rightHit = IntersectBox(ray, inverseDirection, right.min, right.max, *pDistance, &rightEntry);
+
+        const bool leftFirst = (!rightHit || (leftHit && leftEntry <= rightEntry));
+        const int order[2] = {
+            (leftFirst ? branch.child + 1 : branch.child),
+            (leftFirst ? branch.child : branch.child + 1)
+        };
+
+        for (int index = 0; index < 2; ++index)
+        {
+            const bool isLeft = (order[index] == branch.child);
+            if (isLeft ? leftHit : rightHit) {
+                branches[depth] = order[index];
+                entries[depth] = (isLeft ? leftEntry : rightEntry);
+                depth++;
+            }
+        }
+    }
+
+    return hit;
+}
+
+bool PickGeometry::IntersectLines(const PickRay& ray, float* pDistance) const
+{
+    // Strips follow one another, each contributes one segment less than
+    // it has vertices (the same as "VertexBuffer::LoadData").
+    bool hit = false;
+    const int vertexCount = ((int) mLineVertices.size()) / 3;
+    const int stripCount = ((int) mLineVertexCounts.size());
+
+    int first = 0;
+    for (int strip = 0; strip < stripCount; ++strip)
+    {
+        const int end = first + mLineVertexCounts[strip];
+        for (int vertex = first; vertex + 1 < end && vertex + 1 < vertexCount; ++vertex) {
+            if (IntersectSegment(ray, &mLineVertices[vertex * 3], pDistance))
+                hit = true;
+        }
+
+        first = end;
+    }
+
+    return hit;
+}
+
+bool PickGeometry::IntersectPoints(const PickRay& ray, float* pDistance) const
+{
+    bool hit = false;
+    const std::size_t pointCount = mPoints.size() / 3;
+
+    for (std::size_t point = 0; point < pointCount; ++point)
+    {
+        const float* pPoint = &mPoints[point * 3];
+        const float offset[3] = {
+            pPoint[0] - ray.origin[0],
+            pPoint[1] - ray.origin[1],
+            pPoint[2] - ray.origin[2]
+        };
+
+        const float along = (offset[0] * ray.direction[0]) +
+            (offset[1] * ray.direction[1]) + (offset[2] * ray.direction[2]);
+        if (along < 0.0f || along >= *pDistance)
+            continue;
+
+        const float across = GetDistanceSquared(pPoint, ray.origin) - (along * along);
+        const float tolerance = ray.spread * along;
+        if (across <= tolerance * tolerance) {
+            (*pDistance) = along;
+            hit = true;
+        }
+    }
+
+    return hit;
+}
@@ -0,0 +1,88 @@
+#ifndef _PICKING_H_
+#define _PICKING_H_
+
+#include "Interfaces.h"
+
+namespace Dynamo { namespace Bloodstone {
+
+    // Ray cast from a point of the viewport, with a direction of unit length.
+    // Points and lines are hit when they are within "spread" times their
+    // distance along the ray from it (the pick tolerance, in pixels, turned
+    // into world units per unit of distance from the eye).
+    //
+    struct PickRay
+    {
+        float origin[3];
+        float direction[3];
+        float spread;
+    };
+
+    // Positions of the geometries of a node, kept on the CPU for picking.
+    // They are taken out of the converted geometries once those are loaded
+    // into vertex buffers (which leaves them without any), not copied.
+    // Triangles are tested through a bounding volume hierarchy (one block
+    // of four triangles in each leaf), which is only built on a worker
+    // thread the first time the node is a candidate for a pick. Triangles
+    // are tested one block after another until the hierarchy is there.
+    // Shared between "NodeSceneData" and the worker thread, whichever lets
+    // go of it last deletes it.
+    //
+    class PickGeometry
+    {
+    public:
+        PickGeometry(PointGeometryData* pPoints,
+            LineStripGeometryData* pLineStrips, TriangleGeometryData* pTriangles);
+
+        void AddRef(void);
+        void Release(void);
+        void Cancel(void);
+
+        // Distance along the ray to the nearest hit closer than "*pDistance"
+        // (which is then updated), false if nothing is hit that close.
+        bool Intersect(const PickRay& ray, float* pDistance);
+
+        // Called on the worker thread.
+        void BuildHierarchy(void);
+
+    private:
+        // Leaves have "block" set to that of their triangles, the children
+        // of other branches are "child" and "child + 1".
+        struct Branch
+        {
+            float min[3];
+            float max[3];
+            int child;
+            int block;
+        };
+
+        ~PickGeometry(void);
+        PickGeometry(const PickGeometry& other);
+        PickGeometry& operator=(const PickGeometry& other);
+
+        void BuildBranch(int branch, std::vector<int>& triangles,
+            const std::vector<float>& centers, int begin, int end);
+        void GatherBlock(const int* pTriangles, int count, float* pBlock) const;
+        bool IntersectTriangles(const PickRay& ray, float* pDistance) const;
+        bool IntersectHierarchy(const PickRay& ray, float* pDistance) const;
+        bool IntersectLines(const PickRay& ray, float* pDistance) const;
+        bool IntersectPoints(const PickRay& ray, float* pDistance) const;
+
+        volatile long mReferenceCount;
+        volatile long mCancelled;
+        volatile long mBuildState; // Not started, queued or completed.
+
+        std::vector<float> mPoints;
+        std::vector<float> mLineVertices;
+        std::vector<int> mLineVertexCounts; // Vertices of each strip.
+
+        // Triangles as they came in, released once the hierarchy is built.
+        std::vector<float> mVertices;
+        std::vector<unsigned int> mIndices;
+
+        // Written by the worker thread, read only once it has completed.
+        std::vector<Branch> mBranches;
+        std::vector<float> mBlocks;
+    };
+} }
+
+#endif
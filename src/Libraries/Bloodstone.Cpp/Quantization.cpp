@@ -0,0 +1,137 @@
+// Quantization.cpp : Compiled without precompiled headers and as native
+// code, see "PositionQuantizer" in "Quantization.h" for details.
+//
+
+#include "Quantization.h"
+
+#include <cmath>
+
+using namespace Dynamo::Bloodstone;
+
+// Largest value of a 16-bit quantized position component.
+#define QUANTIZED_POSITION_MAX 65535.0f
+
+// Largest value of a signed 16-bit octahedral normal component.
+#define QUANTIZED_NORMAL_MAX 32767.0f
+
+// Relative precision of a float (a unit in the last place at 1.0), with
+// some headroom for the multiply and add that dequantization takes.
+#define FLOAT_ROUNDING_ERROR 2.5e-7f
+
+static unsigned short QuantizePosition(float value)
+{
+    value = value + 0.5f; // Round to the nearest step.
+    if (value <= 0.0f)
+        return 0;
+    if (value >= QUANTIZED_POSITION_MAX)
+        return ((unsigned short) QUANTIZED_POSITION_MAX);
+
+    return ((unsigned short) value);
+}
+
+static short QuantizeNormal(float value)
+{
+    value = std::floor((value * QUANTIZED_NORMAL_MAX) + 0.5f);
+    if (value <= -QUANTIZED_NORMAL_MAX)
+        return ((short) -QUANTIZED_NORMAL_MAX);
+    if (value >= QUANTIZED_NORMAL_MAX)
+        return ((short) QUANTIZED_NORMAL_MAX);
+
+    return ((short) value);
+}
+
+// ================================================================================
+// PositionQuantizer
+// ================================================================================
+
+PositionQuantizer::PositionQuantizer(const float* pMin, const float* pMax)
+{
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const float extent = pMax[axis] - pMin[axis];
+        mScale[axis] = ((extent > 0.0f) ? extent : 0.0f);
+        mOffset[axis] = pMin[axis];
+        mQuantize[axis] = ((extent > 0.0f) ? (QUANTIZED_POSITION_MAX / extent) : 0.0f);
+    }
+}
+
+void PositionQuantizer::Quantize(const float* pPosition, unsigned short* pQuantized) const
+{
+    for (int axis = 0; axis < 3; ++axis) {
+        pQuantized[axis] = QuantizePosition(
+            (pPosition[axis] - mOffset[axis]) * mQuantize[axis]);
+    }
+}
+
+void PositionQuantizer::Dequantize(const unsigned short* pQuantized, float* pPosition) const
+{
+    for (int axis = 0; axis < 3; ++axis) {
+        const float normalized = ((float) pQuantized[axis]) / QUANTIZED_POSITION_MAX;
+        pPosition[axis] = normalized * mScale[axis] + mOffset[axis];
+    }
+}
+
+float PositionQuantizer::GetErrorBound(int axis) const
+{
+    const float magnitude = std::fabs(mOffset[axis]) + mScale[axis];
+    return (0.5f * mScale[axis] / QUANTIZED_POSITION_MAX) +
+        (magnitude * FLOAT_ROUNDING_ERROR);
+}
+
+const float* PositionQuantizer::GetScale(void) const
+{
+    return &mScale[0];
+}
+
+const float* PositionQuantizer::GetOffset(void) const
+{
+    return &mOffset[0];
+}
+
+// ================================================================================
+// OctahedralNormal
+// ================================================================================
+
+// Project the unit normal onto an octahedron, then unfold the lower half
+// onto the outer triangles of the square.
+// 
+void OctahedralNormal::Encode(const float* pNormal, short* pU, short* pV)
+{
+    const float x = pNormal[0], y = pNormal[1], z = pNormal[2];
+    const float sum = std::fabs(x) + std::fabs(y) + std::fabs(z);
+    if (!(sum > 0.0f)) {
+        *pU = *pV = 0; // Degenerated normal, decodes to +Z.
+        return;
+    }
+
+    float u = x / sum;
+    float v = y / sum;
+    if (z < 0.0f)
+    {
+        const float fu = (1.0f - std::fabs(v)) * ((u >= 0.0f) ? 1.0f : -1.0f);
+        const float fv = (1.0f - std::fabs(u)) * ((v >= 0.0f) ? 1.0f : -1.0f);
+        u = fu;
+        v = fv;
+    }
+
+    *pU = QuantizeNormal(u);
+    *pV = QuantizeNormal(v);
+}
+
+void OctahedralNormal::Decode(short u, short v, float* pNormal)
+{
+    float x = ((float) u) / QUANTIZED_NORMAL_MAX;
+    float y = ((float) v) / QUANTIZED_NORMAL_MAX;
+    const float z = 1.0f - std::fabs(x) - std::fabs(y);
+    if (z < 0.0f)
+    {
+        const float fx = (1.0f - std::fabs(y)) * ((x >= 0.0f) ? 1.0f : -1.0f);
+        const float fy = (1.0f - std::fabs(x)) * ((y >= 0.0f) ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+
+    pNormal[0] = x;
+    pNormal[1] = y;
+    pNormal[2] = z;
+}
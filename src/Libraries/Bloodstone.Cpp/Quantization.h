@@ -0,0 +1,49 @@
+#ifndef _BLOODSTONE_QUANTIZATION_H_
+#define _BLOODSTONE_QUANTIZATION_H_
+
+namespace Dynamo { namespace Bloodstone {
+
+    // Positions of a quantized vertex buffer, 16 bits per axis relative to
+    // a bounding box (see "IVertexBuffer::AttributeEncoding"). "Dequantize"
+    // does what "Phong21.vert" does with the scale and offset. This file is
+    // compiled natively (no /clr) and depends on nothing else in this
+    // project, so that its error bound can be tested on its own.
+    //
+    class PositionQuantizer
+    {
+    public:
+        // Axes along which the box has no extent quantize to zero, which
+        // dequantizes back to exactly the minimum corner.
+        PositionQuantizer(const float* pMin, const float* pMax);
+
+        void Quantize(const float* pPosition, unsigned short* pQuantized) const;
+        void Dequantize(const unsigned short* pQuantized, float* pPosition) const;
+
+        // Farthest a dequantized position gets from its source along "axis"
+        // for positions within the box: half a quantization step, plus what
+        // single precision rounding loses at the magnitude of the box.
+        float GetErrorBound(int axis) const;
+
+        // Extent and minimum corner of the box, for the vertex shader.
+        const float* GetScale(void) const;
+        const float* GetOffset(void) const;
+
+    private:
+        float mScale[3];
+        float mOffset[3];
+        float mQuantize[3];
+    };
+
+    // Unit normals projected onto an octahedron, then unfolded onto a square
+    // of two signed 16-bit components. "Decode" does what "Phong21.vert"
+    // does, except for normalizing its result.
+    //
+    class OctahedralNormal
+    {
+    public:
+        static void Encode(const float* pNormal, short* pU, short* pV);
+        static void Decode(short u, short v, float* pNormal);
+    };
+} }
+
+#endif
@@ -0,0 +1,152 @@
+#include "stdafx.h"
+#include "RenderQueue.h"
+
+#include <cstring>
+
+using namespace Dynamo::Bloodstone;
+
+// Positions of the fields of a sort key (see "RenderQueue"), those of
+// blended items are all below their distance instead of above it.
+#define RENDER_KEY_TRANSLUCENT_SHIFT    63
+#define RENDER_KEY_DIMENSIONALITY_SHIFT 62
+#define RENDER_KEY_FEATURES_SHIFT       58
+#define RENDER_KEY_FEATURES_MASK        0xf
+#define RENDER_KEY_PRIMITIVE_SHIFT      56
+#define RENDER_KEY_DISTANCE_SHIFT       32
+#define RENDER_KEY_DISTANCE_MASK        0xffffff
+#define RENDER_KEY_BLENDED_FIELDS_SHIFT 24 // Down from where opaque keys have them.
+#define RENDER_KEY_BLENDED_DEPTH_SHIFT  39
+
+// Keys are sorted on a byte at a time, over the upper 32 bits only.
+#define RENDER_KEY_RADIX_BITS           8
+#define RENDER_KEY_RADIX_DIGITS         256
+#define RENDER_KEY_RADIX_PASSES         4
+#define RENDER_KEY_RADIX_SHIFT          32
+
+// ================================================================================
+// RenderQueue
+// ================================================================================
+
+unsigned long long RenderQueue::MakeKey(bool translucent, ShaderFeatures features,
+    IVertexBuffer::PrimitiveType primitiveType, float distance)
+{
+    // Bits of a float that is not negative compare the same way as its
+    // value does, the upper 24 of its 31 bits keep that order (a coarser
+    // one, relative to the magnitude of the distance).
+    unsigned int bits = 0;
+    if (distance > 0.0f) // Also takes care of a distance that is not a number.
+        std::memcpy(&bits, &distance, sizeof(bits));
+
+    const unsigned long long depth = ((bits >> 7) & RENDER_KEY_DISTANCE_MASK);
+
+    unsigned long long fields = 0;
+    fields |= (((unsigned long long) primitiveType) & 0x3) << RENDER_KEY_PRIMITIVE_SHIFT;
+    fields |= (((unsigned long long) features) & RENDER_KEY_FEATURES_MASK) << RENDER_KEY_FEATURES_SHIFT;
+    if (primitiveType == IVertexBuffer::PrimitiveType::Triangle)
+        fields |= 1ull << RENDER_KEY_DIMENSIONALITY_SHIFT;
+
+    if (translucent == false)
+        return fields | (depth << RENDER_KEY_DISTANCE_SHIFT);
+
+    // Back to front, right below the translucent bit.
+    const unsigned long long reversed = RENDER_KEY_DISTANCE_MASK - depth;
+    return (1ull << RENDER_KEY_TRANSLUCENT_SHIFT) |
+        (reversed << RENDER_KEY_BLENDED_DEPTH_SHIFT) |
+        (fields >> RENDER_KEY_BLENDED_FIELDS_SHIFT);
+}
+
+ShaderFeatures RenderQueue::GetShaderFeatures(unsigned long long key)
+{
+    int shift = RENDER_KEY_FEATURES_SHIFT;
+    if (IsTranslucent(key))
+        shift = shift - RENDER_KEY_BLENDED_FIELDS_SHIFT;
+
+    return ((ShaderFeatures) ((key >> shift) & RENDER_KEY_FEATURES_MASK));
+}
+
+bool RenderQueue::IsTranslucent(unsigned long long key)
+{
+    return (key >> RENDER_KEY_TRANSLUCENT_SHIFT) != 0;
+}
+
+void RenderQueue::Clear(void)
+{
+    mItems.clear(); // Capacity is kept for the next frame.
+}
+
+void RenderQueue::Add(unsigned long long key, IVertexBuffer* pVertexBuffer, int stateRow)
+{
+    DrawItem drawItem;
+    drawItem.key = key;
+    drawItem.pVertexBuffer = pVertexBuffer;
+    drawItem.stateRow = stateRow;
+    mItems.push_back(drawItem);
+}
+
+void RenderQueue::Sort(void)
+{
+    const std::size_t count = mItems.size();
+    if (count < 2)
+        return;
+
+    // Digits of every pass are counted in one go over the keys. Each pass
+    // (least significant byte first) is stable, which is what makes the
+    // whole sort stable. Passes over a byte that is the same in every key
+    // leave the order as it is, so they are skipped altogether.
+    // 
+    std::size_t offsets[RENDER_KEY_RADIX_PASSES][RENDER_KEY_RADIX_DIGITS];
+    std::memset(offsets, 0, sizeof(offsets));
+
+    for (std::size_t index = 0; index < count; ++index)
+    {
+        unsigned long long key = mItems[index].key >> RENDER_KEY_RADIX_SHIFT;
+        for (int pass = 0; pass < RENDER_KEY_RADIX_PASSES; ++pass) {
+            offsets[pass][key & (RENDER_KEY_RADIX_DIGITS - 1)]++;
+            key = key >> RENDER_KEY_RADIX_BITS;
+        }
+    }
+
+    mSortedItems.resize(count);
+    DrawItem* pSource = &mItems[0];
+    DrawItem* pTarget = &mSortedItems[0];
+
+    for (int pass = 0; pass < RENDER_KEY_RADIX_PASSES; ++pass)
+    {
+        const int shift = RENDER_KEY_RADIX_SHIFT + pass * RENDER_KEY_RADIX_BITS;
+        std::size_t* pOffsets = &offsets[pass][0];
+
+        const auto first = ((pSource[0].key >> shift) & (RENDER_KEY_RADIX_DIGITS - 1));
+        if (pOffsets[first] == count)
+            continue;
+
+        // Counts of each digit turned into where the first item of it goes.
+        std::size_t total = 0;
+        for (int digit = 0; digit < RENDER_KEY_RADIX_DIGITS; ++digit) {
+            const std::size_t digitCount = pOffsets[digit];
+            pOffsets[digit] = total;
+            total = total + digitCount;
+        }
+
+        for (std::size_t index = 0; index < count; ++index) {
+            const auto digit = ((pSource[index].key >> shift) & (RENDER_KEY_RADIX_DIGITS - 1));
+            pTarget[pOffsets[digit]++] = pSource[index];
+        }
+
+        DrawItem* pSwap = pSource;
+        pSource = pTarget;
+        pTarget = pSwap;
+    }
+
+    if (pSource != &mItems[0])
+        mItems.swap(mSortedItems);
+}
+
+int RenderQueue::GetItemCount(void) const
+{
+    return ((int) mItems.size());
+}
+
+const DrawItem* RenderQueue::GetItems(void) const
+{
+    return (mItems.empty() ? nullptr : &mItems[0]);
+}
@@ -0,0 +1,52 @@
+#ifndef _RENDERQUEUE_H_
+#define _RENDERQUEUE_H_
+
+#include "Interfaces.h"
+
+namespace Dynamo { namespace Bloodstone {
+
+    // Draw items of a frame, sorted by their keys before they are submitted.
+    // From the most significant bit down, the key of an opaque item is:
+    // 
+    //  bit 63:      "0", opaque items are drawn ahead of blended ones.
+    //  bit 62:      dimensionality of the primitives ("1" for "High").
+    //  bits 61-58:  features of the shader program (see "ShaderFeatures").
+    //  bits 57-56:  primitive type.
+    //  bits 55-32:  distance from the camera, increasing (front to back,
+    //               for depth tests to reject as many of the fragments
+    //               behind them as possible).
+    // 
+    // Blended (translucent) items have to be drawn back to front whatever
+    // they are drawn with, their distance comes first:
+    // 
+    //  bit 63:      "1", drawn after all of the opaque items for there to
+    //               be something to blend with.
+    //  bits 62-39:  distance from the camera, decreasing.
+    //  bit 38:      dimensionality of the primitives.
+    //  bits 37-34:  features of the shader program.
+    //  bits 33-32:  primitive type.
+    // 
+    // Bits 31-0 are zero, they are left out of the sort. Items of equal
+    // keys remain in the order they were added in.
+    // 
+    class RenderQueue
+    {
+    public:
+        static unsigned long long MakeKey(bool translucent, ShaderFeatures features,
+            IVertexBuffer::PrimitiveType primitiveType, float distance);
+        static ShaderFeatures GetShaderFeatures(unsigned long long key);
+        static bool IsTranslucent(unsigned long long key);
+
+        void Clear(void);
+        void Add(unsigned long long key, IVertexBuffer* pVertexBuffer, int stateRow);
+        void Sort(void);
+        int GetItemCount(void) const;
+        const DrawItem* GetItems(void) const;
+
+    private:
+        std::vector<DrawItem> mItems;
+        std::vector<DrawItem> mSortedItems; // Scratch space for "Sort".
+    };
+} }
+
+#endif
@@ -1,4 +1,5 @@
 #version 120
+#extension GL_ARB_uniform_buffer_object : enable
 
 attribute vec3 inPosition;
 attribute vec4 inColor;
@@ -7,9 +8,26 @@ attribute vec4 inTextCoords;
 varying vec4 vertColor;
 varying vec2 vertTexCoords;
 
+// Values of the camera shared by all programs, taken from its uniform
+// buffer where uniform buffers are supported, set one by one otherwise.
+// 
+#ifdef GL_ARB_uniform_buffer_object
+layout(std140) uniform CameraBlock
+{
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+    mat4 viewProj;
+    mat4 normalMatrix;
+    vec4 viewportSize;
+    vec4 eyePosition;
+};
+#else
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 proj;
+#endif
+
 uniform vec2 screenSize;
 
 void main(void)
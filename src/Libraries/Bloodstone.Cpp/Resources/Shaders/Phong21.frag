@@ -1,19 +1,12 @@
 #version 120
 
+#ifdef LIT
 varying vec3 vertNormal;
 varying vec3 vertPosition;
-varying vec4 vertColor;
-
-uniform float alpha;
+varying float vertShaded;
+#endif
 
-// Various control parameters merged into a single vector value:
-// 
-//  controlParams[0]: "1.0" for rendering points/lines
-//                    "3.0" for rendering triangles
-// 
-//  controlParams[1]: "1.0" for overriding color.
-// 
-uniform vec4 controlParams;
+varying vec4 vertColor;
 
 const vec3 lightPosition = vec3(5000.0, 55000.0, 10000.0);
 const vec3 ambientColor  = vec3(0.3, 0.3, 0.3);
@@ -22,15 +15,11 @@ const vec3 specularColor = vec3(0.8, 0.8, 0.8);
 
 void main(void)
 {
+#ifndef LIT
     // Rendering primitives of lower dimensionality (e.g. points and lines)
     // will not require shading to be done, just take their current colors.
-    // 
-    if (controlParams[0] < 3.0)
-    {
-        gl_FragColor = vec4(vertColor.rgb, alpha);
-        return;
-    }
-
+    gl_FragColor = vec4(vertColor.rgb, 1.0);
+#else
     vec3 normal = normalize(vertNormal);
     vec3 finalColor = vec3(0.0, 0.0, 0.0);
     
@@ -52,5 +41,8 @@ void main(void)
     finalColor += ambient + diffuse + specular;
     // END - For multiple lights
 
-    gl_FragColor = vec4(finalColor.rgb, 1.0);
+    // Triangles of nodes not drawn as shaded just take their current colors
+    // ("vertShaded" is the same "0.0" or "1.0" all over a node).
+    gl_FragColor = vec4(mix(vertColor.rgb, finalColor.rgb, vertShaded), 1.0);
+#endif
 }
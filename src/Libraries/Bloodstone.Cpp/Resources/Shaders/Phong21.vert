@@ -1,39 +1,127 @@
 #version 120
+#extension GL_ARB_uniform_buffer_object : enable
 
+// Specialized for the features of the vertex buffers it draws, each one
+// defined ahead of this source when present:
+// 
+//  LIT:        triangles, their normals and positions are passed on for
+//              the fragment shader to light them.
+// 
+//  QUANTIZED:  positions relative to the bounding box of the buffer, and
+//              octahedral encoded normals.
+// 
 attribute vec3 inPosition;
-attribute vec3 inNormal;
 attribute vec4 inColor;
 
+#ifdef LIT
+attribute vec3 inNormal;
+
 varying vec3 vertNormal;
 varying vec3 vertPosition;
+varying float vertShaded;
+#endif
+
 varying vec4 vertColor;
 
+// Values of the camera shared by all programs, taken from its uniform
+// buffer where uniform buffers are supported, set one by one otherwise.
+// 
+#ifdef GL_ARB_uniform_buffer_object
+layout(std140) uniform CameraBlock
+{
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+    mat4 viewProj;
+    mat4 normalMatrix;
+    vec4 viewportSize;
+    vec4 eyePosition;
+};
+#else
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 proj;
 uniform mat4 normalMatrix;
-uniform vec4 colorOverride;
+#endif
 
-// Various control parameters merged into a single vector value:
+// Table of per node states, two texels in each row (the row of the node
+// being drawn is "nodeIndex", rows are laid out one line after another):
 // 
-//  controlParams[0]: "1.0" for rendering points/lines
-//                    "3.0" for rendering triangles
+//  texel 0:    color that overrides that of vertices.
 // 
-//  controlParams[1]: "1.0" for overriding color.
+//  texel 1:    "x" is "1.0" for overriding color, "y" is "1.0" when the
+//              node is selected, "z" is "1.0" when triangles are shaded.
 // 
-uniform vec4 controlParams;
+#ifdef NODE_STATE_UNIFORMS
+// Where vertex shaders cannot read textures, both texels of the row are
+// set for each node drawn instead.
+uniform vec4 nodeStateColor;
+uniform vec4 nodeStateFlags;
+#else
+uniform sampler2D nodeStates;
+uniform vec2 nodeStatesSize;
+uniform float nodeIndex;
+#endif
+
+#ifdef QUANTIZED
+
+// Per vertex buffer dequantization parameters:
+// 
+//  dequantScale.xyz:  scale applied to "inPosition" (extent of the box).
+// 
+//  dequantOffset.xyz: offset added to the scaled position (the minimum
+//                     corner of the box).
+// 
+uniform vec4 dequantScale;
+uniform vec4 dequantOffset;
+
+vec3 decodeOctahedral(vec2 encoded)
+{
+    vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+    if (normal.z < 0.0)
+        normal.xy = (1.0 - abs(normal.yx)) * sign(normal.xy);
+
+    return normalize(normal);
+}
+
+#endif
 
 void main(void)
 {
-    vec4 viewPos = view * model * vec4(inPosition, 1.0);
+#ifdef QUANTIZED
+    vec3 position = inPosition * dequantScale.xyz + dequantOffset.xyz;
+#else
+    vec3 position = inPosition;
+#endif
+
+    vec4 viewPos = view * model * vec4(position, 1.0);
     gl_Position = proj * viewPos;
-    
+
+#ifdef NODE_STATE_UNIFORMS
+    vec4 nodeColor = nodeStateColor;
+    vec4 nodeFlags = nodeStateFlags;
+#else
+    float texel = nodeIndex * 2.0;
+    vec2 coords = vec2(mod(texel, nodeStatesSize.x), floor(texel / nodeStatesSize.x));
+    coords = (coords + vec2(0.5, 0.5)) / nodeStatesSize;
+    vec4 nodeColor = texture2DLod(nodeStates, coords, 0.0);
+    vec4 nodeFlags = texture2DLod(nodeStates, coords + vec2(1.0 / nodeStatesSize.x, 0.0), 0.0);
+#endif
+
+    // Flags are either "0.0" or "1.0", which picks one color or the other.
+    vertColor = mix(inColor, nodeColor, nodeFlags.x);
+
+#ifdef LIT
     // Compute parameters for fragment shader
     vertPosition = vec3(viewPos) / viewPos.w;
+    vertShaded = nodeFlags.z;
 
-    vertColor = inColor;
-    if (controlParams[1] > 0.5)
-        vertColor = colorOverride;
+#ifdef QUANTIZED
+    vec3 normal = decodeOctahedral(inNormal.xy);
+#else
+    vec3 normal = inNormal;
+#endif
 
-    vertNormal = vec3(normalMatrix * vec4(inNormal, 0.0));
+    vertNormal = vec3(normalMatrix * vec4(normal, 0.0));
+#endif
 }
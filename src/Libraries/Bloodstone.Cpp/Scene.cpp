@@ -3,44 +3,403 @@
 #include "Bloodstone.h"
 #include "Utilities.h"
 #include "NodeSceneData.h"
+#include "SceneCommandQueue.h"
+#include "MeshProcessing.h"
+#include "Picking.h"
+#include "RenderQueue.h"
+#include "ShaderVariants.h"
 #include "BillboardText.h"
 #include "Resources\resource.h"
 
-#include <msclr/marshal_cppstd.h>
+#include <vcclr.h>
+#include <msclr/lock.h>
+#include <algorithm>
+#include <cfloat>
 
 using namespace System;
 using namespace System::Collections::Generic;
 using namespace Dynamo::Bloodstone;
 using namespace Autodesk::DesignScript::Interfaces;
 
+// Triangle meshes with at least this many vertices are uploaded with
+// quantized attributes, see "IVertexBuffer::AttributeEncoding".
+#define QUANTIZED_MESH_VERTEX_COUNT 30000
+
+// Vertices of a triangle mesh this close to one another (in position and
+// normal, with identical colors) are welded into a single indexed vertex.
+// Normals are of unit length wherever the vertex is, their tolerance is
+// independent of the extent of the scene.
+#define WELD_VERTEX_EPSILON 1.0e-5f
+#define WELD_NORMAL_EPSILON 1.0e-3f
+
+// Triangle meshes with at least this many triangles get simplified levels
+// built in the background. The full mesh is drawn while the projected size
+// of the node is at least "FULL_DETAIL_SCREEN_SIZE" pixels, every halving
+// of that size then moves one level down (to a quarter of the triangles).
+#define SIMPLIFIED_MESH_TRIANGLE_COUNT  20000
+#define FULL_DETAIL_SCREEN_SIZE         512.0f
+
+// Triangle meshes with at least this many triangles are split into
+// clusters of (at most) "MESH_CLUSTER_SIZE" triangles, those out of view
+// (or facing away from the camera) are then skipped when drawing.
+#define CLUSTERED_MESH_TRIANGLE_COUNT   16384
+#define MESH_CLUSTER_SIZE               128
+
+// Nodes whose geometries change again within this many milliseconds (say,
+// while a slider is being dragged) are considered dynamic. Their vertex
+// buffers are streamed every frame instead of living in vertex arenas,
+// until they have gone this long without a change.
+#define DYNAMIC_NODE_UPDATE_INTERVAL    1000
+
+// Points and lines this many pixels away from the point picked are still
+// hit (triangles only ever are when they are right under it).
+#define PICK_TOLERANCE_PIXELS           3.0f
+
 extern bool GetPointGeometries(IRenderPackage^ rp, PointGeometryData& data);
 extern bool GetLineStripGeometries(IRenderPackage^ rp, LineStripGeometryData& data);
 extern bool GetTriangleGeometries(IRenderPackage^ rp, TriangleGeometryData& data);
 
+extern const NativeRenderPackageData* GetNativeRenderPackage(IRenderPackage^ rp);
+extern bool GetPointGeometries(const NativeRenderPackageData* pPackage, PointGeometryData& data);
+extern bool GetLineStripGeometries(const NativeRenderPackageData* pPackage, LineStripGeometryData& data);
+extern bool GetTriangleGeometries(const NativeRenderPackageData* pPackage, TriangleGeometryData& data);
+
+// ================================================================================
+// Node keys
+// ================================================================================
+
+static int GetHexDigit(wchar_t character)
+{
+    if (character >= L'0' && character <= L'9')
+        return character - L'0';
+    if (character >= L'a' && character <= L'f')
+        return character - L'a' + 10;
+    if (character >= L'A' && character <= L'F')
+        return character - L'A' + 10;
+
+    return -1;
+}
+
+// Node identifiers are GUIDs in any of the usual formats, which are parsed
+// straight out of the managed string (case does not matter). Identifiers
+// that turn out not to be GUIDs get hashed into a key instead.
+// 
+static NodeKey GetNodeKey(System::String^ identifier)
+{
+    pin_ptr<const wchar_t> pCharacters = PtrToStringChars(identifier);
+    const int length = identifier->Length;
+
+    NodeKey key = { 0, 0 };
+    int digits = 0;
+
+    for (int index = 0; index < length; ++index)
+    {
+        const wchar_t character = pCharacters[index];
+        const int digit = GetHexDigit(character);
+        if (digit < 0)
+        {
+            if (character == L'-' || character == L'{' || character == L'}')
+                continue;
+
+            digits = -1; // Not a GUID.
+            break;
+        }
+
+        if (digits >= 32) {
+            digits = -1;
+            break;
+        }
+
+        auto& half = ((digits < 16) ? key.high : key.low);
+        half = (half << 4) | ((unsigned long long) digit);
+        digits++;
+    }
+
+    if (digits == 32)
+        return key;
+
+    ContentHasher highHasher(0), lowHasher(~0ULL);
+    for (int index = 0; index < length; ++index) {
+        const wchar_t character = ((wchar_t) towlower(pCharacters[index]));
+        highHasher.Update(&character, sizeof(character));
+        lowHasher.Update(&character, sizeof(character));
+    }
+
+    key.high = highHasher.Finalize();
+    key.low = lowHasher.Finalize();
+    return key;
+}
+
+// ================================================================================
+// Render package hashing
+// ================================================================================
+
+// Element count goes in ahead of the content, so that adjacent streams
+// cannot shift into one another. Missing streams hash as empty ones.
+// 
+template<typename T>
+static void HashStream(ContentHasher& hasher, const T* pValues, int count)
+{
+    count = ((pValues != nullptr && count > 0) ? count : 0);
+    hasher.Update(&count, sizeof(count));
+    if (count > 0)
+        hasher.Update(pValues, count * sizeof(T));
+}
+
+template<typename T>
+static void HashStream(ContentHasher& hasher, List<T>^ values)
+{
+    auto elements = ((values != nullptr) ? values->ToArray() : nullptr);
+    if (elements == nullptr || elements->Length <= 0) {
+        HashStream<T>(hasher, nullptr, 0);
+        return;
+    }
+
+    pin_ptr<T> pElements = &elements[0];
+    HashStream(hasher, ((const T *) pElements), elements->Length);
+}
+
+// Fingerprint of every stream that ends up in vertex buffers of the node,
+// "pBytes" receives the size of the content that went into the hash.
+// 
+static unsigned long long HashRenderPackage(IRenderPackage^ renderPackage,
+    const NativeRenderPackageData* pNativePackage, unsigned long long* pBytes)
+{
+    ContentHasher hasher;
+
+    if (pNativePackage != nullptr)
+    {
+        const auto& package = *pNativePackage;
+        HashStream(hasher, package.pPointVertices, package.pointVertexCount * 3);
+        HashStream(hasher, package.pPointColors, package.pointVertexCount * 4);
+        HashStream(hasher, package.pLineStripVertices, package.lineStripVertexCount * 3);
+        HashStream(hasher, package.pLineStripColors, package.lineStripVertexCount * 4);
+        HashStream(hasher, package.pLineStripVertexCounts, package.lineStripCount);
+        HashStream(hasher, package.pTriangleVertices, package.triangleVertexCount * 3);
+        HashStream(hasher, package.pTriangleNormals, package.triangleVertexCount * 3);
+        HashStream(hasher, package.pTriangleColors, package.triangleVertexCount * 4);
+    }
+    else
+    {
+        HashStream(hasher, renderPackage->PointVertices);
+        HashStream(hasher, renderPackage->PointVertexColors);
+        HashStream(hasher, renderPackage->LineStripVertices);
+        HashStream(hasher, renderPackage->LineStripVertexColors);
+        HashStream(hasher, renderPackage->LineStripVertexCounts);
+        HashStream(hasher, renderPackage->TriangleVertices);
+        HashStream(hasher, renderPackage->TriangleNormals);
+        HashStream(hasher, renderPackage->TriangleVertexColors);
+    }
+
+    // Zero is what nodes without any package loaded have.
+    const auto hash = hasher.Finalize();
+    *pBytes = hasher.GetByteCount();
+    return ((hash != 0) ? hash : 1);
+}
+
+// ================================================================================
+// NodeGeometries
+// ================================================================================
+
+// Geometries of a single node, converted from its render package ahead of
+// (and independently from) any vertex buffer creation. Each member is left
+// as nullptr if the package does not have that kind of geometry, or if the
+// content of the package is the same as what the node already has.
+// 
+class NodeGeometries
+{
+public:
+    NodeGeometries(void) : 
+        pPoints(nullptr),
+        pLineStrips(nullptr),
+        pTriangles(nullptr),
+        pPickGeometry(nullptr),
+        unchanged(false),
+        previousHash(0),
+        contentHash(0),
+        contentBytes(0)
+    {
+    }
+
+    ~NodeGeometries(void)
+    {
+        delete pPoints;
+        delete pLineStrips;
+        delete pTriangles;
+        if (pPickGeometry != nullptr)
+            pPickGeometry->Release();
+    }
+
+    void Convert(IRenderPackage^ renderPackage);
+
+    PointGeometryData* pPoints;
+    LineStripGeometryData* pLineStrips;
+    TriangleGeometryData* pTriangles;
+    PickGeometry* pPickGeometry; // Positions of all of the above, once uploaded.
+
+    bool unchanged;
+    unsigned long long previousHash;
+    unsigned long long contentHash;
+    unsigned long long contentBytes;
+
+private:
+    NodeGeometries(const NodeGeometries& other);
+    NodeGeometries& operator=(const NodeGeometries& other);
+};
+
+void NodeGeometries::Convert(IRenderPackage^ renderPackage)
+{
+    // Packages backed by native memory are read directly (their arrays
+    // are copied over in bulk), others fall back to the (much slower)
+    // managed accessors. The package stays locked until its native arrays
+    // are all copied, so they are not rebuilt or released meanwhile (see
+    // "RenderPackage"); nothing converted refers to them afterwards.
+    Object^ syncRoot = renderPackage;
+    auto memoryOwner = dynamic_cast<DynamoUtilities::INativeMemoryOwner^>(renderPackage);
+    if (memoryOwner != nullptr)
+        syncRoot = memoryOwner->SyncRoot;
+
+    msclr::lock packageLock(syncRoot);
+    auto pNativePackage = GetNativeRenderPackage(renderPackage);
+
+    // Identical packages are sent over and over again (e.g. upstream nodes
+    // executed with unchanged outputs), those are not converted at all.
+    contentHash = HashRenderPackage(renderPackage, pNativePackage, &contentBytes);
+    unchanged = (contentHash == previousHash);
+    if (unchanged)
+        return;
+
+    bool converted = false;
+    if (pNativePackage != nullptr) {
+        pPoints = new PointGeometryData(0);
+        converted = GetPointGeometries(pNativePackage, *pPoints);
+    } else {
+        pPoints = new PointGeometryData(renderPackage->PointVertices->Count / 3);
+        converted = GetPointGeometries(renderPackage, *pPoints);
+    }
+
+    if (converted == false) {
+        delete pPoints;
+        pPoints = nullptr;
+    }
+
+    pLineStrips = new LineStripGeometryData(0);
+    if (pNativePackage != nullptr)
+        converted = GetLineStripGeometries(pNativePackage, *pLineStrips);
+    else
+        converted = GetLineStripGeometries(renderPackage, *pLineStrips);
+
+    if (converted == false) {
+        delete pLineStrips;
+        pLineStrips = nullptr;
+    }
+
+    TriangleGeometryData* pSource = nullptr;
+    if (pNativePackage != nullptr) {
+        pSource = new TriangleGeometryData(0);
+        converted = GetTriangleGeometries(pNativePackage, *pSource);
+    } else {
+        pSource = new TriangleGeometryData(renderPackage->TriangleVertices->Count / 3);
+        converted = GetTriangleGeometries(renderPackage, *pSource);
+    }
+
+    packageLock.release(); // Streams are all copied into owned storage.
+
+    if (converted != false)
+    {
+        // Tessellated surfaces share most of their vertices between adjacent
+        // triangles, welding them has each vertex uploaded and shaded once.
+        TriangleGeometryData welded(0);
+        MeshProcessor::Weld(*pSource, WELD_VERTEX_EPSILON, WELD_NORMAL_EPSILON, welded);
+
+        // Tessellation output comes in whatever order the surface evaluator
+        // produced it, reorder it for the post-transform vertex cache.
+        pTriangles = new TriangleGeometryData(0);
+        MeshProcessor::OptimizeVertexCache(welded, *pTriangles);
+
+        if (pTriangles->IndexCount() / 3 >= CLUSTERED_MESH_TRIANGLE_COUNT)
+        {
+            auto pClustered = new TriangleGeometryData(0);
+            MeshProcessor::BuildClusters(*pTriangles, MESH_CLUSTER_SIZE, *pClustered);
+            delete pTriangles;
+            pTriangles = pClustered;
+        }
+    }
+
+    delete pSource;
+}
+
+ref class GeometryConverter
+{
+public:
+    GeometryConverter(List<IRenderPackage^>^ renderPackages, NodeGeometries* pNodeGeometries) : 
+        mRenderPackages(renderPackages),
+        mpNodeGeometries(pNodeGeometries)
+    {
+    }
+
+    // Called concurrently, each index is converted by one thread only.
+    void Convert(int index)
+    {
+        mpNodeGeometries[index].Convert(mRenderPackages[index]);
+    }
+
+private:
+    List<IRenderPackage^>^ mRenderPackages;
+    NodeGeometries* mpNodeGeometries;
+};
+
+// ================================================================================
+// Scene
+// ================================================================================
+
 Scene::Scene(VisualizerWnd^ visualizer) : 
-    mAlphaParamIndex(-1),
-    mColorParamIndex(-1),
-    mControlParamsIndex(-1),
-    mpPhongShader(nullptr),
+    mpPhongShaders(nullptr),
+    mpNodeStates(nullptr),
+    mpRenderQueue(nullptr),
     mpBillboardTextGroup(nullptr),
-    mpNodeSceneData(nullptr),
+    mpNodeTable(nullptr),
+    mFrameUpdateRequested(false),
+    mpCommandQueue(nullptr),
+    mRenderListValid(true),
+    mSceneBoundsValid(true),
+    mpSceneBounds(nullptr),
+    mpRenderList(nullptr),
+    mpRenderListIndices(nullptr),
+    mHierarchyValid(true),
+    mpHierarchy(nullptr),
+    mpVisibleSlots(nullptr),
+    mpVisibleNodes(nullptr),
+    mpPendingDetailNodes(nullptr),
+    mpDynamicNodes(nullptr),
+    mReceivedPackageBytes(0),
+    mSkippedPackageBytes(0),
     mVisualizer(visualizer)
 {
     // Create storage for storing nodes and their geometries.
-    mpNodeSceneData = new std::map<std::wstring, NodeSceneData*>();
+    mpNodeTable = new NodeTable<NodeSceneData>();
+    mpCommandQueue = new SceneCommandQueue();
+    mPendingPackages = gcnew List<IRenderPackage^>();
+    mPendingIdentifiers = gcnew List<String^>();
+    mNodeIdentifiers = gcnew List<String^>();
+
+    mpSceneBounds = new BoundingBox();
+    mpRenderList = new std::vector<NodeSceneData *>();
+    mpRenderListIndices = new std::vector<int>();
+    mpPendingDetailNodes = new std::vector<NodeHandle>();
+    mpDynamicNodes = new std::vector<NodeHandle>();
+
+    mpHierarchy = new NodeHierarchy();
+    mpVisibleSlots = new std::vector<int>();
+    mpVisibleNodes = new std::vector<NodeSceneData *>();
+    mpRenderQueue = new RenderQueue();
 }
 
 void Scene::Initialize(int width, int height)
 {
     auto pGraphicsContext = mVisualizer->GetGraphicsContext();
-    mpPhongShader = pGraphicsContext->CreateShaderProgram(ShaderName::Phong);
-    mpPhongShader->BindTransformMatrix(TransMatrix::Model, "model");
-    mpPhongShader->BindTransformMatrix(TransMatrix::View, "view");
-    mpPhongShader->BindTransformMatrix(TransMatrix::Projection, "proj");
-    mpPhongShader->BindTransformMatrix(TransMatrix::Normal, "normalMatrix");
-    mAlphaParamIndex = mpPhongShader->GetShaderParameterIndex("alpha");
-    mColorParamIndex = mpPhongShader->GetShaderParameterIndex("colorOverride");
-    mControlParamsIndex = mpPhongShader->GetShaderParameterIndex("controlParams");
+    mpPhongShaders = new ShaderVariants(pGraphicsContext, ShaderName::Phong);
+    mpNodeStates = pGraphicsContext->CreateNodeStateTable();
 
     auto pCamera = pGraphicsContext->GetDefaultCamera();
     {
@@ -75,43 +434,81 @@ void Scene::Destroy(void)
         this->mpBillboardTextGroup = nullptr;
     }
 
-    if (this->mpNodeSceneData != nullptr)
+    if (this->mpCommandQueue != nullptr)
+    {
+        delete this->mpCommandQueue;
+        this->mpCommandQueue = nullptr;
+        mPendingPackages->Clear();
+        mPendingIdentifiers->Clear();
+    }
+
+    if (this->mpNodeTable != nullptr)
+    {
+        delete this->mpNodeTable;
+        this->mpNodeTable = nullptr;
+        mNodeIdentifiers->Clear();
+    }
+
+    if (this->mpRenderList != nullptr)
     {
-        ClearAllGeometries();
-        delete this->mpNodeSceneData;
-        this->mpNodeSceneData = nullptr;
+        delete this->mpSceneBounds;
+        delete this->mpRenderList;
+        delete this->mpRenderListIndices;
+        delete this->mpPendingDetailNodes;
+        delete this->mpDynamicNodes;
+        this->mpSceneBounds = nullptr;
+        this->mpRenderList = nullptr;
+        this->mpRenderListIndices = nullptr;
+        this->mpPendingDetailNodes = nullptr;
+        this->mpDynamicNodes = nullptr;
+    }
+
+    if (this->mpHierarchy != nullptr)
+    {
+        delete this->mpHierarchy;
+        delete this->mpVisibleSlots;
+        delete this->mpVisibleNodes;
+        this->mpHierarchy = nullptr;
+        this->mpVisibleSlots = nullptr;
+        this->mpVisibleNodes = nullptr;
+    }
+
+    if (this->mpRenderQueue != nullptr) {
+        delete this->mpRenderQueue;
+        this->mpRenderQueue = nullptr;
+    }
+
+    if (this->mpNodeStates != nullptr) {
+        delete this->mpNodeStates;
+        this->mpNodeStates = nullptr;
     }
 
-    if (this->mpPhongShader != nullptr) {
-        delete this->mpPhongShader;
-        this->mpPhongShader = nullptr;
+    if (this->mpPhongShaders != nullptr) {
+        delete this->mpPhongShaders;
+        this->mpPhongShaders = nullptr;
     }
 }
 
 void Scene::RenderScene(void)
 {
-    std::vector<NodeSceneData *> geometries;
+    // Changes since the last frame are applied here, unless the caller is
+    // in the middle of making them (its "EndUpdate" requests another frame).
+    mFrameUpdateRequested = false;
+    if (mpCommandQueue->IsUpdating() == false)
+        ApplyCommands();
 
-    BoundingBox boundingBox;
-    auto iterator = mpNodeSceneData->begin();
-    for (; iterator != mpNodeSceneData->end(); ++iterator) {
-        BoundingBox innerBox;
-        iterator->second->GetBoundingBox(&innerBox);
-        boundingBox.EvaluateBox(innerBox);
-        geometries.push_back(iterator->second);
-    }
+    UpdateLevelsOfDetail();
+    UpdateDynamicNodes();
+    UpdateRenderList();
+
+    auto pGraphicsContext = mVisualizer->GetGraphicsContext();
+    auto pCamera = pGraphicsContext->GetDefaultCamera();
+    CullRenderList(pCamera);
 
-    if (geometries.size() > 0)
+    if (mpVisibleNodes->size() > 0)
     {
-        auto pGraphicsContext = mVisualizer->GetGraphicsContext();
         pGraphicsContext->EnableAlphaBlend();
-        pGraphicsContext->ActivateShaderProgram(mpPhongShader);
-
-        // Fit the camera to the bounding box, and apply transformation.
-        auto pCamera = pGraphicsContext->GetDefaultCamera();
-        mpPhongShader->ApplyTransformation(pCamera);
-
-        RenderGeometries(geometries);
+        RenderGeometries(*mpVisibleNodes);
     }
 
     mpBillboardTextGroup->Render(); // Render billboard text.
@@ -119,227 +516,725 @@ void Scene::RenderScene(void)
 
 void Scene::ClearAllGeometries(void)
 {
-    auto iterator = mpNodeSceneData->begin();
-    for (; iterator != mpNodeSceneData->end(); ++iterator) {
-        auto pNodeSceneData = iterator->second;
-        delete pNodeSceneData;
-    }
-
-    mpNodeSceneData->clear();
-    mVisualizer->RequestFrameUpdate(); // Update window.
+    mpCommandQueue->ClearGeometries();
+    mPendingPackages->Clear();
+    mPendingIdentifiers->Clear();
+    RequestFrameUpdate();
 }
 
 void Scene::GetBoundingBox(BoundingBox& boundingBox)
 {
-    if (mpNodeSceneData == nullptr) {
+    if (mpNodeTable == nullptr) {
         boundingBox.Reset(0.0f, 0.0f, 0.0f);
         return;
     }
 
-    auto iterator = mpNodeSceneData->begin();
-    for (; iterator != mpNodeSceneData->end(); ++iterator) {
-        BoundingBox innerBox;
-        iterator->second->GetBoundingBox(&innerBox);
-        boundingBox.EvaluateBox(innerBox);
+    if (mSceneBoundsValid == false)
+    {
+        mpSceneBounds->Invalidate();
+        const int slotCount = mpNodeTable->GetSlotCount();
+        for (int slot = 0; slot < slotCount; ++slot)
+        {
+            auto pNodeSceneData = mpNodeTable->GetNode(slot);
+            if (pNodeSceneData != nullptr) {
+                BoundingBox innerBox;
+                pNodeSceneData->GetBoundingBox(&innerBox);
+                mpSceneBounds->EvaluateBox(innerBox);
+            }
+        }
+
+        mSceneBoundsValid = true;
     }
+
+    if (mpSceneBounds->IsInitialized())
+        boundingBox.EvaluateBox(*mpSceneBounds);
 }
 
 void Scene::UpdateNodeGeometries(RenderPackages^ geometries)
 {
-    BoundingBox outerBoundingBox;
-    auto pGraphicsContext = mVisualizer->GetGraphicsContext();
-
     for each (KeyValuePair<System::String^, Ds::IRenderPackage^>^ geometry in geometries)
     {
-        auto pRenderPackage = geometry->Value;
-        if (pRenderPackage == nullptr)
+        if (geometry->Value == nullptr)
             continue;
 
-        System::String^ nodeId = geometry->Key->ToLower();
-        std::wstring identifier = msclr::interop::marshal_as<std::wstring>(nodeId);
+        // Only the last package of a node gets converted and uploaded.
+        const int packageIndex = mpCommandQueue->SetPackage(GetNodeKey(geometry->Key));
+        if (packageIndex < mPendingPackages->Count)
+            mPendingPackages[packageIndex] = geometry->Value;
+        else {
+            mPendingPackages->Add(geometry->Value);
+            mPendingIdentifiers->Add(geometry->Key);
+        }
+    }
 
-        NodeSceneData* pNodeSceneData = nullptr;
-        auto found = mpNodeSceneData->find(identifier);
-        if (found != mpNodeSceneData->end())
-        {
-            pNodeSceneData = found->second;
-            pNodeSceneData->ClearVertexBuffers();
+    RequestFrameUpdate();
+}
+
+void Scene::RemoveNodeGeometries(Strings^ identifiers)
+{
+    for each (System::String^ identifier in identifiers)
+    {
+        // The package dropped along with the node is not loaded anymore.
+        const int packageIndex = mpCommandQueue->RemoveGeometries(GetNodeKey(identifier));
+        if (packageIndex >= 0)
+            mPendingPackages[packageIndex] = nullptr;
+    }
+
+    RequestFrameUpdate();
+}
+
+void Scene::SelectNodes(Strings^ identifiers, SelectMode selectMode)
+{
+    if (selectMode == SelectMode::ClearExisting)
+        mpCommandQueue->ClearSelection();
+
+    const bool selected = (selectMode != SelectMode::RemoveFromExisting);
+    for each (System::String^ identifier in identifiers)
+        mpCommandQueue->SetSelection(GetNodeKey(identifier), selected);
+
+    RequestFrameUpdate();
+}
+
+void Scene::SetNodeColor(NodeColors^ nodeColors)
+{
+    for each (KeyValuePair<System::String^, NodeColor^>^ nodeColor in nodeColors)
+    {
+        float color[4] = { 0 };
+        nodeColor->Value->Get(color);
+
+        mpCommandQueue->SetColor(GetNodeKey(nodeColor->Key), color);
+    }
+
+    RequestFrameUpdate();
+}
+
+void Scene::SetNodeRenderMode(RenderModes^ renderModes)
+{
+    for each (KeyValuePair<System::String^, RenderMode>^ renderMode in renderModes)
+    {
+        const auto key = GetNodeKey(renderMode->Key);
+        mpCommandQueue->SetRenderMode(key, ((int) renderMode->Value));
+    }
+
+    RequestFrameUpdate();
+}
+
+void Scene::GetCullingStatistics(CullingStatistics* pStatistics)
+{
+    mpHierarchy->GetCullingStatistics(pStatistics);
+}
+
+void Scene::GetRenderStatistics(RenderStatistics* pStatistics)
+{
+    mVisualizer->GetGraphicsContext()->GetRenderStatistics(pStatistics);
+    pStatistics->receivedPackageBytes = mReceivedPackageBytes;
+    pStatistics->skippedPackageBytes = mSkippedPackageBytes;
+}
+
+System::String^ Scene::PickNode(int x, int y)
+{
+    if (mpNodeTable == nullptr)
+        return nullptr;
+
+    UpdateHierarchy();
+    auto pCamera = mVisualizer->GetGraphicsContext()->GetDefaultCamera();
+
+    // Only nodes within the tolerance of the point can be hit at all, the
+    // hierarchy narrows the scene down to those in a frustum around it.
+    const float px = ((float) x) + 0.5f, py = ((float) y) + 0.5f;
+    Frustum frustum;
+    pCamera->GetPickingFrustum(px - PICK_TOLERANCE_PIXELS, py - PICK_TOLERANCE_PIXELS,
+        px + PICK_TOLERANCE_PIXELS, py + PICK_TOLERANCE_PIXELS, &frustum);
+
+    std::vector<int> slots;
+    mpHierarchy->Query(frustum, false, slots);
+    if (slots.empty())
+        return nullptr;
+
+    CameraConfiguration camera;
+    pCamera->GetConfiguration(&camera);
+    const float halfFovRadian = camera.fieldOfView * 0.5f * (3.14159265f / 180.0f);
+
+    PickRay ray;
+    pCamera->GetPickingRay(px, py, &ray.origin[0], &ray.direction[0]);
+    ray.spread = (PICK_TOLERANCE_PIXELS * 2.0f * std::tanf(halfFovRadian)) /
+        ((float) camera.viewportHeight);
+
+    // Candidates go by the nearest any part of their bounds can be along
+    // the ray, so the search ends at the first one that is beyond the hit
+    // found so far (nothing in it can then be any nearer).
+    std::vector<std::pair<float, int>> candidates;
+    candidates.reserve(slots.size());
+    for (std::size_t index = 0; index < slots.size(); ++index)
+    {
+        BoundingBox boundingBox;
+        mpNodeTable->GetNode(slots[index])->GetBoundingBox(&boundingBox);
+
+        float min[3], max[3];
+        boundingBox.Get(&min[0], &max[0]);
+
+        float nearest = 0.0f;
+        for (int axis = 0; axis < 3; ++axis) {
+            const float corner = ((ray.direction[axis] < 0.0f) ? max[axis] : min[axis]);
+            nearest += (corner - ray.origin[axis]) * ray.direction[axis];
         }
-        else
+
+        candidates.push_back(std::make_pair(nearest, slots[index]));
+    }
+
+    std::sort(candidates.begin(), candidates.end());
+
+    int picked = -1;
+    float distance = FLT_MAX;
+    for (std::size_t index = 0; index < candidates.size(); ++index)
+    {
+        if (candidates[index].first >= distance)
+            break;
+
+        const int slot = candidates[index].second;
+        if (mpNodeTable->GetNode(slot)->Pick(ray, &distance))
+            picked = slot;
+    }
+
+    return ((picked >= 0) ? mNodeIdentifiers[picked] : nullptr);
+}
+
+Strings^ Scene::PickNodes(int left, int top, int right, int bottom)
+{
+    auto identifiers = gcnew List<String^>();
+    if (mpNodeTable == nullptr)
+        return identifiers;
+
+    if (left > right)
+        std::swap(left, right);
+    if (top > bottom)
+        std::swap(top, bottom);
+
+    // Corners are both inclusive, the rectangle covers at least one pixel.
+    UpdateHierarchy();
+    Frustum frustum;
+    auto pCamera = mVisualizer->GetGraphicsContext()->GetDefaultCamera();
+    pCamera->GetPickingFrustum(((float) left), ((float) top),
+        ((float) (right + 1)), ((float) (bottom + 1)), &frustum);
+
+    std::vector<int> slots;
+    mpHierarchy->Query(frustum, true, slots);
+    std::sort(slots.begin(), slots.end());
+
+    for (std::size_t index = 0; index < slots.size(); ++index)
+        identifiers->Add(mNodeIdentifiers[slots[index]]);
+
+    return identifiers;
+}
+
+void Scene::BeginUpdate(void)
+{
+    mpCommandQueue->BeginUpdate();
+}
+
+void Scene::EndUpdate(void)
+{
+    if (mpCommandQueue->EndUpdate() == false) {
+        auto message = L"'EndUpdate' called without a matching 'BeginUpdate'";
+        throw gcnew System::InvalidOperationException(gcnew String(message));
+    }
+
+    if (!mpCommandQueue->IsUpdating() && !mpCommandQueue->IsEmpty())
+        RequestFrameUpdate();
+}
+
+void Scene::RequestFrameUpdate(void)
+{
+    // A frame that is already on its way picks up every further change.
+    if (mpCommandQueue->IsUpdating() || mFrameUpdateRequested)
+        return;
+
+    mFrameUpdateRequested = true;
+    mVisualizer->RequestFrameUpdate(); // Update window.
+}
+
+void Scene::ApplyCommands(void)
+{
+    if (mpCommandQueue->IsEmpty())
+        return;
+
+    // Geometries are removed before any gets loaded, so that a node that
+    // was removed and then updated again starts afresh.
+    if (mpCommandQueue->GetClearGeometries())
+    {
+        mpNodeTable->Clear();
+        mNodeIdentifiers->Clear();
+        mpSceneBounds->Invalidate();
+        mSceneBoundsValid = true; // Empty is as small as it gets.
+        mRenderListValid = false;
+        mHierarchyValid = false;
+    }
+
+    std::vector<NodeKey> nodeKeys;
+    auto identifiers = gcnew List<String^>();
+    auto renderPackages = gcnew List<IRenderPackage^>();
+
+    const int commandCount = mpCommandQueue->GetCommandCount();
+    for (int index = 0; index < commandCount; ++index)
+    {
+        const NodeCommand& command = mpCommandQueue->GetCommand(index);
+        if (command.removeGeometries)
         {
-            pNodeSceneData = new NodeSceneData(identifier);
-            mpNodeSceneData->insert(std::pair<std::wstring, NodeSceneData*>
-                (identifier, pNodeSceneData));
+            auto handle = mpNodeTable->Find(command.key);
+            if (mpNodeTable->IsValid(handle)) {
+                mpNodeTable->Remove(handle);
+                mSceneBoundsValid = false;
+                mRenderListValid = false;
+                mHierarchyValid = false;
+            }
         }
 
-        PointGeometryData pointData(pRenderPackage->PointVertices->Count / 3);
-        if (GetPointGeometries(pRenderPackage, pointData))
-        {
-            auto pVertexBuffer = pGraphicsContext->CreateVertexBuffer();
-            pVertexBuffer->LoadData(pointData);
-            pVertexBuffer->BindToShaderProgram(mpPhongShader);
-            pNodeSceneData->AppendVertexBuffer(pVertexBuffer);
+        if (command.packageIndex >= 0) {
+            nodeKeys.push_back(command.key);
+            identifiers->Add(mPendingIdentifiers[command.packageIndex]);
+            renderPackages->Add(mPendingPackages[command.packageIndex]);
         }
+    }
 
-        LineStripGeometryData lineData(0);
-        if (GetLineStripGeometries(pRenderPackage, lineData))
-        {
-            auto pVertexBuffer = pGraphicsContext->CreateVertexBuffer();
-            pVertexBuffer->LoadData(lineData);
-            pVertexBuffer->BindToShaderProgram(mpPhongShader);
-            pNodeSceneData->AppendVertexBuffer(pVertexBuffer);
+    if (renderPackages->Count > 0)
+    {
+        BoundingBox outerBoundingBox;
+        LoadNodeGeometries(nodeKeys, identifiers, renderPackages, outerBoundingBox);
+
+        // Camera is fitted once for everything loaded in this batch.
+        CameraConfiguration configuration;
+        auto pCamera = mVisualizer->GetGraphicsContext()->GetDefaultCamera();
+        pCamera->GetConfiguration(&configuration);
+        configuration.FitToBoundingBox(outerBoundingBox);
+        pCamera->BeginConfigure(&configuration);
+    }
+
+    if (mpCommandQueue->GetClearSelection())
+    {
+        const int slotCount = mpNodeTable->GetSlotCount();
+        for (int slot = 0; slot < slotCount; ++slot) {
+            auto pNodeSceneData = mpNodeTable->GetNode(slot);
+            if (pNodeSceneData != nullptr && pNodeSceneData->GetSelected()) {
+                pNodeSceneData->SetSelected(false); // Clear selection.
+                WriteNodeState(pNodeSceneData);
+            }
         }
+    }
 
-        TriangleGeometryData triangleData(pRenderPackage->TriangleVertices->Count / 3);
-        if (GetTriangleGeometries(pRenderPackage, triangleData))
-        {
-            auto pVertexBuffer = pGraphicsContext->CreateVertexBuffer();
-            pVertexBuffer->LoadData(triangleData);
-            pVertexBuffer->BindToShaderProgram(mpPhongShader);
-            pNodeSceneData->AppendVertexBuffer(pVertexBuffer);
+    for (int index = 0; index < commandCount; ++index)
+    {
+        const NodeCommand& command = mpCommandQueue->GetCommand(index);
+        auto pNodeSceneData = mpNodeTable->GetNode(mpNodeTable->Find(command.key));
+        if (pNodeSceneData == nullptr)
+            continue; // The node does not have any associated geometries.
+
+        if (command.setColor) {
+            const bool translucent = pNodeSceneData->IsTranslucent();
+            const float* pColor = &command.rgbaColor[0];
+            pNodeSceneData->SetColor(pColor[0], pColor[1], pColor[2], pColor[3]);
+            if (pNodeSceneData->IsTranslucent() != translucent)
+                mRenderListValid = false;
         }
 
-        // Finally, determine the bounding box for these geometries.
-        BoundingBox boundingBox;
-        pNodeSceneData->GetBoundingBox(&boundingBox);
-        outerBoundingBox.EvaluateBox(boundingBox);
+        if (command.setRenderMode) {
+            const auto renderMode = ((RenderMode) command.renderMode);
+            if (pNodeSceneData->GetRenderMode() != renderMode)
+                mRenderListValid = false;
+            pNodeSceneData->SetRenderMode(renderMode);
+        }
+        if (command.selection >= 0)
+            pNodeSceneData->SetSelected(command.selection != 0);
+
+        if (command.setColor || command.setRenderMode || command.selection >= 0)
+            WriteNodeState(pNodeSceneData);
     }
 
-    CameraConfiguration configuration;
-    auto pCamera = pGraphicsContext->GetDefaultCamera();
-    pCamera->GetConfiguration(&configuration);
-    configuration.FitToBoundingBox(outerBoundingBox);
-    pCamera->BeginConfigure(&configuration);
+    mpCommandQueue->Clear();
+    mPendingPackages->Clear();
+    mPendingIdentifiers->Clear();
+}
 
-    mVisualizer->RequestFrameUpdate(); // Update window.
+void Scene::UpdateLevelsOfDetail(void)
+{
+    // Upload simplified levels that finished in the background. Only nodes
+    // still waiting on them are visited, not every node in the scene.
+    auto pGraphicsContext = mVisualizer->GetGraphicsContext();
+
+    std::size_t index = 0;
+    while (index < mpPendingDetailNodes->size())
+    {
+        auto pNodeSceneData = mpNodeTable->GetNode(mpPendingDetailNodes->at(index));
+        if (pNodeSceneData != nullptr) {
+            pNodeSceneData->UpdateLevelsOfDetail(pGraphicsContext, mpPhongShaders);
+            if (pNodeSceneData->HasPendingLevelsOfDetail()) {
+                index++;
+                continue;
+            }
+        }
+
+        // Either removed or done, the order of the rest does not matter.
+        mpPendingDetailNodes->at(index) = mpPendingDetailNodes->back();
+        mpPendingDetailNodes->pop_back();
+    }
 }
 
-void Scene::RemoveNodeGeometries(Strings^ identifiers)
+void Scene::UpdateDynamicNodes(void)
 {
-    for each (System::String^ identifier in identifiers)
+    // Nodes no longer changing have their streamed geometries moved into
+    // vertex arenas. Only nodes still dynamic are visited, as above.
+    const auto frameTime = ::GetTickCount64();
+
+    std::size_t index = 0;
+    while (index < mpDynamicNodes->size())
     {
-        System::String^ nodeId = identifier->ToLower();
-        std::wstring identifier = msclr::interop::marshal_as<std::wstring>(nodeId);
+        auto pNodeSceneData = mpNodeTable->GetNode(mpDynamicNodes->at(index));
+        if (pNodeSceneData != nullptr && pNodeSceneData->IsDynamic()) {
+            if (frameTime - pNodeSceneData->GetUpdateTime() < DYNAMIC_NODE_UPDATE_INTERVAL) {
+                index++;
+                continue;
+            }
 
-        auto found = mpNodeSceneData->find(identifier);
-        if (found == mpNodeSceneData->end())
-            continue; // The node does not have any associated geometries.
+            pNodeSceneData->SetDynamic(false);
+        }
 
-        // Release the node geometry ownership from map.
-        NodeSceneData* pNodeSceneData = found->second;
-        mpNodeSceneData->erase(found);
-        delete pNodeSceneData; // Release node geometries and its resources.
+        mpDynamicNodes->at(index) = mpDynamicNodes->back();
+        mpDynamicNodes->pop_back();
     }
-
-    mVisualizer->RequestFrameUpdate(); // Update window.
 }
 
-void Scene::SelectNodes(Strings^ identifiers, SelectMode selectMode)
+void Scene::UpdateRenderList(void)
 {
-    if (selectMode == SelectMode::ClearExisting) {
-        auto iterator = mpNodeSceneData->begin();
-        for (; iterator != mpNodeSceneData->end(); ++iterator) {
-            auto pNodeSceneData = iterator->second;
-            pNodeSceneData->SetSelected(false); // Clear selection.
+    if (mRenderListValid)
+        return;
+
+    // Opaque nodes are drawn ahead of translucent ones, so that whatever is
+    // behind the latter is there to blend with. Nodes of the same render
+    // mode are kept together, and otherwise remain in slot order.
+    // 
+    mpRenderList->clear();
+    const int slotCount = mpNodeTable->GetSlotCount();
+    mpRenderListIndices->assign(slotCount, -1);
+    for (int group = 0; group < 4; ++group)
+    {
+        const bool translucent = (group >= 2);
+        const auto renderMode = (((group & 1) != 0) ? RenderMode::Primitive : RenderMode::Shaded);
+        for (int slot = 0; slot < slotCount; ++slot)
+        {
+            auto pNodeSceneData = mpNodeTable->GetNode(slot);
+            if (pNodeSceneData == nullptr)
+                continue;
+
+            if (pNodeSceneData->IsTranslucent() == translucent &&
+                pNodeSceneData->GetRenderMode() == renderMode) {
+                mpRenderListIndices->at(slot) = ((int) mpRenderList->size());
+                mpRenderList->push_back(pNodeSceneData);
+            }
         }
     }
 
-    for each (System::String^ identifier in identifiers)
-    {
-        System::String^ nodeId = identifier->ToLower();
-        std::wstring identifier = msclr::interop::marshal_as<std::wstring>(nodeId);
+    mRenderListValid = true;
+}
 
-        auto found = mpNodeSceneData->find(identifier);
-        if (found == mpNodeSceneData->end())
-            continue; // The node does not have any associated geometries.
+void Scene::UpdateHierarchy(void)
+{
+    if (mHierarchyValid)
+        return;
+
+    const int slotCount = mpNodeTable->GetSlotCount();
+    std::vector<NodeBounds> nodes;
+    nodes.reserve(mpNodeTable->GetNodeCount());
+
+    for (int slot = 0; slot < slotCount; ++slot)
+    {
+        auto pNodeSceneData = mpNodeTable->GetNode(slot);
+        if (pNodeSceneData == nullptr)
+            continue;
 
-        NodeSceneData* pNodeSceneData = found->second;
-        if (selectMode == SelectMode::RemoveFromExisting)
-            pNodeSceneData->SetSelected(false);
-        else
-            pNodeSceneData->SetSelected(true);
+        NodeBounds bounds;
+        bounds.slot = slot;
+        BoundingBox boundingBox;
+        pNodeSceneData->GetBoundingBox(&boundingBox);
+        boundingBox.Get(&bounds.min[0], &bounds.max[0]);
+        nodes.push_back(bounds);
     }
 
-    mVisualizer->RequestFrameUpdate(); // Update window.
+    mpHierarchy->Build(nodes, slotCount);
+    mHierarchyValid = true;
 }
 
-void Scene::SetNodeColor(NodeColors^ nodeColors)
+void Scene::CullRenderList(const ICamera* pCamera)
 {
-    for each (KeyValuePair<System::String^, NodeColor^>^ nodeColor in nodeColors)
+    // Nodes in the render list and in the hierarchy are the same ones, the
+    // latter is never invalidated without the former being invalidated too
+    // (and both are brought up to date ahead of this).
+    UpdateHierarchy();
+
+    Frustum frustum;
+    pCamera->GetFrustum(&frustum);
+    mpHierarchy->Cull(frustum, *mpVisibleSlots);
+
+    // Visible nodes are drawn in the order they are in the render list.
+    auto& indices = *mpVisibleSlots;
+    for (std::size_t index = 0; index < indices.size(); ++index)
+        indices[index] = mpRenderListIndices->at(indices[index]);
+
+    std::sort(indices.begin(), indices.end());
+
+    mpVisibleNodes->clear();
+    for (std::size_t index = 0; index < indices.size(); ++index)
+        mpVisibleNodes->push_back(mpRenderList->at(indices[index]));
+}
+
+void Scene::LoadNodeGeometries(const std::vector<NodeKey>& nodeKeys,
+    List<String^>^ identifiers, List<IRenderPackage^>^ renderPackages, BoundingBox& outerBoundingBox)
+{
+    // Packages are converted in parallel, each into its own staging data.
+    // Vertex buffers are then created on this (the context) thread in the
+    // order nodes came in, so the result does not depend on scheduling.
+    const int nodeCount = renderPackages->Count;
+    auto pNodeGeometries = new NodeGeometries[nodeCount];
+    std::vector<NodeHandle> handles(nodeCount);
+
+    for (int node = 0; node < nodeCount; ++node)
     {
-        float color[4] = { 0 };
-        nodeColor->Value->Get(color);
+        handles[node] = mpNodeTable->Find(nodeKeys[node]);
+        auto pNodeSceneData = mpNodeTable->GetNode(handles[node]);
+        if (pNodeSceneData != nullptr)
+            pNodeGeometries[node].previousHash = pNodeSceneData->GetContentHash();
+    }
 
-        System::String^ nodeId = nodeColor->Key->ToLower();
-        std::wstring identifier = msclr::interop::marshal_as<std::wstring>(nodeId);
+    unsigned long long receivedBytes = 0, skippedBytes = 0;
 
-        auto found = mpNodeSceneData->find(identifier);
-        if (found == mpNodeSceneData->end())
-            continue; // The node does not have any associated geometries.
+    try
+    {
+        auto converter = gcnew GeometryConverter(renderPackages, pNodeGeometries);
+        System::Threading::Tasks::Parallel::For(0, nodeCount,
+            gcnew Action<int>(converter, &GeometryConverter::Convert));
+
+        for (int node = 0; node < nodeCount; ++node)
+        {
+            const NodeGeometries& converted = pNodeGeometries[node];
+            receivedBytes = receivedBytes + converted.contentBytes;
+
+            // Handles found earlier are still valid, nothing gets removed
+            // in between. "Insert" returns the node inserted for an earlier
+            // entry if the same node is listed more than once.
+            auto pNodeSceneData = mpNodeTable->GetNode(handles[node]);
+            if (pNodeSceneData == nullptr) {
+                handles[node] = mpNodeTable->Insert(nodeKeys[node]);
+                pNodeSceneData = mpNodeTable->GetNode(handles[node]);
+                mRenderListValid = false;
+                mHierarchyValid = false;
 
-        NodeSceneData* pNodeSceneData = found->second;
-        pNodeSceneData->SetColor(color[0], color[1], color[2], color[3]);
+                const int slot = handles[node].slot;
+                while (mNodeIdentifiers->Count <= slot)
+                    mNodeIdentifiers->Add(nullptr);
+                mNodeIdentifiers[slot] = identifiers[node];
+
+                pNodeSceneData->SetStateRow(slot);
+                WriteNodeState(pNodeSceneData);
+            }
+            else if (converted.unchanged == false)
+                mSceneBoundsValid = false; // New geometries may be smaller.
+
+            const bool simplifying = pNodeSceneData->HasPendingLevelsOfDetail();
+            if (converted.unchanged == false)
+                pNodeSceneData->ClearVertexBuffers();
+
+            if (converted.unchanged == false)
+            {
+                const auto updateTime = ::GetTickCount64();
+                const auto previousTime = pNodeSceneData->GetUpdateTime();
+                const bool wasDynamic = pNodeSceneData->IsDynamic();
+                pNodeSceneData->SetDynamic(previousTime != 0 &&
+                    updateTime - previousTime < DYNAMIC_NODE_UPDATE_INTERVAL);
+                pNodeSceneData->SetUpdateTime(updateTime);
+
+                if (!wasDynamic && pNodeSceneData->IsDynamic())
+                    mpDynamicNodes->push_back(handles[node]);
+
+                if (converted.pPoints != nullptr)
+                    AppendVertexBuffer(pNodeSceneData, *converted.pPoints);
+                if (converted.pLineStrips != nullptr)
+                    AppendVertexBuffer(pNodeSceneData, *converted.pLineStrips);
+                if (converted.pTriangles != nullptr)
+                    AppendVertexBuffer(pNodeSceneData, *converted.pTriangles);
+
+                // Positions are taken out of the geometries rather than
+                // copied, nothing else needs them once they are uploaded.
+                converted.pPickGeometry = new PickGeometry(converted.pPoints,
+                    converted.pLineStrips, converted.pTriangles);
+                pNodeSceneData->SetPickGeometry(converted.pPickGeometry);
+                pNodeSceneData->SetContentHash(converted.contentHash);
+            }
+            else
+                skippedBytes = skippedBytes + converted.contentBytes;
+
+            // Nodes already listed stay there until their jobs are done.
+            if (!simplifying && pNodeSceneData->HasPendingLevelsOfDetail())
+                mpPendingDetailNodes->push_back(handles[node]);
+
+            // Finally, determine the bounding box for these geometries.
+            BoundingBox boundingBox;
+            pNodeSceneData->GetBoundingBox(&boundingBox);
+            outerBoundingBox.EvaluateBox(boundingBox);
+            if (mSceneBoundsValid)
+                mpSceneBounds->EvaluateBox(boundingBox);
+            if (mHierarchyValid && converted.unchanged == false) {
+                float min[3], max[3];
+                boundingBox.Get(&min[0], &max[0]);
+                mpHierarchy->Refit(handles[node].slot, &min[0], &max[0]);
+            }
+        }
+    }
+    finally
+    {
+        delete [] pNodeGeometries;
     }
 
-    mVisualizer->RequestFrameUpdate(); // Update window.
+    mReceivedPackageBytes = mReceivedPackageBytes + receivedBytes;
+    mSkippedPackageBytes = mSkippedPackageBytes + skippedBytes;
 }
 
-void Scene::SetNodeRenderMode(RenderModes^ renderModes)
+void Scene::AppendVertexBuffer(NodeSceneData* pNodeSceneData, const PointGeometryData& data)
 {
-    for each (KeyValuePair<System::String^, RenderMode>^ renderMode in renderModes)
-    {
-        System::String^ nodeId = renderMode->Key->ToLower();
-        std::wstring identifier = msclr::interop::marshal_as<std::wstring>(nodeId);
+    auto pGraphicsContext = mVisualizer->GetGraphicsContext();
+    auto pVertexBuffer = pGraphicsContext->CreateVertexBuffer();
+    pVertexBuffer->SetDynamic(pNodeSceneData->IsDynamic());
+    pVertexBuffer->LoadData(data);
+    AppendVertexBuffer(pNodeSceneData, pVertexBuffer);
+}
 
-        auto found = mpNodeSceneData->find(identifier);
-        if (found == mpNodeSceneData->end())
-            continue; // The node does not have any associated geometries.
+void Scene::AppendVertexBuffer(NodeSceneData* pNodeSceneData, const LineStripGeometryData& data)
+{
+    auto pGraphicsContext = mVisualizer->GetGraphicsContext();
+    auto pVertexBuffer = pGraphicsContext->CreateVertexBuffer();
+    pVertexBuffer->SetDynamic(pNodeSceneData->IsDynamic());
+    pVertexBuffer->LoadData(data);
+    AppendVertexBuffer(pNodeSceneData, pVertexBuffer);
+}
+
+void Scene::AppendVertexBuffer(NodeSceneData* pNodeSceneData, const TriangleGeometryData& data)
+{
+    auto encoding = IVertexBuffer::AttributeEncoding::Full;
+    if (data.VertexCount() >= QUANTIZED_MESH_VERTEX_COUNT)
+        encoding = IVertexBuffer::AttributeEncoding::Quantized;
+
+    auto pGraphicsContext = mVisualizer->GetGraphicsContext();
+    auto pVertexBuffer = pGraphicsContext->CreateVertexBuffer();
+    pVertexBuffer->SetDynamic(pNodeSceneData->IsDynamic());
+    pVertexBuffer->LoadData(data, encoding);
+    AppendVertexBuffer(pNodeSceneData, pVertexBuffer);
+
+    // Dynamic meshes are likely replaced before simplification completes.
+    if (pNodeSceneData->IsDynamic())
+        return;
+
+    if (data.IndexCount() / 3 >= SIMPLIFIED_MESH_TRIANGLE_COUNT)
+        pNodeSceneData->BuildLevelsOfDetail(pVertexBuffer, data, encoding);
+}
+
+void Scene::AppendVertexBuffer(NodeSceneData* pNodeSceneData, IVertexBuffer* pVertexBuffer)
+{
+    // Attribute layout depends on the primitive type (and the program on
+    // its encoding), so the buffer is bound only after its data is loaded.
+    auto pShaderProgram = mpPhongShaders->GetProgram(pVertexBuffer->GetShaderFeatures());
+    pVertexBuffer->BindToShaderProgram(pShaderProgram);
+    pNodeSceneData->AppendVertexBuffer(pVertexBuffer);
+}
 
-        NodeSceneData* pNodeSceneData = found->second;
-        pNodeSceneData->SetRenderMode(renderMode->Value);
+static int GetLevelOfDetail(const CameraConfiguration& camera, float radius, float distance)
+{
+    if (distance <= radius)
+        return 0; // Camera is within the bounding sphere.
+
+    // Projected diameter of the bounding sphere, in pixels.
+    const float halfFovRadian = camera.fieldOfView * 0.5f * (3.14159265f / 180.0f);
+    const float screenSize = (radius / (distance * std::tanf(halfFovRadian))) *
+        ((float) camera.viewportHeight);
+
+    int levelOfDetail = 0;
+    float threshold = FULL_DETAIL_SCREEN_SIZE;
+    while (screenSize < threshold && threshold > 1.0f) {
+        threshold = threshold * 0.5f;
+        levelOfDetail++;
     }
 
-    mVisualizer->RequestFrameUpdate(); // Update window.
+    return levelOfDetail;
 }
 
 void Scene::RenderGeometries(const std::vector<NodeSceneData *>& geometries)
 {
-    float alpha = 1.0f;
     auto pGraphicsContext = mVisualizer->GetGraphicsContext();
-    mpPhongShader->SetParameter(mAlphaParamIndex, &alpha, 1);
+    auto pCamera = pGraphicsContext->GetDefaultCamera();
+
+    // Rows written since the last frame are uploaded, each node drawn then
+    // only has its row selected (its color and flags are looked up there).
+    mpNodeStates->Activate();
 
+    // Same camera as the one in "ApplyTransformation" of the shaders.
+    CameraConfiguration camera;
+    pCamera->GetConfiguration(&camera);
+
+    // Every vertex buffer of the nodes is queued with its distance from the
+    // camera (that of the bounding sphere center of its node), then drawn
+    // in the order of their keys (see "RenderQueue").
+    // 
+    mpRenderQueue->Clear();
     auto iterator = geometries.begin();
     for (; iterator != geometries.end(); ++iterator)
     {
-        float rgbaColor[4] = { 0 };
-        float controlParams[4] = { 0 };
-
         auto pNodeSceneData = *iterator;
-        pNodeSceneData->GetColor(&rgbaColor[0]);
 
-        // Use the node color if one is specified.
-        if (rgbaColor[3] > 0.01f)
-            controlParams[1] = 1.0f; // Override color.
+        BoundingBox boundingBox;
+        pNodeSceneData->GetBoundingBox(&boundingBox);
 
-        if (pNodeSceneData->GetSelected()) {
-            rgbaColor[0] = 154.0f / 255.0f;
-            rgbaColor[1] = 206.0f / 255.0f;
-            rgbaColor[2] = 235.0f / 255.0f;
-            controlParams[1] = 1.0f; // Override color.
-        }
+        float center[3], radius = 0.0f;
+        boundingBox.Get(&center[0], radius);
 
-        mpPhongShader->SetParameter(mColorParamIndex, &rgbaColor[0], 4);
+        const float dx = center[0] - camera.cameraPosition[0];
+        const float dy = center[1] - camera.cameraPosition[1];
+        const float dz = center[2] - camera.cameraPosition[2];
+        const float distance = std::sqrtf((dx * dx) + (dy * dy) + (dz * dz));
 
-        // Draw primitives of lower dimensionality first (e.g. points and lines).
-        controlParams[0] = 1.0f;
-        mpPhongShader->SetParameter(mControlParamsIndex, &controlParams[0], 4);
-        pNodeSceneData->Render(pGraphicsContext, Dimensionality::Low);
+        const int levelOfDetail = GetLevelOfDetail(camera, radius, distance);
+        pNodeSceneData->Enqueue(mpRenderQueue, distance, levelOfDetail);
+    }
+
+    mpRenderQueue->Sort();
+
+    // Items are drawn with the program specialized for the features of
+    // their vertex buffers (e.g. points and lines with one that is not
+    // lit), which is switched to whenever the features change from one
+    // item to the next. Items in between go in a single submission.
+    // 
+    const DrawItem* pDrawItems = mpRenderQueue->GetItems();
+    const int itemCount = mpRenderQueue->GetItemCount();
+
+    int first = 0;
+    while (first < itemCount)
+    {
+        const auto features = RenderQueue::GetShaderFeatures(pDrawItems[first].key);
 
-        if (pNodeSceneData->GetRenderMode() == RenderMode::Shaded)
-            controlParams[0] = 3.0f;
+        int last = first + 1;
+        while (last < itemCount &&
+            RenderQueue::GetShaderFeatures(pDrawItems[last].key) == features) {
+            last++;
+        }
+
+        auto pShaderProgram = mpPhongShaders->GetProgram(features);
+        pGraphicsContext->ActivateShaderProgram(pShaderProgram);
+        pShaderProgram->ApplyTransformation(pCamera);
+        mpNodeStates->BindToShaderProgram(pShaderProgram);
 
-        // Draw primitives of higher dimensionality later (e.g. triangles).
-        mpPhongShader->SetParameter(mControlParamsIndex, &controlParams[0], 4);
-        pNodeSceneData->Render(pGraphicsContext, Dimensionality::High);
+        pGraphicsContext->RenderDrawItems(&pDrawItems[first], last - first, mpNodeStates);
+        first = last;
     }
 }
+
+void Scene::WriteNodeState(const NodeSceneData* pNodeSceneData)
+{
+    NodeState nodeState;
+    pNodeSceneData->GetState(&nodeState);
+    mpNodeStates->SetRow(pNodeSceneData->GetStateRow(), nodeState);
+}
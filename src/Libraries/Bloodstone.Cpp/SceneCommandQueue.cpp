@@ -0,0 +1,161 @@
+// SceneCommandQueue.cpp : Compiled into the native tests as well, see
+// "SceneCommandQueue" in "SceneCommandQueue.h".
+//
+
+#include "stdafx.h"
+#include "SceneCommandQueue.h"
+
+using namespace Dynamo::Bloodstone;
+
+SceneCommandQueue::SceneCommandQueue(void) :
+    mClearGeometries(false),
+    mClearSelection(false),
+    mPackageCount(0),
+    mUpdateDepth(0)
+{
+}
+
+bool SceneCommandQueue::IsEmpty(void) const
+{
+    return mCommands.empty() && !mClearGeometries && !mClearSelection;
+}
+
+bool SceneCommandQueue::GetClearGeometries(void) const
+{
+    return this->mClearGeometries;
+}
+
+bool SceneCommandQueue::GetClearSelection(void) const
+{
+    return this->mClearSelection;
+}
+
+int SceneCommandQueue::GetCommandCount(void) const
+{
+    return ((int) mCommands.size());
+}
+
+const NodeCommand& SceneCommandQueue::GetCommand(int index) const
+{
+    return mCommands[index];
+}
+
+int SceneCommandQueue::SetPackage(const NodeKey& key)
+{
+    // Only the last package of a node gets converted and uploaded.
+    auto& command = GetCommand(key);
+    if (command.packageIndex < 0)
+        command.packageIndex = mPackageCount++;
+
+    return command.packageIndex;
+}
+
+int SceneCommandQueue::GetPackageCount(void) const
+{
+    return this->mPackageCount;
+}
+
+int SceneCommandQueue::RemoveGeometries(const NodeKey& key)
+{
+    // Anything recorded for the node so far goes away with it.
+    auto& command = GetCommand(key);
+    const int packageIndex = command.packageIndex;
+
+    command.packageIndex = -1;
+    command.removeGeometries = true;
+    command.setColor = false;
+    command.setRenderMode = false;
+    command.selection = -1;
+    return packageIndex;
+}
+
+void SceneCommandQueue::SetSelection(const NodeKey& key, bool selected)
+{
+    GetCommand(key).selection = (selected ? 1 : 0);
+}
+
+void SceneCommandQueue::SetColor(const NodeKey& key, const float* pRgbaColor)
+{
+    auto& command = GetCommand(key);
+    command.setColor = true;
+    command.rgbaColor[0] = pRgbaColor[0];
+    command.rgbaColor[1] = pRgbaColor[1];
+    command.rgbaColor[2] = pRgbaColor[2];
+    command.rgbaColor[3] = pRgbaColor[3];
+}
+
+void SceneCommandQueue::SetRenderMode(const NodeKey& key, int renderMode)
+{
+    auto& command = GetCommand(key);
+    command.setRenderMode = true;
+    command.renderMode = renderMode;
+}
+
+void SceneCommandQueue::ClearGeometries(void)
+{
+    // Every node goes away, and whatever was recorded for them with it.
+    mCommands.clear();
+    mCommandIndices.clear();
+    mClearGeometries = true;
+    mClearSelection = false;
+    mPackageCount = 0;
+}
+
+void SceneCommandQueue::ClearSelection(void)
+{
+    auto iterator = mCommands.begin();
+    for (; iterator != mCommands.end(); ++iterator)
+        iterator->selection = -1;
+
+    mClearSelection = true;
+}
+
+void SceneCommandQueue::Clear(void)
+{
+    mCommands.clear();
+    mCommandIndices.clear();
+    mClearGeometries = false;
+    mClearSelection = false;
+    mPackageCount = 0;
+}
+
+void SceneCommandQueue::BeginUpdate(void)
+{
+    mUpdateDepth++;
+}
+
+bool SceneCommandQueue::EndUpdate(void)
+{
+    if (mUpdateDepth <= 0)
+        return false;
+
+    mUpdateDepth--;
+    return true;
+}
+
+bool SceneCommandQueue::IsUpdating(void) const
+{
+    return mUpdateDepth > 0;
+}
+
+NodeCommand& SceneCommandQueue::GetCommand(const NodeKey& key)
+{
+    auto found = mCommandIndices.find(key);
+    if (found != mCommandIndices.end())
+        return mCommands[found->second];
+
+    NodeCommand command;
+    command.key = key;
+    command.packageIndex = -1;
+    command.removeGeometries = false;
+    command.setColor = false;
+    command.setRenderMode = false;
+    command.selection = -1;
+    command.rgbaColor[0] = command.rgbaColor[1] = 0.0f;
+    command.rgbaColor[2] = command.rgbaColor[3] = 0.0f;
+    command.renderMode = 0; // Shaded.
+
+    mCommandIndices.insert(std::make_pair(key, ((int) mCommands.size())));
+    mCommands.push_back(command);
+    return mCommands.back();
+}
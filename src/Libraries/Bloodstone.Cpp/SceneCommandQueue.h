@@ -0,0 +1,83 @@
+#ifndef _SCENECOMMANDQUEUE_H_
+#define _SCENECOMMANDQUEUE_H_
+
+#include "NodeTable.h"
+
+#include <unordered_map>
+
+namespace Dynamo { namespace Bloodstone {
+
+    // Changes to a node recorded since the last frame. Geometries are
+    // removed before the package (if any) is loaded, which is then
+    // followed by the remaining properties.
+    // 
+    struct NodeCommand
+    {
+        NodeKey key;
+        int packageIndex; // Into pending render packages, -1 for none.
+        bool removeGeometries;
+        bool setColor;
+        bool setRenderMode;
+        int selection; // Either -1 (unchanged), 0 (deselect) or 1 (select).
+        float rgbaColor[4];
+        int renderMode; // Of "RenderMode", which is managed.
+    };
+
+    // Scene changes are recorded here and applied all at once at the start
+    // of the next frame. Only the last change to each property of a node is
+    // kept, so the queue holds at most one command per node (in the order
+    // nodes were first mentioned, for results not to depend on hashing).
+    // Between "BeginUpdate" and the matching "EndUpdate" the commands are
+    // held back, the scene does not apply any of them. Depends on nothing
+    // managed, so that the native tests can build it on its own.
+    // 
+    class SceneCommandQueue
+    {
+    public:
+        SceneCommandQueue(void);
+
+        bool IsEmpty(void) const;
+        bool GetClearGeometries(void) const;
+        bool GetClearSelection(void) const;
+        int GetCommandCount(void) const;
+        const NodeCommand& GetCommand(int index) const;
+
+        // Returns where the package of the node goes among those pending,
+        // either at the index of the package it replaces or (for a node
+        // without one) at "GetPackageCount" from before the call.
+        int SetPackage(const NodeKey& key);
+        int GetPackageCount(void) const;
+
+        // Drops everything else recorded for the node, and returns the
+        // index of the package dropped along with it (-1 for none). The
+        // package is no longer referred to by any command.
+        int RemoveGeometries(const NodeKey& key);
+
+        void SetSelection(const NodeKey& key, bool selected);
+        void SetColor(const NodeKey& key, const float* pRgbaColor);
+        void SetRenderMode(const NodeKey& key, int renderMode);
+
+        // Both drop changes recorded so far that they make irrelevant.
+        void ClearGeometries(void);
+        void ClearSelection(void);
+        void Clear(void);
+
+        // Updates nest, "EndUpdate" returns false (and changes nothing)
+        // if there is no "BeginUpdate" left to match.
+        void BeginUpdate(void);
+        bool EndUpdate(void);
+        bool IsUpdating(void) const;
+
+    private:
+        NodeCommand& GetCommand(const NodeKey& key);
+
+        bool mClearGeometries;
+        bool mClearSelection;
+        int mPackageCount;
+        int mUpdateDepth;
+        std::vector<NodeCommand> mCommands;
+        std::unordered_map<NodeKey, int, NodeKeyHasher> mCommandIndices;
+    };
+} }
+
+#endif
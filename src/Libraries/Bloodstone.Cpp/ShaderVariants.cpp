@@ -0,0 +1,39 @@
+#include "stdafx.h"
+#include "ShaderVariants.h"
+
+using namespace Dynamo::Bloodstone;
+
+// ================================================================================
+// ShaderVariants
+// ================================================================================
+
+ShaderVariants::ShaderVariants(const IGraphicsContext* pGraphicsContext,
+    ShaderName shaderName) :
+    mShaderName(shaderName),
+    mpGraphicsContext(pGraphicsContext)
+{
+    for (int features = 0; features < ((int) ShaderFeatures::Count); ++features)
+        mpPrograms[features] = nullptr;
+}
+
+ShaderVariants::~ShaderVariants(void)
+{
+    for (int features = 0; features < ((int) ShaderFeatures::Count); ++features) {
+        delete mpPrograms[features];
+        mpPrograms[features] = nullptr;
+    }
+}
+
+IShaderProgram* ShaderVariants::GetProgram(ShaderFeatures features)
+{
+    auto& pProgram = mpPrograms[((int) features)];
+    if (pProgram != nullptr)
+        return pProgram;
+
+    pProgram = mpGraphicsContext->CreateShaderProgram(mShaderName, features);
+    pProgram->BindTransformMatrix(TransMatrix::Model, "model");
+    pProgram->BindTransformMatrix(TransMatrix::View, "view");
+    pProgram->BindTransformMatrix(TransMatrix::Projection, "proj");
+    pProgram->BindTransformMatrix(TransMatrix::Normal, "normalMatrix");
+    return pProgram;
+}
@@ -0,0 +1,32 @@
+#ifndef _SHADERVARIANTS_H_
+#define _SHADERVARIANTS_H_
+
+#include "Interfaces.h"
+
+namespace Dynamo { namespace Bloodstone {
+
+    // Programs of a shader, one for each combination of features that it
+    // gets specialized for (see "ShaderFeatures"). Each is compiled the first
+    // time it is asked for, rather than having a single program branch on
+    // the features of every vertex buffer it draws. Programs are owned by the
+    // variants and deleted along with them.
+    // 
+    class ShaderVariants
+    {
+    public:
+        ShaderVariants(const IGraphicsContext* pGraphicsContext, ShaderName shaderName);
+        ~ShaderVariants(void);
+
+        IShaderProgram* GetProgram(ShaderFeatures features);
+
+    private:
+        ShaderVariants(const ShaderVariants& other);
+        ShaderVariants& operator=(const ShaderVariants& other);
+
+        ShaderName mShaderName;
+        const IGraphicsContext* mpGraphicsContext;
+        IShaderProgram* mpPrograms[((int) ShaderFeatures::Count)];
+    };
+} }
+
+#endif
@@ -2,6 +2,15 @@
 #include "stdafx.h"
 #include "Utilities.h"
 
+#include <stdlib.h>
+
+// Primes of the xxHash64 algorithm.
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+
 bool Utils::LoadShaderResource(unsigned int id, std::string& content)
 {
     auto module = GetModuleHandle(L"Bloodstone.Cpp.dll");
@@ -64,3 +73,128 @@ float Interpolator::GetSecondsSinceStarted(void) const
     LONGLONG difference = currentTime.QuadPart - mStartTime.QuadPart;
     return ((float)(difference * mInversedFrequency));
 }
+
+static unsigned long long ReadUInt64(const unsigned char* pBytes)
+{
+    unsigned long long value = 0;
+    memcpy(&value, pBytes, sizeof(value)); // Input need not be aligned.
+    return value;
+}
+
+static unsigned long long ReadUInt32(const unsigned char* pBytes)
+{
+    unsigned int value = 0;
+    memcpy(&value, pBytes, sizeof(value));
+    return value;
+}
+
+static unsigned long long HashRound(unsigned long long accumulator, unsigned long long input)
+{
+    accumulator = accumulator + input * XXH_PRIME64_2;
+    accumulator = _rotl64(accumulator, 31);
+    return accumulator * XXH_PRIME64_1;
+}
+
+static unsigned long long MergeRound(unsigned long long hash, unsigned long long accumulator)
+{
+    hash = hash ^ HashRound(0, accumulator);
+    return hash * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+ContentHasher::ContentHasher(unsigned long long seed) : 
+    mSeed(seed),
+    mByteCount(0),
+    mPendingBytes(0)
+{
+    mAccumulators[0] = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+    mAccumulators[1] = seed + XXH_PRIME64_2;
+    mAccumulators[2] = seed;
+    mAccumulators[3] = seed - XXH_PRIME64_1;
+}
+
+void ContentHasher::Update(const void* pData, std::size_t bytes)
+{
+    auto pBytes = ((const unsigned char *) pData);
+    mByteCount = mByteCount + bytes;
+
+    // Top up whatever is left over from the previous update first.
+    if (mPendingBytes > 0)
+    {
+        std::size_t count = sizeof(mPending) - mPendingBytes;
+        count = ((bytes < count) ? bytes : count);
+        memcpy(&mPending[mPendingBytes], pBytes, count);
+        mPendingBytes = mPendingBytes + count;
+        pBytes = pBytes + count;
+        bytes = bytes - count;
+
+        if (mPendingBytes < sizeof(mPending))
+            return;
+
+        ConsumeStripe(&mPending[0]);
+        mPendingBytes = 0;
+    }
+
+    for (; bytes >= sizeof(mPending); bytes -= sizeof(mPending)) {
+        ConsumeStripe(pBytes);
+        pBytes = pBytes + sizeof(mPending);
+    }
+
+    if (bytes > 0) {
+        memcpy(&mPending[0], pBytes, bytes);
+        mPendingBytes = bytes;
+    }
+}
+
+unsigned long long ContentHasher::GetByteCount(void) const
+{
+    return this->mByteCount;
+}
+
+unsigned long long ContentHasher::Finalize(void) const
+{
+    unsigned long long hash = 0;
+    if (mByteCount >= sizeof(mPending))
+    {
+        hash = _rotl64(mAccumulators[0], 1) + _rotl64(mAccumulators[1], 7) +
+            _rotl64(mAccumulators[2], 12) + _rotl64(mAccumulators[3], 18);
+
+        for (int lane = 0; lane < 4; ++lane)
+            hash = MergeRound(hash, mAccumulators[lane]);
+    }
+    else
+        hash = mSeed + XXH_PRIME64_5;
+
+    hash = hash + mByteCount;
+
+    const unsigned char* pBytes = &mPending[0];
+    std::size_t remaining = mPendingBytes;
+    for (; remaining >= 8; remaining -= 8, pBytes += 8) {
+        hash = hash ^ HashRound(0, ReadUInt64(pBytes));
+        hash = _rotl64(hash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+
+    if (remaining >= 4) {
+        hash = hash ^ (ReadUInt32(pBytes) * XXH_PRIME64_1);
+        hash = _rotl64(hash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        remaining = remaining - 4;
+        pBytes = pBytes + 4;
+    }
+
+    for (; remaining > 0; --remaining, ++pBytes) {
+        hash = hash ^ ((*pBytes) * XXH_PRIME64_5);
+        hash = _rotl64(hash, 11) * XXH_PRIME64_1;
+    }
+
+    // Final avalanche.
+    hash = hash ^ (hash >> 33);
+    hash = hash * XXH_PRIME64_2;
+    hash = hash ^ (hash >> 29);
+    hash = hash * XXH_PRIME64_3;
+    return hash ^ (hash >> 32);
+}
+
+void ContentHasher::ConsumeStripe(const unsigned char* pStripe)
+{
+    for (int lane = 0; lane < 4; ++lane)
+        mAccumulators[lane] = HashRound(mAccumulators[lane], ReadUInt64(pStripe + lane * 8));
+}
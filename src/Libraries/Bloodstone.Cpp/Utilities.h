@@ -23,4 +23,25 @@ private:
     LARGE_INTEGER mStartTime;
 };
 
+// 64-bit content hash (xxHash64) computed over data fed in incrementally,
+// the same bytes yield the same hash regardless of how they are split up.
+// 
+class ContentHasher
+{
+public:
+    ContentHasher(unsigned long long seed = 0);
+    void Update(const void* pData, std::size_t bytes);
+    unsigned long long GetByteCount(void) const;
+    unsigned long long Finalize(void) const;
+
+private:
+    void ConsumeStripe(const unsigned char* pStripe);
+
+    unsigned long long mSeed;
+    unsigned long long mAccumulators[4];
+    unsigned long long mByteCount;
+    unsigned char mPending[32];
+    std::size_t mPendingBytes;
+};
+
 #endif
@@ -241,6 +241,10 @@ LRESULT VisualizerWnd::ProcessMessage(HWND hWnd, UINT msg, WPARAM wParam, LPARAM
     case WM_ERASEBKGND:
         return 0L; // Avoid erasing background to flickering during sizing.
 
+    case WM_BLOODSTONE_FRAME_UPDATE:
+        this->RequestFrameUpdate();
+        return 0L;
+
     case WM_SIZE:
         {
             if (mpGraphicsContext != nullptr)
@@ -0,0 +1,187 @@
+﻿using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Runtime.InteropServices;
+using Autodesk.DesignScript.Interfaces;
+using Dynamo.DSEngine;
+using NUnit.Framework;
+
+namespace Dynamo.Tests
+{
+    public class RenderPackageTests
+    {
+        /// <summary>
+        /// A grid of "size" by "size" quads, two triangles each, the way a
+        /// tessellated surface comes out of the geometry library.
+        /// </summary>
+        /// 
+        private static RenderPackage CreateSurfacePackage(int size)
+        {
+            var package = new RenderPackage(true);
+            for (int row = 0; row < size; ++row)
+            {
+                for (int column = 0; column < size; ++column)
+                {
+                    var corners = new[]
+                    {
+                        column, row, column + 1, row, column + 1, row + 1,
+                        column, row, column + 1, row + 1, column, row + 1
+                    };
+
+                    for (int corner = 0; corner < corners.Length; corner += 2)
+                    {
+                        var x = corners[corner] * 0.1;
+                        var y = corners[corner + 1] * 0.1;
+                        package.PushTriangleVertex(x, y, Math.Sin(x) * Math.Cos(y));
+                        package.PushTriangleVertexNormal(0.0, 0.0, 1.0);
+                        package.PushTriangleVertexColor(255, 128, 0, 255);
+                    }
+                }
+            }
+
+            return package;
+        }
+
+        private static NativeRenderPackageData ReadNativeRenderPackage(IRenderPackage package)
+        {
+            var pointer = package.NativeRenderPackage;
+            Assert.AreNotEqual(IntPtr.Zero, pointer);
+
+            var data = (NativeRenderPackageData)Marshal.PtrToStructure(
+                pointer, typeof(NativeRenderPackageData));
+
+            Assert.AreEqual(NativeRenderPackageData.PackageSignature, data.Signature);
+            Assert.AreEqual(Marshal.SizeOf(typeof(NativeRenderPackageData)), (int)data.StructSize);
+            return data;
+        }
+
+        [Test]
+        [Category("UnitTests")]
+        public void NativeRenderPackage00()
+        {
+            // Snapshot holds the same values as the lists.
+            var package = CreateSurfacePackage(8);
+            var data = ReadNativeRenderPackage(package);
+
+            int vertexCount = package.TriangleVertices.Count / 3;
+            Assert.AreEqual(vertexCount, data.TriangleVertexCount);
+
+            var vertices = new float[vertexCount * 3];
+            var normals = new float[vertexCount * 3];
+            var colors = new byte[vertexCount * 4];
+            Marshal.Copy(data.TriangleVertices, vertices, 0, vertices.Length);
+            Marshal.Copy(data.TriangleNormals, normals, 0, normals.Length);
+            Marshal.Copy(data.TriangleColors, colors, 0, colors.Length);
+
+            for (int index = 0; index < vertices.Length; ++index)
+            {
+                Assert.AreEqual((float)package.TriangleVertices[index], vertices[index]);
+                Assert.AreEqual((float)package.TriangleNormals[index], normals[index]);
+            }
+
+            CollectionAssert.AreEqual(package.TriangleVertexColors, colors);
+            Assert.AreEqual(0, data.PointVertexCount);
+            Assert.AreEqual(IntPtr.Zero, data.PointVertices);
+
+            package.Dispose();
+        }
+
+        [Test]
+        [Category("UnitTests")]
+        public void NativeRenderPackage01()
+        {
+            // Snapshot is rebuilt once the package changes.
+            var package = new RenderPackage(true);
+            package.PushLineStripVertex(0.0, 0.0, 0.0);
+            package.PushLineStripVertex(1.0, 2.0, 3.0);
+            package.PushLineStripVertexCount(2);
+            Assert.AreEqual(2, ReadNativeRenderPackage(package).LineStripVertexCount);
+
+            package.PushLineStripVertex(4.0, 5.0, 6.0);
+            package.LineStripVertexCounts[0] = 3;
+
+            var data = ReadNativeRenderPackage(package);
+            Assert.AreEqual(3, data.LineStripVertexCount);
+            Assert.AreEqual(1, data.LineStripCount);
+            Assert.AreEqual(IntPtr.Zero, data.LineStripColors);
+
+            var counts = new int[1];
+            Marshal.Copy(data.LineStripVertexCounts, counts, 0, counts.Length);
+            Assert.AreEqual(3, counts[0]);
+
+            package.Dispose();
+        }
+
+        [Test]
+        [Category("UnitTests")]
+        public void NativeRenderPackage02()
+        {
+            // Disposed packages no longer hand out a snapshot, consumers
+            // then fall back to reading the lists.
+            var package = CreateSurfacePackage(2);
+            Assert.AreNotEqual(IntPtr.Zero, package.NativeRenderPackage);
+
+            package.Dispose();
+            Assert.AreEqual(IntPtr.Zero, package.NativeRenderPackage);
+            Assert.AreEqual(72, package.TriangleVertices.Count);
+        }
+
+        /// <summary>
+        /// Compares the way Bloodstone used to read a package, one element at
+        /// a time through the "IRenderPackage" lists, against building the
+        /// native snapshot and copying its arrays out in bulk. Timings are 
+        /// written to the test output, nothing is asserted on them.
+        /// </summary>
+        /// 
+        [Test]
+        [Category("Benchmark")]
+        public void NativeRenderPackageBenchmark()
+        {
+            const int Iterations = 5;
+
+            var package = CreateSurfacePackage(512); // About 1.5M vertices.
+            IRenderPackage renderPackage = package;
+            int vertexCount = renderPackage.TriangleVertices.Count / 3;
+
+            var vertices = new float[vertexCount * 3];
+            var normals = new float[vertexCount * 3];
+            var colors = new byte[vertexCount * 4];
+
+            var managed = Stopwatch.StartNew();
+            for (int iteration = 0; iteration < Iterations; ++iteration)
+            {
+                for (int index = 0; index < vertices.Length; ++index)
+                {
+                    vertices[index] = (float)renderPackage.TriangleVertices[index];
+                    normals[index] = (float)renderPackage.TriangleNormals[index];
+                }
+
+                for (int index = 0; index < colors.Length; ++index)
+                    colors[index] = renderPackage.TriangleVertexColors[index];
+            }
+
+            managed.Stop();
+
+            var native = Stopwatch.StartNew();
+            for (int iteration = 0; iteration < Iterations; ++iteration)
+            {
+                // Setting any of the lists has the snapshot rebuilt.
+                package.TriangleVertices = package.TriangleVertices;
+                var data = ReadNativeRenderPackage(package);
+                Marshal.Copy(data.TriangleVertices, vertices, 0, vertices.Length);
+                Marshal.Copy(data.TriangleNormals, normals, 0, normals.Length);
+                Marshal.Copy(data.TriangleColors, colors, 0, colors.Length);
+            }
+
+            native.Stop();
+
+            Console.WriteLine("{0} triangle vertices, {1} iterations", vertexCount, Iterations);
+            Console.WriteLine("Per-element reads: {0} ms", managed.ElapsedMilliseconds);
+            Console.WriteLine("Native snapshot:   {0} ms", native.ElapsedMilliseconds);
+            Console.WriteLine("Speedup:           {0:F1}x", 
+                managed.Elapsed.TotalMilliseconds / Math.Max(native.Elapsed.TotalMilliseconds, 1.0));
+
+            package.Dispose();
+        }
+    }
+}
@@ -0,0 +1,227 @@
+// ConversionBenchmark.cpp : CPU side conversion of node geometries, the
+// way "Scene::UpdateNodeGeometries" does it, over many nodes converted one
+// after another and then across all cores.
+//
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h> // Window and device context types used by "Interfaces.h".
+
+#include "TestFramework.h"
+#include "MeshProcessing.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace Dynamo::Bloodstone;
+using namespace Dynamo::Bloodstone::Tests;
+
+// Same as in "Scene.cpp".
+#define WELD_VERTEX_EPSILON             1.0e-5f
+#define WELD_NORMAL_EPSILON             1.0e-3f
+#define CLUSTERED_MESH_TRIANGLE_COUNT   16384
+#define MESH_CLUSTER_SIZE               128
+
+#define BENCHMARK_NODE_COUNT            256
+
+// Post-transform cache sizes vertex cache statistics are reported for.
+#define SMALL_VERTEX_CACHE_SIZE         16
+#define LARGE_VERTEX_CACHE_SIZE         32
+
+// A wavy "cells" by "cells" grid, given the way render packages give it:
+// three vertices (each with its normal and color) for every triangle.
+//
+static TriangleGeometryData* MakeTessellatedGrid(int cells, float offset)
+{
+    auto pGrid = new TriangleGeometryData(cells * cells * 2);
+
+    const int corners[6][2] = { {0,0}, {1,0}, {1,1}, {0,0}, {1,1}, {0,1} };
+    for (int row = 0; row < cells; ++row)
+    {
+        for (int column = 0; column < cells; ++column)
+        {
+            for (int corner = 0; corner < 6; ++corner)
+            {
+                const float u = ((float) (column + corners[corner][0])) / cells;
+                const float v = ((float) (row + corners[corner][1])) / cells;
+                const float su = std::sin(u * 6.0f), cu = std::cos(u * 6.0f);
+                const float sv = std::sin(v * 6.0f), cv = std::cos(v * 6.0f);
+
+                // z = 0.25 * sin(6u) * sin(6v), normal is (-dz/du, -dz/dv, 1).
+                const float nx = -1.5f * cu * sv, ny = -1.5f * su * cv;
+                const float length = std::sqrt(nx * nx + ny * ny + 1.0f);
+
+                pGrid->PushVertex(offset + u, v, 0.25f * su * sv);
+                pGrid->PushNormal(nx / length, ny / length, 1.0f / length);
+                pGrid->PushColor(((unsigned char) (u * 255.0f)),
+                    ((unsigned char) (v * 255.0f)), 128, 255);
+            }
+        }
+    }
+
+    return pGrid;
+}
+
+static TriangleGeometryData* Convert(const TriangleGeometryData& source)
+{
+    TriangleGeometryData welded(0);
+    MeshProcessor::Weld(source, WELD_VERTEX_EPSILON, WELD_NORMAL_EPSILON, welded);
+
+    auto pTriangles = new TriangleGeometryData(0);
+    MeshProcessor::OptimizeVertexCache(welded, *pTriangles);
+
+    if (pTriangles->IndexCount() / 3 >= CLUSTERED_MESH_TRIANGLE_COUNT)
+    {
+        auto pClustered = new TriangleGeometryData(0);
+        MeshProcessor::BuildClusters(*pTriangles, MESH_CLUSTER_SIZE, *pClustered);
+        delete pTriangles;
+        pTriangles = pClustered;
+    }
+
+    return pTriangles;
+}
+
+// Converts every source on "threadCount" threads, each taking the next
+// node still to be converted (as "Parallel::For" hands them out).
+//
+static void ConvertAll(const std::vector<TriangleGeometryData*>& sources,
+    int threadCount, std::vector<TriangleGeometryData*>& converted)
+{
+    converted.assign(sources.size(), nullptr);
+
+    std::atomic<int> nextNode(0);
+    auto worker = [&]()
+    {
+        for (int node = nextNode++; node < ((int) sources.size()); node = nextNode++)
+            converted[node] = Convert(*sources[node]);
+    };
+
+    std::vector<std::thread> threads;
+    for (int thread = 1; thread < threadCount; ++thread)
+        threads.push_back(std::thread(worker));
+
+    worker();
+    for (std::size_t thread = 0; thread < threads.size(); ++thread)
+        threads[thread].join();
+}
+
+static bool AreIdentical(const TriangleGeometryData& a, const TriangleGeometryData& b)
+{
+    if (a.VertexCount() != b.VertexCount() || a.IndexCount() != b.IndexCount())
+        return false;
+    if (a.ClusterCount() != b.ClusterCount())
+        return false;
+
+    for (int vertex = 0; vertex < a.VertexCount(); ++vertex)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (a.GetCoordinates(vertex)[axis] != b.GetCoordinates(vertex)[axis])
+                return false;
+            if (a.GetNormalCoords(vertex)[axis] != b.GetNormalCoords(vertex)[axis])
+                return false;
+        }
+    }
+
+    for (int index = 0; index < a.IndexCount(); ++index)
+    {
+        if (a.GetIndices()[index] != b.GetIndices()[index])
+            return false;
+    }
+
+    for (int cluster = 0; cluster < a.ClusterCount(); ++cluster)
+    {
+        if (a.GetClusters()[cluster].firstIndex != b.GetClusters()[cluster].firstIndex)
+            return false;
+        if (a.GetClusters()[cluster].indexCount != b.GetClusters()[cluster].indexCount)
+            return false;
+    }
+
+    return true;
+}
+
+// Vertex cache statistics of every welded node, in the order it was
+// tessellated in and then as optimized, averaged over all triangles.
+//
+static void ReportVertexCache(const std::vector<TriangleGeometryData*>& sources)
+{
+    const int cacheSizes[] = { SMALL_VERTEX_CACHE_SIZE, LARGE_VERTEX_CACHE_SIZE };
+    for (int size = 0; size < 2; ++size)
+    {
+        double before[2] = { 0.0, 0.0 }, after[2] = { 0.0, 0.0 }, triangles = 0.0;
+        for (std::size_t node = 0; node < sources.size(); ++node)
+        {
+            TriangleGeometryData welded(0), optimized(0);
+            MeshProcessor::Weld(*sources[node], WELD_VERTEX_EPSILON, WELD_NORMAL_EPSILON, welded);
+            MeshProcessor::OptimizeVertexCache(welded, optimized);
+
+            const auto b = MeshProcessor::AnalyzeVertexCache(welded, cacheSizes[size]);
+            const auto a = MeshProcessor::AnalyzeVertexCache(optimized, cacheSizes[size]);
+
+            const double count = welded.IndexCount() / 3;
+            before[0] = before[0] + b.acmr * count;
+            before[1] = before[1] + b.atvr * count;
+            after[0] = after[0] + a.acmr * count;
+            after[1] = after[1] + a.atvr * count;
+            triangles = triangles + count;
+        }
+
+        // Small grids can already fit a whole row in the cache as they
+        // are tessellated, only the average is bound to improve.
+        CHECK(after[0] < before[0]);
+        std::printf("  vertex cache (%d entries): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+            cacheSizes[size], before[0] / triangles, after[0] / triangles,
+            before[1] / triangles, after[1] / triangles);
+    }
+}
+
+static void DeleteAll(std::vector<TriangleGeometryData*>& geometries)
+{
+    for (std::size_t index = 0; index < geometries.size(); ++index)
+        delete geometries[index];
+
+    geometries.clear();
+}
+
+// Most nodes of a graph are small, every sixteenth one is large enough to
+// be split into clusters.
+//
+BENCHMARK(ConvertNodesSerialAndParallel)
+{
+    std::vector<TriangleGeometryData*> sources;
+    for (int node = 0; node < BENCHMARK_NODE_COUNT; ++node)
+    {
+        const int cells = (((node % 16) == 0) ? 96 : (8 + (node % 5) * 8));
+        sources.push_back(MakeTessellatedGrid(cells, ((float) node)));
+    }
+
+    int threadCount = ((int) std::thread::hardware_concurrency());
+    threadCount = ((threadCount > 0) ? threadCount : 1);
+
+    std::vector<TriangleGeometryData*> serial, parallel;
+
+    const Stopwatch serialWatch;
+    ConvertAll(sources, 1, serial);
+    const double serialMs = serialWatch.GetMilliseconds();
+
+    const Stopwatch parallelWatch;
+    ConvertAll(sources, threadCount, parallel);
+    const double parallelMs = parallelWatch.GetMilliseconds();
+
+    // Every node is converted on its own, the thread it ran on must not
+    // make any difference to what comes out.
+    for (int node = 0; node < BENCHMARK_NODE_COUNT; ++node)
+        CHECK(AreIdentical(*serial[node], *parallel[node]));
+
+    std::printf("  %d nodes: serial %.1f ms, parallel (%d threads) %.1f ms, "
+        "speedup %.2fx\n", BENCHMARK_NODE_COUNT, serialMs, threadCount,
+        parallelMs, serialMs / parallelMs);
+
+    ReportVertexCache(sources);
+
+    DeleteAll(serial);
+    DeleteAll(parallel);
+    DeleteAll(sources);
+}
@@ -0,0 +1,186 @@
+// CullingBenchmark.cpp : Frustum culling through "NodeHierarchy" against a
+// linear scan over the bounds of every node, and the CPU time of a frame
+// (as "Scene::RenderScene" spends it) with and without culling.
+//
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h> // Window and device context types used by "Interfaces.h".
+
+#include "TestFramework.h"
+#include "NodeHierarchy.h"
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+using namespace Dynamo::Bloodstone;
+using namespace Dynamo::Bloodstone::Tests;
+
+#define SCENE_EXTENT        1000.0f
+#define FRAME_REPETITIONS   50
+
+// Nodes scattered over a square of "SCENE_EXTENT" on the x-z plane, each
+// a few units across (the way nodes of a graph tend to be laid out).
+//
+static std::vector<NodeBounds> MakeNodes(int nodeCount)
+{
+    TestRandom random(((unsigned int) nodeCount));
+    std::vector<NodeBounds> nodes(nodeCount);
+    for (int node = 0; node < nodeCount; ++node)
+    {
+        nodes[node].slot = node;
+        const float center[3] =
+        {
+            random.NextFloat(0.0f, SCENE_EXTENT),
+            random.NextFloat(0.0f, 20.0f),
+            random.NextFloat(0.0f, SCENE_EXTENT)
+        };
+
+        for (int axis = 0; axis < 3; ++axis) {
+            const float half = random.NextFloat(0.5f, 5.0f);
+            nodes[node].min[axis] = center[axis] - half;
+            nodes[node].max[axis] = center[axis] + half;
+        }
+    }
+
+    return nodes;
+}
+
+// Camera at "pEye" looking down the negative z axis, "tangent" being that
+// of half its field of view. Plane normals point into the frustum.
+//
+static Frustum MakeFrustum(const float* pEye, float tangent, float nearest, float farthest)
+{
+    const float ex = pEye[0], ey = pEye[1], ez = pEye[2];
+    const float planes[24] =
+    {
+         1.0f,  0.0f, -tangent, -ex + tangent * ez,    // Left.
+        -1.0f,  0.0f, -tangent,  ex + tangent * ez,    // Right.
+         0.0f,  1.0f, -tangent, -ey + tangent * ez,    // Bottom.
+         0.0f, -1.0f, -tangent,  ey + tangent * ez,    // Top.
+         0.0f,  0.0f, -1.0f, ez - nearest,             // Near.
+         0.0f,  0.0f,  1.0f, farthest - ez             // Far.
+    };
+
+    Frustum frustum;
+    frustum.SetPlanes(&planes[0]);
+    return frustum;
+}
+
+static void CullLinearly(const Frustum& frustum,
+    const std::vector<NodeBounds>& nodes, std::vector<int>& visibleSlots)
+{
+    visibleSlots.clear();
+    for (std::size_t node = 0; node < nodes.size(); ++node)
+    {
+        const NodeBounds& bounds = nodes[node];
+        if (frustum.Classify(bounds.min, bounds.max) != Frustum::Containment::Outside)
+            visibleSlots.push_back(bounds.slot);
+    }
+}
+
+// What is left of a frame on the CPU once the nodes to draw are known:
+// the distance of each one from the camera, and two vertex buffers (a
+// mesh and its edges) queued for it, before the queue is sorted.
+//
+static void QueueNodes(const std::vector<NodeBounds>& nodes,
+    const std::vector<int>& slots, const float* pEye, RenderQueue& renderQueue)
+{
+    renderQueue.Clear();
+    for (std::size_t index = 0; index < slots.size(); ++index)
+    {
+        const NodeBounds& bounds = nodes[slots[index]];
+        float squared = 0.0f;
+        for (int axis = 0; axis < 3; ++axis) {
+            const float delta = (bounds.min[axis] + bounds.max[axis]) * 0.5f - pEye[axis];
+            squared = squared + delta * delta;
+        }
+
+        const float distance = std::sqrt(squared);
+        renderQueue.Add(RenderQueue::MakeKey(false, ShaderFeatures::Lit,
+            IVertexBuffer::PrimitiveType::Triangle, distance), nullptr, slots[index]);
+        renderQueue.Add(RenderQueue::MakeKey(false, ShaderFeatures::None,
+            IVertexBuffer::PrimitiveType::LineStrip, distance), nullptr, slots[index]);
+    }
+
+    renderQueue.Sort();
+}
+
+static void BenchmarkCulling(int nodeCount, const float* pEye,
+    float tangent, float farthest, const char* pView)
+{
+    const auto nodes = MakeNodes(nodeCount);
+    const Frustum frustum = MakeFrustum(pEye, tangent, 0.1f, farthest);
+
+    const Stopwatch buildWatch;
+    NodeHierarchy hierarchy;
+    hierarchy.Build(nodes, nodeCount);
+    const double buildMs = buildWatch.GetMilliseconds();
+
+    std::vector<int> allSlots(nodeCount);
+    for (int node = 0; node < nodeCount; ++node)
+        allSlots[node] = node;
+
+    std::vector<int> linearSlots, hierarchySlots;
+    RenderQueue renderQueue;
+
+    const Stopwatch linearWatch;
+    for (int repetition = 0; repetition < FRAME_REPETITIONS; ++repetition)
+        CullLinearly(frustum, nodes, linearSlots);
+    const double linearMs = linearWatch.GetMilliseconds() / FRAME_REPETITIONS;
+
+    const Stopwatch hierarchyWatch;
+    for (int repetition = 0; repetition < FRAME_REPETITIONS; ++repetition)
+        hierarchy.Cull(frustum, hierarchySlots);
+    const double hierarchyMs = hierarchyWatch.GetMilliseconds() / FRAME_REPETITIONS;
+
+    // Both find the very same nodes (in their own order).
+    std::sort(linearSlots.begin(), linearSlots.end());
+    std::vector<int> sortedSlots = hierarchySlots;
+    std::sort(sortedSlots.begin(), sortedSlots.end());
+    CHECK(sortedSlots == linearSlots);
+
+    const Stopwatch allWatch;
+    for (int repetition = 0; repetition < FRAME_REPETITIONS; ++repetition)
+        QueueNodes(nodes, allSlots, pEye, renderQueue);
+    const double allMs = allWatch.GetMilliseconds() / FRAME_REPETITIONS;
+
+    const Stopwatch culledWatch;
+    for (int repetition = 0; repetition < FRAME_REPETITIONS; ++repetition) {
+        hierarchy.Cull(frustum, hierarchySlots);
+        QueueNodes(nodes, hierarchySlots, pEye, renderQueue);
+    }
+    const double culledMs = culledWatch.GetMilliseconds() / FRAME_REPETITIONS;
+
+    CullingStatistics statistics;
+    hierarchy.GetCullingStatistics(&statistics);
+    CHECK(statistics.nodesDrawn == ((int) linearSlots.size()));
+    CHECK(statistics.nodesDrawn + statistics.nodesCulled == nodeCount);
+
+    std::printf("  %6d nodes, %s: %d drawn, %d tested (built in %.2f ms)\n",
+        nodeCount, pView, statistics.nodesDrawn, statistics.nodesTested, buildMs);
+    std::printf("    culling: linear %.3f ms, hierarchy %.3f ms (%.1fx)\n",
+        linearMs, hierarchyMs, linearMs / hierarchyMs);
+    std::printf("    frame: all nodes %.3f ms, culled %.3f ms (%.1fx)\n",
+        allMs, culledMs, allMs / culledMs);
+}
+
+// Frame times leave out the draw calls themselves (and the GPU), which
+// culling saves on as well, so they understate the difference it makes.
+//
+BENCHMARK(CullNodesThroughHierarchy)
+{
+    const float overview[3] = { SCENE_EXTENT * 0.5f, 10.0f, SCENE_EXTENT };
+    const float closeUp[3] = { SCENE_EXTENT * 0.3f, 10.0f, SCENE_EXTENT * 0.6f };
+    const int nodeCounts[] = { 1000, 10000, 100000 };
+
+    for (int index = 0; index < 3; ++index)
+    {
+        BenchmarkCulling(nodeCounts[index], &overview[0], 0.4142f,
+            SCENE_EXTENT * 2.0f, "overview");
+        BenchmarkCulling(nodeCounts[index], &closeUp[0], 0.4142f,
+            SCENE_EXTENT * 0.1f, "close-up");
+    }
+}
@@ -0,0 +1,400 @@
+// KernelTests.cpp : Every instruction set path of "GeometryKernels" (see
+// "Kernels.h") run on the same inputs, each expected to produce results
+// identical (bit for bit) to those of the scalar one.
+//
+
+#include "TestFramework.h"
+#include "Kernels.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+using namespace Dynamo::Bloodstone;
+using namespace Dynamo::Bloodstone::Tests;
+
+// Restores the widest instruction set supported when the test is done,
+// whether or not it fails (the kernels are shared by all tests).
+//
+class InstructionSetScope
+{
+public:
+    InstructionSetScope(void) :
+        mWidest(GeometryKernels::SetInstructionSet(InstructionSet::Avx))
+    {
+    }
+
+    ~InstructionSetScope(void)
+    {
+        GeometryKernels::SetInstructionSet(mWidest);
+    }
+
+    // Scalar, then every wider one the processor supports.
+    int GetCount(void) const
+    {
+        return ((int) mWidest) + 1;
+    }
+
+    InstructionSet Select(int index) const
+    {
+        return GeometryKernels::SetInstructionSet((InstructionSet) index);
+    }
+
+private:
+    InstructionSet mWidest;
+};
+
+static bool AreIdentical(const float* pFirst, const float* pSecond, std::size_t count)
+{
+    return std::memcmp(pFirst, pSecond, count * sizeof(float)) == 0;
+}
+
+// ================================================================================
+// Double to float conversion
+// ================================================================================
+
+// Values that round, overflow or underflow in every way there is, along
+// with those that are not a number and zeros of both signs.
+static std::vector<double> MakeConversionSource(std::size_t count)
+{
+    const double specials[] =
+    {
+        std::numeric_limits<double>::quiet_NaN(),
+        -std::numeric_limits<double>::quiet_NaN(),
+        0.0, -0.0,
+        std::numeric_limits<double>::infinity(),
+        -std::numeric_limits<double>::infinity(),
+        1.0e300, -1.0e300,                      // Overflow to infinity.
+        1.0e-300, -1.0e-300,                    // Underflow to zero.
+        std::numeric_limits<double>::denorm_min(),
+        1.0e-45, 3.0e-39,                       // Denormal floats.
+        1.0 + std::ldexp(1.0, -24),             // Tie, rounds down to even.
+        1.0 + 3.0 * std::ldexp(1.0, -24),       // Tie, rounds up to even.
+        3.4028235677973366e38,                  // Just too large for a float.
+        0.1, -123456.789
+    };
+
+    const std::size_t specialCount = sizeof(specials) / sizeof(specials[0]);
+
+    TestRandom random(7);
+    std::vector<double> source(count);
+    for (std::size_t index = 0; index < count; ++index)
+    {
+        if ((index % 3) == 0)
+            source[index] = specials[(index / 3) % specialCount];
+        else
+            source[index] = ((double) random.NextFloat(-1000.0f, 1000.0f)) / 3.0;
+    }
+
+    return source;
+}
+
+// Every length up to a few times the widest vector (eight doubles), so
+// each path has its remainder handled as well. Floats past the length
+// must be left as they were.
+//
+TEST(ConvertToFloatsMatchesAcrossInstructionSets)
+{
+    const InstructionSetScope scope;
+    const std::size_t maxCount = 67, padding = 9;
+    const auto source = MakeConversionSource(maxCount);
+
+    for (std::size_t count = 0; count <= maxCount; ++count)
+    {
+        std::vector<float> expected(maxCount + padding, 42.0f);
+        scope.Select(0);
+        GeometryKernels::ConvertToFloats(&source[0], &expected[0], count);
+
+        for (std::size_t index = 0; index < count; ++index) {
+            const float cast = ((float) source[index]);
+            CHECK(AreIdentical(&expected[index], &cast, 1));
+        }
+
+        for (int set = 1; set < scope.GetCount(); ++set)
+        {
+            std::vector<float> target(maxCount + padding, 42.0f);
+            CHECK(((int) scope.Select(set)) == set);
+            GeometryKernels::ConvertToFloats(&source[0], &target[0], count);
+            CHECK(AreIdentical(&target[0], &expected[0], target.size()));
+        }
+    }
+}
+
+// ================================================================================
+// Bounding box evaluation
+// ================================================================================
+
+enum class CoordinateRange
+{
+    Mixed, NotNegative, NotPositive
+};
+
+// Coordinates in the given range, with some of them not a number and
+// some of them zeros of either sign (which the bounds of the last two
+// ranges then are, on at least some axis).
+//
+static std::vector<float> MakeBoundsSource(unsigned int seed,
+    std::size_t vertexCount, CoordinateRange range)
+{
+    const float min = ((range == CoordinateRange::NotNegative) ? 0.0f : -10.0f);
+    const float max = ((range == CoordinateRange::NotPositive) ? 0.0f : 10.0f);
+
+    TestRandom random(seed);
+    std::vector<float> coordinates(vertexCount * 3);
+    for (std::size_t index = 0; index < coordinates.size(); ++index)
+    {
+        const unsigned int kind = random.NextInt() % 8;
+        if (kind == 0)
+            coordinates[index] = std::numeric_limits<float>::quiet_NaN();
+        else if (kind == 1)
+            coordinates[index] = 0.0f;
+        else if (kind == 2)
+            coordinates[index] = -0.0f;
+        else
+            coordinates[index] = random.NextFloat(min, max);
+    }
+
+    return coordinates;
+}
+
+static void CheckBoundsAcrossInstructionSets(const InstructionSetScope& scope,
+    const std::vector<float>& coordinates, std::size_t vertexCount)
+{
+    float expectedMin[3], expectedMax[3];
+    scope.Select(0);
+    GeometryKernels::EvaluateBounds(&coordinates[0], vertexCount,
+        &expectedMin[0], &expectedMax[0]);
+
+    for (int set = 1; set < scope.GetCount(); ++set)
+    {
+        float min[3], max[3];
+        CHECK(((int) scope.Select(set)) == set);
+        GeometryKernels::EvaluateBounds(&coordinates[0], vertexCount, &min[0], &max[0]);
+        CHECK(AreIdentical(&min[0], &expectedMin[0], 3));
+        CHECK(AreIdentical(&max[0], &expectedMax[0], 3));
+    }
+
+    // Whichever zeros were found, the corners are at positive ones.
+    const float zero = 0.0f;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (expectedMin[axis] == 0.0f)
+            CHECK(AreIdentical(&expectedMin[axis], &zero, 1));
+        if (expectedMax[axis] == 0.0f)
+            CHECK(AreIdentical(&expectedMax[axis], &zero, 1));
+    }
+}
+
+// Every vertex count up to a few times the widest vector (eight vertices).
+TEST(EvaluateBoundsMatchesAcrossInstructionSets)
+{
+    const InstructionSetScope scope;
+    const CoordinateRange ranges[] =
+    {
+        CoordinateRange::Mixed,
+        CoordinateRange::NotNegative,
+        CoordinateRange::NotPositive
+    };
+
+    for (std::size_t vertexCount = 1; vertexCount <= 41; ++vertexCount)
+    {
+        for (int range = 0; range < 3; ++range)
+        {
+            auto coordinates = MakeBoundsSource(((unsigned int) vertexCount),
+                vertexCount, ranges[range]);
+
+            // The first vertex is where bounds start out, so it is tried
+            // both as a number and as not a number (which then sticks).
+            coordinates[0] = coordinates[1] = coordinates[2] = 1.0f;
+            CheckBoundsAcrossInstructionSets(scope, coordinates, vertexCount);
+
+            coordinates[1] = std::numeric_limits<float>::quiet_NaN();
+            CheckBoundsAcrossInstructionSets(scope, coordinates, vertexCount);
+        }
+    }
+}
+
+TEST(EvaluateBoundsOfZerosAreAtPositiveZero)
+{
+    const InstructionSetScope scope;
+
+    for (std::size_t vertexCount = 1; vertexCount <= 17; ++vertexCount)
+    {
+        std::vector<float> coordinates(vertexCount * 3);
+        for (std::size_t index = 0; index < coordinates.size(); ++index)
+            coordinates[index] = (((index % 2) == 0) ? -0.0f : 0.0f);
+
+        CheckBoundsAcrossInstructionSets(scope, coordinates, vertexCount);
+    }
+}
+
+// ================================================================================
+// Ray/triangle intersection
+// ================================================================================
+
+#define GRID_CELLS 5
+
+// Position of vertex (column, row) of a slanted grid, with coordinates
+// that are not exactly representable (so edges are never axis aligned).
+static void GetGridVertex(int column, int row, float* pPosition)
+{
+    pPosition[0] = column * 0.7f + row * 0.1f;
+    pPosition[1] = row * 0.9f - column * 0.05f;
+    pPosition[2] = 1.0f + column * 0.3f + row * 0.2f;
+}
+
+// Two triangles for every cell (50 in all, so the last block has two
+// lanes that are unused), in blocks the way "PickGeometry" gathers them.
+//
+static std::vector<float> MakeGridBlocks(void)
+{
+    std::vector<float> triangles;
+    for (int row = 0; row < GRID_CELLS; ++row)
+    {
+        for (int column = 0; column < GRID_CELLS; ++column)
+        {
+            const int corners[6][2] =
+            {
+                { column, row }, { column + 1, row }, { column + 1, row + 1 },
+                { column, row }, { column + 1, row + 1 }, { column, row + 1 }
+            };
+
+            for (int corner = 0; corner < 6; ++corner) {
+                float position[3];
+                GetGridVertex(corners[corner][0], corners[corner][1], &position[0]);
+                triangles.insert(triangles.end(), &position[0], &position[3]);
+            }
+        }
+    }
+
+    const int triangleCount = ((int) triangles.size()) / 9;
+    const int blockCount = (triangleCount + 3) / 4;
+    std::vector<float> blocks(blockCount * 36, std::numeric_limits<float>::quiet_NaN());
+
+    for (int triangle = 0; triangle < triangleCount; ++triangle)
+    {
+        float* pBlock = &blocks[(triangle / 4) * 36];
+        for (int vertex = 0; vertex < 3; ++vertex)
+        {
+            for (int axis = 0; axis < 3; ++axis) {
+                pBlock[vertex * 12 + axis * 4 + (triangle % 4)] =
+                    triangles[triangle * 9 + vertex * 3 + axis];
+            }
+        }
+    }
+
+    return blocks;
+}
+
+// Points the rays go through: every vertex and the middle of every edge
+// inside the grid (each shared by two or more triangles), and the middle
+// of every cell (which is on the diagonal edge of its two triangles).
+//
+static std::vector<float> MakeSharedTargets(void)
+{
+    std::vector<float> targets;
+    for (int row = 1; row < GRID_CELLS * 2; ++row)
+    {
+        for (int column = 1; column < GRID_CELLS * 2; ++column)
+        {
+            float first[3], second[3];
+            GetGridVertex(column / 2, row / 2, &first[0]);
+            GetGridVertex((column + 1) / 2, (row + 1) / 2, &second[0]);
+
+            for (int axis = 0; axis < 3; ++axis)
+                targets.push_back((first[axis] + second[axis]) * 0.5f);
+        }
+    }
+
+    return targets;
+}
+
+// Directions straight and slanted on to either side of the grid, along
+// every axis (so that each of them ends up as the "z" of "KernelRay").
+//
+static std::vector<float> MakeDirections(void)
+{
+    const float directions[] =
+    {
+        0.0f, 0.0f, -1.0f,      0.0f, 0.0f, 1.0f,
+        0.3f, -0.2f, -1.0f,     -0.25f, 0.4f, 1.0f,
+        -1.0f, 0.3f, 0.5f,      1.0f, -0.1f, -0.6f,
+        0.2f, -1.0f, 0.4f,      -0.3f, 1.0f, -0.7f
+    };
+
+    return std::vector<float>(&directions[0],
+        &directions[0] + sizeof(directions) / sizeof(directions[0]));
+}
+
+static int CastRay(const float* pTarget, const float* pDirection,
+    const std::vector<float>& blocks, float* pDistance)
+{
+    float origin[3];
+    for (int axis = 0; axis < 3; ++axis)
+        origin[axis] = pTarget[axis] - 10.0f * pDirection[axis];
+
+    KernelRay ray;
+    GeometryKernels::PrepareRay(&origin[0], pDirection, &ray);
+
+    (*pDistance) = std::numeric_limits<float>::max();
+    return GeometryKernels::IntersectTriangles(ray, &blocks[0], blocks.size() / 36, pDistance);
+}
+
+static void CheckRaysAcrossInstructionSets(const InstructionSetScope& scope,
+    const std::vector<float>& blocks, const std::vector<float>& targets,
+    bool expectHits)
+{
+    const auto directions = MakeDirections();
+    for (std::size_t direction = 0; direction < directions.size(); direction += 3)
+    {
+        for (std::size_t target = 0; target < targets.size(); target += 3)
+        {
+            float expectedDistance = 0.0f;
+            scope.Select(0);
+            const int expected = CastRay(&targets[target],
+                &directions[direction], blocks, &expectedDistance);
+
+            if (expectHits)
+                CHECK(expected >= 0);
+
+            for (int set = 1; set < scope.GetCount(); ++set)
+            {
+                float distance = 0.0f;
+                CHECK(((int) scope.Select(set)) == set);
+                const int nearest = CastRay(&targets[target],
+                    &directions[direction], blocks, &distance);
+
+                CHECK(nearest == expected);
+                CHECK(AreIdentical(&distance, &expectedDistance, 1));
+                if (expectHits)
+                    CHECK(nearest >= 0);
+            }
+        }
+    }
+}
+
+// Watertight: however a ray goes through an edge or a vertex shared by
+// several triangles, one of them is hit (and the same one on every path).
+TEST(IntersectTrianglesHitsSharedEdgesAndVertices)
+{
+    const InstructionSetScope scope;
+    CheckRaysAcrossInstructionSets(scope, MakeGridBlocks(), MakeSharedTargets(), true);
+}
+
+// Rays anywhere around the grid, through it or past it.
+TEST(IntersectTrianglesMatchesAcrossInstructionSets)
+{
+    const InstructionSetScope scope;
+
+    TestRandom random(11);
+    std::vector<float> targets;
+    for (int target = 0; target < 200; ++target)
+    {
+        targets.push_back(random.NextFloat(-1.0f, GRID_CELLS * 0.8f + 1.0f));
+        targets.push_back(random.NextFloat(-1.0f, GRID_CELLS * 0.9f + 1.0f));
+        targets.push_back(random.NextFloat(0.0f, 4.0f));
+    }
+
+    CheckRaysAcrossInstructionSets(scope, MakeGridBlocks(), targets, false);
+}
@@ -0,0 +1,416 @@
+// MeshProcessingTests.cpp : What "MeshProcessor" makes of triangle meshes,
+// see "MeshProcessing.h".
+//
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h> // Window and device context types used by "Interfaces.h".
+
+#include "TestFramework.h"
+#include "MeshProcessing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace Dynamo::Bloodstone;
+using namespace Dynamo::Bloodstone::Tests;
+
+// Same as in "Scene.cpp".
+#define WELD_VERTEX_EPSILON             1.0e-5f
+#define WELD_NORMAL_EPSILON             1.0e-3f
+
+static void PushCorner(TriangleGeometryData& mesh, float x, float y, float z,
+    const float* pNormal, unsigned char red)
+{
+    mesh.PushVertex(x, y, z);
+    mesh.PushNormal(pNormal[0], pNormal[1], pNormal[2]);
+    mesh.PushColor(red, 0, 0, 255);
+}
+
+// Unit square at ("x", "y") on the x-y plane, as two triangles of three
+// vertices each (the way render packages give them).
+//
+static void PushSquare(TriangleGeometryData& mesh, float x, float y,
+    const float* pNormal, unsigned char red)
+{
+    PushCorner(mesh, x, y, 0.0f, pNormal, red);
+    PushCorner(mesh, x + 1.0f, y, 0.0f, pNormal, red);
+    PushCorner(mesh, x + 1.0f, y + 1.0f, 0.0f, pNormal, red);
+    PushCorner(mesh, x, y, 0.0f, pNormal, red);
+    PushCorner(mesh, x + 1.0f, y + 1.0f, 0.0f, pNormal, red);
+    PushCorner(mesh, x, y + 1.0f, 0.0f, pNormal, red);
+}
+
+static bool HasDegenerateTriangles(const TriangleGeometryData& mesh)
+{
+    const unsigned int* pIndices = mesh.GetIndices();
+    for (int index = 0; index < mesh.IndexCount(); index += 3)
+    {
+        if (pIndices[index] == pIndices[index + 1] || pIndices[index] == pIndices[index + 2])
+            return true;
+        if (pIndices[index + 1] == pIndices[index + 2])
+            return true;
+    }
+
+    return false;
+}
+
+TEST(WeldSharedVertices)
+{
+    const float up[] = { 0.0f, 0.0f, 1.0f };
+    TriangleGeometryData source(0), welded(0);
+    PushSquare(source, 0.0f, 0.0f, up, 0);
+    PushSquare(source, 1.0f, 0.0f, up, 0);
+
+    MeshProcessor::Weld(source, WELD_VERTEX_EPSILON, WELD_NORMAL_EPSILON, welded);
+    CHECK(welded.IndexCount() == 12);
+    CHECK(welded.VertexCount() == 6);
+    CHECK(HasDegenerateTriangles(welded) == false);
+}
+
+TEST(WeldVerticesFarFromOrigin)
+{
+    // Coordinates in cells of the epsilon go way past 32 bits out there,
+    // squares apart from one another must stay apart.
+    const float up[] = { 0.0f, 0.0f, 1.0f };
+    TriangleGeometryData source(0), welded(0);
+    PushSquare(source, 30000.0f, 0.0f, up, 0);
+    PushSquare(source, 40000.0f, 0.0f, up, 0);
+    PushSquare(source, -1.0e7f, 2.0e6f, up, 0);
+
+    MeshProcessor::Weld(source, WELD_VERTEX_EPSILON, WELD_NORMAL_EPSILON, welded);
+    CHECK(welded.IndexCount() == 18);
+    CHECK(welded.VertexCount() == 12);
+    CHECK(HasDegenerateTriangles(welded) == false);
+
+    // Adjacent squares still share their edge.
+    TriangleGeometryData adjacent(0), adjacentWelded(0);
+    PushSquare(adjacent, 1.0e6f, 1.0e6f, up, 0);
+    PushSquare(adjacent, 1.0e6f + 1.0f, 1.0e6f, up, 0);
+
+    MeshProcessor::Weld(adjacent, WELD_VERTEX_EPSILON, WELD_NORMAL_EPSILON, adjacentWelded);
+    CHECK(adjacentWelded.VertexCount() == 6);
+    CHECK(HasDegenerateTriangles(adjacentWelded) == false);
+}
+
+TEST(WeldKeepsDistinctNormals)
+{
+    // A crease: both squares have the same positions, their normals differ
+    // by far less than a unit but far more than the normal epsilon.
+    const float up[] = { 0.0f, 0.0f, 1.0f };
+    const float tilted[] = { 0.0f, 0.0099995f, 0.99995f };
+    TriangleGeometryData source(0), welded(0);
+    PushSquare(source, 0.0f, 0.0f, up, 0);
+    PushSquare(source, 0.0f, 0.0f, tilted, 0);
+
+    MeshProcessor::Weld(source, WELD_VERTEX_EPSILON, WELD_NORMAL_EPSILON, welded);
+    CHECK(welded.VertexCount() == 8);
+
+    // Normals that only differ by rounding are welded.
+    const float rounded[] = { 0.0f, 1.0e-6f, 1.0f };
+    TriangleGeometryData nearly(0), nearlyWelded(0);
+    PushSquare(nearly, 0.0f, 0.0f, up, 0);
+    PushSquare(nearly, 0.0f, 0.0f, rounded, 0);
+
+    MeshProcessor::Weld(nearly, WELD_VERTEX_EPSILON, WELD_NORMAL_EPSILON, nearlyWelded);
+    CHECK(nearlyWelded.VertexCount() == 4);
+}
+
+TEST(WeldKeepsColorSeams)
+{
+    // Adjacent squares of different colors keep the vertices of their
+    // shared edge apart, the seam would blend otherwise.
+    const float up[] = { 0.0f, 0.0f, 1.0f };
+    TriangleGeometryData source(0), welded(0);
+    PushSquare(source, 0.0f, 0.0f, up, 0);
+    PushSquare(source, 1.0f, 0.0f, up, 255);
+
+    MeshProcessor::Weld(source, WELD_VERTEX_EPSILON, WELD_NORMAL_EPSILON, welded);
+    CHECK(welded.VertexCount() == 8);
+    CHECK(welded.GetRgbaColors(0)[0] == 0);
+    CHECK(welded.GetRgbaColors(7)[0] == 255);
+}
+
+// A "cells" by "cells" grid of squares given in random order, welded.
+//
+static void MakeShuffledGrid(int cells, unsigned int seed, TriangleGeometryData& welded)
+{
+    std::vector<int> order(cells * cells);
+    for (int cell = 0; cell < cells * cells; ++cell)
+        order[cell] = cell;
+
+    TestRandom random(seed);
+    for (int cell = cells * cells - 1; cell > 0; --cell)
+        std::swap(order[cell], order[random.NextInt() % (cell + 1)]);
+
+    const float up[] = { 0.0f, 0.0f, 1.0f };
+    TriangleGeometryData source(cells * cells * 2);
+    for (int cell = 0; cell < cells * cells; ++cell)
+        PushSquare(source, ((float) (order[cell] % cells)), ((float) (order[cell] / cells)), up, 0);
+
+    MeshProcessor::Weld(source, WELD_VERTEX_EPSILON, WELD_NORMAL_EPSILON, welded);
+}
+
+TEST(OptimizeVertexCacheLowersMissRatio)
+{
+    TriangleGeometryData welded(0), optimized(0);
+    MakeShuffledGrid(64, 11, welded);
+    MeshProcessor::OptimizeVertexCache(welded, optimized);
+
+    // Same triangles, only in another order.
+    CHECK(optimized.IndexCount() == welded.IndexCount());
+    CHECK(optimized.VertexCount() == welded.VertexCount());
+
+    const int cacheSizes[] = { 16, 32 };
+    for (int size = 0; size < 2; ++size)
+    {
+        const auto before = MeshProcessor::AnalyzeVertexCache(welded, cacheSizes[size]);
+        const auto after = MeshProcessor::AnalyzeVertexCache(optimized, cacheSizes[size]);
+
+        // Random order misses nearly all four vertices of every square (two
+        // per triangle), the optimized one gets within reach of the 0.5 of
+        // a perfect grid.
+        CHECK(before.acmr > 1.9f);
+        CHECK(after.acmr < 0.8f);
+        CHECK(after.atvr < before.atvr);
+        CHECK(after.atvr >= 1.0f);
+    }
+}
+
+// Closed cube of "cells" by "cells" squares on each of its faces, wound
+// counter-clockwise as seen from outside (and with outward normals).
+//
+static void MakeCube(int cells, TriangleGeometryData& welded)
+{
+    const int corners[6][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 0 }, { 1, 1 }, { 0, 1 } };
+
+    TriangleGeometryData source(cells * cells * 12);
+    for (int face = 0; face < 6; ++face)
+    {
+        const int axis = face / 2;
+        const bool positive = ((face & 1) != 0);
+        float normal[3] = { 0.0f, 0.0f, 0.0f };
+        normal[axis] = (positive ? 1.0f : -1.0f);
+
+        // Tangents swap on the negative side, for the winding to flip.
+        const int u = (positive ? (axis + 1) % 3 : (axis + 2) % 3);
+        const int v = (positive ? (axis + 2) % 3 : (axis + 1) % 3);
+
+        for (int cell = 0; cell < cells * cells; ++cell)
+        {
+            for (int corner = 0; corner < 6; ++corner)
+            {
+                float position[3];
+                position[axis] = (positive ? ((float) cells) : 0.0f);
+                position[u] = ((float) ((cell % cells) + corners[corner][0]));
+                position[v] = ((float) ((cell / cells) + corners[corner][1]));
+                PushCorner(source, position[0], position[1], position[2], normal, 0);
+            }
+        }
+    }
+
+    MeshProcessor::Weld(source, WELD_VERTEX_EPSILON, WELD_NORMAL_EPSILON, welded);
+}
+
+// Positions of the corners of a triangle, starting from the lowest one (so
+// that the same triangle compares equal whatever corner it was given from).
+//
+struct TriangleCorners
+{
+    float coordinates[9];
+
+    bool operator<(const TriangleCorners& other) const
+    {
+        return std::lexicographical_compare(coordinates, coordinates + 9,
+            other.coordinates, other.coordinates + 9);
+    }
+
+    bool operator==(const TriangleCorners& other) const
+    {
+        return std::equal(coordinates, coordinates + 9, other.coordinates);
+    }
+};
+
+static std::vector<TriangleCorners> GetTriangleCorners(const TriangleGeometryData& mesh)
+{
+    std::vector<TriangleCorners> triangles(mesh.IndexCount() / 3);
+    const unsigned int* pIndices = mesh.GetIndices();
+    for (std::size_t triangle = 0; triangle < triangles.size(); ++triangle)
+    {
+        int lowest = 0;
+        for (int corner = 1; corner < 3; ++corner) {
+            const float* pCorner = mesh.GetCoordinates(pIndices[triangle * 3 + corner]);
+            const float* pLowest = mesh.GetCoordinates(pIndices[triangle * 3 + lowest]);
+            if (std::lexicographical_compare(pCorner, pCorner + 3, pLowest, pLowest + 3))
+                lowest = corner;
+        }
+
+        for (int corner = 0; corner < 3; ++corner) {
+            const unsigned int index = pIndices[triangle * 3 + ((lowest + corner) % 3)];
+            std::copy(mesh.GetCoordinates(index), mesh.GetCoordinates(index) + 3,
+                &triangles[triangle].coordinates[corner * 3]);
+        }
+    }
+
+    std::sort(triangles.begin(), triangles.end());
+    return triangles;
+}
+
+TEST(BuildClustersCoverAllIndices)
+{
+    const int clusterSize = 64;
+    TriangleGeometryData welded(0), clustered(0);
+    MakeShuffledGrid(32, 5, welded);
+    MeshProcessor::BuildClusters(welded, clusterSize, clustered);
+
+    // Clusters follow one another from the first index to the last, none
+    // of them empty or larger than asked for.
+    const MeshCluster* pClusters = clustered.GetClusters();
+    CHECK(clustered.ClusterCount() >= (welded.IndexCount() / 3) / clusterSize);
+
+    int nextIndex = 0;
+    for (int cluster = 0; cluster < clustered.ClusterCount(); ++cluster)
+    {
+        CHECK(pClusters[cluster].firstIndex == nextIndex);
+        CHECK(pClusters[cluster].indexCount > 0);
+        CHECK(pClusters[cluster].indexCount % 3 == 0);
+        CHECK(pClusters[cluster].indexCount <= clusterSize * 3);
+        nextIndex = pClusters[cluster].firstIndex + pClusters[cluster].indexCount;
+
+        // A grid is open, drawn from both sides.
+        CHECK(pClusters[cluster].coneAngle < 0.0f);
+    }
+
+    CHECK(nextIndex == clustered.IndexCount());
+
+    // Same triangles (with the same winding), only in another order.
+    CHECK(clustered.IndexCount() == welded.IndexCount());
+    CHECK(GetTriangleCorners(clustered) == GetTriangleCorners(welded));
+}
+
+TEST(BuildClustersBoundTheirTriangles)
+{
+    TriangleGeometryData welded(0), clustered(0);
+    MakeCube(8, welded);
+    MeshProcessor::BuildClusters(welded, 32, clustered);
+
+    const MeshCluster* pClusters = clustered.GetClusters();
+    const unsigned int* pIndices = clustered.GetIndices();
+    CHECK(clustered.ClusterCount() > 6);
+
+    int conedClusters = 0;
+    for (int cluster = 0; cluster < clustered.ClusterCount(); ++cluster)
+    {
+        const MeshCluster& current = pClusters[cluster];
+        const int endIndex = current.firstIndex + current.indexCount;
+        for (int index = current.firstIndex; index < endIndex; ++index)
+        {
+            // Every corner is within the bounding sphere.
+            const float* pCoordinates = clustered.GetCoordinates(pIndices[index]);
+            const float dx = pCoordinates[0] - current.center[0];
+            const float dy = pCoordinates[1] - current.center[1];
+            const float dz = pCoordinates[2] - current.center[2];
+            const float limit = current.radius * 1.0001f;
+            CHECK((dx * dx) + (dy * dy) + (dz * dz) <= limit * limit);
+
+            // The outward normal of every triangle is within the cone, were
+            // the cone facing inwards the cluster would be culled when seen.
+            if (current.coneAngle >= 0.0f) {
+                const float* pNormal = clustered.GetNormalCoords(pIndices[index]);
+                const float dot = (pNormal[0] * current.coneAxis[0]) +
+                    (pNormal[1] * current.coneAxis[1]) + (pNormal[2] * current.coneAxis[2]);
+                CHECK(dot >= std::cos(current.coneAngle) - 1.0e-4f);
+            }
+        }
+
+        if (current.coneAngle >= 0.0f) {
+            CHECK(current.coneAngle < 1.5707963f);
+            conedClusters++;
+        }
+    }
+
+    // Clusters within a single face of the cube can all face away.
+    CHECK(conedClusters > 0);
+}
+
+// Whether "mesh" has a vertex at ("x", "y", 0).
+//
+static bool HasVertexAt(const TriangleGeometryData& mesh, float x, float y)
+{
+    for (int vertex = 0; vertex < mesh.VertexCount(); ++vertex) {
+        const float* pCoordinates = mesh.GetCoordinates(vertex);
+        if (pCoordinates[0] == x && pCoordinates[1] == y && pCoordinates[2] == 0.0f)
+            return true;
+    }
+
+    return false;
+}
+
+TEST(SimplifyReachesTriangleTarget)
+{
+    TriangleGeometryData welded(0), simplified(0);
+    MakeShuffledGrid(64, 3, welded);
+
+    const int targetTriangleCount = (welded.IndexCount() / 3) / 4;
+    MeshProcessor::Simplify(welded, targetTriangleCount, simplified);
+    CHECK(simplified.IndexCount() / 3 <= targetTriangleCount);
+    CHECK(simplified.IndexCount() / 3 > targetTriangleCount / 2);
+    CHECK(simplified.IndexCount() % 3 == 0);
+    CHECK(HasDegenerateTriangles(simplified) == false);
+
+    // Collapses move vertices onto their neighbours, none end up anywhere
+    // new (and nothing is left unreferenced).
+    CHECK(simplified.VertexCount() < welded.VertexCount());
+    for (int vertex = 0; vertex < simplified.VertexCount(); ++vertex) {
+        const float* pCoordinates = simplified.GetCoordinates(vertex);
+        CHECK(HasVertexAt(welded, pCoordinates[0], pCoordinates[1]));
+    }
+
+    std::vector<char> referenced(simplified.VertexCount(), 0);
+    for (int index = 0; index < simplified.IndexCount(); ++index)
+        referenced[simplified.GetIndices()[index]] = 1;
+    CHECK(std::find(referenced.begin(), referenced.end(), 0) == referenced.end());
+
+    // A target above what there is leaves the mesh as it is.
+    TriangleGeometryData unchanged(0);
+    MeshProcessor::Simplify(welded, welded.IndexCount(), unchanged);
+    CHECK(unchanged.IndexCount() == welded.IndexCount());
+}
+
+TEST(SimplifyKeepsBoundariesAndSeams)
+{
+    // Left and right halves of a grid differ in color, welding keeps the
+    // vertices along the middle apart (a seam, as much an outline as the
+    // open boundary all around).
+    const int cells = 32;
+    const float up[] = { 0.0f, 0.0f, 1.0f };
+    TriangleGeometryData source(cells * cells * 2), welded(0), simplified(0);
+    for (int cell = 0; cell < cells * cells; ++cell) {
+        const int x = cell % cells, y = cell / cells;
+        PushSquare(source, ((float) x), ((float) y), up, ((x < cells / 2) ? 0 : 255));
+    }
+
+    MeshProcessor::Weld(source, WELD_VERTEX_EPSILON, WELD_NORMAL_EPSILON, welded);
+    MeshProcessor::Simplify(welded, 16, simplified);
+    CHECK(simplified.IndexCount() / 3 < welded.IndexCount() / 3);
+    CHECK(HasDegenerateTriangles(simplified) == false);
+
+    for (int step = 0; step <= cells; ++step)
+    {
+        const float at = ((float) step);
+        CHECK(HasVertexAt(simplified, at, 0.0f));
+        CHECK(HasVertexAt(simplified, at, ((float) cells)));
+        CHECK(HasVertexAt(simplified, 0.0f, at));
+        CHECK(HasVertexAt(simplified, ((float) cells), at));
+        CHECK(HasVertexAt(simplified, ((float) (cells / 2)), at));
+    }
+
+    // Colors stay on their side of the seam.
+    for (int vertex = 0; vertex < simplified.VertexCount(); ++vertex)
+    {
+        const float x = simplified.GetCoordinates(vertex)[0];
+        const unsigned char red = simplified.GetRgbaColors(vertex)[0];
+        if (x != ((float) (cells / 2)))
+            CHECK(red == ((x < ((float) (cells / 2))) ? 0 : 255));
+    }
+}
@@ -0,0 +1,199 @@
+// NodeTableTests.cpp : Keys, slots and handles of "NodeTable", see
+// "NodeTable.h" (with nodes that only hold on to their key).
+//
+
+#include "TestFramework.h"
+#include "NodeTable.h"
+
+#include <vector>
+
+using namespace Dynamo::Bloodstone;
+using namespace Dynamo::Bloodstone::Tests;
+
+// Nodes alive at any one time, for the table to be seen deleting them.
+static int liveNodeCount = 0;
+
+class TestNode
+{
+public:
+    TestNode(const NodeKey& nodeKey) : mNodeKey(nodeKey)
+    {
+        liveNodeCount++;
+    }
+
+    ~TestNode(void)
+    {
+        liveNodeCount--;
+    }
+
+    const NodeKey& GetNodeKey(void) const
+    {
+        return this->mNodeKey;
+    }
+
+private:
+    NodeKey mNodeKey;
+};
+
+typedef NodeTable<TestNode> TestNodeTable;
+
+static NodeKey MakeKey(TestRandom& random)
+{
+    NodeKey key;
+    key.high = (((unsigned long long) random.NextInt()) << 32) | random.NextInt();
+    key.low = (((unsigned long long) random.NextInt()) << 32) | random.NextInt();
+    return key;
+}
+
+// Bucket the key hashes to in a table of the minimum size.
+static int GetHomeBucket(const NodeKey& key)
+{
+    return ((int) (NodeKeyHasher()(key) & (NODE_TABLE_MINIMUM_BUCKETS - 1)));
+}
+
+// "count" keys that all hash to "bucket", the table probes from one to
+// the next of them (and on past the end of the buckets for the last one).
+//
+static std::vector<NodeKey> MakeCollidingKeys(int bucket, int count, TestRandom& random)
+{
+    std::vector<NodeKey> keys;
+    while (((int) keys.size()) < count)
+    {
+        const NodeKey key = MakeKey(random);
+        if (GetHomeBucket(key) == bucket)
+            keys.push_back(key);
+    }
+
+    return keys;
+}
+
+static bool Contains(const TestNodeTable& table, const NodeKey& key)
+{
+    const auto pNode = table.GetNode(table.Find(key));
+    return pNode != nullptr && pNode->GetNodeKey() == key;
+}
+
+TEST(NodeTableRemovesWithinCollisionChains)
+{
+    // Chains of the last bucket wrap around to the first ones, where keys
+    // of their own follow.
+    TestRandom random(17);
+    const int lastBucket = NODE_TABLE_MINIMUM_BUCKETS - 1;
+    const auto chain = MakeCollidingKeys(lastBucket, 4, random);
+    const auto next = MakeCollidingKeys(0, 2, random);
+
+    for (int removed = 0; removed < 4; ++removed)
+    {
+        TestNodeTable table;
+        for (std::size_t index = 0; index < chain.size(); ++index)
+            table.Insert(chain[index]);
+        for (std::size_t index = 0; index < next.size(); ++index)
+            table.Insert(next[index]);
+
+        table.Remove(table.Find(chain[removed]));
+        CHECK(table.GetNodeCount() == 5);
+        CHECK(table.IsValid(table.Find(chain[removed])) == false);
+
+        // Keys probed past the removed one are all still found.
+        for (int index = 0; index < 4; ++index)
+            CHECK(Contains(table, chain[index]) == (index != removed));
+        for (std::size_t index = 0; index < next.size(); ++index)
+            CHECK(Contains(table, next[index]));
+
+        // Removing what is left one by one keeps finding the rest.
+        table.Remove(table.Find(next[0]));
+        CHECK(Contains(table, next[1]));
+        for (int index = 0; index < 4; ++index) {
+            if (index != removed) {
+                table.Remove(table.Find(chain[index]));
+                CHECK(Contains(table, next[1]));
+            }
+        }
+
+        CHECK(table.GetNodeCount() == 1);
+    }
+
+    CHECK(liveNodeCount == 0);
+}
+
+TEST(NodeTableRejectsStaleHandles)
+{
+    TestRandom random(23);
+    const NodeKey first = MakeKey(random);
+    const NodeKey second = MakeKey(random);
+
+    TestNodeTable table;
+    const NodeHandle removed = table.Insert(first);
+    table.Remove(removed);
+    CHECK(table.IsValid(removed) == false);
+    CHECK(liveNodeCount == 0);
+
+    // The slot is reused by the next node, but not for the old handle.
+    const NodeHandle inserted = table.Insert(second);
+    CHECK(inserted.slot == removed.slot);
+    CHECK(inserted.generation != removed.generation);
+    CHECK(table.IsValid(removed) == false);
+    CHECK(table.GetNode(removed) == nullptr);
+    CHECK(table.IsValid(table.Find(first)) == false);
+    CHECK(table.GetNode(inserted)->GetNodeKey() == second);
+
+    // Removing through the stale handle leaves the new node alone.
+    table.Remove(removed);
+    CHECK(table.GetNodeCount() == 1);
+    CHECK(Contains(table, second));
+
+    // Same after all nodes are cleared.
+    table.Clear();
+    CHECK(table.IsValid(inserted) == false);
+    const NodeHandle again = table.Insert(second);
+    CHECK(table.IsValid(inserted) == false);
+    CHECK(table.IsValid(again));
+    CHECK(liveNodeCount == 1);
+}
+
+TEST(NodeTableGrows)
+{
+    const int count = NODE_TABLE_MINIMUM_BUCKETS * 40;
+    TestRandom random(29);
+    std::vector<NodeKey> keys(count);
+    std::vector<NodeHandle> handles(count);
+
+    TestNodeTable table;
+    for (int index = 0; index < count; ++index) {
+        keys[index] = MakeKey(random);
+        handles[index] = table.Insert(keys[index]);
+    }
+
+    // Handles survive every rehash on the way, slots stay dense.
+    CHECK(table.GetNodeCount() == count);
+    CHECK(table.GetSlotCount() == count);
+    for (int index = 0; index < count; ++index)
+    {
+        const NodeHandle found = table.Find(keys[index]);
+        CHECK(found.slot == handles[index].slot);
+        CHECK(table.GetNode(handles[index])->GetNodeKey() == keys[index]);
+
+        // Inserting again gives back the node that is there.
+        const NodeHandle existing = table.Insert(keys[index]);
+        CHECK(existing.slot == handles[index].slot);
+    }
+
+    CHECK(table.GetNodeCount() == count);
+
+    // Every other node goes, their slots are taken by the same number of
+    // new nodes rather than new slots being added.
+    for (int index = 0; index < count; index += 2)
+        table.Remove(handles[index]);
+    for (int index = 0; index < count; index += 2) {
+        keys[index] = MakeKey(random);
+        handles[index] = table.Insert(keys[index]);
+    }
+
+    CHECK(table.GetSlotCount() == count);
+    for (int index = 0; index < count; ++index)
+        CHECK(Contains(table, keys[index]));
+
+    table.Clear();
+    CHECK(table.GetNodeCount() == 0);
+    CHECK(liveNodeCount == 0);
+}
@@ -0,0 +1,213 @@
+// QuantizationTests.cpp : Error bounds of quantized vertex attributes, see
+// "PositionQuantizer" and "OctahedralNormal" in "Quantization.h".
+//
+
+#include "TestFramework.h"
+#include "Quantization.h"
+
+#include <cmath>
+#include <vector>
+
+using namespace Dynamo::Bloodstone;
+using namespace Dynamo::Bloodstone::Tests;
+
+// Quantizes every position against the bounds of all of them (the way
+// "VertexBuffer" does) and checks the reconstructed ones, returning the
+// largest error found relative to the bound (at most 1.0 when it holds).
+//
+static float CheckPositions(const std::vector<float>& positions)
+{
+    float min[3], max[3];
+    for (int axis = 0; axis < 3; ++axis)
+        min[axis] = max[axis] = positions[axis];
+
+    for (std::size_t index = 0; index < positions.size(); index += 3)
+    {
+        for (int axis = 0; axis < 3; ++axis) {
+            const float value = positions[index + axis];
+            min[axis] = ((value < min[axis]) ? value : min[axis]);
+            max[axis] = ((value > max[axis]) ? value : max[axis]);
+        }
+    }
+
+    const PositionQuantizer quantizer(&min[0], &max[0]);
+
+    float worst = 0.0f;
+    for (std::size_t index = 0; index < positions.size(); index += 3)
+    {
+        unsigned short quantized[3];
+        float reconstructed[3];
+        quantizer.Quantize(&positions[index], &quantized[0]);
+        quantizer.Dequantize(&quantized[0], &reconstructed[0]);
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            const float error = std::fabs(reconstructed[axis] - positions[index + axis]);
+            const float bound = quantizer.GetErrorBound(axis);
+            CHECK(error <= bound);
+
+            const float relative = ((bound > 0.0f) ? (error / bound) : 0.0f);
+            worst = ((relative > worst) ? relative : worst);
+        }
+    }
+
+    return worst;
+}
+
+static std::vector<float> MakeRandomPositions(unsigned int seed, int count,
+    const float* pCenter, const float* pExtent)
+{
+    TestRandom random(seed);
+    std::vector<float> positions(count * 3);
+    for (int index = 0; index < count * 3; ++index) {
+        const int axis = index % 3;
+        positions[index] = random.NextFloat(
+            pCenter[axis] - pExtent[axis], pCenter[axis] + pExtent[axis]);
+    }
+
+    return positions;
+}
+
+TEST(QuantizePositionsAroundOrigin)
+{
+    const float center[] = { 0.0f, 0.0f, 0.0f };
+    const float extent[] = { 1.0f, 25.0f, 0.001f };
+    CHECK(CheckPositions(MakeRandomPositions(1, 50000, center, extent)) <= 1.0f);
+}
+
+TEST(QuantizePositionsWithLargeOffsets)
+{
+    // Site coordinates of linked models are often far from the origin,
+    // where a float has few bits left below the decimal point.
+    const float center[] = { 250000.0f, -4000000.0f, 120.0f };
+    const float extent[] = { 50.0f, 2.5f, 60.0f };
+    CHECK(CheckPositions(MakeRandomPositions(2, 50000, center, extent)) <= 1.0f);
+
+    const float largeCenter[] = { 1.0e7f, 1.0e7f, -1.0e7f };
+    const float largeExtent[] = { 1.0e6f, 10.0f, 1.0e-2f };
+    CHECK(CheckPositions(MakeRandomPositions(3, 50000, largeCenter, largeExtent)) <= 1.0f);
+}
+
+TEST(QuantizePositionsOfDegenerateBounds)
+{
+    // Flat along one axis, a line along two and a single point.
+    const float center[] = { 10.0f, -3.0f, 7.5f };
+    const float flat[] = { 5.0f, 5.0f, 0.0f };
+    const float line[] = { 0.0f, 8.0f, 0.0f };
+    const float point[] = { 0.0f, 0.0f, 0.0f };
+
+    CHECK(CheckPositions(MakeRandomPositions(4, 1000, center, flat)) <= 1.0f);
+    CHECK(CheckPositions(MakeRandomPositions(5, 1000, center, line)) <= 1.0f);
+    CHECK(CheckPositions(MakeRandomPositions(6, 1000, center, point)) <= 1.0f);
+
+    // No extent means no error at all along that axis.
+    const float min[] = { 1.0f, 2.0f, 3.0f };
+    const float max[] = { 4.0f, 2.0f, 3.0f };
+    const PositionQuantizer quantizer(&min[0], &max[0]);
+
+    const float position[] = { 2.0f, 2.0f, 3.0f };
+    unsigned short quantized[3];
+    float reconstructed[3];
+    quantizer.Quantize(&position[0], &quantized[0]);
+    quantizer.Dequantize(&quantized[0], &reconstructed[0]);
+
+    CHECK(quantized[1] == 0 && quantized[2] == 0);
+    CHECK(reconstructed[1] == 2.0f && reconstructed[2] == 3.0f);
+}
+
+TEST(QuantizePositionsOfBoxCorners)
+{
+    const float min[] = { -3.0f, 100.0f, 0.25f };
+    const float max[] = { 7.0f, 100.5f, 1.0e4f };
+    const PositionQuantizer quantizer(&min[0], &max[0]);
+
+    unsigned short quantized[3];
+    quantizer.Quantize(&min[0], &quantized[0]);
+    CHECK(quantized[0] == 0 && quantized[1] == 0 && quantized[2] == 0);
+
+    quantizer.Quantize(&max[0], &quantized[0]);
+    CHECK(quantized[0] == 0xffff && quantized[1] == 0xffff && quantized[2] == 0xffff);
+
+    float reconstructed[3];
+    quantizer.Dequantize(&quantized[0], &reconstructed[0]);
+    for (int axis = 0; axis < 3; ++axis)
+        CHECK(std::fabs(reconstructed[axis] - max[axis]) <= quantizer.GetErrorBound(axis));
+
+    // Anything outside of the box is clamped onto it.
+    const float outside[] = { -10.0f, 200.0f, 0.25f };
+    quantizer.Quantize(&outside[0], &quantized[0]);
+    CHECK(quantized[0] == 0 && quantized[1] == 0xffff && quantized[2] == 0);
+}
+
+TEST(EncodeOctahedralNormals)
+{
+    // Every axis direction, then normals spread all over the sphere.
+    std::vector<float> normals;
+    const float axes[] = {
+        1.0f, 0.0f, 0.0f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f,
+        0.0f, -1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, -1.0f
+    };
+
+    normals.insert(normals.end(), &axes[0], &axes[0] + 18);
+
+    TestRandom random(7);
+    for (int index = 0; index < 100000; ++index)
+    {
+        float normal[3];
+        float length = 0.0f;
+        do {
+            normal[0] = random.NextFloat(-1.0f, 1.0f);
+            normal[1] = random.NextFloat(-1.0f, 1.0f);
+            normal[2] = random.NextFloat(-1.0f, 1.0f);
+            length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+        } while (length < 0.01f || length > 1.0f);
+
+        normals.push_back(normal[0] / length);
+        normals.push_back(normal[1] / length);
+        normals.push_back(normal[2] / length);
+    }
+
+    // Two 16-bit components keep normals within about 0.004 degrees (the
+    // angle is taken from both the sine and cosine, in double precision,
+    // for it to still be accurate that close to zero).
+    const double maximumAngle = 0.01 * 3.14159265358979 / 180.0;
+
+    for (std::size_t index = 0; index < normals.size(); index += 3)
+    {
+        short u = 0, v = 0;
+        float decoded[3];
+        OctahedralNormal::Encode(&normals[index], &u, &v);
+        OctahedralNormal::Decode(u, v, &decoded[0]);
+
+        const double n[] = { normals[index], normals[index + 1], normals[index + 2] };
+        const double d[] = { decoded[0], decoded[1], decoded[2] };
+
+        const double cosine = n[0] * d[0] + n[1] * d[1] + n[2] * d[2];
+        const double cross[] = {
+            n[1] * d[2] - n[2] * d[1],
+            n[2] * d[0] - n[0] * d[2],
+            n[0] * d[1] - n[1] * d[0]
+        };
+
+        const double sine = std::sqrt(cross[0] * cross[0] +
+            cross[1] * cross[1] + cross[2] * cross[2]);
+
+        CHECK(std::atan2(sine, cosine) <= maximumAngle);
+    }
+}
+
+TEST(EncodeDegeneratedNormals)
+{
+    const float zero[] = { 0.0f, 0.0f, 0.0f };
+    const float notANumber[] = { std::sqrt(-1.0f), 0.0f, 1.0f };
+
+    short u = 1, v = 1;
+    float decoded[3];
+    OctahedralNormal::Encode(&zero[0], &u, &v);
+    OctahedralNormal::Decode(u, v, &decoded[0]);
+    CHECK(u == 0 && v == 0);
+    CHECK(decoded[0] == 0.0f && decoded[1] == 0.0f && decoded[2] == 1.0f);
+
+    OctahedralNormal::Encode(&notANumber[0], &u, &v);
+    CHECK(u == 0 && v == 0);
+}
@@ -0,0 +1,173 @@
+// RenderQueueTests.cpp : Order of draw items, see "RenderQueue" (the sort
+// keys and the radix sort of them).
+//
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h> // Window and device context types used by "Interfaces.h".
+
+#include "TestFramework.h"
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace Dynamo::Bloodstone;
+using namespace Dynamo::Bloodstone::Tests;
+
+// Lit and quantized.
+#define LIT_QUANTIZED ((ShaderFeatures) (((int) ShaderFeatures::Lit) | ((int) ShaderFeatures::Quantized)))
+
+struct QueuedItem
+{
+    bool translucent;
+    ShaderFeatures features;
+    IVertexBuffer::PrimitiveType primitiveType;
+    float distance;
+};
+
+// Items of every kind at random distances, each added with its index for
+// a state row (which is how they are told apart once sorted).
+//
+static std::vector<QueuedItem> QueueRandomItems(unsigned int seed,
+    int count, RenderQueue& renderQueue)
+{
+    const ShaderFeatures features[] =
+    {
+        ShaderFeatures::None, ShaderFeatures::Lit,
+        ShaderFeatures::Quantized, LIT_QUANTIZED
+    };
+
+    const IVertexBuffer::PrimitiveType primitiveTypes[] =
+    {
+        IVertexBuffer::PrimitiveType::Point,
+        IVertexBuffer::PrimitiveType::LineStrip,
+        IVertexBuffer::PrimitiveType::Triangle
+    };
+
+    TestRandom random(seed);
+    std::vector<QueuedItem> items(count);
+    renderQueue.Clear();
+
+    for (int index = 0; index < count; ++index)
+    {
+        QueuedItem& item = items[index];
+        item.translucent = ((random.NextInt() & 0x100) != 0);
+        item.features = features[(random.NextInt() >> 8) % 4];
+        item.primitiveType = primitiveTypes[(random.NextInt() >> 8) % 3];
+        item.distance = random.NextFloat(0.0f, 5000.0f);
+
+        // Some items share their distance, as all buffers of a node do.
+        if (index > 0 && (random.NextInt() & 0x300) == 0)
+            item.distance = items[index - 1].distance;
+
+        renderQueue.Add(RenderQueue::MakeKey(item.translucent, item.features,
+            item.primitiveType, item.distance), nullptr, index);
+    }
+
+    return items;
+}
+
+struct KeyOrder
+{
+    const DrawItem* pItems;
+    bool operator()(int a, int b) const
+    {
+        return pItems[a].key < pItems[b].key;
+    }
+};
+
+TEST(SortRenderQueueMatchesStableSort)
+{
+    for (int round = 0; round < 4; ++round)
+    {
+        const int count = ((round == 0) ? 2 : 1000 * round * round);
+        RenderQueue renderQueue;
+        QueueRandomItems(round + 1, count, renderQueue);
+
+        // Indices of the items (their state rows) in the order they are
+        // expected in, by key and otherwise as they were added.
+        std::vector<DrawItem> added(renderQueue.GetItems(), renderQueue.GetItems() + count);
+        std::vector<int> expected(count);
+        for (int index = 0; index < count; ++index)
+            expected[index] = index;
+
+        KeyOrder order = { &added[0] };
+        std::stable_sort(expected.begin(), expected.end(), order);
+
+        renderQueue.Sort();
+        CHECK(renderQueue.GetItemCount() == count);
+        for (int index = 0; index < count; ++index)
+            CHECK(renderQueue.GetItems()[index].stateRow == expected[index]);
+    }
+}
+
+TEST(SortBlendedItemsBackToFront)
+{
+    RenderQueue renderQueue;
+    const auto items = QueueRandomItems(7, 5000, renderQueue);
+    renderQueue.Sort();
+
+    // Opaque items first, grouped by what they are drawn with and front
+    // to back within each group. Blended items then go back to front,
+    // whatever they are drawn with.
+    const DrawItem* pSorted = renderQueue.GetItems();
+    bool blended = false;
+    for (int index = 0; index < renderQueue.GetItemCount(); ++index)
+    {
+        const QueuedItem& item = items[pSorted[index].stateRow];
+        CHECK(RenderQueue::GetShaderFeatures(pSorted[index].key) == item.features);
+
+        if (item.translucent == false) {
+            CHECK(blended == false);
+            continue;
+        }
+
+        blended = true;
+        if (index == 0 || items[pSorted[index - 1].stateRow].translucent == false)
+            continue;
+
+        // Distances are compared to the precision the keys keep of them.
+        const QueuedItem& previous = items[pSorted[index - 1].stateRow];
+        CHECK(previous.distance >= item.distance * 0.999f);
+    }
+
+    CHECK(blended);
+
+    int opaque = 0;
+    while (items[pSorted[opaque].stateRow].translucent == false)
+        opaque++;
+
+    for (int index = 1; index < opaque; ++index)
+    {
+        const QueuedItem& previous = items[pSorted[index - 1].stateRow];
+        const QueuedItem& item = items[pSorted[index].stateRow];
+        if (previous.features == item.features && previous.primitiveType == item.primitiveType)
+            CHECK(previous.distance <= item.distance * 1.001f);
+    }
+}
+
+TEST(MakeKeysOfBlendedItemsByDistanceFirst)
+{
+    // Closer blended items go after farther ones, whatever the features
+    // and primitives of either one.
+    const auto near = RenderQueue::MakeKey(true, ShaderFeatures::None,
+        IVertexBuffer::PrimitiveType::Point, 10.0f);
+    const auto far = RenderQueue::MakeKey(true, LIT_QUANTIZED,
+        IVertexBuffer::PrimitiveType::Triangle, 100.0f);
+    CHECK(far < near);
+
+    // Opaque items are grouped by their features ahead of their distance.
+    const auto opaqueNear = RenderQueue::MakeKey(false, ShaderFeatures::Lit,
+        IVertexBuffer::PrimitiveType::Triangle, 10.0f);
+    const auto opaqueFar = RenderQueue::MakeKey(false, ShaderFeatures::Lit,
+        IVertexBuffer::PrimitiveType::Triangle, 100.0f);
+    const auto opaqueOther = RenderQueue::MakeKey(false, LIT_QUANTIZED,
+        IVertexBuffer::PrimitiveType::Triangle, 1.0f);
+    CHECK(opaqueNear < opaqueFar);
+    CHECK(opaqueFar < opaqueOther);
+    CHECK(opaqueOther < far);
+
+    // Sorted bits are all there is to keys.
+    CHECK((near & 0xffffffffull) == 0);
+    CHECK((opaqueOther & 0xffffffffull) == 0);
+}
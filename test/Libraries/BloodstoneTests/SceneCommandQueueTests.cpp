@@ -0,0 +1,163 @@
+// SceneCommandQueueTests.cpp : Changes recorded ahead of a frame, see
+// "SceneCommandQueue" (only the last change to each node is kept).
+//
+
+#include "TestFramework.h"
+#include "SceneCommandQueue.h"
+
+using namespace Dynamo::Bloodstone;
+using namespace Dynamo::Bloodstone::Tests;
+
+// Values of "RenderMode" (which is managed).
+#define RENDER_MODE_SHADED      0
+#define RENDER_MODE_PRIMITIVE   1
+
+static NodeKey MakeKey(unsigned long long value)
+{
+    NodeKey key;
+    key.high = value;
+    key.low = ~value;
+    return key;
+}
+
+// Command of the node, or nullptr if nothing is recorded for it.
+static const NodeCommand* FindCommand(const SceneCommandQueue& queue, const NodeKey& key)
+{
+    for (int index = 0; index < queue.GetCommandCount(); ++index) {
+        if (queue.GetCommand(index).key == key)
+            return &queue.GetCommand(index);
+    }
+
+    return nullptr;
+}
+
+TEST(SceneCommandQueueKeepsLastWritePerNode)
+{
+    const NodeKey first = MakeKey(1), second = MakeKey(2);
+    const float red[] = { 1.0f, 0.0f, 0.0f, 1.0f };
+    const float blue[] = { 0.0f, 0.0f, 1.0f, 0.5f };
+
+    SceneCommandQueue queue;
+    CHECK(queue.IsEmpty());
+
+    queue.SetColor(second, red);
+    queue.SetColor(first, red);
+    queue.SetSelection(second, true);
+    queue.SetColor(second, blue);
+    queue.SetSelection(second, false);
+    queue.SetRenderMode(first, RENDER_MODE_PRIMITIVE);
+    queue.SetRenderMode(first, RENDER_MODE_SHADED);
+
+    // One command per node, in the order nodes were first mentioned.
+    CHECK(queue.IsEmpty() == false);
+    CHECK(queue.GetCommandCount() == 2);
+    CHECK(queue.GetCommand(0).key == second);
+    CHECK(queue.GetCommand(1).key == first);
+
+    const NodeCommand& command = queue.GetCommand(0);
+    CHECK(command.setColor);
+    CHECK(command.rgbaColor[2] == 1.0f && command.rgbaColor[3] == 0.5f);
+    CHECK(command.selection == 0);
+    CHECK(command.setRenderMode == false);
+    CHECK(queue.GetCommand(1).setRenderMode);
+    CHECK(queue.GetCommand(1).renderMode == RENDER_MODE_SHADED);
+    CHECK(queue.GetCommand(1).selection == -1);
+
+    // Later packages of a node replace the earlier one where it is.
+    CHECK(queue.SetPackage(first) == 0);
+    CHECK(queue.SetPackage(second) == 1);
+    CHECK(queue.SetPackage(first) == 0);
+    CHECK(queue.GetPackageCount() == 2);
+    CHECK(queue.GetCommandCount() == 2);
+    CHECK(queue.GetCommand(1).packageIndex == 0);
+
+    queue.Clear();
+    CHECK(queue.IsEmpty());
+    CHECK(queue.GetPackageCount() == 0);
+    CHECK(FindCommand(queue, first) == nullptr);
+}
+
+TEST(SceneCommandQueueRemovesAfterAdd)
+{
+    const NodeKey removed = MakeKey(3), kept = MakeKey(4);
+    const float green[] = { 0.0f, 1.0f, 0.0f, 1.0f };
+
+    SceneCommandQueue queue;
+    CHECK(queue.RemoveGeometries(removed) == -1);
+    CHECK(queue.GetCommandCount() == 1);
+
+    queue.Clear();
+    CHECK(queue.SetPackage(kept) == 0);
+    CHECK(queue.SetPackage(removed) == 1);
+    queue.SetColor(removed, green);
+    queue.SetSelection(removed, true);
+    queue.SetRenderMode(removed, RENDER_MODE_PRIMITIVE);
+
+    // The package goes along with everything else recorded for the node,
+    // the index it had is not handed out again.
+    CHECK(queue.RemoveGeometries(removed) == 1);
+    const NodeCommand* pCommand = FindCommand(queue, removed);
+    CHECK(pCommand != nullptr);
+    CHECK(pCommand->removeGeometries);
+    CHECK(pCommand->packageIndex == -1);
+    CHECK(pCommand->setColor == false);
+    CHECK(pCommand->setRenderMode == false);
+    CHECK(pCommand->selection == -1);
+    CHECK(queue.GetPackageCount() == 2);
+    CHECK(FindCommand(queue, kept)->packageIndex == 0);
+    CHECK(FindCommand(queue, kept)->removeGeometries == false);
+
+    // Added again, the node is removed before its new package is loaded.
+    CHECK(queue.SetPackage(removed) == 2);
+    CHECK(pCommand->removeGeometries);
+    CHECK(pCommand->packageIndex == 2);
+    CHECK(queue.RemoveGeometries(removed) == 2);
+
+    // Clearing geometries drops what was recorded along with the packages.
+    queue.ClearGeometries();
+    CHECK(queue.GetClearGeometries());
+    CHECK(queue.GetCommandCount() == 0);
+    CHECK(queue.GetPackageCount() == 0);
+    CHECK(queue.SetPackage(kept) == 0);
+}
+
+TEST(SceneCommandQueueClearsSelection)
+{
+    const NodeKey first = MakeKey(5), second = MakeKey(6);
+
+    SceneCommandQueue queue;
+    queue.SetSelection(first, true);
+    queue.ClearSelection();
+    queue.SetSelection(second, true);
+
+    CHECK(queue.GetClearSelection());
+    CHECK(FindCommand(queue, first)->selection == -1);
+    CHECK(FindCommand(queue, second)->selection == 1);
+
+    queue.ClearGeometries();
+    CHECK(queue.GetClearSelection() == false);
+}
+
+TEST(SceneCommandQueueNestsUpdates)
+{
+    SceneCommandQueue queue;
+    CHECK(queue.IsUpdating() == false);
+
+    // Without a "BeginUpdate" to match, nothing changes.
+    CHECK(queue.EndUpdate() == false);
+    CHECK(queue.IsUpdating() == false);
+
+    queue.BeginUpdate();
+    queue.BeginUpdate();
+    CHECK(queue.EndUpdate());
+    CHECK(queue.IsUpdating());
+    CHECK(queue.EndUpdate());
+    CHECK(queue.IsUpdating() == false);
+    CHECK(queue.EndUpdate() == false);
+
+    // An unmatched "EndUpdate" does not cancel out a later "BeginUpdate".
+    queue.BeginUpdate();
+    CHECK(queue.IsUpdating());
+    CHECK(queue.EndUpdate());
+    CHECK(queue.IsUpdating() == false);
+}
@@ -0,0 +1,96 @@
+#ifndef _BLOODSTONE_TESTFRAMEWORK_H_
+#define _BLOODSTONE_TESTFRAMEWORK_H_
+
+#include <chrono>
+#include <string>
+
+namespace Dynamo { namespace Bloodstone { namespace Tests {
+
+    typedef void (*TestFunction)(void);
+
+    // Thrown (by value) out of a test by "CHECK", the test is reported as
+    // failed and the next one is run.
+    struct TestFailure
+    {
+        std::string message;
+    };
+
+    // Tests and benchmarks register themselves from static initializers
+    // (see "TEST" and "BENCHMARK"), and are run in the order of their names.
+    // Benchmarks write their timings out and fail only where they "CHECK"
+    // that what they measured is also correct.
+    //
+    class TestRegistry
+    {
+    public:
+        static bool Register(const char* pName, TestFunction function, bool benchmark);
+        static int Run(bool benchmarks, const char* pFilter);
+        static void Fail(const char* pFile, int line, const char* pCondition);
+    };
+
+    // Repeatable pseudo-random numbers (a 32-bit linear congruential
+    // generator), the same on every platform and with every runtime.
+    //
+    class TestRandom
+    {
+    public:
+        explicit TestRandom(unsigned int seed) : mState(seed)
+        {
+        }
+
+        unsigned int NextInt(void)
+        {
+            mState = mState * 1664525u + 1013904223u;
+            return mState;
+        }
+
+        // Uniformly distributed in [min, max].
+        float NextFloat(float min, float max)
+        {
+            const float unit = ((float) (NextInt() >> 8)) / ((float) 0xffffff);
+            return min + (max - min) * unit;
+        }
+
+    private:
+        unsigned int mState;
+    };
+
+    class Stopwatch
+    {
+    public:
+        Stopwatch(void) : mStart(std::chrono::high_resolution_clock::now())
+        {
+        }
+
+        double GetMilliseconds(void) const
+        {
+            const auto elapsed = std::chrono::high_resolution_clock::now() - mStart;
+            return std::chrono::duration<double, std::milli>(elapsed).count();
+        }
+
+    private:
+        std::chrono::high_resolution_clock::time_point mStart;
+    };
+} } }
+
+#define TEST(name)                                                          \
+    static void name(void);                                                 \
+    static const bool name##Registered =                                    \
+        Dynamo::Bloodstone::Tests::TestRegistry::Register(#name, name, false); \
+    static void name(void)
+
+#define BENCHMARK(name)                                                     \
+    static void name(void);                                                 \
+    static const bool name##Registered =                                    \
+        Dynamo::Bloodstone::Tests::TestRegistry::Register(#name, name, true); \
+    static void name(void)
+
+#define CHECK(condition)                                                    \
+    do {                                                                    \
+        if (!(condition)) {                                                 \
+            Dynamo::Bloodstone::Tests::TestRegistry::Fail(                  \
+                __FILE__, __LINE__, #condition);                            \
+        }                                                                   \
+    } while (false)
+
+#endif
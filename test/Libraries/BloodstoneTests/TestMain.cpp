@@ -0,0 +1,106 @@
+// TestMain.cpp : Runs the native Bloodstone tests, or with "/benchmark"
+// its benchmarks instead. Any other argument runs only those whose name
+// contains it. The exit code is the number of tests that failed.
+//
+
+#include "TestFramework.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace Dynamo::Bloodstone::Tests;
+
+struct RegisteredTest
+{
+    const char* pName;
+    TestFunction function;
+    bool benchmark;
+};
+
+static bool CompareNames(const RegisteredTest& first, const RegisteredTest& second)
+{
+    return std::strcmp(first.pName, second.pName) < 0;
+}
+
+// Registration happens from static initializers of other files, so the
+// list is created on first use rather than being a static itself.
+static std::vector<RegisteredTest>& GetRegisteredTests(void)
+{
+    static std::vector<RegisteredTest>* pTests = nullptr;
+    if (pTests == nullptr)
+        pTests = new std::vector<RegisteredTest>();
+
+    return *pTests;
+}
+
+// ================================================================================
+// TestRegistry
+// ================================================================================
+
+bool TestRegistry::Register(const char* pName, TestFunction function, bool benchmark)
+{
+    RegisteredTest test = { pName, function, benchmark };
+    GetRegisteredTests().push_back(test);
+    return true;
+}
+
+int TestRegistry::Run(bool benchmarks, const char* pFilter)
+{
+    auto tests = GetRegisteredTests();
+    std::sort(tests.begin(), tests.end(), CompareNames);
+
+    int run = 0, failed = 0;
+    for (auto test = tests.begin(); test != tests.end(); ++test)
+    {
+        if (test->benchmark != benchmarks)
+            continue;
+        if (pFilter != nullptr && std::strstr(test->pName, pFilter) == nullptr)
+            continue;
+
+        std::printf("[ RUN    ] %s\n", test->pName);
+        std::fflush(stdout);
+        run++;
+
+        try
+        {
+            test->function();
+            std::printf("[     OK ] %s\n", test->pName);
+        }
+        catch (const TestFailure& failure)
+        {
+            std::printf("%s\n[ FAILED ] %s\n", failure.message.c_str(), test->pName);
+            failed++;
+        }
+    }
+
+    std::printf("%d run, %d failed\n", run, failed);
+    return failed;
+}
+
+void TestRegistry::Fail(const char* pFile, int line, const char* pCondition)
+{
+    char lineText[16] = { 0 };
+    std::sprintf(lineText, "%d", line);
+
+    TestFailure failure;
+    failure.message = std::string(pFile) + "(" + lineText + "): CHECK(" + pCondition + ") failed";
+    throw failure;
+}
+
+int main(int argc, char* argv[])
+{
+    bool benchmarks = false;
+    const char* pFilter = nullptr;
+
+    for (int index = 1; index < argc; ++index)
+    {
+        if (std::strcmp(argv[index], "/benchmark") == 0)
+            benchmarks = true;
+        else
+            pFilter = argv[index];
+    }
+
+    return TestRegistry::Run(benchmarks, pFilter);
+}